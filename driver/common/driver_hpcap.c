@@ -7,6 +7,7 @@
 #include "driver_hpcap.h"
 #include "hpcap_hugepages.h"
 #include "hpcap_rx.h"
+#include "hpcap_copy.h"
 #include "hpcap_dups.h"
 #include "hpcap_vma.h"
 #include "hpcap_sysfs.h"
@@ -17,6 +18,10 @@ HW_ADAPTER * adapters[HPCAP_MAX_NIC];
 
 int hpcap_buf_clear(struct hpcap_buf *bufp)
 {
+#if defined(HPCAP_BURST_DETECTOR) || defined(HPCAP_MEASURE_LATENCY)
+	size_t i;
+#endif
+
 	if ((atomic_read(&bufp->created) == 1) || (atomic_read(&bufp->mapped) == 1) || (atomic_read(&bufp->opened) != 0))
 		printk("[HPCAP] Error: trying to unregister cdev in use (if%d,q%d)  (created=%d, mapped=%d, opened=%d)\n", bufp->adapter, bufp->queue, atomic_read(&bufp->created), atomic_read(&bufp->mapped), atomic_read(&bufp->opened));
 
@@ -28,6 +33,25 @@ int hpcap_buf_clear(struct hpcap_buf *bufp)
 #endif
 	bufp->bufferCopia = NULL;
 
+#ifdef HPCAP_BURST_DETECTOR
+
+	for (i = 0; i < MAX_CONSUMERS_PER_Q; i++)
+		hpcap_burst_free(&bufp->consumers_thinfo[i].burst);
+
+#endif
+
+#ifdef HPCAP_MEASURE_LATENCY
+
+	for (i = 0; i < MAX_CONSUMERS_PER_Q; i++)
+		hpcap_latency_free(&bufp->consumers_thinfo[i].lm.probe);
+
+	for (i = 0; i < MAX_LISTENERS; i++)
+		hpcap_latency_free(&bufp->lstnr.listeners[i].delivery);
+
+	hpcap_latency_free(&bufp->lstnr.global.delivery);
+
+#endif
+
 #ifdef REMOVE_DUPS
 
 	if (bufp->dupTable) {
@@ -60,11 +84,16 @@ int hpcap_buf_init(struct hpcap_buf *bufp, HW_ADAPTER *adapter, int queue, u64 s
 	atomic_set(&bufp->opened, 0);
 	atomic_set(&bufp->last_handle, 0);
 	atomic_set(&bufp->enabled_filter, 0);
+	atomic_set(&bufp->overwrite, 0);
 	bufp->max_opened = MAX_LISTENERS + 1;
 	sprintf(bufp->name, "hpcapPoll%dq%d", adapter->bd_number, queue);
 	bufp->huge_pages = NULL;
 	bufp->huge_pages_num = 0;
 
+#ifdef HPCAP_BURST_DETECTOR
+	hpcap_burst_control_init(&bufp->burst_ctl);
+#endif
+
 #ifdef DO_BUF_ALLOC
 	bufp->bufferCopia = kmalloc_node(sizeof(char) * HPCAP_BUF_SIZE, GFP_KERNEL, adapter->numa_node);
 	bufp->bufSize = HPCAP_BUF_SIZE;
@@ -96,6 +125,10 @@ int hpcap_buf_init(struct hpcap_buf *bufp, HW_ADAPTER *adapter, int queue, u64 s
 	hpcap_allocate_duptable(adapter, bufp);
 #endif
 
+#ifdef HPCAP_MEASURE_LATENCY
+	hpcap_latency_init_buffer(bufp, adapter->numa_node);
+#endif
+
 	return 0;
 }
 
@@ -115,6 +148,8 @@ int hpcap_register_adapters()
 
 	BPRINTK(INFO, "HPCAP Adapters: %u out of %d total IXGBE.\n", hpcap_adapters, adapters_found);
 
+	hpcap_copy_init();
+
 	for (j = 0, i = 0; i < adapters_found; i++) {
 		HW_ADAPTER* adapter = adapters[i];
 
@@ -147,6 +182,47 @@ int hpcap_register_adapters()
 	return 0;
 }
 
+#if defined(HPCAP_IXGBE) || defined(HPCAP_I40E)
+void hpcap_set_mtu(HW_ADAPTER *adapter, struct net_device *netdev)
+{
+	int mtu = adapter->hpcap_mtu;
+
+	if (!is_hpcap_adapter(adapter) || mtu == 0)
+		return;
+
+#ifdef HAVE_NETDEVICE_MIN_MAX_MTU
+
+	if (mtu > netdev->max_mtu) {
+		BPRINTK(WARNING, "Adapter %u: MTU %d over the maximum of the NIC, using %u\n",
+				adapter->bd_number, mtu, netdev->max_mtu);
+		mtu = netdev->max_mtu;
+	}
+
+#endif
+
+	netdev->mtu = mtu;
+
+	if (mtu > HPCAP_MAX_DESCR_MTU)
+		BPRINTK(INFO, "Adapter %u: MTU %d, frames over %d bytes span several descriptors\n",
+				adapter->bd_number, mtu, MAX_DESCR_SIZE);
+}
+
+int hpcap_check_mtu(HW_ADAPTER *adapter, int new_mtu)
+{
+#ifndef HPCAP_CONSUMERS_VIA_RINGS
+
+	if (is_hpcap_adapter(adapter) && new_mtu > HPCAP_MAX_DESCR_MTU && adapter->consumers > 1) {
+		BPRINTK(ERR, "Adapter %u: MTU %d needs one consumer per queue (there are %zu)\n",
+				adapter->bd_number, new_mtu, adapter->consumers);
+		return -EINVAL;
+	}
+
+#endif
+
+	return 0;
+}
+#endif
+
 void hpcap_get_buffer_info(struct hpcap_buf* bufp, struct hpcap_buffer_info* info)
 {
 	hpcap_huge_info(bufp, info);
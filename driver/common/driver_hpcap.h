@@ -63,6 +63,25 @@ int hpcap_register_adapters(void);
  */
 int hpcap_precheck_options(void);
 
+#if defined(HPCAP_IXGBE) || defined(HPCAP_I40E)
+/**
+ * Set the MTU of the MTU parameter on the netdev of the adapter. Called in the
+ * probe, before the netdev is registered and the RX rings are configured.
+ * @param adapter Adapter.
+ * @param netdev  Its netdev.
+ */
+void hpcap_set_mtu(HW_ADAPTER *adapter, struct net_device *netdev);
+
+/**
+ * Check that the RX path of HPCAP can take a new MTU: frames longer than one
+ * descriptor buffer need one consumer per queue.
+ * @param  adapter Adapter.
+ * @param  new_mtu MTU requested.
+ * @return         0 if OK, -EINVAL if not.
+ */
+int hpcap_check_mtu(HW_ADAPTER *adapter, int new_mtu);
+#endif
+
 /**
  * Fill the bufinfo structure with all the data of the buffer.
  * @param  bufp    HPCAP buffer.
@@ -71,6 +90,23 @@ int hpcap_precheck_options(void);
  */
 void hpcap_get_buffer_info(struct hpcap_buf* bufp, struct hpcap_buffer_info* bufinfo);
 
+/**
+ * Update the client loss/discard statistics of the adapter (see ethtool) from
+ * the counters of the consumers of its queues.
+ * @param adapter Adapter.
+ */
+void hpcap_stats_update_adapter(HW_ADAPTER *adapter);
+
+#ifdef HPCAP_LOSS_RECORDS
+/**
+ * Report the frames the NIC dropped in the queue of a buffer since the
+ * previous call, so they go to the loss records of the stream.
+ * @param bufp  HPCAP buffer of the queue.
+ * @param drops Frames dropped since the previous call.
+ */
+void hpcap_mark_nic_drops(struct hpcap_buf *bufp, u64 drops);
+#endif
+
 /** @} */
 
 #endif
@@ -0,0 +1,282 @@
+/**
+ * @brief Microburst detector of the HPCAP consumers.
+ *
+ * @see hpcap_burst.h for the description of the detector.
+ *
+ * @addtogroup HPCAP
+ * @{
+ */
+
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+
+#include "hpcap_types.h"
+#include "hpcap_burst.h"
+#include "hpcap_debug.h"
+
+#define HPCAP_BURST_MASK (HPCAP_BURST_BINS - 1)
+
+/**
+ * Bytes per ns received at 80% of the line rate, the default burst threshold.
+ */
+#ifdef HPCAP_40G
+#define HPCAP_BURST_DEFAULT_RATE 4
+#else
+#define HPCAP_BURST_DEFAULT_RATE 1
+#endif
+
+void hpcap_burst_control_init(struct hpcap_burst_control *ctl)
+{
+	atomic_set(&ctl->gen, 0);
+	ctl->bin_ns = 0;
+	ctl->threshold = 0;
+}
+
+/**
+ * Set a new configuration for the consumers of the buffer.
+ * @return 0 if OK, -EINVAL if the bin width is out of range.
+ */
+int hpcap_burst_control_set(struct hpcap_burst_control *ctl, const struct hpcap_burst_conf *conf)
+{
+	int gen;
+
+	if (conf->bin_ns != 0 && (conf->bin_ns < HPCAP_BURST_MIN_NS || conf->bin_ns > HPCAP_BURST_MAX_NS))
+		return -EINVAL;
+
+	// Make the generation odd, so the consumers do not take a half-written configuration
+	do {
+		gen = atomic_read(&ctl->gen) & ~1;
+	} while (atomic_cmpxchg(&ctl->gen, gen, gen + 1) != gen);
+
+	smp_wmb();
+	ctl->bin_ns = conf->bin_ns;
+	ctl->threshold = conf->threshold;
+	smp_wmb();
+	atomic_set(&ctl->gen, gen + 2);
+
+	return 0;
+}
+
+int hpcap_burst_alloc(struct hpcap_burst *b, int numa_node)
+{
+	if (b->ring == NULL)
+		b->ring = kzalloc_node(sizeof(u32) * HPCAP_BURST_BINS, GFP_KERNEL, numa_node);
+
+	return b->ring != NULL ? 0 : -ENOMEM;
+}
+
+void hpcap_burst_free(struct hpcap_burst *b)
+{
+	if (b->ring)
+		kfree(b->ring);
+
+	b->ring = NULL;
+	b->bin_end = U64_MAX;
+}
+
+static inline void hpcap_burst_write_begin(struct hpcap_burst *b)
+{
+	atomic_set(&b->seq, atomic_read(&b->seq) + 1);
+	smp_wmb();
+}
+
+static inline void hpcap_burst_write_end(struct hpcap_burst *b)
+{
+	smp_wmb();
+	atomic_set(&b->seq, atomic_read(&b->seq) + 1);
+}
+
+/**
+ * Restart the detector with the current configuration of the buffer. If the
+ * configuration is being changed, the defaults are used until the next call
+ * of hpcap_burst_check.
+ */
+void hpcap_burst_reset(struct hpcap_burst *b, struct hpcap_burst_control *ctl, size_t consumers)
+{
+	int gen = atomic_read(&ctl->gen);
+	u32 bin_ns, threshold;
+
+	smp_rmb();
+	bin_ns = ctl->bin_ns;
+	threshold = ctl->threshold;
+	smp_rmb();
+
+	if ((gen & 1) || atomic_read(&ctl->gen) != gen)
+		bin_ns = threshold = 0;
+
+	b->gen = gen;
+
+	if (bin_ns == 0)
+		bin_ns = HPCAP_BURST_DEFAULT_NS;
+
+	// Each consumer only sees its share of the frames
+	if (threshold == 0)
+		threshold = bin_ns * HPCAP_BURST_DEFAULT_RATE / max_t(size_t, consumers, 1);
+
+	hpcap_burst_write_begin(b);
+
+	memset(&b->stats, 0, sizeof(struct hpcap_burst_stats));
+	b->stats.bin_ns = bin_ns;
+	b->stats.threshold = threshold;
+
+	b->bin_ns = bin_ns;
+	b->threshold = threshold;
+	b->bin_end = b->ring ? 0 : U64_MAX;
+	b->cur_bytes = 0;
+	b->head = 0;
+	b->run_start = 0;
+	b->run_len = 0;
+
+	hpcap_burst_write_end(b);
+}
+
+/**
+ * Store the current bin in the ring and update the statistics with it.
+ */
+static void hpcap_burst_push(struct hpcap_burst *b, u64 bytes)
+{
+	struct hpcap_burst_stats *s = &b->stats;
+	u64 bin = b->head;
+
+	// Readers only trust the bins before first_bin + bins, so the slot must be written first
+	b->ring[bin & HPCAP_BURST_MASK] = bytes;
+
+	hpcap_burst_write_begin(b);
+
+	s->bins++;
+	s->bytes += bytes;
+
+	if (bytes > s->peak_bytes) {
+		s->peak_bytes = bytes;
+		s->peak_bin = bin;
+	}
+
+	if (bytes > b->threshold) {
+		if (b->run_len == 0) {
+			b->run_start = bin;
+			s->bursts++;
+		}
+
+		b->run_len++;
+		s->burst_bins++;
+		s->last_burst = b->run_start;
+		s->last_burst_bins = b->run_len;
+
+		if (b->run_len > s->longest_burst)
+			s->longest_burst = b->run_len;
+	} else {
+		b->run_len = 0;
+	}
+
+	hpcap_burst_write_end(b);
+
+	b->head = bin + 1;
+}
+
+/**
+ * Close the current bin, and the empty ones until the bin of ns. Called by
+ * hpcap_burst_account when a frame falls after the end of the current bin.
+ */
+void hpcap_burst_close(struct hpcap_burst *b, u64 ns)
+{
+	u64 bin = div64_u64(ns, b->bin_ns);
+	u64 empty, i;
+
+	if (unlikely(b->bin_end == 0)) {
+		// First frame: start at its bin, so the bins of every consumer are aligned
+		hpcap_burst_write_begin(b);
+		b->stats.first_bin = bin;
+		hpcap_burst_write_end(b);
+
+		b->head = bin;
+		b->bin_end = (bin + 1) * b->bin_ns;
+		return;
+	}
+
+	hpcap_burst_push(b, b->cur_bytes);
+	b->cur_bytes = 0;
+
+	/**
+	 * Bins without frames. Once the whole ring is zeroed the remaining ones
+	 * only move the head: the slots they would write are already empty.
+	 */
+	empty = bin - b->head;
+
+	for (i = 0; i < min_t(u64, empty, HPCAP_BURST_BINS); i++)
+		hpcap_burst_push(b, 0);
+
+	if (empty > HPCAP_BURST_BINS) {
+		hpcap_burst_write_begin(b);
+		b->stats.bins += empty - HPCAP_BURST_BINS;
+		hpcap_burst_write_end(b);
+
+		b->head = bin;
+	}
+
+	b->bin_end = (bin + 1) * b->bin_ns;
+}
+
+/**
+ * Consistent copy of the statistics.
+ */
+void hpcap_burst_get_stats(struct hpcap_burst *b, struct hpcap_burst_stats *stats)
+{
+	int seq;
+
+	do {
+		while ((seq = atomic_read(&b->seq)) & 1)
+			cpu_relax();
+
+		smp_rmb();
+		memcpy(stats, &b->stats, sizeof(struct hpcap_burst_stats));
+		smp_rmb();
+	} while (atomic_read(&b->seq) != seq);
+}
+
+/**
+ * Copy the bins still in the ring from *from on. Bins overwritten by the
+ * consumer while copying are dropped from the start of the copy.
+ * @param from  First bin wanted. Updated with the first bin copied.
+ * @return Bins copied to dst.
+ */
+size_t hpcap_burst_copy_bins(struct hpcap_burst *b, u64 *from, u32 *dst, size_t count)
+{
+	struct hpcap_burst_stats before, after;
+	u64 head, first, oldest;
+	size_t n, drop, i;
+
+	if (b->ring == NULL)
+		return 0;
+
+	do {
+		hpcap_burst_get_stats(b, &before);
+		head = before.first_bin + before.bins;
+
+		// The slot of the bin head can be being written
+		oldest = head >= HPCAP_BURST_BINS ? head - HPCAP_BURST_BINS + 1 : 0;
+		first = max3(*from, before.first_bin, oldest);
+		n = first < head ? min_t(u64, count, head - first) : 0;
+
+		for (i = 0; i < n; i++)
+			dst[i] = READ_ONCE(b->ring[(first + i) & HPCAP_BURST_MASK]);
+
+		smp_rmb();
+		hpcap_burst_get_stats(b, &after);
+
+		// Restarted while copying
+	} while (after.first_bin != before.first_bin || after.bin_ns != before.bin_ns || after.bins < before.bins);
+
+	head = after.first_bin + after.bins;
+	oldest = head >= HPCAP_BURST_BINS ? head - HPCAP_BURST_BINS + 1 : 0;
+	drop = oldest > first ? min_t(u64, oldest - first, n) : 0;
+
+	if (drop > 0)
+		memmove(dst, dst + drop, (n - drop) * sizeof(u32));
+
+	*from = first + drop;
+
+	return n - drop;
+}
+
+/** @} */
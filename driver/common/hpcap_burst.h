@@ -0,0 +1,91 @@
+/**
+ * @brief Microburst detector of the HPCAP consumers.
+ *
+ * Each consumer accumulates the bytes of the frames it receives in fixed bins
+ * of a few microseconds, taking the timestamps that hpcap_rx already has. The
+ * per-frame cost is a comparison against the end of the current bin and an
+ * add; everything else is done when a bin closes. Closed bins are stored in a
+ * ring of HPCAP_BURST_BINS entries, and the consumer keeps the peak rate and
+ * the count and length of the runs of bins above the burst threshold.
+ *
+ * Only the consumer writes its detector. Readers (the ioctls) take the
+ * statistics under a sequence counter and validate the bins they copy against
+ * the head of the ring, so the RX path never waits for them.
+ *
+ * @addtogroup HPCAP
+ * @{
+ */
+
+#ifndef HPCAP_BURST_H
+#define HPCAP_BURST_H
+
+#include <linux/types.h>
+#include <linux/time.h>
+
+#include "hpcap.h"
+
+/**
+ * Burst configuration shared by the consumers of a buffer. Written by the
+ * ioctl and checked by every consumer once per call of hpcap_rx.
+ */
+struct hpcap_burst_control {
+	atomic_t gen;		/**< Incremented on every change; odd while the fields are being written */
+	u32 bin_ns;
+	u32 threshold;
+};
+
+/**
+ * Burst detector of a consumer.
+ */
+struct hpcap_burst {
+	u64 bin_end;	/**< End of the current bin in ns. 0 until the first frame */
+	u64 cur_bytes;	/**< Bytes of the current bin */
+	u64 bin_ns;		/**< Width of the bins */
+	u64 threshold;	/**< Bytes per bin that mark a burst */
+	u64 head;		/**< Current bin; every bin before it is in the ring or already overwritten */
+	u64 run_start;	/**< First bin of the burst in progress */
+	u64 run_len;	/**< Length of the burst in progress, 0 if none */
+	int gen;		/**< Generation of the configuration in use */
+	u32 *ring;		/**< HPCAP_BURST_BINS bins, indexed by bin & (HPCAP_BURST_BINS - 1) */
+
+	atomic_t seq;	/**< Odd while stats is being updated */
+	struct hpcap_burst_stats stats;
+};
+
+void hpcap_burst_control_init(struct hpcap_burst_control *ctl);
+int hpcap_burst_control_set(struct hpcap_burst_control *ctl, const struct hpcap_burst_conf *conf);
+
+int hpcap_burst_alloc(struct hpcap_burst *b, int numa_node);
+void hpcap_burst_free(struct hpcap_burst *b);
+void hpcap_burst_reset(struct hpcap_burst *b, struct hpcap_burst_control *ctl, size_t consumers);
+
+void hpcap_burst_close(struct hpcap_burst *b, u64 ns);
+void hpcap_burst_get_stats(struct hpcap_burst *b, struct hpcap_burst_stats *stats);
+size_t hpcap_burst_copy_bins(struct hpcap_burst *b, u64 *from, u32 *dst, size_t count);
+
+/**
+ * Reload the configuration if it changed since the last call. Called by the
+ * consumer before receiving, never concurrently with hpcap_burst_account.
+ */
+static inline void hpcap_burst_check(struct hpcap_burst *b, struct hpcap_burst_control *ctl, size_t consumers)
+{
+	if (unlikely(b->gen != atomic_read(&ctl->gen)))
+		hpcap_burst_reset(b, ctl, consumers);
+}
+
+/**
+ * Account a frame received at the given time.
+ */
+static inline void hpcap_burst_account(struct hpcap_burst *b, struct timespec *tv, size_t len)
+{
+	u64 ns = tv->tv_sec * 1000000000ull + tv->tv_nsec;
+
+	if (unlikely(ns >= b->bin_end))
+		hpcap_burst_close(b, ns);
+
+	b->cur_bytes += len;
+}
+
+/** @} */
+
+#endif
@@ -7,12 +7,23 @@
 #include "hpcap_vma.h"
 #include "hpcap_debug.h"
 #include "hpcap_sysfs.h"
+#include "hpcap_stats.h"
+#include "hpcap_trace.h"
+#include "hpcap_rx.h"
 
 #include <linux/types.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/kref.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/splice.h>
 
 static struct file_operations hpcap_fops = {
 	.open = hpcap_open,
 	.read = hpcap_read,
+	.splice_read = hpcap_splice_read,
 	.release = hpcap_release,
 	.mmap = hpcap_mmap,
 	.unlocked_ioctl = hpcap_ioctl,
@@ -231,7 +242,9 @@ ssize_t hpcap_read(struct file *filp, char __user *dstBuf, size_t count, loff_t
 		return -1;
 	}
 
-	avail = hpcap_wait_listener(list, count);
+	trace_hpcap_listener_wait(bufp, atomic_read(&list->id), count, used_bytes(list));
+	avail = hpcap_wait_listener(&bufp->lstnr, list, count);
+	trace_hpcap_listener_wake(bufp, atomic_read(&list->id), count, avail < 0 ? 0 : avail);
 	to_copy = minimo(count, avail);
 	offset = list->bufferRdOffset;
 
@@ -259,6 +272,324 @@ out:
 	return retval;
 }
 
+/**
+ * Data of a listener handed to a pipe by a call to hpcap_splice_read. Every
+ * pipe buffer holds a reference, and the data is acknowledged once the last
+ * one is released. Only the pipe references count, so this is only safe when
+ * the pipe goes to a file (see hpcap_splice_read).
+ */
+struct hpcap_splice_ref {
+	struct kref ref;
+	struct hpcap_buf* bufp;
+	int handle_id;
+	u64 seq;			/**< Sequence number of the call, see hpcap_ack_spliced */
+	size_t bytes;		/**< Bytes that got in the pipe */
+};
+
+static void hpcap_splice_ref_free(struct kref* ref)
+{
+	struct hpcap_splice_ref* sref = container_of(ref, struct hpcap_splice_ref, ref);
+
+	hpcap_ack_spliced(&sref->bufp->lstnr, sref->handle_id, sref->seq, sref->bytes);
+	kfree(sref);
+	module_put(THIS_MODULE);
+}
+
+static void hpcap_pipe_buf_release(struct pipe_inode_info* pipe, struct pipe_buffer* buf)
+{
+	put_page(buf->page);
+	kref_put(&((struct hpcap_splice_ref*) buf->private)->ref, hpcap_splice_ref_free);
+}
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5,1,0))
+static bool hpcap_pipe_buf_get(struct pipe_inode_info* pipe, struct pipe_buffer* buf)
+{
+	if (!try_get_page(buf->page))
+		return false;
+
+	kref_get(&((struct hpcap_splice_ref*) buf->private)->ref);
+	return true;
+}
+#else
+static void hpcap_pipe_buf_get(struct pipe_inode_info* pipe, struct pipe_buffer* buf)
+{
+	get_page(buf->page);
+	kref_get(&((struct hpcap_splice_ref*) buf->private)->ref);
+}
+#endif
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(5,8,0))
+static int hpcap_pipe_buf_steal(struct pipe_inode_info* pipe, struct pipe_buffer* buf)
+{
+	return 1; // The pages belong to the HPCAP buffer
+}
+#endif
+
+static const struct pipe_buf_operations hpcap_pipe_buf_ops = {
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(5,1,0))
+	.can_merge = 0,
+#endif
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(5,8,0))
+	.confirm = generic_pipe_buf_confirm,
+	.steal = hpcap_pipe_buf_steal,
+#endif
+	.release = hpcap_pipe_buf_release,
+	.get = hpcap_pipe_buf_get,
+};
+
+/* Pages that did not fit in the pipe */
+static void hpcap_splice_spd_release(struct splice_pipe_desc* spd, unsigned int i)
+{
+	struct hpcap_splice_ref* sref = (struct hpcap_splice_ref*) spd->partial[i].private;
+
+	sref->bytes -= spd->partial[i].len;
+	put_page(spd->pages[i]);
+	kref_put(&sref->ref, hpcap_splice_ref_free);
+}
+
+ssize_t hpcap_splice_read(struct file* filp, loff_t* ppos, struct pipe_inode_info* pipe, size_t len, unsigned int flags)
+{
+	struct hpcap_buf* bufp = hpcap_buffer_of(filp);
+	struct hpcap_listener* list;
+	struct hpcap_splice_ref* sref;
+	struct page* pages[PIPE_DEF_BUFFERS];
+	struct partial_page partial[PIPE_DEF_BUFFERS];
+	struct splice_pipe_desc spd = {
+		.pages = pages,
+		.partial = partial,
+		.nr_pages = 0,
+		.nr_pages_max = PIPE_DEF_BUFFERS,
+		.ops = &hpcap_pipe_buf_ops,
+		.spd_release = hpcap_splice_spd_release,
+	};
+	size_t offset, chunk, total;
+	ssize_t ret;
+	int avail;
+
+	if (!bufp) {
+		printk("HPCAP: trying to splice from undefined chardev\n");
+		return -EINVAL;
+	}
+
+	list = hpcap_get_listener(&bufp->lstnr, hpcap_handleid_of(filp));
+
+	// The data must stay in the buffer until the pipe releases it, so groups and lossy listeners can't splice
+	if (!list || list->group != HPCAP_NO_GROUP || list->max_lag > 0)
+		return -EINVAL;
+
+	if (hpcap_poll_listener(&bufp->lstnr, list, 0) <= list->spliced) {
+		if ((flags & SPLICE_F_NONBLOCK) || (filp->f_flags & O_NONBLOCK))
+			return -EAGAIN;
+
+		trace_hpcap_listener_wait(bufp, atomic_read(&list->id), len, used_bytes(list));
+		avail = hpcap_wait_listener(&bufp->lstnr, list, list->spliced + 1);
+		trace_hpcap_listener_wake(bufp, atomic_read(&list->id), len, avail < 0 ? 0 : avail);
+
+		if (avail < 0)
+			return 0;
+	}
+
+	sref = kmalloc(sizeof(struct hpcap_splice_ref), GFP_KERNEL);
+
+	if (!sref)
+		return -ENOMEM;
+
+	kref_init(&sref->ref);
+	sref->bufp = bufp;
+	sref->handle_id = hpcap_handleid_of(filp);
+	__module_get(THIS_MODULE);
+
+	spin_lock(&bufp->lstnr.lock);
+
+	if (list->splice_tail - list->splice_head >= HPCAP_SPLICE_CALLS) {
+		spin_unlock(&bufp->lstnr.lock);
+		kfree(sref);
+		module_put(THIS_MODULE);
+		return -EBUSY;
+	}
+
+	offset = (list->bufferRdOffset + list->spliced) % bufp->bufSize;
+	len = minimo(len, used_bytes(list) - list->spliced);
+
+	for (total = 0; total < len && spd.nr_pages < PIPE_DEF_BUFFERS; total += chunk) {
+		chunk = minimo(len - total, PAGE_SIZE - offset_in_page(bufp->bufferCopia + offset));
+		chunk = minimo(chunk, bufp->bufSize - offset);
+
+		pages[spd.nr_pages] = hpcap_buffer_page(bufp, offset);
+		partial[spd.nr_pages].offset = offset_in_page(bufp->bufferCopia + offset);
+		partial[spd.nr_pages].len = chunk;
+		partial[spd.nr_pages].private = (unsigned long) sref;
+		get_page(pages[spd.nr_pages]);
+		kref_get(&sref->ref);
+		spd.nr_pages++;
+
+		offset = (offset + chunk) % bufp->bufSize;
+	}
+
+	list->spliced += total;
+	sref->seq = list->splice_tail++;
+	sref->bytes = total;
+	list->splice_bytes[sref->seq % HPCAP_SPLICE_CALLS] = total;
+
+	spin_unlock(&bufp->lstnr.lock);
+
+	ret = splice_to_pipe(pipe, &spd);
+
+	if (ret < (ssize_t) total) {
+		spin_lock(&bufp->lstnr.lock);
+		list->spliced -= total - (ret > 0 ? ret : 0);
+		spin_unlock(&bufp->lstnr.lock);
+	}
+
+	kref_put(&sref->ref, hpcap_splice_ref_free);
+
+	return ret;
+}
+
+static long hpcap_ioctl_stats(struct hpcap_buf *bufp, void __user *arg)
+{
+	struct hpcap_stats_info *info;
+	long ret = 0;
+
+	// Too big for the stack
+	info = kzalloc(sizeof(struct hpcap_stats_info), GFP_KERNEL);
+
+	if (info == NULL)
+		return -ENOMEM;
+
+	if (copy_from_user(info, arg, sizeof(info->enable)) > 0) {
+		HPRINTK(WARNING, "Bad argument pointer %p\n", arg);
+		kfree(info);
+		return -EFAULT;
+	}
+
+	hpcap_stats_get_info(bufp, info);
+	bufp_dbg(DBG_IOCTL, "stats, %u consumers, enabled = %u\n", info->consumers, info->enabled);
+
+	if (copy_to_user(arg, info, sizeof(struct hpcap_stats_info)) > 0) {
+		HPRINTK(WARNING, "Could not copy back %p\n", arg);
+		ret = -EFAULT;
+	}
+
+	kfree(info);
+
+	return ret;
+}
+
+#ifdef HPCAP_MEASURE_LATENCY
+
+static long hpcap_ioctl_latency(struct hpcap_buf *bufp, void __user *arg)
+{
+	struct hpcap_latency_info *info;
+	long ret = 0;
+
+	// Too big for the stack
+	info = kzalloc(sizeof(struct hpcap_latency_info), GFP_KERNEL);
+
+	if (info == NULL)
+		return -ENOMEM;
+
+	if (copy_from_user(info, arg, sizeof(info->reset)) > 0) {
+		HPRINTK(WARNING, "Bad argument pointer %p\n", arg);
+		kfree(info);
+		return -EFAULT;
+	}
+
+	hpcap_latency_get_info(bufp, info);
+	bufp_dbg(DBG_IOCTL, "latency, %llu probes, %llu deliveries, reset = %u\n", info->probe.count, info->delivery.count, info->reset);
+
+	if (copy_to_user(arg, info, sizeof(struct hpcap_latency_info)) > 0) {
+		HPRINTK(WARNING, "Could not copy back %p\n", arg);
+		ret = -EFAULT;
+	}
+
+	kfree(info);
+
+	return ret;
+}
+
+#endif
+
+#ifdef HPCAP_BURST_DETECTOR
+
+static long hpcap_ioctl_burst_conf(struct hpcap_buf *bufp, void __user *arg)
+{
+	struct hpcap_burst_conf conf;
+
+	if (copy_from_user(&conf, arg, sizeof(struct hpcap_burst_conf)) > 0) {
+		HPRINTK(WARNING, "Bad argument pointer %p\n", arg);
+		return -EFAULT;
+	}
+
+	bufp_dbg(DBG_IOCTL, "burst_conf, bins of %u ns, threshold %u bytes\n", conf.bin_ns, conf.threshold);
+
+	return hpcap_burst_control_set(&bufp->burst_ctl, &conf);
+}
+
+static long hpcap_ioctl_burst_stats(struct hpcap_buf *bufp, void __user *arg)
+{
+	struct hpcap_burst_info *info;
+	size_t i;
+	long ret = 0;
+
+	// Too big for the stack
+	info = kzalloc(sizeof(struct hpcap_burst_info), GFP_KERNEL);
+
+	if (info == NULL)
+		return -ENOMEM;
+
+	info->consumers = bufp->consumers;
+
+	for (i = 0; i < bufp->consumers; i++)
+		hpcap_burst_get_stats(&bufp->consumers_thinfo[i].burst, &info->stats[i]);
+
+	if (copy_to_user(arg, info, sizeof(struct hpcap_burst_info)) > 0) {
+		HPRINTK(WARNING, "Could not copy back %p\n", arg);
+		ret = -EFAULT;
+	}
+
+	kfree(info);
+
+	return ret;
+}
+
+static long hpcap_ioctl_burst_bins(struct hpcap_buf *bufp, void __user *arg)
+{
+	struct hpcap_burst_bins_op op;
+	u32 *bins;
+	long ret = 0;
+
+	if (copy_from_user(&op, arg, sizeof(struct hpcap_burst_bins_op)) > 0) {
+		HPRINTK(WARNING, "Bad argument pointer %p\n", arg);
+		return -EFAULT;
+	}
+
+	if (op.consumer >= bufp->consumers)
+		return -EINVAL;
+
+	op.count = min_t(u32, op.count, HPCAP_BURST_BINS);
+	bins = vmalloc(sizeof(u32) * HPCAP_BURST_BINS);
+
+	if (bins == NULL)
+		return -ENOMEM;
+
+	// The bins are copied first to the kernel, so the ones overwritten meanwhile can be dropped
+	op.count = hpcap_burst_copy_bins(&bufp->consumers_thinfo[op.consumer].burst, &op.from, bins, op.count);
+
+	bufp_dbg(DBG_IOCTL, "burst_bins, consumer %u: %u bins from %llu\n", op.consumer, op.count, op.from);
+
+	if (copy_to_user(op.bins, bins, sizeof(u32) * op.count) > 0 || copy_to_user(arg, &op, sizeof(struct hpcap_burst_bins_op)) > 0) {
+		HPRINTK(WARNING, "Could not copy back %p\n", arg);
+		ret = -EFAULT;
+	}
+
+	vfree(bins);
+
+	return ret;
+}
+
+#endif
+
 long hpcap_ioctl(struct file * filp, unsigned int cmd, unsigned long arg2)
 {
 	void* arg = (void*) arg2;
@@ -268,6 +599,7 @@ long hpcap_ioctl(struct file * filp, unsigned int cmd, unsigned long arg2)
 	struct hpcap_listener_op lstop;
 	struct hpcap_buffer_info bufinfo;
 	struct hpcap_ioc_status_info status_info;
+	struct hpcap_snapshot snap;
 	int arg_as_int = (int)(uintptr_t) arg;   // Just to avoid compiler warnings
 
 	if (!bufp) {
@@ -298,11 +630,25 @@ long hpcap_ioctl(struct file * filp, unsigned int cmd, unsigned long arg2)
 
 			if (lstop.ack_bytes > 0) {
 				atomic_set(&bufp->lstnr.already_popped, 1);
-				hpcap_pop_listener(list, lstop.ack_bytes);
+				hpcap_ack_listener(&bufp->lstnr, list, lstop.ack_bytes);
 			}
 
-			if (likely(lstop.expect_bytes > 0))
-				hpcap_wait_listener_user(list, &lstop);
+			if (likely(lstop.expect_bytes > 0)) {
+				trace_hpcap_listener_wait(bufp, atomic_read(&list->id), lstop.expect_bytes, used_bytes(list));
+				hpcap_wait_listener_user(&bufp->lstnr, list, &lstop);
+				trace_hpcap_listener_wake(bufp, atomic_read(&list->id), lstop.expect_bytes, lstop.available_bytes);
+			} else
+				hpcap_update_listener_offsets(bufp); // Give the space acked back to the consumers
+
+			// After the wait, so the skips done while waiting are reported too
+			lstop.skipped_bytes = hpcap_listener_skipped(&bufp->lstnr, list, &lstop);
+
+#ifdef HPCAP_MEASURE_LATENCY
+
+			if (lstop.expect_bytes > 0 && lstop.available_bytes > 0)
+				hpcap_listener_delivered(list);
+
+#endif
 
 			bufp_dbg(DBG_LSTNR, "lstop, %zu available bytes from offset %llu\n", lstop.available_bytes, lstop.read_offset);
 			bufp_dbg(DBG_LSTNR, "lstop, global R: %zu W: %zu\n", bufp->lstnr.global.bufferRdOffset, bufp->lstnr.global.bufferWrOffset);
@@ -412,6 +758,60 @@ long hpcap_ioctl(struct file * filp, unsigned int cmd, unsigned long arg2)
 			ret = hpcap_kill_listener(&bufp->lstnr, arg_as_int);
 			break;
 
+		case HPCAP_IOC_STATS:
+			ret = hpcap_ioctl_stats(bufp, arg);
+			break;
+
+		case HPCAP_IOC_GROUP:
+			ret = hpcap_join_group(&bufp->lstnr, list, arg_as_int);
+			break;
+
+		case HPCAP_IOC_LOSSY:
+			ret = hpcap_set_lossy(&bufp->lstnr, list, (size_t) arg2);
+			break;
+
+		case HPCAP_IOC_OVERWRITE:
+			HPRINTK(INFO, "Overwrite mode %s by handle %llu\n", arg_as_int ? "enabled" : "disabled", hpcap_handleid_of(filp));
+			atomic_set(&bufp->overwrite, arg_as_int != 0);
+			break;
+
+		case HPCAP_IOC_SNAPSHOT:
+			if (copy_from_user(&snap, arg, sizeof(struct hpcap_snapshot)) > 0) {
+				HPRINTK(WARNING, "Bad argument pointer %p\n", arg);
+				return -EFAULT;
+			}
+
+			ret = hpcap_snapshot(&bufp->lstnr, list, &snap);
+
+			if (ret == 0 && copy_to_user(arg, &snap, sizeof(struct hpcap_snapshot)) > 0) {
+				HPRINTK(WARNING, "Could not copy back %p\n", arg);
+				return -EFAULT;
+			}
+
+			break;
+
+#ifdef HPCAP_MEASURE_LATENCY
+
+		case HPCAP_IOC_LATENCY:
+			ret = hpcap_ioctl_latency(bufp, arg);
+			break;
+#endif
+
+#ifdef HPCAP_BURST_DETECTOR
+
+		case HPCAP_IOC_BURST_CONF:
+			ret = hpcap_ioctl_burst_conf(bufp, arg);
+			break;
+
+		case HPCAP_IOC_BURST_STATS:
+			ret = hpcap_ioctl_burst_stats(bufp, arg);
+			break;
+
+		case HPCAP_IOC_BURST_BINS:
+			ret = hpcap_ioctl_burst_bins(bufp, arg);
+			break;
+#endif
+
 		default:
 			HPRINTK(WARNING, "Unrecognized ioctl from handle %llu, cmd %u\n", hpcap_handleid_of(filp), cmd);
 			ret = -ENOTTY;
@@ -510,12 +910,19 @@ void hpcap_check_status(struct hpcap_buf * bufp, struct hpcap_ioc_status_info *
 	listeners_count = atomic_read(&lstnr.listeners_count);
 	status_info->num_listeners = listeners_count;
 
-	for (i = 0; i < listeners_count; i++)
+	for (i = 0; i < listeners_count; i++) {
 		status_info->listeners[i] = hpcap_build_ioc_listener_from_hpcap_listener(listeners[i]);
 
+		if (listeners[i].group != HPCAP_NO_GROUP)
+			status_info->listeners[i].group = atomic_read(&lstnr.groups[listeners[i].group].id);
+	}
+
 	status_info->consumer_write_off = atomic_read(&bufp->consumer_write_off);
 	status_info->consumer_read_off = atomic_read(&bufp->consumer_read_off);
 
+	status_info->overwrite = atomic_read(&bufp->overwrite);
+	status_info->overwritten_bytes = lstnr.overwritten_bytes;
+
 	//Reception thread
 	/* thread = bufp->hilo;
 	status_info->thread_state = -1;
@@ -535,6 +942,10 @@ struct hpcap_ioc_status_info_listener hpcap_build_ioc_listener_from_hpcap_listen
 	listener.bufferWrOffset = original.bufferWrOffset;
 	listener.bufferRdOffset = original.bufferRdOffset;
 	listener.buffer_size = original.bufsz;
+	listener.group = 0;
+	listener.max_lag = original.max_lag;
+	listener.skipped_bytes = original.skipped_bytes;
+	listener.skips = original.skips;
 
 	return listener;
 }
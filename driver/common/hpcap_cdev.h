@@ -14,6 +14,7 @@
 
 #include <linux/types.h>
 #include <linux/cdev.h>
+#include <linux/fs.h>
 
 /**
  * Register all the character devices associated to the given adapter.
@@ -57,6 +58,30 @@ int hpcap_release(struct inode *inode, struct file *filp);
  */
 ssize_t hpcap_read(struct file *filp, char __user *dstBuf, size_t count, loff_t *f_pos);
 
+/**
+ * Respond to a splice() request from userspace: hand the pages of up to len
+ * bytes after the data the listener already spliced to the pipe, without
+ * copies, waiting for data unless the call or the file are non-blocking.
+ *
+ * The bytes of each call are acknowledged (popped from the read offset of the
+ * listener) when the pipe releases them and the older calls were released
+ * too, so the buffer holds them while they are in the pipe, also in the copies
+ * made with tee(). At most HPCAP_SPLICE_CALLS calls can be in flight, a
+ * further one fails with EBUSY. The pipe must only be spliced to
+ * files, which copy the data before they release it: a socket releases the
+ * pipe buffers once it references the pages, before the data is sent, and the
+ * driver could overwrite them. The listener must not be lossy or in a group,
+ * and must not mix splice() with read() or the ack ioctls.
+ *
+ * @param  filp  File information structure.
+ * @param  ppos  Unused.
+ * @param  pipe  Destination pipe.
+ * @param  len   Maximum number of bytes.
+ * @param  flags Splice flags.
+ * @return       Number of bytes spliced, 0 if the listener was killed, negative if error.
+ */
+ssize_t hpcap_splice_read(struct file *filp, loff_t *ppos, struct pipe_inode_info *pipe, size_t len, unsigned int flags);
+
 /**
  * Respond to an ioctl() request from userspace.
  * @param  filp File information structure.
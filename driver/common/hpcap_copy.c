@@ -0,0 +1,36 @@
+/**
+ * @brief Copies of the captured frames to the HPCAP buffer.
+ *
+ * @see hpcap_copy.h for the description of the copies.
+ *
+ * @addtogroup HPCAP
+ * @{
+ */
+
+#include <linux/kernel.h>
+#include <asm/cpufeature.h>
+
+#include "hpcap_copy.h"
+#include "hpcap_debug.h"
+
+/** Captured bytes from which frames are copied with non-temporal stores */
+size_t hpcap_copy_nt_min __read_mostly = SIZE_MAX;
+
+/**
+ * Pick the copies of the frames. Called when the module is loaded.
+ */
+void hpcap_copy_init(void)
+{
+	// movnti comes with SSE2
+	if (boot_cpu_has(X86_FEATURE_XMM2))
+		hpcap_copy_nt_min = HPCAP_COPY_NT_THRESHOLD;
+	else
+		hpcap_copy_nt_min = SIZE_MAX;
+
+	if (hpcap_copy_nt_min != SIZE_MAX)
+		BPRINTK(INFO, "Frames of %zu bytes or more are copied with non-temporal stores\n", hpcap_copy_nt_min);
+	else
+		BPRINTK(INFO, "Frames are copied with cached stores\n");
+}
+
+/** @} */
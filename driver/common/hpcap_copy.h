@@ -0,0 +1,124 @@
+/**
+ * @brief Copies of the captured frames to the HPCAP buffer.
+ *
+ * Each copy is picked by the size of what is written:
+ *  - The 12-byte raw header is a fixed-size store the compiler inlines.
+ *  - Frames of less than hpcap_copy_nt_min bytes are copied with cached
+ *    stores: the listeners usually read them right away.
+ *  - Larger frames are copied with non-temporal stores (movnti), which go to
+ *    memory without filling the cache with data nobody will read soon, and so
+ *    keep the descriptor ring and the working set of the consumers cached.
+ *    The partial cache lines at both ends of the frame use cached stores.
+ *
+ * movnti stores general purpose registers, so it does not touch the FPU state
+ * and the consumers do not need kernel_fpu_begin, which vector stores would.
+ *
+ * Non-temporal stores are weakly ordered: hpcap_copy_fence must be called
+ * after a batch of copies and before the data is published to the listeners.
+ * Locked instructions wait for them to reach memory too, so they are only
+ * worth it in queues with one consumer, which reserve the space of each frame
+ * without a locked add.
+ *
+ * The threshold is picked by hpcap_copy_init when the module is loaded,
+ * according to the features of the CPU.
+ *
+ * @addtogroup HPCAP
+ * @{
+ */
+
+#ifndef HPCAP_COPY_H
+#define HPCAP_COPY_H
+
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/cache.h>
+#include <asm/barrier.h>
+
+#include "hpcap.h"
+
+extern size_t hpcap_copy_nt_min;
+
+void hpcap_copy_init(void);
+
+/**
+ * Copy with non-temporal stores the cache lines of dst that are fully written,
+ * and with cached stores the partial lines at both ends. A line is never
+ * written both ways: a cached store to a line with pending non-temporal ones
+ * would flush them and read the line back from memory.
+ */
+static inline void hpcap_copy_nt(void *dst, const void *src, size_t len)
+{
+	u8 *d = dst;
+	const u8 *s = src;
+	size_t head = minimo(-(unsigned long) d & (L1_CACHE_BYTES - 1), len);
+
+	if (head) {
+		memcpy(d, s, head);
+		d += head;
+		s += head;
+		len -= head;
+	}
+
+	for (; len >= 64; len -= 64, d += 64, s += 64) {
+		__asm__ __volatile__(
+			"movq    (%1), %%r8\n\t"
+			"movq   8(%1), %%r9\n\t"
+			"movq  16(%1), %%r10\n\t"
+			"movq  24(%1), %%r11\n\t"
+			"movnti %%r8,    (%0)\n\t"
+			"movnti %%r9,   8(%0)\n\t"
+			"movnti %%r10, 16(%0)\n\t"
+			"movnti %%r11, 24(%0)\n\t"
+			"movq  32(%1), %%r8\n\t"
+			"movq  40(%1), %%r9\n\t"
+			"movq  48(%1), %%r10\n\t"
+			"movq  56(%1), %%r11\n\t"
+			"movnti %%r8,  32(%0)\n\t"
+			"movnti %%r9,  40(%0)\n\t"
+			"movnti %%r10, 48(%0)\n\t"
+			"movnti %%r11, 56(%0)\n\t"
+			:
+			: "r"(d), "r"(s)
+			: "memory", "r8", "r9", "r10", "r11");
+	}
+
+	if (len)
+		memcpy(d, s, len);
+}
+
+/**
+ * Whether a frame of len captured bytes is copied with non-temporal stores.
+ */
+static inline short hpcap_copy_use_nt(size_t len)
+{
+	return len >= hpcap_copy_nt_min;
+}
+
+/**
+ * Copy (part of) a frame with the stores picked by hpcap_copy_use_nt for it.
+ */
+static inline void hpcap_copy_frame(void *dst, const void *src, size_t len, short nt)
+{
+	if (nt)
+		hpcap_copy_nt(dst, src, len);
+	else
+		memcpy(dst, src, len);
+}
+
+static inline void hpcap_copy_header(void *dst, const struct raw_header *rawh)
+{
+	memcpy(dst, rawh, RAW_HLEN);
+}
+
+/**
+ * Make the non-temporal stores of the previous copies visible before the
+ * ones that follow (sfence).
+ */
+static inline void hpcap_copy_fence(void)
+{
+	wmb();
+}
+
+/** @} */
+
+#endif
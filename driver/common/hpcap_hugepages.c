@@ -12,86 +12,223 @@
 #include <asm/uaccess.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+
+/**
+ * Pins the user page at the given address. The caller holds mmap_sem.
+ * @param addr User address.
+ * @param page Where the pinned page is stored.
+ * @return     0 if OK, negative if error.
+ */
+static int hpcap_huge_pin(unsigned long addr, struct page** page)
+{
+	int retval;
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,9,0))
+	retval = get_user_pages(addr, 1, 1, page, NULL);
+#elif (LINUX_VERSION_CODE < KERNEL_VERSION(4,6,0))
+	retval = get_user_pages(current, current->mm, addr, 1,
+							1 /* Write enable */, 0 /* Force */, page, NULL);
+#else
+	retval = get_user_pages(addr, 1,
+							1 /* Write enable */, 0 /* Force */, page, NULL);
+#endif
+
+	if (retval == 1)
+		return 0;
+
+	return retval < 0 ? retval : -EFAULT;
+}
+
+/**
+ * Releases the given hugepages, marking them dirty as the driver wrote them.
+ * @param heads  Head pages.
+ * @param npages Number of pages.
+ */
+static void hpcap_huge_unpin(struct page** heads, unsigned long npages)
+{
+	unsigned long i;
+
+	for (i = 0; i < npages; i++) {
+		if (!PageReserved(heads[i]))
+			SetPageDirty(heads[i]);
+
+		put_page(heads[i]);
+	}
+}
+
+/**
+ * Checks whether the hugepages are physically contiguous and in the linear
+ * mapping, so the buffer can be used through it. The linear mapping is made of
+ * 2 MB and 1 GB pages, so the copies to the buffer need a TLB entry per
+ * hugepage at most instead of one per 4 KB.
+ */
+static short hpcap_huge_contiguous(struct page** heads, unsigned long npages, size_t page_size)
+{
+	unsigned long i, pfn = page_to_pfn(heads[0]);
+
+	if (PageHighMem(heads[0]))
+		return 0;
+
+	for (i = 1; i < npages; i++)
+		if (page_to_pfn(heads[i]) != pfn + i * (page_size >> PAGE_SHIFT))
+			return 0;
+
+	return 1;
+}
+
+/**
+ * Maps the hugepages in a virtually contiguous range of the kernel. vmap only
+ * builds 4 KB entries, so the array of 4 KB pages is built just for the call.
+ */
+static void* hpcap_huge_vmap(struct page** heads, unsigned long npages, size_t page_size)
+{
+	unsigned long i, j, subpages = page_size >> PAGE_SHIFT;
+	struct page** pages;
+	void* addr;
+
+	pages = vmalloc(npages * subpages * sizeof(struct page*));
+
+	if (pages == NULL)
+		return NULL;
+
+	for (i = 0; i < npages; i++)
+		for (j = 0; j < subpages; j++)
+			pages[i * subpages + j] = nth_page(heads[i], j);
+
+	addr = vmap(pages, npages * subpages, VM_MAP, PAGE_KERNEL);
+	vfree(pages);
+
+	return addr;
+}
 
 /**
  * Configures the driver to use hugepages allocated in userspace.
+ *
+ * The buffer can be made of several hugetlbfs files (e.g. one per NUMA node)
+ * mapped one after the other, of 2 MB or 1 GB pages. Only the head page of
+ * each hugepage is pinned and kept. If the pages are physically contiguous
+ * (always with a single hugepage) the driver writes to them through the
+ * linear mapping, otherwise through a vmap of their 4 KB pages.
+ *
  * @param buf  HPCAP descriptor.
  * @param huge Structure holding the hugepage buffer information.
  * @return     0 if OK, negative if error.
  */
 int hpcap_huge_use(struct hpcap_buf* bufp, struct hpcap_buffer_info* bufinfo)
 {
-	struct page** pages;
-	int retval;
-	unsigned long npages;
+	struct page** heads = NULL;
+	struct page* page;
+	unsigned long i, npages = 0;
 	unsigned long buffer_start = (unsigned long) bufinfo->addr;
+	size_t page_size;
 	void* remapped;
-	int nid;
+	short direct;
+	int retval;
 
-	/* Calculate the number of pages to allocate the neccessary
-	 * number of struct page* */
-	npages = 1 + ((bufinfo->size - 1) / PAGE_SIZE); /* Ceil of division bufinfo->size / PAGE_SIZE */
+	if (has_hugepages(bufp)) {
+		HPRINTK(WARNING, "There is a hugepage buffer already (%s)\n", bufp->huge_pages_file);
+		return -EBUSY;
+	}
 
-	bufp_dbg(DBG_MEM, "Mapping %lu pages into kernel space. Backing file is %s\n", npages, bufinfo->file_name);
+	bufp_dbg(DBG_MEM, "Pinning the hugepages of %zu bytes at %p. Backing file is %s\n", bufinfo->size, bufinfo->addr, bufinfo->file_name);
 
-	pages = vmalloc(npages * sizeof(struct page *));
+	down_read(&current->mm->mmap_sem);
 
-	if (pages == NULL)
-		return -EFAULT;
+	retval = hpcap_huge_pin(buffer_start, &page);
 
-	/* Get the pages supporting the buffer passed from userspace */
-	down_read(&current->mm->mmap_sem);
-#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,9,0))
-	retval = get_user_pages(buffer_start, npages, 1, pages, NULL);
-#elif (LINUX_VERSION_CODE < KERNEL_VERSION(4,6,0))
-	retval = get_user_pages(current, current->mm, buffer_start, npages,
-							1 /* Write enable */, 0 /* Force */, pages, NULL);
-#else
-	retval = get_user_pages(buffer_start, npages,
-							1 /* Write enable */, 0 /* Force */, pages, NULL);
-#endif
-	up_read(&current->mm->mmap_sem);
+	if (retval < 0)
+		goto unlock;
 
-	bufp_dbg(DBG_MEM, "get_user_pages: return value %d for request of %lu pages starting at %p\n", retval, npages, (void*) buffer_start);
+	page_size = PAGE_SIZE << compound_order(compound_head(page));
 
-	if (retval < 0) {
-		vfree(pages);
-		return retval;
+	if (!PageHuge(page) || compound_head(page) != page || bufinfo->size == 0 || (bufinfo->size % page_size) != 0) {
+		HPRINTK(WARNING, "Buffer at %p (%zu bytes) is not made of whole hugepages\n", bufinfo->addr, bufinfo->size);
+		put_page(page);
+		retval = -EINVAL;
+		goto unlock;
 	}
 
-	if (retval != npages) {
-		/* TODO: What do we do here? */
-		bufp_dbg(DBG_MEM, "get_user_pages: returned less pages (%d) than asked (%lu).\n", retval, npages);
-		npages = retval;
+	heads = vmalloc((bufinfo->size / page_size) * sizeof(struct page*));
+
+	if (heads == NULL) {
+		put_page(page);
+		retval = -ENOMEM;
+		goto unlock;
 	}
 
-	bufp->old_buffer = bufp->bufferCopia; /* Save the current buffer, so it can be reused when the HP are unmapped */
-	bufp->old_bufSize = bufp->bufSize;
+	heads[npages++] = page;
+
+	/* The files can come from different mounts, but all of them must have the same page size */
+	for (i = 1; i < bufinfo->size / page_size; i++) {
+		retval = hpcap_huge_pin(buffer_start + i * page_size, &page);
+
+		if (retval < 0)
+			break;
 
-	nid = page_to_nid(pages[0]);
+		if (!PageHuge(page) || compound_head(page) != page || (PAGE_SIZE << compound_order(page)) != page_size) {
+			HPRINTK(WARNING, "Page %lu of the buffer is not a hugepage of %zu KB\n", i, page_size >> 10);
+			put_page(page);
+			retval = -EINVAL;
+			break;
+		}
 
-	bufp_dbg(DBG_MEM, "Requesting linear mapping of pages in NUMA node %d\n", nid);
+		heads[npages++] = page;
+	}
+
+unlock:
+	up_read(&current->mm->mmap_sem);
+
+	if (retval < 0) {
+		bufp_dbg(DBG_MEM, "Pinning failed after %lu pages: %d\n", npages, retval);
+		goto free_heads;
+	}
 
-	remapped = vm_map_ram(pages, npages, nid, PAGE_KERNEL);
+	direct = hpcap_huge_contiguous(heads, npages, page_size);
+
+	if (direct)
+		remapped = page_address(heads[0]);
+	else
+		remapped = hpcap_huge_vmap(heads, npages, page_size);
 
 	if (!remapped) {
 		HPRINTK(WARNING, "Remapping failed.\n");
-		return 0;
+		retval = -ENOMEM;
+		goto free_heads;
 	}
 
 	bufp_dbg(DBG_MEM, "Remapping succeeded. New address is %p\n", remapped);
 
+	bufp->old_buffer = bufp->bufferCopia; /* Save the current buffer, so it can be reused when the HP are unmapped */
+	bufp->old_bufSize = bufp->bufSize;
+
 	bufp->bufferCopia = remapped;
 	bufp->bufSize = bufinfo->size;
-	bufp->huge_pages = pages;
+	bufp->huge_pages = heads;
 	bufp->huge_pages_num = npages;
+	bufp->huge_files = maximo(bufinfo->file_count, 1);
+	bufp->huge_page_size = page_size;
+	bufp->huge_vmapped = !direct;
 	strncpy(bufp->huge_pages_file, bufinfo->file_name, MAX_HUGETLB_FILE_LEN);
 
 	hpcap_update_listener_bufsizes(&bufp->lstnr, bufp->bufSize);
+	hpcap_huge_info(bufp, bufinfo);
 
-	HPRINTK(INFO, "Hugepage buffer %s of size %llu correctly set up.\n", bufinfo->file_name, bufp->bufSize);
+	HPRINTK(INFO, "Hugepage buffer %s of size %llu correctly set up: %lu pages of %zu KB in %d files (node %d first), %s.\n",
+			bufinfo->file_name, bufp->bufSize, npages, page_size >> 10, bufp->huge_files, page_to_nid(heads[0]),
+			direct ? "linear mapping" : "vmap of 4 KB pages");
 
 	return 0;
+
+free_heads:
+
+	if (heads) {
+		hpcap_huge_unpin(heads, npages);
+		vfree(heads);
+	}
+
+	return retval;
 }
 
 /**
@@ -106,29 +243,24 @@ int hpcap_huge_use(struct hpcap_buf* bufp, struct hpcap_buffer_info* bufinfo)
  */
 int hpcap_huge_release(struct hpcap_buf* bufp)
 {
-	int i;
-
 	if (!has_hugepages(bufp))
 		return -EIDRM;
 
-	for (i = 0; i < bufp->huge_pages_num; i++) {
-		kunmap(bufp->huge_pages[i]);
+	if (bufp->huge_vmapped)
+		vunmap(bufp->bufferCopia);
 
-		down_read(&current->mm->mmap_sem);
-
-		if (!PageReserved(bufp->huge_pages[i]))
-			SetPageDirty(bufp->huge_pages[i]);
-
-		put_page(bufp->huge_pages[i]);
-
-		up_read(&current->mm->mmap_sem);
-	}
+	hpcap_huge_unpin(bufp->huge_pages, bufp->huge_pages_num);
 
 	bufp->bufferCopia = bufp->old_buffer;
+	bufp->bufSize = bufp->old_bufSize;
+	hpcap_update_listener_bufsizes(&bufp->lstnr, bufp->bufSize);
 
 	vfree(bufp->huge_pages);
 	bufp->huge_pages_num = 0;
 	bufp->huge_pages = NULL;
+	bufp->huge_files = 0;
+	bufp->huge_page_size = 0;
+	bufp->huge_vmapped = 0;
 	memset(bufp->huge_pages_file, 0, MAX_HUGETLB_FILE_LEN);
 
 	bufp_dbg(DBG_MEM, "Released mapping.\n");
@@ -147,10 +279,16 @@ void hpcap_huge_info(struct hpcap_buf* buf, struct hpcap_buffer_info* info)
 {
 	info->has_hugepages = has_hugepages(buf);
 
-	if (!info->has_hugepages)
+	if (!info->has_hugepages) {
 		memset(info->file_name, 0, MAX_HUGETLB_FILE_LEN);
-	else {
+		info->file_count = 0;
+		info->page_size = 0;
+		info->direct_map = 0;
+	} else {
 		info->size = buf->bufSize;
 		strncpy(info->file_name, buf->huge_pages_file, MAX_HUGETLB_FILE_LEN);
+		info->file_count = buf->huge_files;
+		info->page_size = buf->huge_page_size;
+		info->direct_map = !buf->huge_vmapped;
 	}
 }
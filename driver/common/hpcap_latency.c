@@ -1,17 +1,33 @@
 #include <linux/kernel.h>
+#include <linux/slab.h>
 
+#include "hpcap_types.h"
 #include "hpcap_latency.h"
 #include "hpcap_debug.h"
 
+int hpcap_latency_alloc(struct hpcap_latency_sampler **sampler, int numa_node)
+{
+	if (*sampler == NULL)
+		*sampler = kzalloc_node(sizeof(struct hpcap_latency_sampler), GFP_KERNEL, numa_node);
+
+	return *sampler != NULL ? 0 : -ENOMEM;
+}
+
+void hpcap_latency_free(struct hpcap_latency_sampler **sampler)
+{
+	if (*sampler)
+		kfree(*sampler);
+
+	*sampler = NULL;
+}
+
+/**
+ * Restart the probe measurements. The histogram is kept: it is only reset
+ * through hpcap_latency_collect.
+ */
 void hpcap_latency_init(struct hpcap_latency_measurements* lm)
 {
-	lm->mean = 0;
-	lm->variance = 0;
 	lm->measurements = 0;
-	lm->mean_sum = 0;
-	lm->square_sum = 0;
-	lm->max = 0;
-	lm->min = LONG_MAX;
 	lm->discard = 0;
 	lm->prev_recv_tstamp = 0;
 	lm->prev_send_tstamp = 0;
@@ -19,7 +35,7 @@ void hpcap_latency_init(struct hpcap_latency_measurements* lm)
 
 void hpcap_latency_measure(struct hpcap_latency_measurements* lm, struct timespec* tv, uint8_t* frame, size_t frame_size)
 {
-	long int diff;
+	long long diff;
 	uint16_t tsPacketId;
 	uint64_t send_tstamp;
 	uint64_t recv_tstamp;
@@ -40,35 +56,97 @@ void hpcap_latency_measure(struct hpcap_latency_measurements* lm, struct timespe
 	send_tstamp = *((uint64_t*)(frame + 40)) * 10;
 	recv_tstamp = tv->tv_sec * 1000000000 + tv->tv_nsec;
 
-	lm->measurements++;
-
-	if (lm->measurements > 0) {
+	// The first probe only sets the reference for the next one
+	if (lm->measurements > 0 && lm->probe) {
 		interarrival_recv = recv_tstamp - lm->prev_recv_tstamp;
 		interarrival_send = send_tstamp - lm->prev_send_tstamp;
 
 		diff = interarrival_recv - interarrival_send;
+		hpcap_latency_record(lm->probe, diff < 0 ? -diff : diff);
+	}
 
-		lm->mean_sum += diff;
-		lm->mean = lm->mean_sum / lm->measurements;
+	lm->measurements++;
+	lm->prev_recv_tstamp = recv_tstamp;
+	lm->prev_send_tstamp = send_tstamp;
+}
 
-		lm->square_sum += diff * diff;
-		lm->variance = lm->square_sum / lm->measurements - lm->mean * lm->mean;
+/**
+ * Add the histogram of a sampler since its last reset to sum. Concurrent
+ * calls on the same sampler must be serialized by the caller if reset is set.
+ * @param reset If not 0, start a new histogram: samples recorded after the
+ * 	      counts are read go to the next one.
+ */
+void hpcap_latency_collect(struct hpcap_latency_sampler *s, struct hpcap_latency_hist *sum, short reset)
+{
+	struct hpcap_latency_hist *h = &s->hist, *base = &s->base;
+	uint64_t count, sum_ns;
+	size_t i;
 
-		if (diff > lm->max)
-			lm->max = diff;
+	for (i = 0; i < HPCAP_LATENCY_BUCKETS; i++) {
+		count = READ_ONCE(h->counts[i]);
+		sum->counts[i] += count - base->counts[i];
+		sum->count += count - base->counts[i];
 
-		if (diff < lm->min)
-			lm->min = diff;
+		if (reset)
+			base->counts[i] = count;
 	}
 
-	lm->prev_recv_tstamp = recv_tstamp;
-	lm->prev_send_tstamp = send_tstamp;
+	sum_ns = READ_ONCE(h->sum_ns);
+	sum->sum_ns += sum_ns - base->sum_ns;
+
+	if (reset)
+		base->sum_ns = sum_ns;
 }
 
-void hpcap_latency_print(struct hpcap_latency_measurements* lm, short reset)
+/**
+ * Prepare the delivery latency measurements of the listeners of a buffer.
+ * The probe histograms are allocated with the consumers.
+ */
+void hpcap_latency_init_buffer(struct hpcap_buf *bufp, int numa_node)
 {
-	BPRINTK(INFO, "%lld frames: mean latency %lld ns sum %lld, stdev %lu ns (max %lld, min %lld)\n", lm->measurements, lm->mean, lm->mean_sum, int_sqrt(lm->variance), lm->max, lm->min);
+	int i, ret;
 
-	if (reset)
-		hpcap_latency_init(lm);
+	atomic64_set(&bufp->unpushed_since, 0);
+	spin_lock_init(&bufp->latency_lock);
+
+	ret = hpcap_latency_alloc(&bufp->lstnr.global.delivery, numa_node);
+
+	for (i = 0; i < MAX_LISTENERS; i++)
+		ret |= hpcap_latency_alloc(&bufp->lstnr.listeners[i].delivery, numa_node);
+
+	if (ret)
+		HPRINTK(WARNING, "Cannot allocate the delivery latency histograms\n");
+}
+
+/**
+ * Add up the probe histograms of the consumers and the delivery histograms of
+ * the listeners, and start new ones if info->reset is set.
+ */
+void hpcap_latency_get_info(struct hpcap_buf *bufp, struct hpcap_latency_info *info)
+{
+	short reset = info->reset != 0;
+	size_t i;
+
+	memset(&info->probe, 0, sizeof(struct hpcap_latency_hist));
+	memset(&info->delivery, 0, sizeof(struct hpcap_latency_hist));
+	info->samplers = 0;
+
+	spin_lock(&bufp->latency_lock);
+
+	for (i = 0; i < bufp->consumers; i++) {
+		if (bufp->consumers_thinfo[i].lm.probe) {
+			hpcap_latency_collect(bufp->consumers_thinfo[i].lm.probe, &info->probe, reset);
+			info->samplers++;
+		}
+	}
+
+	if (bufp->lstnr.global.delivery)
+		hpcap_latency_collect(bufp->lstnr.global.delivery, &info->delivery, reset);
+
+	for (i = 0; i < MAX_LISTENERS; i++) {
+		if (bufp->lstnr.listeners[i].delivery)
+			hpcap_latency_collect(bufp->lstnr.listeners[i].delivery, &info->delivery, reset);
+	}
+
+	spin_unlock(&bufp->latency_lock);
 }
@@ -4,21 +4,51 @@
 #include <linux/types.h>
 #include <linux/time.h>
 
+#include "hpcap.h"
+
+struct hpcap_buf;
+
+/**
+ * Latency histogram with a single writer. Readers add it up without locks and
+ * reset it by keeping a copy of the counts at the time of the reset (base),
+ * so the writer never needs to know about them.
+ */
+struct hpcap_latency_sampler {
+	struct hpcap_latency_hist hist;
+	struct hpcap_latency_hist base;
+};
+
 struct hpcap_latency_measurements {
-	long long variance;
-	long long mean_sum;
-	long long square_sum;
-	long long mean;
-	long long max;
-	long long min;
 	long long measurements;
 	long long discard;
 	uint64_t prev_recv_tstamp;
 	uint64_t prev_send_tstamp;
+	struct hpcap_latency_sampler *probe;
 };
 
+int hpcap_latency_alloc(struct hpcap_latency_sampler **sampler, int numa_node);
+void hpcap_latency_free(struct hpcap_latency_sampler **sampler);
+
 void hpcap_latency_init(struct hpcap_latency_measurements* lm);
 void hpcap_latency_measure(struct hpcap_latency_measurements* lm, struct timespec* tv, uint8_t* frame, size_t frame_size);
-void hpcap_latency_print(struct hpcap_latency_measurements* lm, short reset);
+
+/**
+ * Record a value in the histogram of a sampler. Only one thread can record in
+ * a sampler at a time.
+ */
+static inline void hpcap_latency_record(struct hpcap_latency_sampler *s, uint64_t ns)
+{
+	struct hpcap_latency_hist *h = &s->hist;
+	size_t bucket = hpcap_latency_bucket(ns);
+
+	WRITE_ONCE(h->counts[bucket], h->counts[bucket] + 1);
+	WRITE_ONCE(h->sum_ns, h->sum_ns + ns);
+	WRITE_ONCE(h->count, h->count + 1);
+}
+
+void hpcap_latency_collect(struct hpcap_latency_sampler *s, struct hpcap_latency_hist *sum, short reset);
+
+void hpcap_latency_init_buffer(struct hpcap_buf *bufp, int numa_node);
+void hpcap_latency_get_info(struct hpcap_buf *bufp, struct hpcap_latency_info *info);
 
 #endif
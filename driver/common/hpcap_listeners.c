@@ -6,8 +6,14 @@
 #include "hpcap_listeners.h"
 #include "hpcap_debug.h"
 #include "driver_hpcap.h"
+#include "hpcap_trace.h"
+#include "hpcap_rx.h"
 
 #include <linux/spinlock.h>
+#include <linux/string.h>
+
+/** Buffer that owns a listener structure */
+#define hpcap_buffer_of_listeners(lstnr) container_of(lstnr, struct hpcap_buf, lstnr)
 
 void hpcap_rst_listener(struct hpcap_listener *list)
 {
@@ -15,6 +21,19 @@ void hpcap_rst_listener(struct hpcap_listener *list)
 	atomic_set(&list->kill, 0);
 	list->bufferWrOffset = 0;
 	list->bufferRdOffset = 0;
+	list->group = HPCAP_NO_GROUP;
+	atomic_set(&list->claiming, 0);
+	list->max_lag = 0;
+	list->skip_pending = 0;
+	list->skipped_bytes = 0;
+	list->skips = 0;
+	list->spliced = 0;
+	list->splice_head = 0;
+	list->splice_tail = 0;
+	list->splice_done = 0;
+#ifdef HPCAP_MEASURE_LATENCY
+	atomic64_set(&list->pending_since, 0);
+#endif
 }
 
 void hpcap_update_listener_bufsizes(struct hpcap_buffer_listeners* lstnr, size_t bufsize)
@@ -43,8 +62,15 @@ void hpcap_init_listeners(struct hpcap_buffer_listeners* lstnr, size_t bufsize)
 
 	hpcap_rst_listener(&lstnr->global);
 
-	for (i = 0; i < MAX_LISTENERS; i++)
+	for (i = 0; i < MAX_LISTENERS; i++) {
 		hpcap_rst_listener(&lstnr->listeners[i]);
+		atomic_set(&lstnr->groups[i].id, HPCAP_LISTENER_EMPTY);
+		atomic_set(&lstnr->groups[i].members, 0);
+		atomic_set(&lstnr->groups[i].cursor, 0);
+	}
+
+	lstnr->boundaries.next = lstnr->boundaries.count = 0;
+	lstnr->overwritten_bytes = 0;
 
 	hpcap_update_listener_bufsizes(lstnr, bufsize);
 }
@@ -82,14 +108,50 @@ void hpcap_push_all_listeners(struct hpcap_buffer_listeners* lstnr, u64 count)
 
 #if MAX_LISTENERS > 1
 
+	// The members of a group get their data when they claim it
 	for (i = 0; i < MAX_LISTENERS; i++) {
-		if (atomic_read(&lstnr->listeners[i].id) != HPCAP_LISTENER_EMPTY)
+		if (atomic_read(&lstnr->listeners[i].id) != HPCAP_LISTENER_EMPTY && lstnr->listeners[i].group == HPCAP_NO_GROUP)
 			hpcap_push_listener(lstnr, i, count);
 	}
 
 #endif
+
+	trace_hpcap_push_listeners(hpcap_buffer_of_listeners(lstnr), count, lstnr->global.bufferWrOffset,
+							   atomic_read(&lstnr->listeners_count));
+}
+
+#ifdef HPCAP_MEASURE_LATENCY
+void hpcap_mark_listeners_pending(struct hpcap_buffer_listeners* lstnr, u64 since)
+{
+	int i;
+
+	if (since == 0)
+		return;
+
+	atomic64_cmpxchg(&lstnr->global.pending_since, 0, since);
+
+	for (i = 0; i < MAX_LISTENERS; i++) {
+		if (atomic_read(&lstnr->listeners[i].id) != HPCAP_LISTENER_EMPTY)
+			atomic64_cmpxchg(&lstnr->listeners[i].pending_since, 0, since);
+	}
 }
 
+void hpcap_listener_delivered(struct hpcap_listener *list)
+{
+	u64 since = atomic64_xchg(&list->pending_since, 0);
+	struct timespec now;
+	u64 now_ns;
+
+	if (since == 0 || list->delivery == NULL)
+		return;
+
+	getnstimeofday(&now);
+	now_ns = now.tv_sec * 1000000000ull + now.tv_nsec;
+
+	hpcap_latency_record(list->delivery, now_ns > since ? now_ns - since : 0);
+}
+#endif
+
 void hpcap_pop_listener(struct hpcap_listener *list, u64 count)
 {
 	size_t bufsize = list->bufsz;
@@ -102,18 +164,48 @@ void hpcap_pop_listener(struct hpcap_listener *list, u64 count)
 	list->bufferRdOffset = (list->bufferRdOffset + count) % bufsize; // written by consumer
 }
 
+/**
+ * Read offset of a listener for the global one: for a member of a group
+ * without a block, the group cursor.
+ *
+ * A member that claims a block sets its read offset to the start of the block,
+ * then the claiming flag, then moves the cursor past the block. Reading the
+ * cursor before the flag (cursors) and the flag before the offsets, the block
+ * is always held by the cursor or by the member.
+ */
+static inline size_t hpcap_listener_read_offset(struct hpcap_listener* list, size_t* cursors)
+{
+	if (list->group != HPCAP_NO_GROUP && !atomic_read(&list->claiming)) {
+		smp_rmb();
+
+		if (used_bytes(list) == 0)
+			return cursors[list->group];
+	}
+
+	smp_rmb();
+
+	return list->bufferRdOffset;
+}
+
 int hpcap_pop_global_listener(struct hpcap_buffer_listeners* lstnr)
 {
 	int i;
 	struct hpcap_listener* global = &lstnr->global;
 	size_t bufsize = global->bufsz;
+	size_t cursors[MAX_LISTENERS];
 	u64 minDist = bufsize + 1;
 	int dist;
 
+	for (i = 0; i < MAX_LISTENERS; i++) {
+		if (atomic_read(&lstnr->groups[i].members) > 0)
+			cursors[i] = (u32) atomic_read(&lstnr->groups[i].cursor) % bufsize;
+	}
+
+	smp_rmb();
 
 	for (i = 0; i < MAX_LISTENERS; i++) {
 		if ((atomic_read(&lstnr->listeners[i].id) != HPCAP_LISTENER_EMPTY)) {
-			dist = distance(global->bufferRdOffset, lstnr->listeners[i].bufferRdOffset, bufsize);
+			dist = distance(global->bufferRdOffset, hpcap_listener_read_offset(&lstnr->listeners[i], cursors), bufsize);
 
 			if (dist < minDist)
 				minDist = dist;
@@ -126,6 +218,9 @@ int hpcap_pop_global_listener(struct hpcap_buffer_listeners* lstnr)
 
 		global->bufferRdOffset = (global->bufferRdOffset + minDist) % bufsize;
 
+		trace_hpcap_pop_global_listener(hpcap_buffer_of_listeners(lstnr), minDist, global->bufferRdOffset,
+										used_bytes(global));
+
 		return minDist;
 	}
 
@@ -151,7 +246,8 @@ int hpcap_add_listener(struct hpcap_buffer_listeners *lstnr, int id)
 		} else if (current_id == 0) {
 			lstnr->listeners[i].bufferWrOffset = lstnr->global.bufferWrOffset;
 
-			if (hpcap_listener_count(lstnr) == 0 || atomic_read(&lstnr->already_popped) == 0) {
+			if (!atomic_read(&hpcap_buffer_of_listeners(lstnr)->overwrite) &&
+					(hpcap_listener_count(lstnr) == 0 || atomic_read(&lstnr->already_popped) == 0)) {
 				// If there are no listeners or they didn't read anything, the global read/write offsets have been reset
 				// and the read offset points to the beginnning of a frame.
 				lstnr->listeners[i].bufferRdOffset = lstnr->global.bufferRdOffset;
@@ -159,6 +255,7 @@ int hpcap_add_listener(struct hpcap_buffer_listeners *lstnr, int id)
 				// However, if there are more listeners, the read offset of the global listener
 				// may point to the middle of a frame. Set the read offset of this new listener
 				// to the last known write offset, which will point to the beginning of a frame.
+				// In overwrite mode the buffer keeps the old data: new listeners start now too.
 				lstnr->listeners[i].bufferRdOffset = lstnr->global.bufferWrOffset;
 			}
 
@@ -203,6 +300,500 @@ struct hpcap_listener* hpcap_get_listener_by_index(struct hpcap_buffer_listeners
 	return lstnr->listeners + index;
 }
 
+#if MAX_LISTENERS > 1
+
+/**
+ * Remove a listener from its group, which is freed when it has no members.
+ * The block the listener claimed and did not acknowledge is lost for the
+ * group. It becomes a listener of the data not published yet. Called with
+ * the lock held.
+ */
+static void hpcap_leave_group(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener* list)
+{
+	struct hpcap_listener_group* group = &lstnr->groups[list->group];
+
+	list->group = HPCAP_NO_GROUP;
+	list->bufferRdOffset = list->bufferWrOffset = lstnr->global.bufferWrOffset;
+
+	if (atomic_dec_return(&group->members) == 0)
+		atomic_set(&group->id, HPCAP_LISTENER_EMPTY);
+}
+
+int hpcap_join_group(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener* list, int group_id)
+{
+	struct hpcap_buf* bufp = hpcap_buffer_of_listeners(lstnr);
+	int i, slot = -1, ret = 0;
+
+	if (list == &lstnr->global)
+		return -EINVAL;
+
+	spin_lock(&lstnr->lock);
+
+	if (list->group != HPCAP_NO_GROUP)
+		hpcap_leave_group(lstnr, list);
+
+	if (group_id == HPCAP_LISTENER_EMPTY)
+		goto out;
+
+	if (list->max_lag > 0 || list->spliced > 0) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	for (i = 0; i < MAX_LISTENERS; i++) {
+		if (atomic_read(&lstnr->groups[i].id) == group_id) {
+			slot = i;
+			break;
+		} else if (slot < 0 && atomic_read(&lstnr->groups[i].id) == HPCAP_LISTENER_EMPTY)
+			slot = i;
+	}
+
+	if (slot < 0) {
+		ret = -EUSERS;
+		goto out;
+	}
+
+	if (atomic_read(&lstnr->groups[slot].id) != group_id) {
+		// A new group starts with the data not published yet, which the publisher (holding the lock) sets at a frame boundary
+		atomic_set(&lstnr->groups[slot].cursor, bufp->published_off);
+		atomic_set(&lstnr->groups[slot].id, group_id);
+	}
+
+	// The data the listener did not read is dropped: from now on, it reads the blocks it claims
+	list->bufferRdOffset = list->bufferWrOffset = lstnr->global.bufferWrOffset;
+	list->group = slot;
+	atomic_inc(&lstnr->groups[slot].members);
+
+	BPRINTK(INFO, "Listener with handle %d joined group %d (%d members)\n", atomic_read(&list->id), group_id,
+			atomic_read(&lstnr->groups[slot].members));
+
+out:
+	spin_unlock(&lstnr->lock);
+
+	return ret;
+}
+
+static inline void hpcap_read_raw_header(struct hpcap_buf* bufp, size_t offset, struct raw_header* rawh)
+{
+	size_t first = minimo(RAW_HLEN, bufp->bufSize - offset);
+
+	memcpy(rawh, bufp->bufferCopia + offset, first);
+
+	if (first < RAW_HLEN)
+		memcpy((u8*) rawh + first, bufp->bufferCopia, RAW_HLEN - first);
+}
+
+/**
+ * Claim for a member of a group the next block of the group: the records after
+ * the cursor, at least desired bytes and up to HPCAP_GROUP_BLOCK if possible.
+ * Nothing is claimed if the published data is not enough.
+ *
+ * Every published record is fully written, so the block is found by walking
+ * their headers. The cursor is moved past the block with a compare and
+ * exchange, and the walk is repeated if another member moved it first.
+ *
+ * @return Bytes claimed, 0 if none.
+ */
+static size_t hpcap_group_claim(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener* list, size_t desired)
+{
+	struct hpcap_buf* bufp = hpcap_buffer_of_listeners(lstnr);
+	struct hpcap_listener_group* group = &lstnr->groups[list->group];
+	size_t bufsize = list->bufsz;
+	size_t target = maximo(desired, HPCAP_GROUP_BLOCK);
+	size_t offset, avail, claimed, reclen;
+	struct raw_header rawh;
+	u32 start;
+
+	do {
+		start = atomic_read(&group->cursor);
+		offset = start % bufsize;
+
+		// The block is held by the read offset before the cursor moves
+		list->bufferRdOffset = list->bufferWrOffset = offset;
+		smp_wmb();
+		atomic_set(&list->claiming, 1);
+		smp_mb();
+
+		avail = (u32) (READ_ONCE(bufp->published_off) - start);
+		smp_rmb();
+
+		if (avail > bufsize)
+			avail = 0;
+
+		for (claimed = 0; claimed + RAW_HLEN <= avail; claimed += reclen) {
+			hpcap_read_raw_header(bufp, (offset + claimed) % bufsize, &rawh);
+			reclen = RAW_HLEN + rawh.caplen;
+
+			if (claimed + reclen > avail || (claimed >= desired && claimed + reclen > target))
+				break;
+		}
+
+		if (claimed < desired) {
+			atomic_set(&list->claiming, 0);
+			return 0;
+		}
+	} while (atomic_cmpxchg(&group->cursor, start, start + claimed) != start);
+
+	list->bufferWrOffset = (offset + claimed) % bufsize;
+	smp_wmb();
+	atomic_set(&list->claiming, 0);
+
+	printdbg(DBG_LSTNR, "Listener %d claimed %zu bytes at offset %zu\n", atomic_read(&list->id), claimed, offset);
+
+	return claimed;
+}
+
+#else
+
+static inline void hpcap_leave_group(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener* list)
+{
+}
+
+int hpcap_join_group(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener* list, int group_id)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline size_t hpcap_group_claim(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener* list, size_t desired)
+{
+	return 0;
+}
+
+#endif
+
+u64 hpcap_poll_listener(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener* list, u64 desired)
+{
+	hpcap_update_listener_offsets(hpcap_buffer_of_listeners(lstnr));
+
+	if (list->group != HPCAP_NO_GROUP && desired > 0 && used_bytes(list) == 0)
+		hpcap_group_claim(lstnr, list, desired);
+
+	return used_bytes(list);
+}
+
+/**
+ * Whether a published offset (as consumer_write_off) is the start of a record.
+ * It is not when it is the end of a padding reservation that did not reach the
+ * end of the file (a padding record covers it) or the end of one that left
+ * less than a header at the start of the next file (the padding written there
+ * by the next reservation covers it).
+ */
+static inline short hpcap_is_record_boundary(u32 off)
+{
+	size_t file_off = off % HPCAP_FILESIZE;
+
+	return file_off == 0 || (file_off >= RAW_HLEN && file_off <= HPCAP_FILESIZE - RAW_HLEN);
+}
+
+void hpcap_index_boundary(struct hpcap_buffer_listeners* lstnr, u32 off)
+{
+	struct hpcap_boundary_index* idx = &lstnr->boundaries;
+	size_t last = (idx->next + HPCAP_SKIP_INDEX - 1) % HPCAP_SKIP_INDEX;
+	struct timespec now;
+
+	if (!hpcap_is_record_boundary(off))
+		return;
+
+	if (idx->count > 0 && (u32) (off - idx->off[last]) < lstnr->global.bufsz / HPCAP_SKIP_INDEX)
+		return;
+
+	getnstimeofday(&now);
+
+	idx->off[idx->next] = off;
+	idx->ns[idx->next] = now.tv_sec * 1000000000ull + now.tv_nsec;
+	idx->next = (idx->next + 1) % HPCAP_SKIP_INDEX;
+
+	if (idx->count < HPCAP_SKIP_INDEX)
+		idx->count++;
+}
+
+/**
+ * Entry i of the index, from the oldest.
+ */
+static inline size_t hpcap_boundary_entry(struct hpcap_boundary_index* idx, size_t i)
+{
+	return (idx->next + HPCAP_SKIP_INDEX - idx->count + i) % HPCAP_SKIP_INDEX;
+}
+
+/**
+ * Move a listener forward, counting the bytes as skipped.
+ */
+static inline void hpcap_skip_listener(struct hpcap_listener* list, u32 skip)
+{
+	list->bufferRdOffset = (list->bufferRdOffset + skip) % list->bufsz;
+	list->skip_pending += skip;
+	list->skipped_bytes += skip;
+	list->skips++;
+}
+
+/**
+ * Oldest boundary the listener can be skipped to: after its read offset, and
+ * at most max_lag bytes before the published offset.
+ *
+ * @return Bytes to skip, 0 if there is no boundary.
+ */
+static u32 hpcap_find_skip(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener* list, u32 published)
+{
+	struct hpcap_boundary_index* idx = &lstnr->boundaries;
+	u32 lag = used_bytes(list), rd = published - lag, off;
+	size_t i;
+
+	for (i = 0; i < idx->count; i++) {
+		off = idx->off[hpcap_boundary_entry(idx, i)];
+
+		if ((u32) (off - rd) <= lag && (u32) (published - off) <= list->max_lag)
+			return off - rd;
+	}
+
+	return hpcap_is_record_boundary(published) ? lag : 0;
+}
+
+void hpcap_skip_lossy_listeners(struct hpcap_buffer_listeners* lstnr, u32 published)
+{
+	struct hpcap_listener* list;
+	u32 skip;
+	int i;
+
+	for (i = 0; i < MAX_LISTENERS; i++) {
+		list = &lstnr->listeners[i];
+
+		if (list->max_lag == 0 || atomic_read(&list->id) == HPCAP_LISTENER_EMPTY || used_bytes(list) <= list->max_lag)
+			continue;
+
+		skip = hpcap_find_skip(lstnr, list, published);
+
+		if (skip == 0)
+			continue;
+
+		hpcap_skip_listener(list, skip);
+
+		printdbg(DBG_LSTNR, "Listener %d lagged %zu bytes, skipped %u\n", atomic_read(&list->id), used_bytes(list) + skip, skip);
+	}
+}
+
+void hpcap_overwrite_oldest(struct hpcap_buffer_listeners* lstnr, u32 published)
+{
+	struct hpcap_boundary_index* idx = &lstnr->boundaries;
+	struct hpcap_listener* global = &lstnr->global;
+	struct hpcap_listener* list;
+	size_t bufsize = global->bufsz, room = bufsize / HPCAP_OVERWRITE_ROOM;
+	size_t cursors[MAX_LISTENERS];
+	u32 used = used_bytes(global), rd = published - used, drop = 0, off, dist;
+	int i;
+
+	if (used + room <= bufsize)
+		return;
+
+	// Oldest boundary that leaves the room free
+	for (i = 0; i < idx->count && drop == 0; i++) {
+		off = idx->off[hpcap_boundary_entry(idx, i)];
+
+		if ((u32) (off - rd) <= used && (u32) (published - off) + room <= bufsize)
+			drop = off - rd;
+	}
+
+	if (drop == 0 && hpcap_is_record_boundary(published))
+		drop = used;
+
+	if (drop == 0)
+		return;
+
+	for (i = 0; i < MAX_LISTENERS; i++) {
+		if (atomic_read(&lstnr->groups[i].members) > 0)
+			cursors[i] = (u32) atomic_read(&lstnr->groups[i].cursor) % bufsize;
+	}
+
+	smp_rmb();
+
+	// The lossless listeners hold the data they did not read
+	for (i = 0; i < MAX_LISTENERS; i++) {
+		list = &lstnr->listeners[i];
+
+		if (atomic_read(&list->id) != HPCAP_LISTENER_EMPTY && list->max_lag == 0 &&
+				distance(global->bufferRdOffset, hpcap_listener_read_offset(list, cursors), bufsize) < drop)
+			return;
+	}
+
+	for (i = 0; i < MAX_LISTENERS; i++) {
+		list = &lstnr->listeners[i];
+
+		if (atomic_read(&list->id) == HPCAP_LISTENER_EMPTY || list->max_lag == 0)
+			continue;
+
+		dist = distance(global->bufferRdOffset, list->bufferRdOffset, bufsize);
+
+		if (dist < drop)
+			hpcap_skip_listener(list, drop - dist);
+	}
+
+	global->bufferRdOffset = (global->bufferRdOffset + drop) % bufsize;
+	lstnr->overwritten_bytes += drop;
+
+	printdbg(DBG_LSTNR, "Overwrite mode: dropped the oldest %u bytes\n", drop);
+}
+
+int hpcap_snapshot(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener* list, struct hpcap_snapshot* snap)
+{
+	struct hpcap_buf* bufp = hpcap_buffer_of_listeners(lstnr);
+	struct hpcap_boundary_index* idx = &lstnr->boundaries;
+	struct timespec now;
+	u64 now_ns;
+	u32 published, used, rd, off, start;
+	short found = 0;
+	size_t e;
+	int i;
+
+	if (list == &lstnr->global || list->max_lag > 0 || list->group != HPCAP_NO_GROUP)
+		return -EINVAL;
+
+	getnstimeofday(&now);
+	now_ns = now.tv_sec * 1000000000ull + now.tv_nsec;
+
+	snap->start_ns = now_ns > snap->before_ns ? now_ns - snap->before_ns : 0;
+	snap->end_ns = now_ns + snap->after_ns;
+
+	spin_lock(&lstnr->lock);
+
+	published = bufp->published_off;
+	used = used_bytes(&lstnr->global);
+	rd = published - used;
+	start = published;
+
+	/**
+	 * The frames before a boundary were received before it was published: start
+	 * at the newest boundary published before the window, or at the oldest one
+	 * still in the buffer.
+	 */
+	for (i = 0; i < idx->count; i++) {
+		e = hpcap_boundary_entry(idx, i);
+		off = idx->off[e];
+
+		if ((u32) (off - rd) > used)
+			continue;
+
+		if (!found || idx->ns[e] < snap->start_ns)
+			start = off;
+
+		found = 1;
+
+		if (idx->ns[e] >= snap->start_ns)
+			break;
+	}
+
+	if (!found && !hpcap_is_record_boundary(published)) {
+		spin_unlock(&lstnr->lock);
+		return -EAGAIN;
+	}
+
+	list->bufferRdOffset = start % list->bufsz;
+	list->skip_pending = 0;
+
+	snap->read_offset = list->bufferRdOffset;
+	snap->available_bytes = used_bytes(list);
+
+	spin_unlock(&lstnr->lock);
+
+	printdbg(DBG_LSTNR, "Listener %d takes a snapshot of %llu bytes from %llu ns\n", atomic_read(&list->id), snap->available_bytes, snap->start_ns);
+
+	return 0;
+}
+
+int hpcap_set_lossy(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener* list, size_t max_lag)
+{
+	int ret = 0;
+
+	if (list == &lstnr->global || (max_lag > 0 && (max_lag <= RAW_HLEN + MAX_PACKET_SIZE || max_lag >= list->bufsz)))
+		return -EINVAL;
+
+	spin_lock(&lstnr->lock);
+
+	if (list->group != HPCAP_NO_GROUP || list->spliced > 0)
+		ret = -EINVAL;
+	else
+		list->max_lag = max_lag;
+
+	spin_unlock(&lstnr->lock);
+
+	return ret;
+}
+
+void hpcap_ack_listener(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener* list, u64 count)
+{
+	u64 overlap;
+
+	if (list->max_lag == 0 && list->skip_pending == 0) {
+		hpcap_pop_listener(list, count);
+		return;
+	}
+
+	/**
+	 * The listener acknowledges from where it read: the bytes skipped since
+	 * then are already popped, and the ones it read were not lost.
+	 */
+	spin_lock(&lstnr->lock);
+
+	overlap = minimo(count, list->skip_pending);
+	hpcap_pop_listener(list, count - overlap);
+	list->skip_pending -= overlap;
+	list->skipped_bytes -= overlap;
+
+	spin_unlock(&lstnr->lock);
+}
+
+void hpcap_ack_spliced(struct hpcap_buffer_listeners* lstnr, int id, u64 seq, u64 count)
+{
+	struct hpcap_listener* list;
+	u64 slot;
+
+	spin_lock(&lstnr->lock);
+
+	list = hpcap_get_listener(lstnr, id);
+
+	// The handle may be closed before the pipe releases the data
+	if (list && seq >= list->splice_head && seq < list->splice_tail) {
+		slot = seq % HPCAP_SPLICE_CALLS;
+		list->splice_bytes[slot] = count;
+		list->splice_done |= 1ull << slot;
+
+		// Pop only the oldest calls: a later one may be released first
+		while (list->splice_head < list->splice_tail) {
+			slot = list->splice_head % HPCAP_SPLICE_CALLS;
+
+			if (!(list->splice_done & (1ull << slot)))
+				break;
+
+			hpcap_pop_listener(list, list->splice_bytes[slot]);
+			list->spliced -= list->splice_bytes[slot];
+			list->splice_done &= ~(1ull << slot);
+			list->splice_head++;
+		}
+	}
+
+	spin_unlock(&lstnr->lock);
+}
+
+u64 hpcap_listener_skipped(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener* list, struct hpcap_listener_op* lstop)
+{
+	u64 skipped;
+
+	if (list->max_lag == 0 && list->skip_pending == 0)
+		return 0;
+
+	spin_lock(&lstnr->lock);
+
+	skipped = list->skip_pending;
+	list->skip_pending = 0;
+
+	if (skipped > 0) {
+		lstop->read_offset = list->bufferRdOffset;
+		lstop->available_bytes = used_bytes(list);
+	}
+
+	spin_unlock(&lstnr->lock);
+
+	return skipped;
+}
+
 int hpcap_del_listener(struct hpcap_buffer_listeners *lstnr, int id)
 {
 	struct hpcap_listener *list;
@@ -214,6 +805,10 @@ int hpcap_del_listener(struct hpcap_buffer_listeners *lstnr, int id)
 
 	if (list) {
 		BPRINTK(INFO, "Listener with handle %d deleted.\n", id);
+
+		if (list->group != HPCAP_NO_GROUP)
+			hpcap_leave_group(lstnr, list);
+
 		hpcap_rst_listener(list);
 		atomic_dec(&lstnr->listeners_count);
 		ret = 0;
@@ -224,15 +819,15 @@ int hpcap_del_listener(struct hpcap_buffer_listeners *lstnr, int id)
 	return ret;
 }
 
-int hpcap_wait_listener(struct hpcap_listener *list, int desired)
+int hpcap_wait_listener(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener *list, int desired)
 {
 	int avail = 0;
 
-	avail = used_bytes(list);
+	avail = hpcap_poll_listener(lstnr, list, desired);
 
 	while (!atomic_read(&list->kill) && (avail < desired)) {
 		schedule_timeout(ns(100000));  //200us
-		avail = used_bytes(list);
+		avail = hpcap_poll_listener(lstnr, list, desired);
 	}
 
 	if (atomic_read(&list->kill))
@@ -242,18 +837,18 @@ int hpcap_wait_listener(struct hpcap_listener *list, int desired)
 }
 
 #define SLEEP_QUANT 200
-u64 hpcap_wait_listener_user(struct hpcap_listener *list, struct hpcap_listener_op* lstop)
+u64 hpcap_wait_listener_user(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener *list, struct hpcap_listener_op* lstop)
 {
 	u64 avail = 0;
 	u64 desired = lstop->expect_bytes;
 	u64 timeout_ns = lstop->timeout_ns;
 	int num_loops = (timeout_ns / SLEEP_QUANT); //max_loops, if negative -> infinite loop
 
-	avail = used_bytes(list);
+	avail = hpcap_poll_listener(lstnr, list, desired);
 
 	while (!atomic_read(&list->kill) && (avail < desired) && ((num_loops > 0) || (timeout_ns < 0))) {
 		schedule_timeout(ns(SLEEP_QUANT));
-		avail = used_bytes(list);
+		avail = hpcap_poll_listener(lstnr, list, desired);
 		num_loops--;
 	}
 
@@ -18,6 +18,9 @@
 /** ID that denotes that there is not listener in the structure. */
 #define HPCAP_LISTENER_EMPTY 0
 
+/** Group index of the listeners that are not in a group. */
+#define HPCAP_NO_GROUP -1
+
 /**
  * Push the listener to notify it has new data available.
  * @param ls   	  Listener structure
@@ -33,6 +36,23 @@ void hpcap_push_listener(struct hpcap_buffer_listeners* lstnr, int index, u64 co
  */
 void hpcap_push_all_listeners(struct hpcap_buffer_listeners* lstnr, u64 count);
 
+#ifdef HPCAP_MEASURE_LATENCY
+/**
+ * Note that the listeners have new data, received at the given time, unless
+ * they already had data they have not seen.
+ * @param lstnr Listener structure
+ * @param since Reception time in ns of the oldest frame pushed, 0 if unknown.
+ */
+void hpcap_mark_listeners_pending(struct hpcap_buffer_listeners* lstnr, u64 since);
+
+/**
+ * Record the delivery latency of the data pushed to the listener since it
+ * last got data, now that it is being returned to it.
+ * @param list Listener.
+ */
+void hpcap_listener_delivered(struct hpcap_listener *list);
+#endif
+
 /**
  * Acknowledge that the given listener has read _count_ bytes
  * and update the pointers accordingly.
@@ -116,21 +136,139 @@ struct hpcap_listener* hpcap_get_listener_or_global(struct hpcap_buffer_listener
 int hpcap_del_listener(struct hpcap_buffer_listeners* lstnr, int id);
 
 /**
- * Block until the given listener has enough bytes available to read.
+ * Make the listener a member of the group with the given ID, creating it if
+ * needed, or remove it from its group if the ID is HPCAP_LISTENER_EMPTY.
+ *
+ * The members of a group split the data of the buffer: when a member waits for
+ * data and has none left, it claims the next block of records from the group
+ * cursor, and it acknowledges it as any listener. Members do not wait for each
+ * other, and the group holds the buffer as one listener, from its oldest block
+ * not acknowledged. The data the listener did not read when it joins is
+ * dropped, and a new group starts with the data not published yet.
+ *
+ * @param  lstnr    Listeners of the buffer.
+ * @param  list     Listener.
+ * @param  group_id Group ID.
+ * @return          0 if OK, -EUSERS if there are no free groups, -EINVAL for the global listener,
+ *                  lossy listeners and listeners with spliced data not released yet.
+ */
+int hpcap_join_group(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener* list, int group_id);
+
+/**
+ * Publish the data written by the consumers and, if the listener is a member of
+ * a group and read all its data, claim a new block of at least desired bytes.
+ * @param  lstnr   Listeners of the buffer.
+ * @param  list    Listener.
+ * @param  desired Bytes the listener waits for.
+ * @return         Bytes available for the listener.
+ */
+u64 hpcap_poll_listener(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener* list, u64 desired);
+
+/**
+ * Remember a published offset as a frame boundary the lossy listeners can be
+ * skipped to, if it is one and far enough from the last. Called by the
+ * publisher with the lock held.
+ * @param lstnr Listeners of the buffer.
+ * @param off   Published offset, as consumer_write_off.
+ */
+void hpcap_index_boundary(struct hpcap_buffer_listeners* lstnr, u32 off);
+
+/**
+ * Skip forward the lossy listeners that lag more than their maximum, to the
+ * oldest indexed frame boundary within it (or to the published offset), so
+ * they do not hold the buffer. Called by the publisher with the lock held.
+ * @param lstnr     Listeners of the buffer.
+ * @param published Published offset, as consumer_write_off.
+ */
+void hpcap_skip_lossy_listeners(struct hpcap_buffer_listeners* lstnr, u32 published);
+
+/**
+ * In overwrite mode, when less than 1/HPCAP_OVERWRITE_ROOM of the buffer is
+ * free, move the global listener forward to the oldest indexed frame boundary
+ * that frees it, skipping the lossy listeners it passes. Nothing is dropped if
+ * a lossless listener did not read the data. Called by the publisher with the
+ * lock held, instead of popping the global listener: the data read by every
+ * listener stays in the buffer until the space is needed.
+ * @param lstnr     Listeners of the buffer.
+ * @param published Published offset, as consumer_write_off.
+ */
+void hpcap_overwrite_oldest(struct hpcap_buffer_listeners* lstnr, u32 published);
+
+/**
+ * Move a listener to the start of a time window of the data in the buffer: the
+ * newest indexed frame boundary published before the window, or the oldest one
+ * still in the buffer.
+ * @param  lstnr Listeners of the buffer.
+ * @param  list  Listener.
+ * @param  snap  Window, before_ns and after_ns set. The rest is filled.
+ * @return       0 if OK, -EINVAL for the global listener, lossy listeners and
+ *               members of a group, -EAGAIN if no frame boundary is known yet.
+ */
+int hpcap_snapshot(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener* list, struct hpcap_snapshot* snap);
+
+/**
+ * Set the bytes a listener can lag before it is skipped, 0 for a lossless one.
+ * @param  lstnr   Listeners of the buffer.
+ * @param  list    Listener.
+ * @param  max_lag Maximum lag in bytes.
+ * @return         0 if OK, -EINVAL for the global listener, members of a group,
+ *                 listeners with spliced data not released yet and lags not
+ *                 between a frame and the buffer size.
+ */
+int hpcap_set_lossy(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener* list, size_t max_lag);
+
+/**
+ * Acknowledge bytes read by the listener since the last report of its skips
+ * (see hpcap_listener_skipped): for a lossy listener, only those that were not
+ * skipped are popped.
+ * @param lstnr Listeners of the buffer.
+ * @param list  Listener.
+ * @param count Bytes read.
+ */
+void hpcap_ack_listener(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener* list, u64 count);
+
+/**
+ * Report to a lossy listener the bytes it was skipped since the last report. If
+ * any, its read offset and available bytes are set in lstop.
+ * @param  lstnr Listeners of the buffer.
+ * @param  list  Listener.
+ * @param  lstop Listener operation to fill.
+ * @return       Bytes skipped.
+ */
+u64 hpcap_listener_skipped(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener* list, struct hpcap_listener_op* lstop);
+
+/**
+ * Acknowledge a call to splice() of a listener (see hpcap_splice_read) once
+ * the pipes released its data. The calls are popped from the read offset in
+ * order, so the call waits for the older ones still in flight. Nothing is
+ * done if the handle was closed meanwhile.
+ * @param lstnr Listeners of the buffer.
+ * @param id    Handle ID of the listener.
+ * @param seq   Sequence number of the call, see hpcap_listener.splice_tail.
+ * @param count Bytes of the call that got in the pipe.
+ */
+void hpcap_ack_spliced(struct hpcap_buffer_listeners* lstnr, int id, u64 seq, u64 count);
+
+/**
+ * Block until the given listener has enough bytes available to read. Publishes
+ * the data written by the consumers while waiting.
+ * @param  lstnr   Listeners of the buffer.
  * @param  list    Listener.
  * @param  desired Number of bytes that should be available before returning.
  * @return         Number of bytes available or -1 if the listener was killed.
  */
-int hpcap_wait_listener(struct hpcap_listener *list, int desired);
+int hpcap_wait_listener(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener *list, int desired);
 
 /**
  * Block until the given listener has enough bytes available to read, or until
- * a timeout is reached.
+ * a timeout is reached. Publishes the data written by the consumers while
+ * waiting.
+ * @param  lstnr Listeners of the buffer.
  * @param  list  Listener.
  * @param  lstop Structure with the expected bytes and timeout in ns.
  * @return       Available bytes or -1 if the listener was killed.
  */
-u64 hpcap_wait_listener_user(struct hpcap_listener *list, struct hpcap_listener_op* lstop);
+u64 hpcap_wait_listener_user(struct hpcap_buffer_listeners* lstnr, struct hpcap_listener *list, struct hpcap_listener_op* lstop);
 
 /**
  * Signal to all the listeners that they must stop.
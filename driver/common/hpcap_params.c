@@ -108,6 +108,21 @@ DRIVER_PARAM(Pages, "Pages (>=1). Amount of pages for the interfaces's kernel bu
  */
 DRIVER_PARAM(Caplen, "Capture length (BYTES). Default 0 (full packet).");
 
+#if defined(HPCAP_IXGBE) || defined(HPCAP_I40E)
+/* MTU - MTU of the interface when it is probed
+ *
+ * Valid Range: 68-9710
+ *  - 0 - keep the default of the driver
+ *
+ * Frames that do not fit in one descriptor buffer (MTU over 2030) span several
+ * descriptors, which are gathered into one record of the buffer. Those chains
+ * cannot cross the segments of the consumers, so the adapter uses one.
+ *
+ * Default Value: 0
+ */
+DRIVER_PARAM(MTU, "MTU (68-9710, jumbo frames over 2030). Default 0 (driver default).");
+#endif
+
 
 int hpcap_validate_option(unsigned int *value,
 						  struct hpcap_option *opt)
@@ -473,6 +488,55 @@ int hpcap_parse_opts(HW_ADAPTER* adapter)
 		BPRINTK(INFO, "PARAM: Adapter %u Caplen = %u\n", adapter->bd_number, caplen_param);
 	}
 
+#if defined(HPCAP_IXGBE) || defined(HPCAP_I40E)
+	{ /* MTU assignment */
+		static struct hpcap_option opt = {
+			.type = range_option,
+			.name = "MTU",
+			.err  = "keeping the default MTU",
+			.def  = 0,
+			.arg  = {
+				.r = {
+					.min = 0,
+					.max = HPCAP_MAX_MTU
+				}
+			}
+		};
+		int mtu_param = opt.def;
+
+#ifdef module_param_array
+
+		if (num_MTU > bd) {
+#endif
+			mtu_param = MTU[bd];
+			hpcap_validate_option((uint *)&mtu_param, &opt);
+#ifdef module_param_array
+		}
+
+#endif
+
+		if (mtu_param > 0 && mtu_param < HPCAP_MIN_MTU) {
+			BPRINTK(INFO, "MTU %d is below %d, keeping the default MTU\n", mtu_param, HPCAP_MIN_MTU);
+			mtu_param = 0;
+		}
+
+#ifndef HPCAP_CONSUMERS_VIA_RINGS
+
+		// A frame spanning several descriptors could cross the segments of two consumers
+		if (mtu_param > HPCAP_MAX_DESCR_MTU && adapter->consumers > 1) {
+			BPRINTK(WARNING, "Adapter %u: jumbo frames need one consumer per queue, using 1 instead of %zu\n",
+					adapter->bd_number, adapter->consumers);
+			adapter->consumers = 1;
+		}
+
+#endif
+
+		adapter->hpcap_mtu = mtu_param;
+		BPRINTK(INFO, "PARAM: Adapter %u MTU = %d\n", adapter->bd_number, mtu_param);
+	}
+
+#endif
+
 	{ /* Pages assignment */
 		static struct hpcap_option opt = {
 			.type = range_option,
@@ -0,0 +1,71 @@
+/**
+ * @brief Correlation between the PHC of an adapter and the wall clock.
+ *
+ * @see hpcap_phc.h for the description of the conversion.
+ *
+ * @addtogroup HPCAP
+ * @{
+ */
+
+#include <linux/string.h>
+
+#include "hpcap_phc.h"
+
+void hpcap_phc_init(struct hpcap_phc *phc)
+{
+	memset(phc, 0, sizeof(struct hpcap_phc));
+	seqcount_init(&phc->seq);
+}
+
+/**
+ * Update the correlation with a sample of both clocks.
+ * @param phc_ns PHC time.
+ * @param sys_ns Wall clock time at phc_ns.
+ */
+void hpcap_phc_update(struct hpcap_phc *phc, u64 phc_ns, u64 sys_ns)
+{
+	u64 dphc = phc_ns - phc->cal_phc, dsys = sys_ns - phc->cal_sys, mult = phc->mult;
+	s64 err;
+
+	if (mult == 0) {
+		// The PHC counts ns, so start with the nominal rate
+		mult = 1u << HPCAP_PHC_SHIFT;
+	} else if (phc->cal_phc == 0 || (s64) dphc <= 0 || (s64) dsys <= 0 || dsys > 4 * HPCAP_PHC_CORRELATION_NS) {
+		/**
+		 * A resync, a clock that went backwards or a work that did not run for
+		 * long: the interval is no good to measure the rate. Keep the one we
+		 * have.
+		 */
+		phc->steps++;
+	} else {
+		// Before the write section, which would make the conversion wait for it
+		err = sys_ns - hpcap_phc_convert(phc, phc_ns);
+
+		if (err > (s64) HPCAP_PHC_MAX_ERROR_NS || err < -(s64) HPCAP_PHC_MAX_ERROR_NS)
+			phc->steps++; // One of the clocks was set during the interval
+		else
+			mult = div64_u64(dsys << HPCAP_PHC_SHIFT, dphc);
+	}
+
+	write_seqcount_begin(&phc->seq);
+	phc->phc_base = phc_ns;
+	phc->sys_base = sys_ns;
+	phc->mult = mult;
+	write_seqcount_end(&phc->seq);
+
+	phc->cal_phc = phc_ns;
+	phc->cal_sys = sys_ns;
+	phc->updates++;
+}
+
+/**
+ * Update the correlation with a sample taken right after the PHC was set
+ * (settime/adjtime), without measuring the rate across the change.
+ */
+void hpcap_phc_resync(struct hpcap_phc *phc, u64 phc_ns, u64 sys_ns)
+{
+	phc->cal_phc = 0;
+	hpcap_phc_update(phc, phc_ns, sys_ns);
+}
+
+/** @} */
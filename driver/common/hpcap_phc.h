@@ -0,0 +1,82 @@
+/**
+ * @brief Correlation between the PTP hardware clock (PHC) of an adapter and
+ * the wall clock, to convert hardware timestamps.
+ *
+ * A background work of the driver samples the PHC bracketed by two readings
+ * of getnstimeofday every HPCAP_PHC_CORRELATION_NS and feeds the pair to
+ * hpcap_phc_update, which keeps a (base, mult) pair:
+ *
+ *   ns = sys_base + ((phc - phc_base) * mult) >> HPCAP_PHC_SHIFT
+ *
+ * Each sample becomes the new base, and mult the rate measured since the
+ * previous one. Unlike the TSC clock of the consumers (hpcap_tstamp.h), the
+ * difference with the wall clock is not slewed: the stamps latched just before
+ * a sample may be converted after it, and a slewed rate would double their
+ * error. So the conversion may jump at a sample by the error of the previous
+ * one (a few hundred ns). A sample further than HPCAP_PHC_MAX_ERROR_NS from
+ * the conversion, or one requested with hpcap_phc_resync after the PHC was set,
+ * means that a clock was set during the interval: it keeps the previous rate.
+ *
+ * The conversion is read by the consumers of every queue while the work
+ * updates it, so it is protected by a seqcount: converting a timestamp is a
+ * couple of loads, a multiply, a shift and an add. The driver serializes the
+ * writers.
+ *
+ * @addtogroup HPCAP
+ * @{
+ */
+
+#ifndef HPCAP_PHC_H
+#define HPCAP_PHC_H
+
+#include <linux/types.h>
+#include <linux/math64.h>
+#include <linux/seqlock.h>
+
+#include "hpcap.h"
+
+/** PHC and wall clock tick at nearly the same rate, so mult is about 1 << 31 */
+#define HPCAP_PHC_SHIFT 31
+
+struct hpcap_phc {
+	seqcount_t seq;
+	u64 phc_base;		/**< PHC time of the conversion base */
+	u64 sys_base;		/**< Wall clock time given to phc_base */
+	u32 mult;			/**< Conversion factor, 0 until the first update */
+
+	u64 cal_phc;		/**< PHC time of the last sample, 0 to skip measuring the rate in the next one */
+	u64 cal_sys;		/**< Wall clock time of that sample */
+	u64 updates;		/**< Samples taken */
+	u64 steps;			/**< Samples that could not measure the rate */
+};
+
+void hpcap_phc_init(struct hpcap_phc *phc);
+void hpcap_phc_update(struct hpcap_phc *phc, u64 phc_ns, u64 sys_ns);
+void hpcap_phc_resync(struct hpcap_phc *phc, u64 phc_ns, u64 sys_ns);
+
+/**
+ * Convert a PHC time with the current correlation. Timestamps latched before
+ * the last update are older than phc_base.
+ */
+static inline u64 hpcap_phc_convert(const struct hpcap_phc *phc, u64 phc_ns)
+{
+	unsigned int seq;
+	u64 ns;
+
+	do {
+		seq = read_seqcount_begin(&phc->seq);
+
+		if (unlikely(phc->mult == 0))
+			ns = phc_ns; // The driver sets the PHC to the wall clock time
+		else if (likely(phc_ns >= phc->phc_base))
+			ns = phc->sys_base + mul_u64_u32_shr(phc_ns - phc->phc_base, phc->mult, HPCAP_PHC_SHIFT);
+		else
+			ns = phc->sys_base - mul_u64_u32_shr(phc->phc_base - phc_ns, phc->mult, HPCAP_PHC_SHIFT);
+	} while (read_seqcount_retry(&phc->seq, seq));
+
+	return ns;
+}
+
+/** @} */
+
+#endif
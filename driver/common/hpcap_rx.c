@@ -9,8 +9,10 @@
 #include "hpcap_debug.h"
 #include "hpcap_types.h"
 #include "hpcap_listeners.h"
-#include "hpcap_rx_profile.h"
+#include "hpcap_stats.h"
+#include "hpcap_copy.h"
 #include "hpcap_dups.h"
+#include "hpcap_trace.h"
 
 #include <linux/kthread.h>
 #include <linux/sched.h>
@@ -37,33 +39,33 @@ extern void mlx4_en_inline_scatter(struct mlx4_en_rx_ring *ring,
 								   struct mlx4_en_priv *priv,
 								   unsigned int length);
 
-/** Build the rx_descr_t structure for Mellanox descriptors */
+static inline struct mlx4_cqe* ring_get_cqe(HW_RING* ring, uint32_t qidx)
+{
+	return mlx4_en_get_cqe(ring->cq->buf, qidx & ring->size_mask, ring->priv->cqe_size) + ring->priv->cqe_factor;
+}
+
+/**
+ * Build the rx_descr_t structure for Mellanox descriptors. The CQE must be in
+ * the burst of the consumer (see hpcap_mlx4_scan_cqes), which already synced
+ * its fragment and did the inline scatter.
+ */
 inline rx_descr_t* ring_get_rxd(HW_RING* ring, uint32_t qidx, rx_descr_t* _rxd)
 {
 	int i;
 
 	i = qidx & ring->size_mask;
 
-	_rxd->cqe = mlx4_en_get_cqe(ring->cq->buf, i, ring->priv->cqe_size) + ring->priv->cqe_factor;
+	_rxd->cqe = ring_get_cqe(ring, qidx);
 	_rxd->rx_desc = ring->buf + (i << ring->log_stride);
 	_rxd->frags = ring->rx_info + (i << ring->priv->log_rx_info);
 	_rxd->cq_mask = qidx & ring->cq->size;
 	_rxd->fcs_del = ring->fcs_del;
 
-	if (_rxd->cqe->owner_sr_opcode & MLX4_CQE_IS_RECV_MASK)
-		mlx4_en_inline_scatter(ring, _rxd->frags, _rxd->rx_desc, ring->priv, rxd_length(_rxd));
-
 	return _rxd;
 }
 
 inline uint8_t* ring_get_buffer(rx_descr_t* rx_desc, HW_RING* ring, size_t i)
 {
-	dma_addr_t dma;
-
-	dma = be64_to_cpu(rx_desc->rx_desc->data[0].addr);
-
-	dma_sync_single_for_cpu(ring->priv->ddev, dma, ring->priv->frag_info[0].frag_size,
-							DMA_FROM_DEVICE);
 	return page_address(rx_desc->frags[0].page) + rx_desc->frags[0].page_offset;
 }
 
@@ -78,17 +80,15 @@ void hpcap_mlx4_release_rx_buffers(HW_RING* ring)
 	wmb();
 }
 
+/**
+ * Timestamp of the CQE, converted with the clock snapshot of its burst: no
+ * lock, and no cache line shared with the PTP code of the driver.
+ */
 inline void rxd_get_tstamp(rx_descr_t* rxd, struct timespec* tv, HW_RING* ring)
 {
-	struct mlx4_en_dev* mdev = ring->priv->mdev;
-	unsigned long flags;
-	u64 nsec, timestamp;
-
-	timestamp = mlx4_en_get_cqe_ts(rxd->cqe);
+	u64 nsec;
 
-	// read_lock_irqsave(&mdev->clock_lock, flags);
-	nsec = timecounter_cyc2time(&mdev->clock, timestamp);
-	// read_unlock_irqrestore(&mdev->clock_lock, flags);
+	nsec = timecounter_cyc2time(rxd->clock, mlx4_en_get_cqe_ts(rxd->cqe));
 
 	*tv = ns_to_timespec(nsec);
 }
@@ -113,6 +113,31 @@ static inline void i40e_release_rx_desc(struct i40e_ring *rx_ring, u32 val)
 	wmb();
 	writel(val, rx_ring->tail);
 }
+
+#ifdef HPCAP_HWTSTAMP
+/**
+ * Hardware timestamp of a frame, if the XL710 latched one for it (only PTP
+ * event frames). The flags are in the last descriptor of the frame.
+ * @return 1 if tv was set, 0 if the frame needs a software timestamp.
+ */
+inline int rxd_get_tstamp(rx_descr_t* rxd, struct timespec* tv, HW_RING* ring)
+{
+	u64 qword = le64_to_cpu(rxd->wb.qword1.status_error_len);
+	struct i40e_pf *pf;
+	u64 nsec;
+
+	if (likely(!(qword & I40E_RXD_QW1_STATUS_TSYNVALID_MASK)))
+		return 0;
+
+	pf = ring->vsi->back;
+
+	if (!i40e_ptp_hpcap_rx_tstamp(pf, (qword & I40E_RXD_QW1_STATUS_TSYNINDX_MASK) >> I40E_RXD_QW1_STATUS_TSYNINDX_SHIFT, &nsec))
+		return 0;
+
+	*tv = ns_to_timespec(hpcap_phc_convert(&pf->hpcap_phc, nsec));
+	return 1;
+}
+#endif
 #endif
 
 static inline uint32_t get_last_descriptor_of_consumer(HW_RING* rx_ring, size_t consumer)
@@ -201,7 +226,11 @@ static inline void hpcap_advance_read_descriptors(HW_RING* rx_ring, uint32_t las
 	bufp->can_free[consumer] = 1;
 #endif
 
+	trace_hpcap_release_rxd(bufp, consumer, last_read_idx, next_rxd_idx, bufp->can_free[consumer]);
+
 	if (bufp->can_free[consumer]) {
+		thi->release_pending = 0;
+
 #ifdef HPCAP_MLNX
 		bufp_dbg(DBG_RXEXTRA, "Thread %zu: Calling driver release. Prod %u cons %u cons_index %u qidx %u next %u\n",
 				 consumer, rx_ring->prod, rx_ring->cons, rx_ring->cq->mcq.cons_index, last_read_idx, next_rxd_idx);
@@ -215,19 +244,23 @@ static inline void hpcap_advance_read_descriptors(HW_RING* rx_ring, uint32_t las
 		rx_ring->next_to_clean = (last_read_idx + 1) % ring_size(rx_ring);
 
 #ifdef HPCAP_40G
-		// TODO: Use bitmask
-		rx_ring->next_to_use = (last_read_idx / 8) * 8; // The XL710 only supports bumps of multiples of 8 descriptors.
+
+		// The XL710 only supports bumps of multiples of 8 descriptors: skip the tail write until it moves
+		if ((last_read_idx & ~7u) != rx_ring->next_to_use) {
+			rx_ring->next_to_use = last_read_idx & ~7u;
+			ring_rxd_release(rx_ring, rx_ring->next_to_use);
+		}
+
 #else
 		rx_ring->next_to_use = last_read_idx;
-#endif
-
 		ring_rxd_release(rx_ring, rx_ring->next_to_use);
+#endif
 		bufp_dbg(DBG_RXEXTRA, "Thread %zu: after release, next idx %u, next_to_clean %d, next_to_use %d\n", consumer, next_rxd_idx, rx_ring->next_to_clean, rx_ring->next_to_use);
 #endif
 
 		bufp_dbg(DBG_RXEXTRA, "Thread %zu: next rxd to read is %u\n", consumer, thi->rxd_idx);
 
-		hpcap_profile_mark_rxd_return(&thi->prof, last_read_idx);
+		hpcap_stats_mark_release(&thi->stats);
 
 #ifndef HPCAP_CONSUMERS_VIA_RINGS
 
@@ -246,11 +279,113 @@ static inline void hpcap_advance_read_descriptors(HW_RING* rx_ring, uint32_t las
 		}
 
 #endif
+	} else {
+		/**
+		 * Remember what we could not return, so we can return it as soon as the previous
+		 * consumer frees its segment even if we do not receive anything else in the meantime.
+		 */
+		thi->pending_rxd = last_read_idx;
+		thi->release_pending = 1;
 	}
 
 	thi->rxd_idx = next_rxd_idx;
 }
 
+#ifdef HPCAP_MLNX
+static inline short hpcap_mlx4_in_burst(const struct hpcap_mlx4_cqe_burst* burst, uint32_t qidx)
+{
+	return qidx - burst->start < burst->end - burst->start;
+}
+
+/**
+ * Look for ready CQEs from qidx on, at most HPCAP_MLX4_CQE_BURST and without
+ * leaving the segment of the consumer, and prepare them to be read: the
+ * fragments of the frames are synced for the CPU in contiguous runs (the
+ * driver carves them in order from higher order pages), the inlined frames
+ * are scattered to their fragments, and the clock of the device is
+ * snapshotted for the timestamps. The CQEs after the burst are prefetched.
+ *
+ * @return Number of CQEs in the new burst.
+ */
+static uint32_t hpcap_mlx4_scan_cqes(HW_RING* ring, struct hpcap_mlx4_cqe_burst* burst, uint32_t qidx, size_t consumer)
+{
+	struct mlx4_en_priv* priv = ring->priv;
+	struct mlx4_en_dev* mdev = priv->mdev;
+	struct mlx4_en_rx_alloc* frags;
+	struct mlx4_cqe* cqe;
+	struct page* run_page = NULL;
+	dma_addr_t dma, run_start = 0, run_end = 0;
+	u32 stride = priv->frag_info[0].frag_stride;
+	uint32_t i, idx;
+	unsigned long flags;
+
+	for (i = qidx; i - qidx < HPCAP_MLX4_CQE_BURST; i++) {
+		if (i != qidx && !rxd_belongs_to_consumer(ring, i, consumer))
+			break;
+
+		cqe = ring_get_cqe(ring, i);
+
+		if (!XNOR(cqe->owner_sr_opcode & MLX4_CQE_OWNER_MASK, i & ring->cq->size))
+			break;
+	}
+
+	burst->start = qidx;
+	burst->end = i;
+
+	for (; i - burst->end < HPCAP_MLX4_CQE_BURST; i++)
+		prefetcht0(ring_get_cqe(ring, i));
+
+	if (burst->end == qidx)
+		return 0;
+
+	rmb(); /* Read the CQEs after their ownership bits */
+
+	for (i = qidx; i != burst->end; i++) {
+		idx = i & ring->size_mask;
+		cqe = ring_get_cqe(ring, i);
+		frags = ring->rx_info + (idx << priv->log_rx_info);
+
+		if (cqe->owner_sr_opcode & MLX4_CQE_IS_RECV_MASK) {
+			// The frame is in the descriptor: copy it to the fragment (synced there)
+			mlx4_en_inline_scatter(ring, frags, ring->buf + (idx << ring->log_stride), priv,
+								   be32_to_cpu(cqe->byte_cnt) - ring->fcs_del);
+			continue;
+		}
+
+		dma = frags[0].dma + frags[0].page_offset;
+
+		if (frags[0].page != run_page || dma != run_end) {
+			if (run_page)
+				dma_sync_single_for_cpu(priv->ddev, run_start, run_end - run_start, DMA_FROM_DEVICE);
+
+			run_page = frags[0].page;
+			run_start = dma;
+		}
+
+		run_end = dma + stride;
+	}
+
+	if (run_page)
+		dma_sync_single_for_cpu(priv->ddev, run_start, run_end - run_start, DMA_FROM_DEVICE);
+
+	for (i = qidx; i != burst->end; i++) {
+		frags = ring->rx_info + ((i & ring->size_mask) << priv->log_rx_info);
+		prefetcht0(page_address(frags[0].page) + frags[0].page_offset);
+	}
+
+	if (ring_has_hw_tstamp(ring)) {
+		read_lock_irqsave(&mdev->clock_lock, flags);
+		burst->cycles = mdev->cycles;
+		burst->clock = mdev->clock;
+		read_unlock_irqrestore(&mdev->clock_lock, flags);
+
+		burst->clock.cc = &burst->cycles;
+	}
+
+	return burst->end - qidx;
+}
+#endif
+
 #ifdef DO_PREFETCH
 static inline void cache_warmup(HW_RING *rx_ring, uint32_t qidx, void *dst, u64 dst_size, u64 dst_offset)
 {
@@ -309,7 +444,7 @@ static inline size_t set_circular_buffer_to(void *dst, u64 dst_size, u64 dst_off
 }
 #endif
 
-static inline size_t copy_to_circular_buffer(void *dst, size_t dst_size, size_t dst_offset, void *src, size_t nbytes)
+static inline size_t copy_to_circular_buffer(void *dst, size_t dst_size, size_t dst_offset, void *src, size_t nbytes, short nt)
 {
 	size_t new_offset;
 	size_t aux;
@@ -319,105 +454,214 @@ static inline size_t copy_to_circular_buffer(void *dst, size_t dst_size, size_t
 
 	if ((dst_offset + nbytes) > dst_size) {
 		aux = dst_size - dst_offset;
-		memcpy(dst + dst_offset, src, aux);
-		memcpy(dst, &(((u8 *)src)[aux]), nbytes - aux);
+		hpcap_copy_frame(dst + dst_offset, src, aux, nt);
+		hpcap_copy_frame(dst, &(((u8 *)src)[aux]), nbytes - aux, nt);
 
-		new_offset = (dst_offset + nbytes) % dst_size;
+		new_offset = nbytes - aux;
 	} else {
-		memcpy(dst + dst_offset, src, nbytes);
-		new_offset = (dst_offset + nbytes) % dst_size;
+		hpcap_copy_frame(dst + dst_offset, src, nbytes, nt);
+
+		// No division: the offset can only reach the end of the buffer
+		new_offset = dst_offset + nbytes;
+
+		if (unlikely(new_offset == dst_size))
+			new_offset = 0;
 	}
 
 	return new_offset;
 }
 
-static inline short can_lock_ring(HW_RING* rx_ring, uint32_t rxd_to_read, size_t consumer)
+static inline size_t write_header_to_circular_buffer(void *dst, size_t dst_size, size_t dst_offset, struct raw_header *rawh)
+{
+	if (unlikely(dst_offset + RAW_HLEN > dst_size))
+		return copy_to_circular_buffer(dst, dst_size, dst_offset, rawh, RAW_HLEN, 0);
+
+	hpcap_copy_header(dst + dst_offset, rawh);
+
+	dst_offset += RAW_HLEN;
+
+	return unlikely(dst_offset == dst_size) ? 0 : dst_offset;
+}
+
+#ifndef HPCAP_MLNX
+static inline short hpcap_in_ready_run(const struct hpcap_rx_thinfo* thi, uint32_t qidx)
+{
+	return qidx - (uint32_t) thi->ready_start < (uint32_t) thi->ready_end - (uint32_t) thi->ready_start;
+}
+
+/**
+ * Find the run of ready descriptors from qidx on, at most HPCAP_RX_SCAN and
+ * without leaving the segment of the consumer. The status words of the
+ * descriptors are loaded together, so the CPU overlaps their cache misses,
+ * and their DD bits are packed in a mask without branches: the run is its
+ * trailing ones. check4packet reads the run without checking them again.
+ *
+ * @return Length of the run.
+ */
+static inline uint32_t hpcap_scan_ready(HW_RING* rx_ring, struct hpcap_rx_thinfo* thi, uint32_t qidx)
 {
 	struct hpcap_buf* bufp = rx_ring->bufp;
+	u64 status[HPCAP_RX_SCAN];
+	uint32_t end, n, i, ready = 0;
+#ifdef HPCAP_40G
+	uint32_t last;
+#endif
+
+#ifdef HPCAP_CONSUMERS_VIA_RINGS
+	end = ring_size(rx_ring);
+#else
+	end = minimo((qidx / bufp->descr_per_consumer + 1) * bufp->descr_per_consumer, ring_size(rx_ring));
+#endif
 
-	if (!bufp->can_free[consumer] && !atomic_read(&bufp->freed_last_rxd[previous_consumer(bufp, consumer)]))
-		if (get_last_descriptor_of_consumer(rx_ring, consumer) - rxd_to_read <= 8)
-			return 1;
+#ifdef HPCAP_40G
 
-	return 0;
+	/**
+	 * While the previous consumer has not returned its segment, ours can only
+	 * be returned up to a multiple of 8 before it, so the last 8 descriptors
+	 * are not read yet. A segment ending before descriptor 8 is not read at all.
+	 */
+	if (!bufp->can_free[thi->th_index] && !atomic_read(&bufp->freed_last_rxd[previous_consumer(bufp, thi->th_index)])) {
+		last = get_last_descriptor_of_consumer(rx_ring, thi->th_index);
+		end = minimo(end, last >= 8 ? last - 8 : thi->th_index * bufp->descr_per_consumer);
+	}
+
+#endif
+
+	n = end > qidx ? minimo(end - qidx, HPCAP_RX_SCAN) : 0;
+
+	for (i = 0; i < n; i++)
+		status[i] = rxd_status_word(ring_get_rxd(rx_ring, qidx + i));
+
+	for (i = 0; i < n; i++)
+		ready |= (uint32_t) ((status[i] & RXD_STATUS_WORD_DD) != 0) << i;
+
+	n = ready == ~0u ? 32 : ffz(ready);
+
+	thi->ready_start = qidx;
+	thi->ready_end = qidx + n;
+
+	return n;
 }
+#endif
 
 
-static inline int check4packet(HW_RING *rx_ring, rxd_idx_t *qidx, char *dst_buf, struct frame_descriptor *fd, size_t consumer)
+#ifndef HPCAP_MLNX
+/**
+ * Give a descriptor back to the NIC with its buffer.
+ */
+static inline void hpcap_rearm_rxd(HW_RING* rx_ring, rx_descr_t* rx_desc, uint32_t qidx)
 {
+	rx_desc->read.pkt_addr = rx_desc->read.hdr_addr = cpu_to_le64(packet_dma(rx_ring, qidx));
+
+#ifdef HPCAP_40G
+	rx_desc->wb.qword1.status_error_len = 0;
+#endif
+}
+#endif
+
+/**
+ * Read the next frame of the ring, gathering all its descriptors when it does
+ * not fit in one buffer (jumbo frames). A frame whose last descriptor is not
+ * written yet is left for the next call, from its first descriptor.
+ *
+ * @return 0 if there is no complete frame, -1 if there is one but no buffer
+ * to copy it to, its length otherwise.
+ */
+static inline int check4packet(HW_RING *rx_ring, rxd_idx_t *qidx, char *dst_buf, struct frame_descriptor *fd, struct hpcap_rx_thinfo* thi)
+{
+	size_t consumer = thi->th_index;
 	rx_descr_t* rx_desc;
 	uint8_t *buffer;
+	rxd_idx_t first = *qidx;
+	size_t len;
+	short more;
 
 	fd->parts        = 0;
 	fd->size         = 0;
-
-#ifdef JUMBO
+	fd->stored       = 0;
 
 	do {
-#endif
 #ifdef HPCAP_MLNX
-		rx_desc = ring_get_rxd(rx_ring, (*qidx), fd->_rxd + fd->parts);
-#else
-		rx_desc = ring_get_rxd(rx_ring, (*qidx));
-#endif
 
-		buffer = ring_get_buffer(rx_desc, rx_ring, (*qidx));
-		fd->pointer[fd->parts] = buffer;
-		fd->rx_desc[fd->parts] = rx_desc;
-
-#ifdef DO_PREFETCH
-		prefetchnta(buffer + MAX_DESCR_SIZE * 4);
-		prefetchnta(rx_desc + 2);
-#endif
+		if (!hpcap_mlx4_in_burst(&thi->cqes, *qidx) && !hpcap_mlx4_scan_cqes(rx_ring, &thi->cqes, *qidx, consumer))
+			return 0;
 
-#ifdef HPCAP_40G
+		rx_desc = ring_get_rxd(rx_ring, (*qidx), fd->_rxd + fd->parts);
+		rx_desc->clock = &thi->cqes.clock;
+#else
 
-		if (can_lock_ring(rx_ring, *qidx, consumer))
+		if (!hpcap_in_ready_run(thi, *qidx) && !hpcap_scan_ready(rx_ring, thi, *qidx)) {
+			*qidx = first;
 			return 0;
+		}
 
-#endif
+		rx_desc = ring_get_rxd(rx_ring, (*qidx));
 
-		if (unlikely(!rxd_has_data(rx_desc)))
-			return 0;
+		/**
+		 * Take it out of the run: when the consumer wraps back to it, it may not
+		 * be written yet, as with segments not longer than HPCAP_RX_SCAN.
+		 */
+		thi->ready_start = *qidx + 1;
+#endif
 
+		// The scan of the burst or run already checked that it has data
 		printdbg(DBG_RXEXTRA, "Found data in descriptor %zu\n", *qidx);
 
-		fd->size += rxd_length(rx_desc);
-		fd->parts++;
+		len = rxd_length(rx_desc);
+		more = rxd_is_jumbo(rx_desc);
 
-		*qidx = rxd_calc_next(rx_ring, *qidx, consumer);
+		fd->size += len;
+		fd->last_idx = *qidx;
 
-		if (!dst_buf)
-			return -1;
+		if (likely(fd->parts < MAX_DESCRIPTORS)) {
+			buffer = ring_get_buffer(rx_desc, rx_ring, (*qidx));
+			fd->pointer[fd->parts] = buffer;
+			fd->rx_desc[fd->parts] = rx_desc;
+			fd->len[fd->parts] = len;
+			fd->idx[fd->parts] = *qidx;
+			fd->stored += len;
+			fd->parts++;
 
-#ifdef JUMBO
+#ifdef DO_PREFETCH
+			prefetchnta(buffer + MAX_DESCR_SIZE * 4);
+			prefetchnta(rx_desc + 2);
+#endif
+		}
 
-		if (rxd_is_jumbo(rx_desc))
-			printk(KERN_INFO "[HPCAP] a jumboframe appeared (len: %zu)\n", rxd_length(rx_desc));
+		*qidx = rxd_calc_next(rx_ring, *qidx, consumer);
+	} while (unlikely(more));
 
-#endif
+#ifndef HPCAP_MLNX
 
-#ifdef REMOVE_DUPS
+	/**
+	 * Longer than MAX_JUMBO_SIZE: only the first parts are kept. Give back the
+	 * rest now that the frame is complete, it would not be read again otherwise.
+	 */
+	if (unlikely(fd->parts == MAX_DESCRIPTORS && fd->last_idx != fd->idx[fd->parts - 1])) {
+		rxd_idx_t extra = fd->idx[fd->parts - 1];
 
-		if (fd->parts == 1)
-			fd->rss_hash = rxd_hash(rx_desc);
+		do {
+			extra = rxd_calc_next(rx_ring, extra, consumer);
+			hpcap_rearm_rxd(rx_ring, ring_get_rxd(rx_ring, extra), extra);
+		} while (extra != fd->last_idx);
+	}
 
 #endif
 
-#ifdef RX_DEBUG
-
-		if (unlikely(rxd_has_error(rx_desc))) {
-			printk(KERN_INFO "found error frames\n");
-			return -1;
-		}
+	if (!dst_buf)
+		return -1;
 
+#ifdef REMOVE_DUPS
+	fd->rss_hash = rxd_hash(fd->rx_desc[0]);
 #endif
 
-#ifdef JUMBO
-	} while (unlikely(rxd_is_jumbo(rx_desc)));
+#ifdef RX_DEBUG
 
-	if (fd->parts > 1)
-		printk(KERN_INFO "[HPCAP] LAST descriptor - %d BYTES (%d fragments)\n", len, jd->parts);
+	// The errors are reported in the last descriptor of the frame
+	if (unlikely(rxd_has_error(fd->rx_desc[fd->parts - 1]))) {
+		printk(KERN_INFO "found error frames\n");
+		return -1;
+	}
 
 #endif
 
@@ -446,7 +690,7 @@ static inline size_t set_padding(uint8_t* dst_buf, size_t bufsize, size_t offset
 		return offset;
 
 	// Write the padding header into the buffer
-	offset = copy_to_circular_buffer(dst_buf, bufsize, offset, &rawh, RAW_HLEN);
+	offset = write_header_to_circular_buffer(dst_buf, bufsize, offset, &rawh);
 
 #ifdef BUF_DEBUG // In debug mode, fill the padding data with zeros.
 
@@ -460,29 +704,163 @@ static inline size_t set_padding(uint8_t* dst_buf, size_t bufsize, size_t offset
 	return offset;
 }
 
+#ifdef HPCAP_LOSS_RECORDS
+/**
+ * Account a frame the consumer received and could not store.
+ */
+static inline void hpcap_loss_account(struct hpcap_loss_record* loss, struct timespec* tv, size_t size)
+{
+	u64 ns = tv->tv_sec * 1000000000ull + tv->tv_nsec;
+
+	if (loss->first_ns == 0 || ns < loss->first_ns)
+		loss->first_ns = ns;
+
+	if (ns > loss->last_ns)
+		loss->last_ns = ns;
+
+	loss->frames++;
+	loss->bytes += size;
+}
+
+/**
+ * Take the drops the NIC reported in the queue (see hpcap_mark_nic_drops) into
+ * the loss record of the consumer.
+ */
+static inline void hpcap_loss_take_nic(struct hpcap_buf* bufp, struct hpcap_loss_record* loss)
+{
+	u64 drops = atomic64_xchg(&bufp->nic_drops, 0);
+	u64 from, to;
+
+	if (drops == 0)
+		return;
+
+	smp_rmb();
+	from = READ_ONCE(bufp->nic_drops_from);
+	to = READ_ONCE(bufp->nic_drops_to);
+
+	if (loss->first_ns == 0 || from < loss->first_ns)
+		loss->first_ns = from;
+
+	if (to > loss->last_ns)
+		loss->last_ns = to;
+
+	loss->nic_frames += drops;
+}
+
+static inline short hpcap_loss_pending(struct hpcap_loss_record* loss)
+{
+	return (loss->frames | loss->nic_frames) != 0;
+}
+
+/**
+ * Write the loss record of the consumer at the given offset, in the space
+ * reserved for the next frame, and clear it.
+ */
+static inline size_t write_loss_record(uint8_t* dst_buf, size_t bufsize, size_t offset, struct hpcap_loss_record* loss)
+{
+	struct raw_header rawh;
+
+	rawh.sec    = 0;
+	rawh.nsec   = HPCAP_LOSS_NSEC;
+	rawh.caplen = sizeof(struct hpcap_loss_record);
+	rawh.len    = 0;
+
+	offset = write_header_to_circular_buffer(dst_buf, bufsize, offset, &rawh);
+	offset = copy_to_circular_buffer(dst_buf, bufsize, offset, loss, sizeof(struct hpcap_loss_record), 0);
+	memset(loss, 0, sizeof(struct hpcap_loss_record));
+
+	return offset;
+}
+#else
+#define hpcap_loss_account(loss, tv, size) do {} while (0)
+#endif
+
 // Macros to convert a offset to the corresponding offset inside the buffer or inside the file.
 #define as_buffer_offset(offset) ((offset) % bufsize)
 #define as_file_offset(offset) ((offset) % HPCAP_FILESIZE)
 
+/**
+ * Set the commit watermark of the consumer before its first reservation: the
+ * space it reserves from now on starts at or after the current write offset.
+ * The store is ordered before the reservations, so the publisher sees the
+ * watermark whenever it sees one of them.
+ */
+static inline void hpcap_commit_begin(struct hpcap_buf* bufp, struct hpcap_rx_thinfo* thi)
+{
+	atomic64_set(&thi->commit_off, (u32) atomic_read(&bufp->consumer_write_off));
+	smp_wmb();
+}
+
+/**
+ * Clear the commit watermark once the frames reserved are written (and fenced).
+ */
+static inline void hpcap_commit_end(struct hpcap_rx_thinfo* thi)
+{
+	smp_wmb();
+	atomic64_set(&thi->commit_off, HPCAP_COMMIT_IDLE);
+}
+
+/**
+ * Reserve to_write bytes of the buffer, if they fit before the data the
+ * slowest listener has not read, keeping room for a padding header.
+ *
+ * Queues with a single writer reserve with a plain store, which skips the
+ * locked instruction (and the wait for the non-temporal stores of the previous
+ * frame); the others with a compare and exchange, as the check and the
+ * reservation must be atomic.
+ *
+ * @return 1 and the start of the space (as consumer_write_off) in offset_dst,
+ * 0 if there is no space.
+ */
+static inline short hpcap_reserve(struct hpcap_buf* bufp, size_t to_write, size_t* offset_dst)
+{
+	atomic_t* wr_offset = &bufp->consumer_write_off;
+	u32 old, rd;
+
+	do {
+		old = atomic_read(wr_offset);
+		rd = atomic_read(&bufp->consumer_read_off);
+
+		if (unlikely((u32) (old + to_write + RAW_HLEN - rd) >= bufp->bufSize))
+			return 0;
+
+		if (bufp->writers == 1) {
+			atomic_set(wr_offset, old + to_write);
+			break;
+		}
+	} while (atomic_cmpxchg(wr_offset, old, old + to_write) != old);
+
+	*offset_dst = old;
+
+	return 1;
+}
+
 uint64_t hpcap_rx(HW_RING *rx_ring, size_t limit, uint8_t *dst_buf, struct hpcap_rx_thinfo* thi)
 {
 	size_t fraglen, capl;
 	u64 cnt;
 	struct timespec tv;
 	struct raw_header rawh;
-	size_t read_descriptors = 0;
+	size_t read_descriptors = 0, released_descriptors = 0;
 	int i;
 	int ret;
 	struct frame_descriptor fd;
 	struct hpcap_buf *bufp = rx_ring->bufp;
 	size_t bufsize = bufp->bufSize;
-	atomic_t* wr_offset = &bufp->consumer_write_off;
 	size_t available, to_write;
 	size_t offset, offset_dst, file_final_offset, file_dst_offset, buffer_dst_offset = 0;
 	size_t caplen = atomic_read(&adapters[bufp->adapter]->caplen);
 	size_t padlen;
 	short owns_next_rxd = 1;
 	short out_of_space = 0;
+	short writing = 0;
+	size_t filtered = 0, unbuffered = 0, dups = 0;
+#ifdef HPCAP_MEASURE_LATENCY
+	short marked_unpushed = 0;
+#endif
+#ifdef HPCAP_LOSS_RECORDS
+	size_t loss_len = 0;
+#endif
 
 #ifdef REMOVE_DUPS
 	struct hpcap_dup_info** duptable = bufp->dupTable;
@@ -494,16 +872,32 @@ uint64_t hpcap_rx(HW_RING *rx_ring, size_t limit, uint8_t *dst_buf, struct hpcap
 
 	size_t total_rx_packets  = 0;
 	size_t total_rx_bytes    = 0;
-	HW_ADAPTER *adapter   = adapters[bufp->adapter];
-
-#ifdef REMOVE_DUPS
-	u32 total_dup_packets = 0;
-#endif
 
 #ifdef RX_DEBUG
 	int r_idx             = rx_ring->reg_idx;
 #endif
 
+#ifdef HPCAP_BURST_DETECTOR
+	hpcap_burst_check(&thi->burst, &bufp->burst_ctl, bufp->consumers);
+#endif
+
+	trace_hpcap_rx_enter(bufp, thi->th_index, next_qidx, limit);
+
+#ifdef HPCAP_LOSS_RECORDS
+
+	if (unlikely(atomic64_read(&bufp->nic_drops)))
+		hpcap_loss_take_nic(bufp, &thi->loss);
+
+	// Without listeners there is no stream, so no holes to report in it
+	if (unlikely(!dst_buf && hpcap_loss_pending(&thi->loss)))
+		memset(&thi->loss, 0, sizeof(struct hpcap_loss_record));
+
+#endif
+
+#if defined(HPCAP_TSC_TSTAMP) && defined(HPCAP_SW_TSTAMP)
+	hpcap_tstamp_batch_start(&thi->ts);
+#endif
+
 	for (cnt = 0, qidx = next_qidx;             // We have not received anything. Start by next_to_clean ring
 		 cnt < limit && !out_of_space;          // While our buffer presents more free space
 		 cnt += fd.size, qidx = next_qidx) {    // Increments the total number of bytes received and the ring
@@ -516,34 +910,47 @@ uint64_t hpcap_rx(HW_RING *rx_ring, size_t limit, uint8_t *dst_buf, struct hpcap
 
 		bufp_dbg(DBG_RXEXTRA, "Thread %zu is checking rxd %lu\n", thi->th_index, qidx);
 
-		if ((ret = check4packet(rx_ring, &next_qidx, dst_buf, &fd, thi->th_index)) == 0) {
+		if ((ret = check4packet(rx_ring, &next_qidx, dst_buf, &fd, thi)) == 0) {
 			// We have consumed all the packets in the card. Do not update qidx.
 			owns_next_rxd = !is_first_descriptor_of_consumer(rx_ring, qidx, thi->th_index);
 			break;
 		}
 
-		last_read_idx = qidx;
+		last_read_idx = fd.last_idx;
 		read_descriptors++;
 
 		total_rx_packets++;
 		total_rx_bytes += fd.size;
 
-		if (!passes_filter(bufp, &fd))
+		if (!passes_filter(bufp, &fd)) {
+			filtered++;
 			goto ignore;
+		}
 
-#ifdef HPCAP_HWTSTAMP
+#ifndef HPCAP_SW_TSTAMP
 		rxd_get_tstamp(fd.rx_desc[0], &tv, rx_ring);
 #else
-		getnstimeofday(&tv);
+#ifdef HPCAP_HWTSTAMP_PARTIAL
+		if (!rxd_get_tstamp(fd.rx_desc[fd.parts - 1], &tv, rx_ring))
+#endif
+#ifdef HPCAP_TSC_TSTAMP
+			hpcap_tstamp_frame(&thi->ts, fd.size, &tv);
+#else
+			getnstimeofday(&tv);
+#endif
 #endif
 
 #ifdef HPCAP_MEASURE_LATENCY
 		hpcap_latency_measure(&thi->lm, &tv, fd.pointer[0], fd.size);
 #endif
 
+#ifdef HPCAP_BURST_DETECTOR
+		hpcap_burst_account(&thi->burst, &tv, fd.size);
+#endif
+
 		if (ret < 0) {
 			// We do not own a buffer to write the data. Ignore it.
-			adapter->hpcap_client_discard++;
+			unbuffered++;
 			goto ignore;
 		}
 
@@ -553,7 +960,7 @@ uint64_t hpcap_rx(HW_RING *rx_ring, size_t limit, uint8_t *dst_buf, struct hpcap
 #ifdef REMOVE_DUPS
 
 		if (duptable && hpcap_check_duplicate(&fd, &tv, duptable)) {
-			total_dup_packets++;
+			dups++;
 			goto ignore;
 		}
 
@@ -563,9 +970,15 @@ uint64_t hpcap_rx(HW_RING *rx_ring, size_t limit, uint8_t *dst_buf, struct hpcap
 		hpcap_print_listener_status(&bufp->lstnr.global);
 #endif
 		// Update the size: minimum between current length and caplen (input argument)
-		capl = CALC_CAPLEN(caplen, fd.size);
+		capl = minimo(CALC_CAPLEN(caplen, fd.size), fd.stored);
 		to_write = capl + RAW_HLEN;
 
+#ifdef HPCAP_LOSS_RECORDS
+		// The losses not reported yet go in a record before the frame, in the same reservation
+		loss_len = hpcap_loss_pending(&thi->loss) ? HPCAP_LOSS_RECLEN : 0;
+		to_write += loss_len;
+#endif
+
 		do {
 			padlen = 0;
 
@@ -574,7 +987,7 @@ uint64_t hpcap_rx(HW_RING *rx_ring, size_t limit, uint8_t *dst_buf, struct hpcap
 			if (available < to_write + RAW_HLEN) {
 				// No space available. Discard this frame, finish this RX loop.
 				out_of_space = 1;
-				adapter->hpcap_client_loss++;
+				hpcap_loss_account(&thi->loss, &tv, fd.size);
 				goto ignore;
 			}
 
@@ -584,8 +997,28 @@ uint64_t hpcap_rx(HW_RING *rx_ring, size_t limit, uint8_t *dst_buf, struct hpcap
 			 * This requires that the HPCAP_FILESIZE and the buffer size divide the maximum
 			 * value of the integer (4GB).
 			 */
-			offset = atomic_add_return(to_write, wr_offset); // offset is now to_write + wr_offset.
-			offset_dst = offset - to_write; // Calculate the original value (before the add) of offset.
+#ifdef HPCAP_MEASURE_LATENCY
+
+			// Reception time of the first frame of this call, for the delivery latency
+			if (unlikely(!marked_unpushed)) {
+				atomic64_cmpxchg(&bufp->unpushed_since, 0, tv.tv_sec * 1000000000ull + tv.tv_nsec);
+				marked_unpushed = 1;
+			}
+
+#endif
+			if (unlikely(!writing)) {
+				hpcap_commit_begin(bufp, thi);
+				writing = 1;
+			}
+
+			if (unlikely(!hpcap_reserve(bufp, to_write, &offset_dst))) {
+				// The listeners did not read enough yet
+				out_of_space = 1;
+				hpcap_loss_account(&thi->loss, &tv, fd.size);
+				goto ignore;
+			}
+
+			offset = offset_dst + to_write;
 
 			/**
 			 * Update the offset in the file (for the padding check) and in the buffer (for the write)
@@ -619,8 +1052,10 @@ uint64_t hpcap_rx(HW_RING *rx_ring, size_t limit, uint8_t *dst_buf, struct hpcap
 				 * If possible, fill the beginning of the file with padding too.
 				 * Remember to calculate correctly the buffer offset, from offset_dst + padlen, because
 				 * if the filesize is less than the buffer, the padding may not go to the buffer offset 0.
+				 * Only if the reserved space reaches the next file: otherwise, the beginning of the file
+				 * belongs to the next reservations, maybe of another consumer.
 				 */
-				if (file_final_offset >= RAW_HLEN)
+				if (file_final_offset < file_dst_offset && file_final_offset >= RAW_HLEN)
 					set_padding(dst_buf, bufsize, as_buffer_offset(offset_dst + padlen), file_final_offset);
 
 			} else if (unlikely(file_dst_offset > 0 && file_dst_offset < RAW_HLEN)) {
@@ -631,7 +1066,7 @@ uint64_t hpcap_rx(HW_RING *rx_ring, size_t limit, uint8_t *dst_buf, struct hpcap
 				 * beginning of the file. Fill it now from the start of the file until
 				 * the position we reserved.
 				 */
-				padlen = as_buffer_offset(offset_dst + file_final_offset);
+				padlen = file_final_offset;
 				set_padding(dst_buf, bufsize, as_buffer_offset(offset_dst - file_dst_offset), padlen);
 			}
 		} while (unlikely(padlen > 0)); // Repeat to allocate space for the frame
@@ -639,37 +1074,36 @@ uint64_t hpcap_rx(HW_RING *rx_ring, size_t limit, uint8_t *dst_buf, struct hpcap
 		bufp_dbg(DBG_RXEXTRA, "Received frame of length %llu (caplen %zu), write to 0x%p + %zu (offset in file is %zu)\n",
 				 fd.size, capl, dst_buf, buffer_dst_offset, file_dst_offset);
 
+#ifdef HPCAP_LOSS_RECORDS
+
+		if (unlikely(loss_len > 0))
+			buffer_dst_offset = write_loss_record(dst_buf, bufsize, buffer_dst_offset, &thi->loss);
+
+#endif
+
 		// Every time that there is a packet: write the header into the buffer
 		rawh.sec    = tv.tv_sec;
 		rawh.nsec   = tv.tv_nsec;
 		rawh.caplen = capl;
 		rawh.len    = fd.size;
 
-		buffer_dst_offset = copy_to_circular_buffer(dst_buf, bufsize, buffer_dst_offset, &rawh, RAW_HLEN);
-
-		// write the payload into the buffer
-#ifdef JUMBO
+		buffer_dst_offset = write_header_to_circular_buffer(dst_buf, bufsize, buffer_dst_offset, &rawh);
 
-		for (i = 0; (i < fd.parts) && (capl > 0); i++) {
-#else
-		i = 0;
-#endif
-			fraglen = minimo(capl, MAX_DESCR_SIZE);
-			offset  = copy_to_circular_buffer(dst_buf, bufsize, buffer_dst_offset, fd.pointer[i], fraglen);
-#ifdef JUMBO
+		// write the payload into the buffer, cutting it at capl bytes
+		for (i = 0; i < fd.parts && capl > 0; i++) {
+			fraglen = minimo(capl, fd.len[i]);
+			buffer_dst_offset = copy_to_circular_buffer(dst_buf, bufsize, buffer_dst_offset, fd.pointer[i], fraglen,
+								bufp->writers == 1 && hpcap_copy_use_nt(fraglen));
 			capl -= fraglen;
 		}
 
-#endif
-
 ignore:
 
 #ifndef HPCAP_MLNX
-		fd.rx_desc[0]->read.pkt_addr = fd.rx_desc[0]->read.hdr_addr = cpu_to_le64(packet_dma(rx_ring, qidx));
 
-#ifdef HPCAP_40G
-		fd.rx_desc[0]->wb.qword1.status_error_len = 0;
-#endif
+		for (i = 0; i < fd.parts; i++)
+			hpcap_rearm_rxd(rx_ring, fd.rx_desc[i], fd.idx[i]);
+
 #else
 
 		// for (i = 0; i < rx_ring->priv->num_frags; i++)
@@ -684,27 +1118,39 @@ ignore:
 		if (read_descriptors % HPCAP_RX_BUFFER_WRITE == 0 || is_last_descriptor_of_consumer(rx_ring, last_read_idx, thi->th_index)) {
 			bufp_dbg(DBG_RXEXTRA, "Thread %zu returning descriptor block\n", thi->th_index);
 			hpcap_advance_read_descriptors(rx_ring, last_read_idx, thi);
+			released_descriptors = read_descriptors;
 		}
 	}
 
-	if (likely(read_descriptors > 0))
+	// The listeners are pushed over the frames once the watermark is cleared
+	if (likely(writing)) {
+		hpcap_copy_fence();
+		hpcap_commit_end(thi);
+	}
+
+	/**
+	 * Do not return again the descriptors returned in the loop: if they were the last of
+	 * the segment, it would be marked as freed twice and the next consumer would return its
+	 * descriptors while the previous one is still reading theirs.
+	 */
+	if (likely(read_descriptors > released_descriptors))
 	{
 		bufp_dbg(DBG_RXEXTRA, "Thread %zu RX loop finished, returning the %zu descriptors read (qidx = %lu)\n",
 				 thi->th_index, read_descriptors, (unsigned long) last_read_idx);
 		hpcap_advance_read_descriptors(rx_ring, last_read_idx, thi);
+	} else if (unlikely(thi->release_pending)) {
+		/**
+		 * Nothing new to return, but there are descriptors that we could not return before. If they
+		 * are the ones that the NIC needs to continue, nobody would return them otherwise.
+		 */
+		hpcap_advance_read_descriptors(rx_ring, thi->pending_rxd, thi);
 	}
 
 #ifdef HPCAP_MLNX
 	// mlx4_en_arm_cq(rx_ring->priv, rx_ring->cq);
 #endif
 
-#ifdef REMOVE_DUPS
-
-	if (likely(total_rx_packets > 0 || total_dup_packets > 0))
-#else
-	if (likely(total_rx_packets > 0))
-#endif
-	{
+	if (likely(total_rx_packets > 0)) {
 #ifndef HPCAP_MLNX
 		rx_ring->stats.packets += total_rx_packets;
 		rx_ring->stats.bytes += total_rx_bytes;
@@ -714,19 +1160,97 @@ ignore:
 		rx_ring->packets += total_rx_packets;
 		rx_ring->bytes += total_rx_bytes;
 #endif
-
-#ifdef REMOVE_DUPS
-		adapter->total_dup_frames += total_dup_packets;
-#endif
 	}
 
-	hpcap_profile_mark_batch(&thi->prof, cnt, total_rx_packets, read_descriptors, owns_next_rxd, cnt >= limit || out_of_space);
+	hpcap_stats_mark_drops(&thi->stats, filtered, dups, out_of_space, unbuffered);
+	hpcap_stats_mark_batch(&thi->stats, read_descriptors, total_rx_bytes, owns_next_rxd, cnt >= limit || out_of_space);
+
+	trace_hpcap_rx_exit(bufp, thi->th_index, thi->rxd_idx, read_descriptors, total_rx_bytes, cnt,
+						filtered + dups + out_of_space + unbuffered, owns_next_rxd, cnt >= limit || out_of_space);
 
 	return cnt;
 }
 
 extern HW_ADAPTER * adapters[HPCAP_MAX_NIC];
 
+void hpcap_update_listener_offsets(struct hpcap_buf* bufp)
+{
+	struct hpcap_buffer_listeners* lstnr = &bufp->lstnr;
+	size_t bufsize = bufp->bufSize;
+	size_t i, behind, oldest = 0;
+	u32 head, new_bytes;
+	s64 commit;
+
+	// Another listener is publishing, which pushes this one too
+	if (!spin_trylock(&lstnr->lock))
+		return;
+
+#if MAX_LISTENERS > 1
+	// The lossy listeners that lag do not hold the buffer
+	hpcap_skip_lossy_listeners(lstnr, bufp->published_off);
+
+	/**
+	 * Update RdPointer according to the slowest listener. In overwrite mode, the
+	 * data stays in the buffer until the consumers need the space.
+	 */
+	if (atomic_read(&bufp->overwrite))
+		hpcap_overwrite_oldest(lstnr, bufp->published_off);
+	else
+		hpcap_pop_global_listener(lstnr);
+#endif
+
+	head = atomic_read(&bufp->consumer_write_off);
+
+	// Pairs with hpcap_commit_begin: the watermark of every reservation in head is visible
+	smp_rmb();
+
+	for (i = 0; i < bufp->writers; i++) {
+		commit = atomic64_read(&bufp->consumers_thinfo[i].commit_off);
+
+		if (commit == HPCAP_COMMIT_IDLE)
+			continue;
+
+		// Watermarks set after head was read are ahead of it and hold nothing back
+		behind = (u32) (head - (u32) commit);
+
+		if (behind <= bufsize && behind > oldest)
+			oldest = behind;
+	}
+
+	// Pairs with hpcap_commit_end: the data before the watermarks is visible
+	smp_rmb();
+
+	/**
+	 * Everything before the oldest watermark is written. It can be behind the
+	 * data already published, which the consumer wrote in a previous call.
+	 */
+	new_bytes = head - oldest - bufp->published_off;
+
+	if (new_bytes > 0 && new_bytes <= bufsize) {
+		bufp_dbg(DBG_RX, "Pushing listeners: offset %u -> %u, %u new bytes\n",
+				 bufp->published_off, bufp->published_off + new_bytes, new_bytes);
+
+#ifdef HPCAP_MEASURE_LATENCY
+		// Before the push, so a listener never gets the data without its reception time
+		hpcap_mark_listeners_pending(lstnr, atomic64_xchg(&bufp->unpushed_since, 0));
+#endif
+
+		hpcap_push_all_listeners(lstnr, new_bytes);
+		bufp->published_off += new_bytes;
+
+#if MAX_LISTENERS > 1
+		hpcap_index_boundary(lstnr, bufp->published_off);
+#endif
+	}
+
+	bufp_dbg(DBG_RXEXTRA, "Updating read offset: %d -> %zu\n",
+			 atomic_read(&bufp->consumer_read_off), bufp->published_off - used_bytes(&lstnr->global));
+
+	atomic_set(&bufp->consumer_read_off, bufp->published_off - used_bytes(&lstnr->global));
+
+	spin_unlock(&lstnr->lock);
+}
+
 int hpcap_poll(void *arg)
 {
 	struct hpcap_rx_thinfo* thinfo = arg;
@@ -737,9 +1261,7 @@ int hpcap_poll(void *arg)
 	size_t limit;
 	uint8_t *rxbuf = NULL;
 	size_t num_list;
-	size_t new_bytes, new_offset;
 	size_t batch = 0, sleep_each_batches = 50000000;
-	size_t bufsize = bufp->bufSize;
 
 #ifdef DEBUG_SLOWDOWN
 	int i = 0;
@@ -761,7 +1283,11 @@ int hpcap_poll(void *arg)
 	while (!kthread_should_stop()) {
 		num_list = hpcap_listener_count(&bufp->lstnr);
 
-		if (unlikely(num_list <= 0)) {
+		if (atomic_read(&bufp->overwrite)) {
+			// Flight recorder: capture without listeners, publishing as we go to drop the oldest data
+			rxbuf = bufp->bufferCopia;
+			hpcap_update_listener_offsets(bufp);
+		} else if (unlikely(num_list <= 0)) {
 			rxbuf = NULL;
 			hpcap_global_listener_reset_offset(&bufp->lstnr);
 			hpcap_reset_buffer_offsets(bufp);
@@ -779,8 +1305,8 @@ int hpcap_poll(void *arg)
 			duptable = NULL;
 
 #endif
-		avail = avail_bytes(&bufp->lstnr.global);
-		limit = avail / bufp->consumers;
+		avail = hpcap_buffer_free(bufp);
+		limit = avail / bufp->writers;
 
 		retval = hpcap_rx(rx_ring, limit, rxbuf, thinfo);
 
@@ -793,7 +1319,7 @@ int hpcap_poll(void *arg)
 
 		// Only sleep after a certain amount of reception calls, to avoid losing frames.
 		if (retval == 0 && batch >= sleep_each_batches) {
-			hpcap_profile_mark_schedtimeout_start(&thinfo->prof);
+			hpcap_stats_mark_sleep_start(&thinfo->stats);
 #ifdef DEBUG_SLOWDOWN
 
 			// Sleep a lot so the debug output is readable
@@ -803,45 +1329,12 @@ int hpcap_poll(void *arg)
 #else
 			schedule_timeout(ns(50));
 #endif
-			hpcap_profile_mark_schedtimeout_end(&thinfo->prof);
+			hpcap_stats_mark_sleep_end(&thinfo->stats);
 
 			batch = 0;
 		}
 
-#ifdef HPCAP_MEASURE_LATENCY
-
-		if (thinfo->lm.measurements >= 100000)
-			hpcap_latency_print(&thinfo->lm, 1);
-
-#endif
-
 		batch++;
-
-		hpcap_profile_try_print(&thinfo->prof, thinfo);
-
-		// Only the first thread updates the pointers.
-		if (thinfo->th_index == 0) {
-
-#if MAX_LISTENERS > 1
-			/* Update RdPointer according to the slowest listener */
-			hpcap_pop_global_listener(&bufp->lstnr);
-#endif
-
-			new_offset = as_buffer_offset(atomic_read(&bufp->consumer_write_off));
-			new_bytes = distance(bufp->lstnr.global.bufferWrOffset, new_offset, bufp->bufSize);
-
-			if (new_bytes > 0) {
-				bufp_dbg(DBG_RX, "Thread 0 pushing listeners: offset %zu -> %zu, %zu new bytes\n",
-						 bufp->lstnr.global.bufferWrOffset, new_offset, new_bytes);
-
-				hpcap_push_all_listeners(&bufp->lstnr, new_bytes);
-			}
-
-			bufp_dbg(DBG_RXEXTRA, "Thread 0 updating read offset: %d -> %zu\n",
-					 atomic_read(&bufp->consumer_read_off), bufp->lstnr.global.bufferRdOffset);
-
-			atomic_set(&bufp->consumer_read_off, bufp->lstnr.global.bufferRdOffset);
-		}
 	}
 
 	HPRINTK(INFO, "Poll thread %zu stop.\n", thinfo->th_index);
@@ -876,14 +1369,98 @@ int hpcap_stop_poll_threads(HW_ADAPTER * adapter)
 	return 0;
 }
 
+void hpcap_init_consumers(HW_ADAPTER * adapter, struct hpcap_buf* bufp, size_t rxq)
+{
+	size_t j;
+	struct hpcap_rx_thinfo* thinfo;
+	size_t starting_consumer;
+	uint32_t first_rxd;
+
+#ifdef HPCAP_CONSUMERS_VIA_RINGS
+	bufp->consumers = 1;
+#else
+	bufp->consumers = adapter->consumers;
+#endif
+	bufp->descr_per_consumer = ring_size(adapter->rx_ring[rxq]) / bufp->consumers;
+	bufp->writers = adapter->consumers;
+
+	adapter_dbg(DBG_NET, "Poll threads not created on rxq %zu, starting %zu with %zu descriptors each\n", rxq, adapter->consumers, bufp->descr_per_consumer);
+
+	first_rxd = ring_get_next_rxd(adapter->rx_ring[rxq]);
+	starting_consumer = rxd_consumer_of(adapter->rx_ring[rxq], first_rxd);
+
+	hpcap_reset_buffer_offsets(bufp);
+
+	for (j = 0; j < adapter->consumers; j++) {
+		thinfo = &bufp->consumers_thinfo[j];
+		thinfo->th_index = j;
+		thinfo->write_offset = &bufp->consumer_write_off;
+		thinfo->read_offset = &bufp->consumer_read_off;
+		atomic64_set(&thinfo->commit_off, HPCAP_COMMIT_IDLE);
+		atomic_set(&bufp->freed_last_rxd[j], 0);
+		thinfo->release_pending = 0;
+
+#if defined(HPCAP_TSC_TSTAMP) && defined(HPCAP_SW_TSTAMP)
+		hpcap_tstamp_init(&thinfo->ts, HPCAP_TSTAMP_MODE);
+#endif
+
+#ifdef HPCAP_MLNX
+		thinfo->cqes.start = thinfo->cqes.end = 0;
+#else
+		thinfo->ready_start = thinfo->ready_end = 0;
+#endif
+
+#ifdef HPCAP_CONSUMERS_VIA_RINGS
+		// In this case, each consumer gets assigned a different ring.
+		thinfo->rx_ring = adapter->rx_ring[rxq + j];
+		thinfo->rxd_idx = ring_get_next_rxd(thinfo->rx_ring);
+		bufp->can_free[j] = 1;
+#else
+		thinfo->rx_ring = adapter->rx_ring[rxq];
+
+#ifdef HPCAP_MEASURE_LATENCY
+
+		if (hpcap_latency_alloc(&thinfo->lm.probe, adapter->numa_node) != 0)
+			HPRINTK(WARNING, "Cannot allocate the latency histogram of consumer %zu\n", j);
+
+		hpcap_latency_init(&thinfo->lm);
+#endif
+
+#ifdef HPCAP_BURST_DETECTOR
+
+		if (hpcap_burst_alloc(&thinfo->burst, adapter->numa_node) != 0)
+			HPRINTK(WARNING, "Cannot allocate the burst bins of consumer %zu, burst detection disabled\n", j);
+
+		hpcap_burst_reset(&thinfo->burst, &bufp->burst_ctl, bufp->consumers);
+#endif
+
+		if (j == starting_consumer) {
+			/**
+			 * If the next rxd to read is in the consumer's segment, set that one as the
+			 * first descriptor of this thread. Also, allow it to free its descriptors.
+			 */
+			thinfo->rxd_idx = first_rxd;
+			bufp->can_free[j] = 1;
+		} else {
+			/**
+			 * Else, next to read is the first in the segment, and this thread should
+			 * wait to be signaled for freeing its segments.
+			 */
+			thinfo->rxd_idx = j * bufp->descr_per_consumer;
+			bufp->can_free[j] = 0;
+		}
+
+#endif
+
+		adapter_dbg(DBG_NET, "Consumer %zu prepared, first rxd is %lu, starting consumer? %d\n", j, (unsigned long) thinfo->rxd_idx, starting_consumer == j);
+	}
+}
+
 int hpcap_launch_poll_threads(HW_ADAPTER * adapter)
 {
 	size_t i, j;
-	struct hpcap_rx_thinfo* thinfo;
 	struct hpcap_buf  *bufp;
 	size_t core_count = 0;
-	size_t starting_consumer;
-	uint32_t first_rxd;
 
 	if (adapter == NULL) {
 		BPRINTK(WARNING, "hpcap_launch_poll_threads received a null adapter ¿?");
@@ -895,7 +1472,7 @@ int hpcap_launch_poll_threads(HW_ADAPTER * adapter)
 	hpcap_check_naming(adapter);
 
 	if (adapter->core < 0) {
-		HPRINTK(ERR, "Configured core for is %d, invalid (should not be negative). Aborting thread start\n", adapter->core);
+		DPRINTK(DRV, ERR, "Configured core for is %d, invalid (should not be negative). Aborting thread start\n", adapter->core);
 		return 0;
 	}
 
@@ -920,60 +1497,10 @@ int hpcap_launch_poll_threads(HW_ADAPTER * adapter)
 			memset(bufp->bufferCopia, 0, bufp->bufSize);
 #endif
 
-#ifdef HPCAP_CONSUMERS_VIA_RINGS
-			bufp->consumers = 1;
-#else
-			bufp->consumers = adapter->consumers;
-#endif
-			bufp->descr_per_consumer = ring_size(adapter->rx_ring[i]) / bufp->consumers;
-
-			adapter_dbg(DBG_NET, "Poll threads not created on rxq %zu, starting %zu with %zu descriptors each\n", i, adapter->consumers, bufp->descr_per_consumer);
-
-			first_rxd = ring_get_next_rxd(adapter->rx_ring[i]);
-			starting_consumer = rxd_consumer_of(adapter->rx_ring[i], first_rxd);
-
-			hpcap_reset_buffer_offsets(bufp);
+			hpcap_init_consumers(adapter, bufp, i);
 
 			for (j = 0; j < adapter->consumers; j++) {
-				thinfo = &bufp->consumers_thinfo[j];
-				thinfo->th_index = j;
-				thinfo->write_offset = &bufp->consumer_write_off;
-				thinfo->read_offset = &bufp->consumer_read_off;
-				atomic_set(&bufp->freed_last_rxd[j], 0);
-
-#ifdef HPCAP_CONSUMERS_VIA_RINGS
-				// In this case, each consumer gets assigned a different ring.
-				thinfo->rx_ring = adapter->rx_ring[i + j];
-				thinfo->rxd_idx = ring_get_next_rxd(thinfo->rx_ring);
-				bufp->can_free[j] = 1;
-#else
-				thinfo->rx_ring = adapter->rx_ring[i];
-
-#ifdef HPCAP_MEASURE_LATENCY
-				hpcap_latency_init(&thinfo->lm);
-#endif
-
-				if (j == starting_consumer) {
-					/**
-					 * If the next rxd to read is in the consumer's segment, set that one as the
-					 * first descriptor of this thread. Also, allow it to free its descriptors.
-					 */
-					thinfo->rxd_idx = first_rxd;
-					bufp->can_free[j] = 1;
-				} else {
-					/**
-					 * Else, next to read is the first in the segment, and this thread should
-					 * wait to be signaled for freeing its segments.
-					 */
-					thinfo->rxd_idx = j * bufp->descr_per_consumer;
-					bufp->can_free[j] = 0;
-				}
-
-#endif
-
-				adapter_dbg(DBG_NET, "Preparing to launch thread %zu, first rxd is %lu, starting consumer? %d\n", j, first_rxd, starting_consumer == j);
-
-				bufp->consumer_threads[j] = kthread_create(hpcap_poll, (void *) thinfo, bufp->name);
+				bufp->consumer_threads[j] = kthread_create(hpcap_poll, (void *) &bufp->consumers_thinfo[j], bufp->name);
 
 				if (bufp->consumer_threads[j] == NULL || bufp->consumer_threads[j] == ERR_PTR(-ENOMEM)) {
 					HPRINTK(ERR, "Thread %zu could not be launched! Please restart the driver (and brace for a crash)", j);
@@ -997,4 +1524,6 @@ void hpcap_reset_buffer_offsets(struct hpcap_buf* bufp)
 {
 	atomic_set(&bufp->consumer_read_off, 0);
 	atomic_set(&bufp->consumer_write_off, 0);
+	bufp->published_off = 0;
+	bufp->lstnr.boundaries.count = 0;
 }
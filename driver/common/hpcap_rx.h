@@ -19,8 +19,12 @@
 struct  __attribute__((__packed__)) frame_descriptor {
 	int           parts;                      /**< Total number of valid parts. 1 represents a single frame, more a jumbo */
 	u64           size;                       /**< Size of the packet (include all fragments) */
+	u64           stored;                     /**< Bytes in the valid parts, less than size if the frame had more than MAX_DESCRIPTORS */
 	u8*           pointer[MAX_DESCRIPTORS];   /**< Pointer to every part of the frame */
 	rx_descr_t*   rx_desc[MAX_DESCRIPTORS];   /**< Pointer to every descriptor */
+	u16           len[MAX_DESCRIPTORS];       /**< Bytes in every part */
+	rxd_idx_t     idx[MAX_DESCRIPTORS];       /**< Ring index of every descriptor */
+	rxd_idx_t     last_idx;                   /**< Ring index of the last descriptor of the frame */
 #ifdef HPCAP_MLNX
 	rx_descr_t 	  _rxd[MAX_DESCRIPTORS];
 #endif
@@ -61,8 +65,43 @@ int hpcap_stop_poll_threads(HW_ADAPTER *adapter);
  */
 int hpcap_launch_poll_threads(HW_ADAPTER *adapter);
 
+/**
+ * Prepares the consumer thread information for the given RX queue:
+ * descriptor segments, starting descriptors and release permissions.
+ * Does not create any thread.
+ *
+ * @param adapter Adapter.
+ * @param bufp    HPCAP buffer of the queue.
+ * @param rxq     RX queue index.
+ */
+void hpcap_init_consumers(HW_ADAPTER *adapter, struct hpcap_buf* bufp, size_t rxq);
+
+/**
+ * Moves the listeners forward to the last offset up to which every consumer
+ * finished writing (the oldest commit watermark, or the write offset if none
+ * is writing), and updates the buffer read offset according to the slowest
+ * one. Called by the listeners before they wait for data, so the consumers do
+ * not spend time on it. Does nothing if another listener is already doing it.
+ *
+ * @param bufp HPCAP buffer.
+ */
+void hpcap_update_listener_offsets(struct hpcap_buf* bufp);
+
 rx_descr_t* rxd_get(HW_RING* ring, size_t idx);
 
+/**
+ * Bytes of the buffer that the consumers can still reserve: neither reserved
+ * nor waiting to be read by the slowest listener.
+ *
+ * @param bufp HPCAP buffer.
+ */
+static inline size_t hpcap_buffer_free(struct hpcap_buf* bufp)
+{
+	size_t used = (u32) (atomic_read(&bufp->consumer_write_off) - atomic_read(&bufp->consumer_read_off));
+
+	return used < bufp->bufSize ? bufp->bufSize - used - 1 : 0;
+}
+
 /**
  * Resets the read/write offsets of the HPCAP buffer.
  * @param bufp HPCAP handle.
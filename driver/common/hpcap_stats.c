@@ -0,0 +1,130 @@
+/**
+ * @brief RX counters of the HPCAP consumers.
+ *
+ * @see hpcap_stats.h for the description of the counters.
+ *
+ * @addtogroup HPCAP
+ * @{
+ */
+
+#include <linux/kernel.h>
+
+#include "driver_hpcap.h"
+#include "hpcap_types.h"
+#include "hpcap_stats.h"
+#include "hpcap_debug.h"
+
+DEFINE_STATIC_KEY_FALSE(hpcap_stats_key);
+
+/**
+ * Start or stop the collection of the optional counters in every queue.
+ * Patches the code, so it can sleep.
+ * @param bufp Buffer the request came through, for the log.
+ */
+void hpcap_stats_set_enabled(struct hpcap_buf *bufp, short enable)
+{
+	if (enable && !static_key_enabled(&hpcap_stats_key)) {
+		static_branch_enable(&hpcap_stats_key);
+		HPRINTK(INFO, "RX statistics enabled in every queue\n");
+	} else if (!enable && static_key_enabled(&hpcap_stats_key)) {
+		static_branch_disable(&hpcap_stats_key);
+		HPRINTK(INFO, "RX statistics disabled in every queue\n");
+	}
+}
+
+/**
+ * Copy the counters of a consumer one word at a time, so none of them is torn.
+ */
+static void hpcap_stats_copy(const struct hpcap_rx_stats *s, struct hpcap_rx_counters *dst)
+{
+	const uint64_t *src = (const uint64_t *) &s->c;
+	uint64_t *out = (uint64_t *) dst;
+	size_t i;
+
+	for (i = 0; i < sizeof(struct hpcap_rx_counters) / sizeof(uint64_t); i++)
+		out[i] = READ_ONCE(src[i]);
+}
+
+/**
+ * Apply info->enable and fill info with the counters of every consumer of
+ * the buffer.
+ */
+void hpcap_stats_get_info(struct hpcap_buf *bufp, struct hpcap_stats_info *info)
+{
+	size_t i;
+
+	if (info->enable >= 0)
+		hpcap_stats_set_enabled(bufp, info->enable);
+
+	info->enabled = static_key_enabled(&hpcap_stats_key);
+	info->consumers = bufp->consumers;
+
+	for (i = 0; i < bufp->consumers; i++)
+		hpcap_stats_copy(&bufp->consumers_thinfo[i].stats, &info->counters[i]);
+}
+
+/**
+ * Set the client loss/discard (and duplicate) statistics of the adapter to
+ * the sum of the counters of the consumers of all its queues.
+ */
+void hpcap_stats_update_adapter(HW_ADAPTER *adapter)
+{
+	struct hpcap_buf *bufp;
+	struct hpcap_rx_counters *c;
+	u64 loss = 0, discard = 0;
+#ifdef REMOVE_DUPS
+	u64 dups = 0;
+#endif
+	int i;
+	size_t j;
+
+	for (i = 0; i < adapter->num_rx_queues; i++) {
+		if (adapter->rx_ring[i] == NULL || (bufp = adapter->rx_ring[i]->bufp) == NULL)
+			continue;
+
+		for (j = 0; j < bufp->consumers; j++) {
+			c = &bufp->consumers_thinfo[j].stats.c;
+			loss += READ_ONCE(c->buffer_full_drops);
+			discard += READ_ONCE(c->unbuffered_drops);
+#ifdef REMOVE_DUPS
+			dups += READ_ONCE(c->dup_drops);
+#endif
+		}
+	}
+
+	adapter->hpcap_client_loss = loss;
+	adapter->hpcap_client_discard = discard;
+#ifdef REMOVE_DUPS
+	adapter->total_dup_frames = dups;
+#endif
+}
+
+#ifdef HPCAP_LOSS_RECORDS
+/**
+ * Report the frames the NIC dropped in the queue of the buffer since the
+ * previous call, read from its counters. The next consumer that stores a frame
+ * takes them into its next loss record (see hpcap_rx).
+ */
+void hpcap_mark_nic_drops(struct hpcap_buf *bufp, u64 drops)
+{
+	struct timespec ts;
+	u64 now;
+
+	getnstimeofday(&ts);
+	now = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+	if (drops > 0) {
+		// A consumer may take the drops in between: the range is only approximate
+		if (atomic64_read(&bufp->nic_drops) == 0)
+			WRITE_ONCE(bufp->nic_drops_from, bufp->nic_read_ns ? bufp->nic_read_ns : now);
+
+		WRITE_ONCE(bufp->nic_drops_to, now);
+		smp_wmb();
+		atomic64_add(drops, &bufp->nic_drops);
+	}
+
+	bufp->nic_read_ns = now;
+}
+#endif
+
+/** @} */
@@ -0,0 +1,114 @@
+/**
+ * @brief RX counters of the HPCAP consumers.
+ *
+ * Every consumer keeps its counters in its own cache line of its thread
+ * information, so they are plain single-writer updates that never bounce
+ * between cores. The drop counters are always kept, and are what the client
+ * loss/discard statistics of the adapter are built from. The rest are only
+ * updated while the static key hpcap_stats_key is enabled: when it is not,
+ * each check is a patched-out jump.
+ *
+ * Readers (HPCAP_IOC_STATS, ethtool) read the counters without locks: each
+ * one is a 64-bit word written with WRITE_ONCE.
+ *
+ * @addtogroup HPCAP
+ * @{
+ */
+
+#ifndef HPCAP_STATS_H
+#define HPCAP_STATS_H
+
+#include <linux/types.h>
+#include <linux/cache.h>
+#include <linux/ktime.h>
+#include <linux/jump_label.h>
+
+#include "hpcap.h"
+
+struct hpcap_buf;
+
+/**
+ * Counters of a consumer and the state needed to update them.
+ */
+struct hpcap_rx_stats {
+	struct hpcap_rx_counters c;
+	u64 sleep_start;		/**< Start of the current sleep, 0 if not measured */
+} ____cacheline_aligned;
+
+DECLARE_STATIC_KEY_FALSE(hpcap_stats_key);
+
+#define hpcap_stats_enabled() static_branch_unlikely(&hpcap_stats_key)
+
+#define hpcap_stats_add(s, field, value) WRITE_ONCE((s)->c.field, (s)->c.field + (value))
+
+/**
+ * Account a call of hpcap_rx. The drops are counted in local variables by the
+ * caller and added here once per call.
+ */
+static inline void hpcap_stats_mark_batch(struct hpcap_rx_stats *s, size_t descriptors, size_t bytes,
+		short owns_next_rxd, short budget_exhausted)
+{
+	if (!hpcap_stats_enabled())
+		return;
+
+	hpcap_stats_add(s, polls, 1);
+
+	if (descriptors > 0) {
+		hpcap_stats_add(s, descriptors, descriptors);
+		hpcap_stats_add(s, bytes, bytes);
+	} else if (owns_next_rxd) {
+		hpcap_stats_add(s, empty_polls, 1);
+	} else {
+		hpcap_stats_add(s, not_owned_polls, 1);
+	}
+
+	if (budget_exhausted)
+		hpcap_stats_add(s, budget_exhausted, 1);
+}
+
+/**
+ * Add the frames dropped in a call of hpcap_rx, counted by the caller in local
+ * variables. These counters are always kept.
+ */
+static inline void hpcap_stats_mark_drops(struct hpcap_rx_stats *s, size_t filtered, size_t dups, size_t full,
+		size_t unbuffered)
+{
+	if (likely((filtered | dups | full | unbuffered) == 0))
+		return;
+
+	hpcap_stats_add(s, filter_drops, filtered);
+	hpcap_stats_add(s, dup_drops, dups);
+	hpcap_stats_add(s, buffer_full_drops, full);
+	hpcap_stats_add(s, unbuffered_drops, unbuffered);
+}
+
+/**
+ * Account a return of descriptors to the NIC.
+ */
+static inline void hpcap_stats_mark_release(struct hpcap_rx_stats *s)
+{
+	if (hpcap_stats_enabled())
+		hpcap_stats_add(s, releases, 1);
+}
+
+static inline void hpcap_stats_mark_sleep_start(struct hpcap_rx_stats *s)
+{
+	s->sleep_start = hpcap_stats_enabled() ? ktime_get_ns() : 0;
+}
+
+static inline void hpcap_stats_mark_sleep_end(struct hpcap_rx_stats *s)
+{
+	// Only measured if the statistics were already enabled when the thread went to sleep
+	if (s->sleep_start == 0 || !hpcap_stats_enabled())
+		return;
+
+	hpcap_stats_add(s, sleeps, 1);
+	hpcap_stats_add(s, sleep_ns, ktime_get_ns() - s->sleep_start);
+}
+
+void hpcap_stats_set_enabled(struct hpcap_buf *bufp, short enable);
+void hpcap_stats_get_info(struct hpcap_buf *bufp, struct hpcap_stats_info *info);
+
+/** @} */
+
+#endif
@@ -0,0 +1,15 @@
+/**
+ * @brief Instantiation of the HPCAP tracepoints.
+ *
+ * @see hpcap_trace.h for the events.
+ *
+ * @addtogroup HPCAP
+ * @{
+ */
+
+#include "hpcap_types.h"
+
+#define CREATE_TRACE_POINTS
+#include "hpcap_trace.h"
+
+/** @} */
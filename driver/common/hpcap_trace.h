@@ -0,0 +1,244 @@
+/**
+ * @brief Tracepoints of the HPCAP capture path.
+ *
+ * Exposed under the "hpcap" system in tracefs (events/hpcap/), so perf,
+ * ftrace and eBPF tools can attach to them without debug information:
+ *
+ * @code
+ *   perf record -e 'hpcap:*' -a -- sleep 10
+ *   bpftrace scripts/bpftrace/hpcap-profile.bt 0
+ * @endcode
+ *
+ * Every event carries the adapter and queue of the buffer. When they are not
+ * enabled, each tracepoint is a patched-out jump, so they are always built.
+ *
+ * This header is read several times by the kernel trace machinery, which is
+ * why it uses TRACE_HEADER_MULTI_READ instead of a plain include guard. The
+ * events are instantiated in hpcap_trace.c.
+ *
+ * @addtogroup HPCAP
+ * @{
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM hpcap
+
+#if !defined(HPCAP_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define HPCAP_TRACE_H
+
+#include <linux/tracepoint.h>
+
+struct hpcap_buf;
+
+/**
+ * Start of a call of hpcap_rx: the consumer will read from descriptor rxd
+ * on, writing at most limit bytes.
+ */
+TRACE_EVENT(hpcap_rx_enter,
+	TP_PROTO(const struct hpcap_buf *bufp, size_t consumer, u32 rxd, size_t limit),
+	TP_ARGS(bufp, consumer, rxd, limit),
+
+	TP_STRUCT__entry(
+		__field(int, adapter)
+		__field(int, queue)
+		__field(u32, consumer)
+		__field(u32, rxd)
+		__field(u64, limit)
+	),
+
+	TP_fast_assign(
+		__entry->adapter = bufp->adapter;
+		__entry->queue = bufp->queue;
+		__entry->consumer = consumer;
+		__entry->rxd = rxd;
+		__entry->limit = limit;
+	),
+
+	TP_printk("adapter=%d queue=%d consumer=%u rxd=%u limit=%llu",
+		__entry->adapter, __entry->queue, __entry->consumer, __entry->rxd, __entry->limit)
+);
+
+/**
+ * End of a call of hpcap_rx. written counts the bytes reserved in the buffer
+ * (headers and paddings included); offset is the write offset of the buffer
+ * after the call. owned is 0 if the loop stopped at a descriptor of the next
+ * consumer, full is 1 if it stopped because its share of the buffer was full.
+ */
+TRACE_EVENT(hpcap_rx_exit,
+	TP_PROTO(const struct hpcap_buf *bufp, size_t consumer, u32 next_rxd, size_t descriptors, size_t bytes,
+			 u64 written, size_t drops, short owned, short full),
+	TP_ARGS(bufp, consumer, next_rxd, descriptors, bytes, written, drops, owned, full),
+
+	TP_STRUCT__entry(
+		__field(int, adapter)
+		__field(int, queue)
+		__field(u32, consumer)
+		__field(u32, next_rxd)
+		__field(u32, descriptors)
+		__field(u32, drops)
+		__field(u64, bytes)
+		__field(u64, written)
+		__field(u32, offset)
+		__field(u8, owned)
+		__field(u8, full)
+	),
+
+	TP_fast_assign(
+		__entry->adapter = bufp->adapter;
+		__entry->queue = bufp->queue;
+		__entry->consumer = consumer;
+		__entry->next_rxd = next_rxd;
+		__entry->descriptors = descriptors;
+		__entry->drops = drops;
+		__entry->bytes = bytes;
+		__entry->written = written;
+		__entry->offset = atomic_read(&bufp->consumer_write_off);
+		__entry->owned = owned;
+		__entry->full = full;
+	),
+
+	TP_printk("adapter=%d queue=%d consumer=%u next_rxd=%u descriptors=%u bytes=%llu written=%llu drops=%u offset=%u owned=%u full=%u",
+		__entry->adapter, __entry->queue, __entry->consumer, __entry->next_rxd, __entry->descriptors,
+		__entry->bytes, __entry->written, __entry->drops, __entry->offset, __entry->owned, __entry->full)
+);
+
+/**
+ * A consumer tried to return its descriptors up to last_rxd to the NIC.
+ * released is 0 when it had to defer it because the previous consumer has not
+ * returned its segment yet.
+ */
+TRACE_EVENT(hpcap_release_rxd,
+	TP_PROTO(const struct hpcap_buf *bufp, size_t consumer, u32 last_rxd, u32 next_rxd, short released),
+	TP_ARGS(bufp, consumer, last_rxd, next_rxd, released),
+
+	TP_STRUCT__entry(
+		__field(int, adapter)
+		__field(int, queue)
+		__field(u32, consumer)
+		__field(u32, last_rxd)
+		__field(u32, next_rxd)
+		__field(u8, released)
+	),
+
+	TP_fast_assign(
+		__entry->adapter = bufp->adapter;
+		__entry->queue = bufp->queue;
+		__entry->consumer = consumer;
+		__entry->last_rxd = last_rxd;
+		__entry->next_rxd = next_rxd;
+		__entry->released = released;
+	),
+
+	TP_printk("adapter=%d queue=%d consumer=%u last_rxd=%u next_rxd=%u released=%u",
+		__entry->adapter, __entry->queue, __entry->consumer, __entry->last_rxd, __entry->next_rxd,
+		__entry->released)
+);
+
+/**
+ * New bytes made visible to the listeners. offset is the write offset of the
+ * global listener after the push.
+ */
+TRACE_EVENT(hpcap_push_listeners,
+	TP_PROTO(const struct hpcap_buf *bufp, u64 bytes, size_t offset, int listeners),
+	TP_ARGS(bufp, bytes, offset, listeners),
+
+	TP_STRUCT__entry(
+		__field(int, adapter)
+		__field(int, queue)
+		__field(u64, bytes)
+		__field(u64, offset)
+		__field(int, listeners)
+	),
+
+	TP_fast_assign(
+		__entry->adapter = bufp->adapter;
+		__entry->queue = bufp->queue;
+		__entry->bytes = bytes;
+		__entry->offset = offset;
+		__entry->listeners = listeners;
+	),
+
+	TP_printk("adapter=%d queue=%d bytes=%llu offset=%llu listeners=%d",
+		__entry->adapter, __entry->queue, __entry->bytes, __entry->offset, __entry->listeners)
+);
+
+/**
+ * The read offset of the global listener advanced to the slowest listener.
+ * used is what is left unread by that listener after the pop.
+ */
+TRACE_EVENT(hpcap_pop_global_listener,
+	TP_PROTO(const struct hpcap_buf *bufp, u64 bytes, size_t offset, size_t used),
+	TP_ARGS(bufp, bytes, offset, used),
+
+	TP_STRUCT__entry(
+		__field(int, adapter)
+		__field(int, queue)
+		__field(u64, bytes)
+		__field(u64, offset)
+		__field(u64, used)
+	),
+
+	TP_fast_assign(
+		__entry->adapter = bufp->adapter;
+		__entry->queue = bufp->queue;
+		__entry->bytes = bytes;
+		__entry->offset = offset;
+		__entry->used = used;
+	),
+
+	TP_printk("adapter=%d queue=%d bytes=%llu offset=%llu used=%llu",
+		__entry->adapter, __entry->queue, __entry->bytes, __entry->offset, __entry->used)
+);
+
+DECLARE_EVENT_CLASS(hpcap_listener_wait_class,
+	TP_PROTO(const struct hpcap_buf *bufp, int listener, u64 desired, u64 avail),
+	TP_ARGS(bufp, listener, desired, avail),
+
+	TP_STRUCT__entry(
+		__field(int, adapter)
+		__field(int, queue)
+		__field(int, listener)
+		__field(u64, desired)
+		__field(u64, avail)
+	),
+
+	TP_fast_assign(
+		__entry->adapter = bufp->adapter;
+		__entry->queue = bufp->queue;
+		__entry->listener = listener;
+		__entry->desired = desired;
+		__entry->avail = avail;
+	),
+
+	TP_printk("adapter=%d queue=%d listener=%d desired=%llu avail=%llu",
+		__entry->adapter, __entry->queue, __entry->listener, __entry->desired, __entry->avail)
+);
+
+/**
+ * A listener starts waiting for desired bytes, with avail already there.
+ */
+DEFINE_EVENT(hpcap_listener_wait_class, hpcap_listener_wait,
+	TP_PROTO(const struct hpcap_buf *bufp, int listener, u64 desired, u64 avail),
+	TP_ARGS(bufp, listener, desired, avail)
+);
+
+/**
+ * A listener returns from the wait with avail bytes (timeout, kill or enough
+ * data).
+ */
+DEFINE_EVENT(hpcap_listener_wait_class, hpcap_listener_wake,
+	TP_PROTO(const struct hpcap_buf *bufp, int listener, u64 desired, u64 avail),
+	TP_ARGS(bufp, listener, desired, avail)
+);
+
+#endif /* HPCAP_TRACE_H */
+
+/** @} */
+
+/* The kernel build adds the source directory to the include path (see scripts/mkmakefile) */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE hpcap_trace
+
+#include <trace/define_trace.h>
@@ -0,0 +1,117 @@
+/**
+ * @brief TSC timestamps of the HPCAP consumers.
+ *
+ * @see hpcap_tstamp.h for the description of the conversion.
+ *
+ * @addtogroup HPCAP
+ * @{
+ */
+
+#include <linux/string.h>
+
+#include "hpcap_tstamp.h"
+#include "hpcap_types.h"
+
+/**
+ * Wire time of a byte in ps at the line rate of the adapter.
+ */
+#ifdef HPCAP_40G
+#define HPCAP_TSTAMP_PS_PER_BYTE 200
+#else
+#define HPCAP_TSTAMP_PS_PER_BYTE 800
+#endif
+
+void hpcap_tstamp_init(struct hpcap_tstamp *ts, int mode)
+{
+	memset(ts, 0, sizeof(struct hpcap_tstamp));
+	ts->mode = mode;
+	ts->ps_per_byte = HPCAP_TSTAMP_PS_PER_BYTE;
+}
+
+/**
+ * Restart the conversion at the given point, forgetting the previous stamps
+ * (the time went backwards).
+ */
+static void hpcap_tstamp_step(struct hpcap_tstamp *ts, u64 tsc, u64 now)
+{
+	ts->tsc_base = tsc;
+	ts->ns_base = now;
+	ts->last_ns = 0;
+	ts->next_ns = 0;
+	ts->prev_batch_ns = 0;
+	ts->steps++;
+}
+
+/**
+ * Read the wall clock and update the conversion.
+ * @param tsc TSC read by the caller.
+ * @return Time of tsc with the new conversion.
+ */
+u64 hpcap_tstamp_calibrate(struct hpcap_tstamp *ts, u64 tsc)
+{
+	struct timespec tv;
+	u64 now, dns, dtsc, rate;
+	s64 err;
+
+	getnstimeofday(&tv);
+	now = timespec_to_ns(&tv);
+
+	dtsc = tsc - ts->cal_tsc;
+	dns = now - ts->cal_ns;
+
+	if (ts->cal_tsc == 0 || dtsc == 0 || (s64) dns <= 0 || dns > 4 * HPCAP_TSC_CALIBRATION_NS) {
+		/**
+		 * First reading, a wall clock that went backwards or a consumer that was
+		 * idle for long: the interval is no good to measure the rate. Keep the one
+		 * we have, if any, and measure again.
+		 */
+		ts->cal_tsc = tsc;
+		ts->cal_ns = now;
+
+		if (ts->mult == 0)
+			return now;
+
+		if (now < ts->last_ns) {
+			hpcap_tstamp_step(ts, tsc, now);
+		} else {
+			ts->tsc_base = tsc;
+			ts->ns_base = now;
+		}
+
+		ts->next_calibration = tsc + div64_u64((u64) HPCAP_TSC_CALIBRATION_NS << HPCAP_TSC_SHIFT, ts->mult);
+		return now;
+	}
+
+	// Before the first calibration, wait for a full period to get a good rate
+	if (ts->mult == 0 && dns < HPCAP_TSC_CALIBRATION_NS)
+		return now;
+
+	rate = div64_u64(dns << HPCAP_TSC_SHIFT, dtsc);
+
+	if (ts->mult == 0) {
+		ts->tsc_base = tsc;
+		ts->ns_base = now;
+		ts->mult = rate;
+	} else {
+		ts->ns_base = hpcap_tstamp_convert(ts, tsc);
+		ts->tsc_base = tsc;
+		err = now - ts->ns_base;
+
+		if (err > (s64) HPCAP_TSC_MAX_SLEW_NS || err < -(s64) HPCAP_TSC_MAX_SLEW_NS) {
+			// The wall clock was set during the interval, so its rate is no good either
+			hpcap_tstamp_step(ts, tsc, now);
+		} else {
+			// Absorb the difference in the next period: mult = rate * (1 + err / period)
+			ts->mult = rate + div64_s64((s64) rate * err, HPCAP_TSC_CALIBRATION_NS);
+		}
+	}
+
+	ts->cal_tsc = tsc;
+	ts->cal_ns = now;
+	ts->next_calibration = tsc + div64_u64(dtsc * HPCAP_TSC_CALIBRATION_NS, dns);
+	ts->calibrations++;
+
+	return ts->ns_base;
+}
+
+/** @} */
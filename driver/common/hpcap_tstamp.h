@@ -0,0 +1,155 @@
+/**
+ * @brief TSC timestamps of the HPCAP consumers.
+ *
+ * Each consumer converts TSC readings to wall clock time with its own
+ * (base, mult) pair:
+ *
+ *   ns = ns_base + ((tsc - tsc_base) * mult) >> HPCAP_TSC_SHIFT
+ *
+ * The pair is recalibrated against getnstimeofday every
+ * HPCAP_TSC_CALIBRATION_NS. A calibration keeps the conversion continuous at
+ * that point, and picks the rate of the next period so the difference with the
+ * wall clock is absorbed during it (a slew), so the stamps of a consumer never
+ * go backwards. Differences larger than HPCAP_TSC_MAX_SLEW_NS (the wall clock
+ * was set, or the consumer was idle for long) step the conversion instead.
+ * Until the first calibration, a consumer uses getnstimeofday.
+ *
+ * Only the consumer uses its clock, so there is no locking at all.
+ *
+ * @addtogroup HPCAP
+ * @{
+ */
+
+#ifndef HPCAP_TSTAMP_H
+#define HPCAP_TSTAMP_H
+
+#include <linux/types.h>
+#include <linux/time.h>
+#include <linux/math64.h>
+#include <linux/timex.h>
+
+#include "hpcap.h"
+
+#define HPCAP_TSC_SHIFT 24
+
+/**
+ * Bytes of Ethernet overhead not in the frame length: preamble, inter-frame
+ * gap and FCS (stripped by the NIC).
+ */
+#define HPCAP_TSTAMP_WIRE_OVERHEAD 24
+
+/**
+ * Clock and stamping state of a consumer.
+ */
+struct hpcap_tstamp {
+	u64 tsc_base;			/**< TSC of the conversion base */
+	u64 ns_base;			/**< Wall clock time given to tsc_base */
+	u32 mult;				/**< Conversion factor, 0 until the first calibration */
+	u64 next_calibration;	/**< TSC of the next calibration */
+	u64 cal_tsc;			/**< TSC of the last wall clock reading, 0 if none */
+	u64 cal_ns;				/**< Wall clock time of that reading */
+	u64 calibrations;		/**< Calibrations done */
+	u64 steps;				/**< Calibrations that stepped the conversion */
+
+	int mode;				/**< HPCAP_TSTAMP_* */
+	u32 ps_per_byte;		/**< Wire time of a byte at line rate, for the spread mode */
+	u64 batch_ns;			/**< Time of the current call of the RX loop, 0 until its first frame */
+	u64 prev_batch_ns;		/**< Time of the previous call with frames */
+	u64 last_ns;			/**< Last timestamp given */
+	u64 next_ns;			/**< Earliest time of the next frame in the spread mode */
+};
+
+void hpcap_tstamp_init(struct hpcap_tstamp *ts, int mode);
+u64 hpcap_tstamp_calibrate(struct hpcap_tstamp *ts, u64 tsc);
+
+/**
+ * Convert a TSC reading with the current calibration.
+ */
+static inline u64 hpcap_tstamp_convert(const struct hpcap_tstamp *ts, u64 tsc)
+{
+	return ts->ns_base + mul_u64_u32_shr(tsc - ts->tsc_base, ts->mult, HPCAP_TSC_SHIFT);
+}
+
+/**
+ * Current wall clock time in ns, from the TSC. Calibrates when it is due.
+ */
+static inline u64 hpcap_tstamp_now(struct hpcap_tstamp *ts)
+{
+	u64 tsc = get_cycles();
+
+	if (unlikely((s64) (tsc - ts->next_calibration) >= 0))
+		return hpcap_tstamp_calibrate(ts, tsc);
+
+	return hpcap_tstamp_convert(ts, tsc);
+}
+
+/**
+ * Start a call of the RX loop. Nothing is read until the first frame.
+ */
+static inline void hpcap_tstamp_batch_start(struct hpcap_tstamp *ts)
+{
+	if (ts->batch_ns != 0) {
+		ts->prev_batch_ns = ts->batch_ns;
+		ts->batch_ns = 0;
+	}
+}
+
+/**
+ * Timestamp of a frame of the spread mode: right after the previous one at
+ * line rate, but not before the start of the window of this call nor after
+ * the time of the call.
+ */
+static inline u64 hpcap_tstamp_spread(struct hpcap_tstamp *ts, size_t len)
+{
+	u64 ns, window;
+
+	if (ts->batch_ns == 0) {
+		ts->batch_ns = hpcap_tstamp_now(ts);
+		window = ts->prev_batch_ns == 0 ? 0 : minimo(ts->batch_ns - ts->prev_batch_ns, HPCAP_TSTAMP_SPREAD_MAX_NS);
+		ts->next_ns = maximo(ts->next_ns, ts->batch_ns - window);
+	}
+
+	ns = minimo(ts->next_ns, ts->batch_ns);
+	ts->next_ns = ns + (len + HPCAP_TSTAMP_WIRE_OVERHEAD) * ts->ps_per_byte / 1000;
+
+	return ns;
+}
+
+/**
+ * Timestamp of a frame of len bytes, according to the mode of the consumer.
+ */
+static inline void hpcap_tstamp_frame(struct hpcap_tstamp *ts, size_t len, struct timespec *tv)
+{
+	u64 ns;
+
+	switch (ts->mode) {
+		case HPCAP_TSTAMP_FRAME:
+			ns = hpcap_tstamp_now(ts);
+			break;
+
+		case HPCAP_TSTAMP_BATCH:
+			if (ts->batch_ns == 0)
+				ts->batch_ns = hpcap_tstamp_now(ts);
+
+			ns = ts->batch_ns;
+			break;
+
+		case HPCAP_TSTAMP_SPREAD:
+			ns = hpcap_tstamp_spread(ts, len);
+			break;
+
+		default:
+			getnstimeofday(tv);
+			return;
+	}
+
+	if (unlikely(ns < ts->last_ns))
+		ns = ts->last_ns;
+
+	ts->last_ns = ns;
+	*tv = ns_to_timespec(ns);
+}
+
+/** @} */
+
+#endif
@@ -20,6 +20,9 @@
 #include "hpcap.h"
 
 #include "hpcap_latency.h"
+#include "hpcap_burst.h"
+#include "hpcap_stats.h"
+#include "hpcap_tstamp.h"
 
 #if defined(HPCAP_IXGBE) || defined(HPCAP_IXGBEN)
 #include "ixgbe.h"
@@ -63,16 +66,26 @@ typedef union i40e_rx_desc rx_descr_t;
 									 	& I40E_RXD_QW1_STATUS_MASK) >> I40E_RXD_QW1_STATUS_SHIFT))
 #define rxd_has_data(rx_desc) 	(rxd_status(rx_desc) & BIT(I40E_RX_DESC_STATUS_DD_SHIFT))
 #define rxd_has_error(rx_desc) 	(le32_to_cpu((rx_desc)->wb.upper.status_error) & IXGBE_RXDADV_ERR_FRAME_ERR_MASK)
-#define rxd_is_jumbo(rx_desc) 	(!(le32_to_cpu((rx_desc)->wb.upper.status_error) & IXGBE_RXD_STAT_EOP))
+#define rxd_is_jumbo(rx_desc) 	(!(rxd_status(rx_desc) & BIT(I40E_RX_DESC_STATUS_EOF_SHIFT)))
+#define rxd_status_word(rx_desc) le64_to_cpu((rx_desc)->wb.qword1.status_error_len)	/**< Word with the DD bit */
+#define RXD_STATUS_WORD_DD		BIT_ULL(I40E_RX_DESC_STATUS_DD_SHIFT)
 #else
 #define rxd_hash(rx_desc) 		le32_to_cpu(rx_desc->wb.lower.hi_dword.rss)
 #define rxd_length(rx_desc) 	le16_to_cpu(rx_desc->wb.upper.length)
 #define rxd_has_data(rx_desc) 	(le32_to_cpu((rx_desc)->wb.upper.status_error) & IXGBE_RXD_STAT_DD)
 #define rxd_has_error(rx_desc) 	(le32_to_cpu((rx_desc)->wb.upper.status_error) & IXGBE_RXDADV_ERR_FRAME_ERR_MASK)
 #define rxd_is_jumbo(rx_desc) 	(!(le32_to_cpu((rx_desc)->wb.upper.status_error) & IXGBE_RXD_STAT_EOP))
+#define rxd_status_word(rx_desc) le32_to_cpu((rx_desc)->wb.upper.status_error)	/**< Word with the DD bit */
+#define RXD_STATUS_WORD_DD		IXGBE_RXD_STAT_DD
 #endif
 
+#if defined(HPCAP_I40E) && defined(HPCAP_I40E_HWTSTAMP) && defined(HAVE_PTP_1588_CLOCK)
+#define HPCAP_HWTSTAMP
+#define HPCAP_HWTSTAMP_PARTIAL	/**< Only some frames carry a hardware timestamp */
+#define ring_has_hw_tstamp(ring) ((ring)->vsi->back->ptp_rx)
+#else
 #define ring_has_hw_tstamp(R) (0)
+#endif
 
 #if defined(HPCAP_IXGBE)
 
@@ -122,6 +135,10 @@ typedef uint16_t rxd_idx_t;
 
 #define ring_rxd_release(R,i) i40e_release_rx_desc((R), (i))
 
+#ifdef HPCAP_HWTSTAMP
+int rxd_get_tstamp(rx_descr_t*, struct timespec*, HW_RING*);
+#endif
+
 #endif /* HPCAP_IXGBEVF */
 #elif defined(HPCAP_MLNX)  /* HPCAP_IXGBEVF || HPCAP_IXGBE */
 #define HPCAP_HWTSTAMP
@@ -137,6 +154,24 @@ struct hpcap_mlx4_rx_desc {
 	struct mlx4_en_rx_alloc* frags;
 	size_t fcs_del;
 	uint32_t cq_mask;
+	struct timecounter* clock;	/**< Clock snapshot of the burst of the CQE */
+};
+
+/**
+ * CQEs a consumer checks at once. The ready ones are processed as a burst:
+ * one barrier, one DMA sync per contiguous run of fragments, one snapshot of
+ * the clock of the device for their timestamps, and the next CQEs prefetched.
+ */
+#define HPCAP_MLX4_CQE_BURST 16
+
+/**
+ * Burst of ready CQEs of a consumer, [start, end) in CQ consumer index.
+ */
+struct hpcap_mlx4_cqe_burst {
+	uint32_t start;
+	uint32_t end;
+	struct cyclecounter cycles;	/**< Snapshot of mdev->cycles, taken with the burst */
+	struct timecounter clock;	/**< Snapshot of mdev->clock, reading cycles */
 };
 
 typedef struct mlx4_en_priv HW_ADAPTER;
@@ -163,6 +198,13 @@ typedef uint32_t rxd_idx_t;
 
 #endif  /* HPCAP_MLNX */
 
+/**
+ * Frames without hardware timestamp get one from the consumer.
+ */
+#if !defined(HPCAP_HWTSTAMP) || defined(HPCAP_HWTSTAMP_PARTIAL)
+#define HPCAP_SW_TSTAMP
+#endif
+
 
 /**
  * Structure representing a client consuming data from the HPCAP
@@ -176,11 +218,51 @@ struct hpcap_listener {
 	size_t bufferWrOffset; /**< Offset of the last write in the HPCAP buffer. */
 	size_t bufferRdOffset; /**< Offset of the last read from the client in the buffer */
 	size_t bufsz;		/**< Size of the HPCAP buffer */
+	int group;			/**< Index of its group in hpcap_buffer_listeners.groups, HPCAP_NO_GROUP if none */
+	atomic_t claiming;	/**< Set by a group member while it claims a block, see hpcap_pop_global_listener */
+	size_t max_lag;		/**< Bytes it can lag before the publisher skips it forward, 0 if lossless */
+	u64 skip_pending;	/**< Bytes skipped not reported to the listener yet. Written with the lock held */
+	u64 skipped_bytes;	/**< Bytes skipped since the listener was added */
+	u64 skips;			/**< Times it was skipped */
+	u64 spliced;		/**< Bytes after the read offset handed to pipes and not released yet, see hpcap_splice_read. Written with the lock held */
+	u64 splice_head;	/**< Sequence number of the oldest splice call not popped yet. Written with the lock held */
+	u64 splice_tail;	/**< Sequence number of the next splice call. Written with the lock held */
+	u64 splice_done;	/**< Bit per call in flight (sequence % HPCAP_SPLICE_CALLS) set once the pipes released it */
+	u64 splice_bytes[HPCAP_SPLICE_CALLS];	/**< Bytes of each call in flight, by sequence % HPCAP_SPLICE_CALLS */
 	struct file* filp;	/**< Pointer to the associated file structure */
+#ifdef HPCAP_MEASURE_LATENCY
+	atomic64_t pending_since;	/**< Reception time of the oldest frame pushed but not returned to the listener yet, 0 if none */
+	struct hpcap_latency_sampler* delivery;	/**< Delivery latency of the listeners that used this slot */
+#endif
 };
 
 #define MAX_FORCE_KILLED_LISTENERS (3 * MAX_LISTENERS)
 
+/**
+ * Listeners that split the stream of a buffer among them: each member reads
+ * the blocks it claims from the group cursor.
+ *
+ * @see hpcap_listeners.h
+ */
+struct hpcap_listener_group {
+	atomic_t id;		/**< Identification chosen by the members, HPCAP_LISTENER_EMPTY if the slot is free */
+	atomic_t members;	/**< Listeners in the group */
+	atomic_t cursor;	/**< Start of the data no member claimed, as consumer_write_off. Always at a record boundary */
+};
+
+/**
+ * Frame boundaries of the published data, which the publisher adds as it
+ * publishes, spaced at least 1/HPCAP_SKIP_INDEX of the buffer.
+ *
+ * @see hpcap_skip_lossy_listeners, hpcap_overwrite_oldest, hpcap_snapshot
+ */
+struct hpcap_boundary_index {
+	u32 off[HPCAP_SKIP_INDEX];	/**< Ring of boundaries, as consumer_write_off */
+	u64 ns[HPCAP_SKIP_INDEX];	/**< Time each boundary was published: the frames before it were received earlier */
+	size_t next;				/**< Entry for the next boundary */
+	size_t count;				/**< Valid entries */
+};
+
 /**
  * This structure holds all the information for the listeners linked to a buffer.
  *
@@ -189,6 +271,9 @@ struct hpcap_listener {
 struct hpcap_buffer_listeners {
 	struct hpcap_listener listeners[MAX_LISTENERS]; /**< Array of listeners */
 	struct hpcap_listener global;	/**< Global (master) listener pointer */
+	struct hpcap_listener_group groups[MAX_LISTENERS];	/**< Groups of listeners */
+	struct hpcap_boundary_index boundaries;	/**< Where the lossy listeners can be skipped to. Written with the lock held */
+	u64 overwritten_bytes;			/**< Bytes dropped by the overwrite mode. Written with the lock held */
 	spinlock_t lock;		 		/**< Lock for write access over the array */
 	atomic_t listeners_count;	 	/**< Number of active listeners. */
 	atomic_t already_popped;		/**< Detects whether the listeners already read some frames. Useful to avoid misaligned accesses. */
@@ -196,28 +281,8 @@ struct hpcap_buffer_listeners {
 	atomic_t force_killed_listeners; 	/**< Number of listeners that were force killed. No atomics as we suppose prod */
 };
 
-struct hpcap_profile {
-	uint64_t descriptors;
-	uint64_t bytes;
-	uint64_t frames;
-	uint64_t times_ring_empty;
-	uint64_t times_rxd_not_owned;
-	uint64_t released_descriptors;
-	uint64_t num_releases;
-	uint64_t budgets_exhausted;
-	uint64_t timeout_jiffies;
-	uint64_t sleeps;
-	uint64_t strike_duration;
-	uint64_t strikes;
-
-	uint64_t _prev_jiffies;
-	size_t _prev_rxd;
-	size_t _rxd_marked;
-	size_t _current_strike;
-
-	size_t samples;
-
-};
+/** Value of hpcap_rx_thinfo.commit_off while the consumer is not writing */
+#define HPCAP_COMMIT_IDLE (-1LL)
 
 /**
  * Structure with the information for each RXQ consumer thread.
@@ -225,14 +290,42 @@ struct hpcap_profile {
 struct hpcap_rx_thinfo {
 	atomic_t* write_offset;
 	atomic_t* read_offset;
+	/**
+	 * Commit watermark: while the consumer writes frames, an offset of the
+	 * buffer (as consumer_write_off) at or before the start of its first space
+	 * reserved and not written yet. HPCAP_COMMIT_IDLE otherwise.
+	 */
+	atomic64_t commit_off;
 	size_t th_index;
 	HW_RING* rx_ring;
-	struct hpcap_profile prof;
 	rxd_idx_t rxd_idx;
+	rxd_idx_t pending_rxd; /**< Last descriptor read but not returned yet because the previous consumer had not freed its segment */
+	short release_pending; /**< Whether pending_rxd is valid */
 
 #ifdef HPCAP_MEASURE_LATENCY
 	struct hpcap_latency_measurements lm;
 #endif
+
+#ifdef HPCAP_BURST_DETECTOR
+	struct hpcap_burst burst;	/**< Microburst detector of the frames received by this consumer */
+#endif
+
+#if defined(HPCAP_TSC_TSTAMP) && defined(HPCAP_SW_TSTAMP)
+	struct hpcap_tstamp ts;	/**< TSC clock of this consumer */
+#endif
+
+#ifdef HPCAP_MLNX
+	struct hpcap_mlx4_cqe_burst cqes;	/**< CQEs found ready and not read yet */
+#else
+	rxd_idx_t ready_start;	/**< Run of descriptors found ready and not read yet, [ready_start, ready_end) */
+	rxd_idx_t ready_end;
+#endif
+
+#ifdef HPCAP_LOSS_RECORDS
+	struct hpcap_loss_record loss;	/**< Losses not reported in the stream yet, written before the next frame */
+#endif
+
+	struct hpcap_rx_stats stats;	/**< RX counters, in their own cache line */
 };
 
 /**
@@ -253,7 +346,9 @@ struct hpcap_buf {
 	u64 bufSize;		/**< Size of the buffer */
 
 	atomic_t consumer_write_off; /**< Write offset for the consumers (pointer to the first free offset in the buffer) */
-	atomic_t consumer_read_off;  /**< Read offset for the consumer (next position to be read by userspace) */
+	atomic_t consumer_read_off;  /**< Read offset for the consumers (as consumer_write_off, next position to be read by the slowest listener) */
+	u32 published_off;			 /**< Offset (as consumer_write_off) up to which the data was pushed to the listeners */
+	atomic_t overwrite;			 /**< If 1, the consumers capture without listeners and the oldest data is dropped when the buffer fills */
 
 	struct task_struct* consumer_threads[MAX_CONSUMERS_PER_Q]; /**< Pointer to the consumer threads' managers */
 	struct hpcap_rx_thinfo consumers_thinfo[MAX_CONSUMERS_PER_Q]; /**< Pointer to the consumer threads' information */
@@ -261,6 +356,7 @@ struct hpcap_buf {
 	short can_free[MAX_CONSUMERS_PER_Q]; /**< Marker for whether a consumer can free its descriptors. It can only free them when the descriptors from the previous sector have been already freed */
 	size_t descr_per_consumer;			 /**< Number of descriptors for each consumer */
 	size_t consumers;					 /**< Number of consumers for the buffer */
+	size_t writers;						 /**< Consumer threads writing to the buffer, more than consumers with HPCAP_CONSUMERS_VIA_RINGS */
 
 	struct hpcap_buffer_listeners lstnr; /**< Structure controlling the listeners for this buffer */
 
@@ -274,9 +370,12 @@ struct hpcap_buf {
 	struct hpcap_dup_info ** dupTable;	/**< Table for duplicate checking */
 #endif
 
-	struct page** huge_pages;	/**< Pointer to the first page of the hugepage buffer, or NULL if no buffer exists */
-	char huge_pages_file[MAX_HUGETLB_FILE_LEN]; /**< File backing the hugepage buffer. */
+	struct page** huge_pages;	/**< Head pages of the hugepages of the buffer, in order, or NULL if no buffer exists */
+	char huge_pages_file[MAX_HUGETLB_FILE_LEN]; /**< File backing the hugepage buffer (the first one if there are several). */
 	int huge_pages_num;			/**< Number of hugepages assigned to the buffer */
+	int huge_files;				/**< Number of hugetlbfs files backing the buffer */
+	size_t huge_page_size;		/**< Size of the hugepages of the buffer (2 MB or 1 GB) */
+	short huge_vmapped;			/**< 1 if bufferCopia is a vmap of the hugepages in 4 KB pages, 0 if it is their linear mapping */
 	char * old_buffer;			/**< Pointer to the HPCAP buffer present before mapping the hugepages. It will be recovered when unmapping hugepages. */
 	u64 old_bufSize;			/**< Size of the old HPCAP buffer */
 
@@ -287,8 +386,20 @@ struct hpcap_buf {
 	size_t filter_lengths[HPCAP_MAX_FILTERS];
 	short filter_reject_on_match[HPCAP_MAX_FILTERS];
 
-#ifdef HPCAP_PROFILING
-	short has_printed_profile_help;
+#ifdef HPCAP_MEASURE_LATENCY
+	atomic64_t unpushed_since;	/**< Reception time of the oldest frame written but not pushed to the listeners yet, 0 if none */
+	spinlock_t latency_lock;	/**< Serializes the readers of the latency histograms */
+#endif
+
+#ifdef HPCAP_BURST_DETECTOR
+	struct hpcap_burst_control burst_ctl;	/**< Configuration of the burst detectors of the consumers */
+#endif
+
+#ifdef HPCAP_LOSS_RECORDS
+	atomic64_t nic_drops;		/**< Frames the NIC dropped in this queue, not taken by a consumer yet */
+	u64 nic_drops_from;			/**< Previous read of the NIC counters before those drops */
+	u64 nic_drops_to;			/**< Last read of the NIC counters that found drops */
+	u64 nic_read_ns;			/**< Last read of the NIC counters */
 #endif
 };
 
@@ -68,8 +68,10 @@ int hpcap_mmap(struct file *filp, struct vm_area_struct *vma)
 {
 	struct hpcap_buf *bufp = hpcap_buffer_of(filp);
 	unsigned long len;
-	unsigned long int phys, pfn;
-#ifndef DO_BUF_ALLOC
+	unsigned long int pfn;
+#ifdef DO_BUF_ALLOC
+	unsigned long int phys;
+#else
 	unsigned long mapaddr, kaddr;
 	struct page *page;
 	int npag, err = 0;
@@ -94,13 +96,6 @@ int hpcap_mmap(struct file *filp, struct vm_area_struct *vma)
 
 	if (1) {
 		phys = virt_to_phys((void *)bufp->bufferCopia);
-#else
-
-	if (has_hugepages(bufp)) {
-		bufp_dbg(DBG_MEM, "HPCAP: Remapping hugepages.\n");
-		phys = virt_to_phys((void *) page_address(bufp->huge_pages[0]));
-#endif
-
 		pfn = phys >> PAGE_SHIFT;
 
 		if (remap_pfn_range(vma, vma->vm_start, pfn, len, vma->vm_page_prot)) {
@@ -109,6 +104,25 @@ int hpcap_mmap(struct file *filp, struct vm_area_struct *vma)
 		}
 
 		bufp_dbg(DBG_MEM, "Buffer mapped at 0x%08lx, sized %lu bytes [offset=%lu] [ALLOC]\n", vma->vm_start, len, phys - (pfn << PAGE_SHIFT));
+#else
+
+	if (has_hugepages(bufp)) {
+		bufp_dbg(DBG_MEM, "HPCAP: Remapping hugepages.\n");
+		npag = 0;
+
+		/* Each hugepage is contiguous, but they need not be contiguous between them */
+		for (mapaddr = vma->vm_start; mapaddr < vma->vm_end && npag < bufp->huge_pages_num; mapaddr += bufp->huge_page_size) {
+			pfn = page_to_pfn(bufp->huge_pages[npag++]);
+
+			if (remap_pfn_range(vma, mapaddr, pfn, minimo(bufp->huge_page_size, vma->vm_end - mapaddr), vma->vm_page_prot)) {
+				printk(KERN_ERR "HPCAP: Error when trying to remap_pfn_range hugepage %d of %d\n", npag, bufp->huge_pages_num);
+				atomic_dec(&bufp->mmapCount);
+				return -EAGAIN;
+			}
+		}
+
+		bufp_dbg(DBG_MEM, "Buffer mapped at 0x%08lx, sized %lu bytes, as %d hugepages\n", vma->vm_start, len, npag);
+#endif
 	} else {
 		kaddr = (unsigned long) bufp->bufferCopia;
 		kaddr = (kaddr >> PAGE_SHIFT) << PAGE_SHIFT;
@@ -160,3 +174,13 @@ int hpcap_buffer_check(struct hpcap_buf* bufp)
 
 	return 0;
 }
+
+struct page* hpcap_buffer_page(struct hpcap_buf* bufp, size_t offset)
+{
+	void* addr = &bufp->bufferCopia[offset];
+
+	if (is_vmalloc_or_module_addr(addr))
+		return vmalloc_to_page(addr);
+
+	return virt_to_page(addr);
+}
@@ -26,5 +26,14 @@ int hpcap_mmap(struct file *filp, struct vm_area_struct *vma);
  */
 int hpcap_buffer_check(struct hpcap_buf* bufp);
 
+/**
+ * Page of the buffer that holds the given offset, whatever memory backs the
+ * buffer (module memory, kmalloc or vmapped hugepages).
+ * @param  bufp   Buffer
+ * @param  offset Offset in the buffer.
+ * @return        Page.
+ */
+struct page* hpcap_buffer_page(struct hpcap_buf* bufp, size_t offset);
+
 #endif
 
@@ -81,6 +81,10 @@
 #include "hpcap_sysfs_types.h"
 #endif
 
+#ifdef HPCAP_I40E_HWTSTAMP
+#include "hpcap_phc.h"
+#endif
+
 #endif
 
 /* Useful i40e defaults */
@@ -612,6 +616,10 @@ struct i40e_pf {
 	unsigned long latch_events[4];
 	bool ptp_tx;
 	bool ptp_rx;
+#if defined(DEV_HPCAP) && defined(HPCAP_I40E_HWTSTAMP)
+	struct hpcap_phc hpcap_phc; /* PHC to wall clock conversion of the RX timestamps */
+	struct delayed_work hpcap_phc_work; /* Refreshes hpcap_phc */
+#endif /* DEV_HPCAP && HPCAP_I40E_HWTSTAMP */
 #endif /* HAVE_PTP_1588_CLOCK */
 #ifdef I40E_ADD_PROBES
 	u64 tcp_segs;
@@ -819,6 +827,7 @@ struct i40e_vsi {
 	int work_mode;
 	atomic_t dup_mode;
 	atomic_t caplen;
+	int hpcap_mtu; /**< MTU set at probe, 0 keeps the default */
 	size_t bufpages;
 	int node;
 	size_t consumers;
@@ -1144,6 +1153,9 @@ void i40e_ptp_rx_hang(struct i40e_pf *pf);
 void i40e_ptp_tx_hang(struct i40e_pf *pf);
 void i40e_ptp_tx_hwtstamp(struct i40e_pf *pf);
 void i40e_ptp_rx_hwtstamp(struct i40e_pf *pf, struct sk_buff *skb, u8 index);
+#if defined(DEV_HPCAP) && defined(HPCAP_I40E_HWTSTAMP)
+int i40e_ptp_hpcap_rx_tstamp(struct i40e_pf *pf, u8 index, u64 *ns);
+#endif
 void i40e_ptp_set_increment(struct i40e_pf *pf);
 int i40e_ptp_set_ts_config(struct i40e_pf *pf, struct ifreq *ifr);
 int i40e_ptp_get_ts_config(struct i40e_pf *pf, struct ifreq *ifr);
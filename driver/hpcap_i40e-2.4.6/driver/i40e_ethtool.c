@@ -25,6 +25,9 @@
 
 #include "i40e.h"
 #include "i40e_diag.h"
+#ifdef DEV_HPCAP
+#include "driver_hpcap.h"
+#endif
 
 #ifdef SIOCETHTOOL
 #ifndef ETH_GSTRING_LEN
@@ -2439,6 +2442,13 @@ static int i40e_get_sset_count(struct net_device *netdev, int sset)
 
 		i40e_update_stats(vsi);
 
+#ifdef DEV_HPCAP
+
+		if (is_hpcap_adapter(vsi))
+			hpcap_stats_update_adapter(vsi);
+
+#endif
+
 		for (j = 0; j < I40E_NETDEV_STATS_LEN; j++) {
 			p = (char *)net_stats + i40e_gstrings_net_stats[j].stat_offset;
 			data[i++] = (i40e_gstrings_net_stats[j].sizeof_stat ==
@@ -2602,6 +2602,13 @@ static int i40e_change_mtu(struct net_device *netdev, int new_mtu)
 	if ((new_mtu < 68) || (max_frame > I40E_MAX_RXBUFFER))
 		return -EINVAL;
 
+#ifdef DEV_HPCAP
+
+	if (hpcap_check_mtu(vsi, new_mtu))
+		return -EINVAL;
+
+#endif /* DEV_HPCAP */
+
 #ifndef HAVE_NDO_FEATURES_CHECK
 
 	/* MTU < 576 causes problems with TSO */
@@ -3587,6 +3594,14 @@ static int i40e_vsi_configure_rx(struct i40e_vsi *vsi)
 
 #endif /* CONFIG_I40E_DISABLE_PACKET_SPLIT */
 
+#ifdef DEV_HPCAP
+
+	/* HPCAP rings have MAX_DESCR_SIZE buffers: longer frames are chained */
+	if (is_hpcap_adapter(vsi) && vsi->rx_buf_len > MAX_DESCR_SIZE)
+		vsi->rx_buf_len = MAX_DESCR_SIZE;
+
+#endif /* DEV_HPCAP */
+
 	/* set up individual rings */
 	for (i = 0; i < vsi->num_queue_pairs && !err; i++)
 		err = i40e_configure_rx_ring(vsi->rx_rings[i]);
@@ -11896,6 +11911,10 @@ struct i40e_vsi *i40e_vsi_setup(struct i40e_pf * pf, u8 type,
 			if (ret)
 				goto err_netdev;
 
+#ifdef DEV_HPCAP
+			hpcap_set_mtu(vsi, vsi->netdev);
+#endif /* DEV_HPCAP */
+
 			ret = register_netdev(vsi->netdev);
 
 			if (ret)
@@ -110,6 +110,79 @@ static void i40e_ptp_convert_to_hwtstamp(struct skb_shared_hwtstamps *hwtstamps,
 
 	hwtstamps->hwtstamp = ns_to_ktime(timestamp);
 }
+#if defined(DEV_HPCAP) && defined(HPCAP_I40E_HWTSTAMP)
+
+/* Readings of the PHC per correlation sample, keeping the fastest one */
+#define I40E_PTP_HPCAP_SAMPLES 3
+
+/**
+ * i40e_ptp_hpcap_sample - Read the PHC and the wall clock at the same time
+ * @pf: Board private structure
+ * @phc: PHC time read
+ * @sys: wall clock time at the middle of that reading
+ *
+ * The PHC is read between two readings of the wall clock. Register reads can
+ * be delayed by the PCIe bus or interrupted, so it is read a few times and the
+ * reading with the narrowest bracket is kept. Called under tmreg_lock.
+ **/
+static void i40e_ptp_hpcap_sample(struct i40e_pf *pf, u64 *phc, u64 *sys)
+{
+	struct timespec64 ts;
+	struct timespec before, after;
+	u64 width, narrowest = ~0ull;
+	int i;
+
+	for (i = 0; i < I40E_PTP_HPCAP_SAMPLES; i++) {
+		getnstimeofday(&before);
+		i40e_ptp_read(pf, &ts);
+		getnstimeofday(&after);
+
+		width = timespec_to_ns(&after) - timespec_to_ns(&before);
+
+		if (width < narrowest) {
+			narrowest = width;
+			*phc = timespec64_to_ns(&ts);
+			*sys = timespec_to_ns(&before) + width / 2;
+		}
+	}
+}
+
+/**
+ * i40e_ptp_hpcap_resync - Rebase the hpcap timestamp conversion
+ * @pf: Board private structure
+ *
+ * Called under tmreg_lock right after the PHC was set, so the RX timestamps
+ * do not take the new time as a drift to slew.
+ **/
+static void i40e_ptp_hpcap_resync(struct i40e_pf *pf)
+{
+	u64 phc, sys;
+
+	i40e_ptp_hpcap_sample(pf, &phc, &sys);
+	hpcap_phc_resync(&pf->hpcap_phc, phc, sys);
+}
+
+/**
+ * i40e_ptp_hpcap_correlate - Refresh the hpcap timestamp conversion
+ * @work: hpcap_phc_work of the PF
+ *
+ * Runs every HPCAP_PHC_CORRELATION_NS while the PHC is registered.
+ **/
+static void i40e_ptp_hpcap_correlate(struct work_struct *work)
+{
+	struct i40e_pf *pf = container_of(to_delayed_work(work), struct i40e_pf,
+									  hpcap_phc_work);
+	u64 phc, sys;
+
+	mutex_lock(&pf->tmreg_lock);
+	i40e_ptp_hpcap_sample(pf, &phc, &sys);
+	hpcap_phc_update(&pf->hpcap_phc, phc, sys);
+	mutex_unlock(&pf->tmreg_lock);
+
+	schedule_delayed_work(&pf->hpcap_phc_work,
+						  usecs_to_jiffies(HPCAP_PHC_CORRELATION_NS / NSEC_PER_USEC));
+}
+#endif /* DEV_HPCAP && HPCAP_I40E_HWTSTAMP */
 
 /**
  * i40e_ptp_adjfreq - Adjust the PHC frequency
@@ -167,6 +240,9 @@ static int i40e_ptp_adjtime(struct ptp_clock_info *ptp, s64 delta)
 	i40e_ptp_read(pf, &now);
 	timespec64_add_ns(&now, delta);
 	i40e_ptp_write(pf, (const struct timespec64 *)&now);
+#if defined(DEV_HPCAP) && defined(HPCAP_I40E_HWTSTAMP)
+	i40e_ptp_hpcap_resync(pf);
+#endif
 
 	mutex_unlock(&pf->tmreg_lock);
 	return 0;
@@ -205,6 +281,9 @@ static int i40e_ptp_settime(struct ptp_clock_info *ptp,
 
 	mutex_lock(&pf->tmreg_lock);
 	i40e_ptp_write(pf, ts);
+#if defined(DEV_HPCAP) && defined(HPCAP_I40E_HWTSTAMP)
+	i40e_ptp_hpcap_resync(pf);
+#endif
 	mutex_unlock(&pf->tmreg_lock);
 	return 0;
 }
@@ -437,30 +516,18 @@ void i40e_ptp_tx_hwtstamp(struct i40e_pf *pf)
 }
 
 /**
- * i40e_ptp_rx_hwtstamp - Utility function which checks for an Rx timestamp
+ * i40e_ptp_read_rx_tstamp - Read a latched Rx timestamp
  * @pf: Board private structure
- * @skb: Particular skb to send timestamp with
  * @index: Index into the receive timestamp registers for the timestamp
+ * @ns: PHC time of the timestamp
  *
- * The XL710 receives a notification in the receive descriptor with an offset
- * into the set of RXTIME registers where the timestamp is for that skb. This
- * function goes and fetches the receive timestamp from that offset, if a valid
- * one exists. The RXTIME registers are in ns, so we must convert the result
- * first.
+ * Reading the registers releases the latch for the next PTP frame. Returns
+ * true if a timestamp was latched at that index.
  **/
-void i40e_ptp_rx_hwtstamp(struct i40e_pf *pf, struct sk_buff *skb, u8 index)
+static bool i40e_ptp_read_rx_tstamp(struct i40e_pf *pf, u8 index, u64 *ns)
 {
+	struct i40e_hw *hw = &pf->hw;
 	u32 prttsyn_stat, hi, lo;
-	struct i40e_hw *hw;
-	u64 ns;
-
-	/* Since we cannot turn off the Rx timestamp logic if the device is
-	 * doing Tx timestamping, check if Rx timestamping is configured.
-	 */
-	if (!(pf->flags & I40E_FLAG_PTP) || !pf->ptp_rx)
-		return;
-
-	hw = &pf->hw;
 
 	spin_lock_bh(&pf->ptp_rx_lock);
 
@@ -470,7 +537,7 @@ void i40e_ptp_rx_hwtstamp(struct i40e_pf *pf, struct sk_buff *skb, u8 index)
 	/* TODO: Should we warn about missing Rx timestamp event? */
 	if (!(prttsyn_stat & BIT(index))) {
 		spin_unlock_bh(&pf->ptp_rx_lock);
-		return;
+		return false;
 	}
 
 	/* Clear the latched event since we're about to read its register */
@@ -481,11 +548,57 @@ void i40e_ptp_rx_hwtstamp(struct i40e_pf *pf, struct sk_buff *skb, u8 index)
 
 	spin_unlock_bh(&pf->ptp_rx_lock);
 
-	ns = (((u64)hi) << 32) | lo;
+	*ns = (((u64)hi) << 32) | lo;
+
+	return true;
+}
+
+/**
+ * i40e_ptp_rx_hwtstamp - Utility function which checks for an Rx timestamp
+ * @pf: Board private structure
+ * @skb: Particular skb to send timestamp with
+ * @index: Index into the receive timestamp registers for the timestamp
+ *
+ * The XL710 receives a notification in the receive descriptor with an offset
+ * into the set of RXTIME registers where the timestamp is for that skb. This
+ * function goes and fetches the receive timestamp from that offset, if a valid
+ * one exists. The RXTIME registers are in ns, so we must convert the result
+ * first.
+ **/
+void i40e_ptp_rx_hwtstamp(struct i40e_pf *pf, struct sk_buff *skb, u8 index)
+{
+	u64 ns;
+
+	/* Since we cannot turn off the Rx timestamp logic if the device is
+	 * doing Tx timestamping, check if Rx timestamping is configured.
+	 */
+	if (!(pf->flags & I40E_FLAG_PTP) || !pf->ptp_rx)
+		return;
+
+	if (!i40e_ptp_read_rx_tstamp(pf, index, &ns))
+		return;
 
 	i40e_ptp_convert_to_hwtstamp(skb_hwtstamps(skb), ns);
 }
 
+#if defined(DEV_HPCAP) && defined(HPCAP_I40E_HWTSTAMP)
+/**
+ * i40e_ptp_hpcap_rx_tstamp - Rx timestamp of a frame captured by hpcap
+ * @pf: Board private structure
+ * @index: Index into the receive timestamp registers, from the descriptor
+ * @ns: PHC time of the timestamp, to convert with pf->hpcap_phc
+ *
+ * Returns 1 if the frame had a timestamp, 0 otherwise.
+ **/
+int i40e_ptp_hpcap_rx_tstamp(struct i40e_pf *pf, u8 index, u64 *ns)
+{
+	if (!(pf->flags & I40E_FLAG_PTP) || !pf->ptp_rx)
+		return 0;
+
+	return i40e_ptp_read_rx_tstamp(pf, index, ns);
+}
+#endif /* DEV_HPCAP && HPCAP_I40E_HWTSTAMP */
+
 /**
  * i40e_ptp_set_increment - Utility function to update clock increment rate
  * @pf: Board private structure
@@ -843,12 +956,26 @@ void i40e_ptp_init(struct i40e_pf *pf)
 		/* Set the increment value per clock tick. */
 		i40e_ptp_set_increment(pf);
 
+#if defined(DEV_HPCAP) && defined(HPCAP_I40E_HWTSTAMP)
+		/* hpcap: the XL710 can only stamp PTP event frames */
+		if (pf->tstamp_config.rx_filter == HWTSTAMP_FILTER_NONE)
+			pf->tstamp_config.rx_filter = HWTSTAMP_FILTER_PTP_V2_EVENT;
+
+		hpcap_phc_init(&pf->hpcap_phc);
+		INIT_DELAYED_WORK(&pf->hpcap_phc_work, i40e_ptp_hpcap_correlate);
+#endif /* DEV_HPCAP && HPCAP_I40E_HWTSTAMP */
+
 		/* reset timestamping mode */
 		i40e_ptp_set_timestamp_mode(pf, &pf->tstamp_config);
 
 		/* Set the clock value. */
 		ts = ktime_to_timespec64(ktime_get_real());
 		i40e_ptp_settime(&pf->ptp_caps, &ts);
+#if defined(DEV_HPCAP) && defined(HPCAP_I40E_HWTSTAMP)
+
+		schedule_delayed_work(&pf->hpcap_phc_work,
+							  usecs_to_jiffies(HPCAP_PHC_CORRELATION_NS / NSEC_PER_USEC));
+#endif /* DEV_HPCAP && HPCAP_I40E_HWTSTAMP */
 	}
 }
 
@@ -861,6 +988,11 @@ void i40e_ptp_init(struct i40e_pf *pf)
  **/
 void i40e_ptp_stop(struct i40e_pf *pf)
 {
+#if defined(DEV_HPCAP) && defined(HPCAP_I40E_HWTSTAMP)
+	if (pf->flags & I40E_FLAG_PTP)
+		cancel_delayed_work_sync(&pf->hpcap_phc_work);
+
+#endif /* DEV_HPCAP && HPCAP_I40E_HWTSTAMP */
 	pf->flags &= ~I40E_FLAG_PTP;
 	pf->ptp_tx = false;
 	pf->ptp_rx = false;
@@ -23,6 +23,9 @@
 
 /* ethtool support for i40evf */
 #include "i40evf.h"
+#ifdef DEV_HPCAP
+#include "driver_hpcap.h"
+#endif
 
 #ifdef SIOCETHTOOL
 #include <linux/uaccess.h>
@@ -211,6 +214,13 @@ static void i40evf_get_ethtool_stats(struct net_device *netdev,
 	unsigned int i, j;
 	char *p;
 
+#ifdef DEV_HPCAP
+
+	if (is_hpcap_adapter(adapter))
+		hpcap_stats_update_adapter(adapter);
+
+#endif
+
 	for (i = 0; i < I40EVF_GLOBAL_STATS_LEN; i++) {
 		p = (char *)adapter + i40evf_gstrings_stats[i].stat_offset;
 		data[i] =  *(u64 *)p;
@@ -746,6 +746,7 @@ struct ixgbe_adapter {
 	int work_mode;
 	atomic_t dup_mode;
 	atomic_t caplen;
+	int hpcap_mtu; /**< MTU set at probe, 0 keeps the default */
 	size_t bufpages;
 	size_t consumers;
 	unsigned int bufpages;
@@ -45,6 +45,7 @@
 
 #ifdef DEV_HPCAP
 #include "hpcap_debug.h"
+#include "driver_hpcap.h"
 #endif
 
 #ifndef ETH_GSTRING_LEN
@@ -1609,6 +1610,13 @@ static void ixgbe_get_ethtool_stats(struct net_device *netdev,
 
 	ixgbe_update_stats(adapter);
 
+#ifdef DEV_HPCAP
+
+	if (is_hpcap_adapter(adapter))
+		hpcap_stats_update_adapter(adapter);
+
+#endif
+
 	for (i = 0; i < IXGBE_NETDEV_STATS_LEN; i++) {
 		p = (char *)net_stats + ixgbe_gstrings_net_stats[i].stat_offset;
 		data[i] = (ixgbe_gstrings_net_stats[i].sizeof_stat ==
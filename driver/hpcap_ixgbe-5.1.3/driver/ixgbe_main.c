@@ -7492,6 +7492,12 @@ static int ixgbe_change_mtu(struct net_device *netdev, int new_mtu)
 		return -EINVAL;
 
 #endif
+#ifdef DEV_HPCAP
+
+	if (hpcap_check_mtu(adapter, new_mtu))
+		return -EINVAL;
+
+#endif /* DEV_HPCAP */
 
 	/*
 	 * For 82599EB we cannot allow legacy VFs to enable their receive
@@ -8016,6 +8022,29 @@ static struct net_device_stats *ixgbe_get_stats(struct net_device *netdev)
 	return &adapter->net_stats;
 #endif /* HAVE_NETDEV_STATS_IN_NETDEV */
 }
+#endif
+#if defined(DEV_HPCAP) && defined(HPCAP_LOSS_RECORDS)
+/**
+ * ixgbe_hpcap_mark_drops - Report the drops of a queue to its HPCAP buffer
+ * @adapter: board private structure
+ * @reg_idx: hardware index of the queue
+ * @drops: frames the queue dropped since the previous read (QPRDC)
+ **/
+static void ixgbe_hpcap_mark_drops(struct ixgbe_adapter *adapter, u8 reg_idx, u32 drops)
+{
+	struct ixgbe_ring *ring;
+	int i;
+
+	for (i = 0; i < adapter->num_rx_queues; i++) {
+		ring = adapter->rx_ring[i];
+
+		if (ring && ring->reg_idx == reg_idx && ring->bufp) {
+			hpcap_mark_nic_drops(ring->bufp, drops);
+			return;
+		}
+	}
+}
+
 #endif
 /**
  * ixgbe_update_stats - Update the board statistics counters.
@@ -8032,6 +8061,7 @@ void ixgbe_update_stats(struct ixgbe_adapter *adapter)
 	struct ixgbe_hw_stats *hwstats = &adapter->stats;
 	u64 total_mpc = 0;
 	u32 i, missed_rx = 0, mpc, bprc, lxon, lxoff, xon_off_tot;
+	u32 qprdc;
 	u64 non_eop_descs = 0, restart_queue = 0, tx_busy = 0;
 	u64 alloc_rx_page_failed = 0, alloc_rx_buff_failed = 0;
 	u64 bytes = 0, packets = 0, hw_csum_rx_error = 0;
@@ -8166,9 +8196,16 @@ void ixgbe_update_stats(struct ixgbe_adapter *adapter)
 			hwstats->b2ogprc += IXGBE_READ_REG(hw, IXGBE_B2OGPRC);
 
 		case ixgbe_mac_82599EB:
-			for (i = 0; i < 16; i++)
-				adapter->hw_rx_no_dma_resources +=
-					IXGBE_READ_REG(hw, IXGBE_QPRDC(i));
+			for (i = 0; i < 16; i++) {
+				qprdc = IXGBE_READ_REG(hw, IXGBE_QPRDC(i));
+				adapter->hw_rx_no_dma_resources += qprdc;
+#if defined(DEV_HPCAP) && defined(HPCAP_LOSS_RECORDS)
+
+				if (is_hpcap_adapter(adapter))
+					ixgbe_hpcap_mark_drops(adapter, i, qprdc);
+
+#endif
+			}
 
 			hwstats->gorc += IXGBE_READ_REG(hw, IXGBE_GORCL);
 			IXGBE_READ_REG(hw, IXGBE_GORCH); /* to clear */
@@ -11906,6 +11943,7 @@ static int __devinit ixgbe_probe(struct pci_dev *pdev,
 	netdev->vlan_features = 0;
 	adapter->numa_node = adapter->node;
 	set_dev_node(&pdev->dev, adapter->numa_node);
+	hpcap_set_mtu(adapter, netdev);
 
 	DPRINTK(PROBE, INFO, "Intel(R) 10 Gigabit Network Connection\n");
 	DPRINTK(PROBE, INFO, "NUMA node = %d, flags = 0x%x, flags2 = 0x%x\n",
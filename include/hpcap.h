@@ -82,19 +82,20 @@ static inline void prefetchnta(void *p)
 
 /************************************************
 * JUMBO
-*  uncomment this define to enable support
-*  for jumboframes (may affect performance)
+*  Every RX descriptor has a buffer of
+*  MAX_DESCR_SIZE bytes. Frames longer than that
+*  (MTU parameter over HPCAP_MAX_DESCR_MTU) span
+*  several descriptors, which are gathered into
+*  one record of the buffer.
 ************************************************/
 #define MAX_DESCR_SIZE	2048
-//#define JUMBO
-#ifdef JUMBO
-#define MAX_JUMBO_SIZE 15872 // 15.5 KB
+#define MAX_JUMBO_SIZE 9728 // Largest frame the Intel NICs receive
 #define MAX_DESCRIPTORS ( 1 + ((MAX_JUMBO_SIZE)/(MAX_DESCR_SIZE)) ) // max number of descriptors that a JUMBOFRAME can take
 #define MAX_PACKET_SIZE	(MAX_JUMBO_SIZE)
-#else
-#define MAX_DESCRIPTORS (1)
-#define MAX_PACKET_SIZE	(MAX_DESCR_SIZE)
-#endif
+
+#define HPCAP_MIN_MTU 68
+#define HPCAP_MAX_MTU (MAX_JUMBO_SIZE - 18) // Minus the Ethernet header and the FCS
+#define HPCAP_MAX_DESCR_MTU (MAX_DESCR_SIZE - 18) // Largest MTU whose frames fit in one descriptor
 
 /************************************************
 * PRINT_DEBUG
@@ -127,10 +128,20 @@ static inline void prefetchnta(void *p)
 #endif
 
 /**
- * HPCAP_PROFILING: enables the profiler (see hpcap_rx_profile.c/h) with some stats
- * about the driver polling threads.
+ * HPCAP_RX_SCAN: Descriptors of Intel rings whose DD bits a consumer checks at
+ * once. The run of ready descriptors found is then read without checking them
+ * again (see hpcap_scan_ready in hpcap_rx.c). At most 32.
+ */
+#define HPCAP_RX_SCAN 8
+
+/**
+ * HPCAP_COPY_NT_THRESHOLD: Captured bytes of a frame from which its copy to
+ * the HPCAP buffer uses non-temporal stores, which do not evict the descriptor
+ * ring and the working set of the consumers from the cache. Smaller frames use
+ * cached stores, as the listeners usually read them right away (see
+ * hpcap_copy.h).
  */
-// #define HPCAP_PROFILING
+#define HPCAP_COPY_NT_THRESHOLD 512
 
 /**
  * HPCAP_CONSUMERS_VIA_RINGS: Assign one different ring to each consumer, instead of
@@ -140,8 +151,70 @@ static inline void prefetchnta(void *p)
 
 /**
  * HPCAP_MEASURE_LATENCY: Enables measurements of latency with iDPDK-LatencyMetter
+ * probes, and of the delivery latency to the listeners. Both are kept in
+ * log-linear histograms read with HPCAP_IOC_LATENCY (see hpcap_latency.c/h).
  */
 #define HPCAP_MEASURE_LATENCY
+#define HPCAP_LATENCY_SUB_BITS 5	/**< Log2 of the buckets per power of two: 1/32 relative precision */
+#define HPCAP_LATENCY_SUB (1ul << HPCAP_LATENCY_SUB_BITS)
+#define HPCAP_LATENCY_BUCKETS 1024ul	/**< Buckets of a histogram, up to 2^36 ns. Larger values go to the last one */
+
+/**
+ * HPCAP_BURST_DETECTOR: Accumulates the bytes received by each consumer in
+ * sub-millisecond bins to detect microbursts (see hpcap_burst.c/h). The
+ * statistics and the bins are read with HPCAP_IOC_BURST_STATS and
+ * HPCAP_IOC_BURST_BINS.
+ */
+#define HPCAP_BURST_DETECTOR
+#define HPCAP_BURST_BINS 16384ul			/**< Bins in the ring of each consumer. Must be a power of two */
+#define HPCAP_BURST_DEFAULT_NS 100000ul	/**< Default bin width */
+#define HPCAP_BURST_MIN_NS 10000ul		/**< Minimum bin width */
+#define HPCAP_BURST_MAX_NS 10000000ul	/**< Maximum bin width, so a bin of a 100G link fits in 32 bits */
+
+/**
+ * HPCAP_TSC_TSTAMP: Without hardware timestamps, stamp the frames with the TSC
+ * converted to wall clock time, calibrated by each consumer against
+ * getnstimeofday every HPCAP_TSC_CALIBRATION_NS (see hpcap_tstamp.c/h),
+ * instead of calling getnstimeofday for every frame. HPCAP_TSTAMP_MODE is the
+ * default mode of the consumers:
+ *  - HPCAP_TSTAMP_CLOCK: getnstimeofday for every frame.
+ *  - HPCAP_TSTAMP_FRAME: read the TSC for every frame.
+ *  - HPCAP_TSTAMP_BATCH: read the TSC once per call of the RX loop, when the
+ *    first frame is found. Every frame of the call gets the same time.
+ *  - HPCAP_TSTAMP_SPREAD: as BATCH, but the frames found together are spread
+ *    at line rate before that time, at most HPCAP_TSTAMP_SPREAD_MAX_NS and
+ *    never before the previous call.
+ */
+#define HPCAP_TSC_TSTAMP
+#define HPCAP_TSTAMP_CLOCK 0
+#define HPCAP_TSTAMP_FRAME 1
+#define HPCAP_TSTAMP_BATCH 2
+#define HPCAP_TSTAMP_SPREAD 3
+#define HPCAP_TSTAMP_MODE HPCAP_TSTAMP_FRAME
+#define HPCAP_TSC_CALIBRATION_NS 10000000ul	/**< Period of the calibration against the wall clock */
+#define HPCAP_TSC_MAX_SLEW_NS 1000000ul		/**< Larger differences with the wall clock are stepped instead of slewed */
+#define HPCAP_TSTAMP_SPREAD_MAX_NS 100000ul
+
+/**
+ * HPCAP_I40E_HWTSTAMP: On i40e adapters with PTP support, use the RX timestamps
+ * of the XL710 for the frames it stamps, converted to wall clock time with a
+ * correlation between its PHC and getnstimeofday that a work of the driver
+ * refreshes every HPCAP_PHC_CORRELATION_NS (see hpcap_phc.c/h). The XL710 only
+ * stamps PTP event frames (the RX filter is set to HWTSTAMP_FILTER_PTP_V2_EVENT
+ * when the PHC is registered), so the other frames keep the timestamps above.
+ * Virtual functions (i40evf) have no access to the PHC.
+ */
+#define HPCAP_I40E_HWTSTAMP
+#define HPCAP_PHC_CORRELATION_NS 100000000ul	/**< Period of the correlation against the wall clock */
+#define HPCAP_PHC_MAX_ERROR_NS 1000000ul		/**< Larger differences with the wall clock mean that a clock was set */
+
+/**
+ * HPCAP_LOSS_RECORDS: When a consumer drops frames because the buffer is full,
+ * or the NIC reports drops in its queue, write a loss record (see struct
+ * hpcap_loss_record) before the next frame the consumer stores, so the readers
+ * of the RAW stream know where its holes are.
+ */
+#define HPCAP_LOSS_RECORDS
 
 /************************************************
 * REMOVE_DUPS
@@ -184,7 +257,32 @@ struct hpcap_dup_info {
 #define HPCAP_OBS 1048576ul
 #define HPCAP_BS (4 * 1048576ul)
 #define HPCAP_COUNT 512ul //256ul //3072ul //768ul //3072=384*8 para ficheros de 3GB
+#ifndef HPCAP_FILESIZE
 #define HPCAP_FILESIZE (HPCAP_BS*HPCAP_COUNT) //tiene que ser multiplo de oblock=8M
+#endif
+/**
+ * Bytes a member of a listener group claims at once when it asks for less
+ * (see hpcap_join_group). Smaller blocks share the load better among the
+ * members, larger ones need fewer claims.
+ */
+#define HPCAP_GROUP_BLOCK (256 * 1024ul)
+/**
+ * Frame boundaries the driver remembers to skip the lossy listeners that lag
+ * (see hpcap_set_lossy), spread over the buffer: a listener is skipped at most
+ * about 1/HPCAP_SKIP_INDEX of the buffer more than its maximum lag.
+ */
+#define HPCAP_SKIP_INDEX 64
+/**
+ * In overwrite mode (see hpcap_set_overwrite), the oldest data is dropped to
+ * keep 1/HPCAP_OVERWRITE_ROOM of the buffer free for the consumers.
+ */
+#define HPCAP_OVERWRITE_ROOM 16
+/**
+ * Calls to splice() a listener can have in flight, i.e. whose data is still
+ * referenced by a pipe (see hpcap_write_block). A further call fails with
+ * EBUSY until the pipes release the oldest ones. At most 64.
+ */
+#define HPCAP_SPLICE_CALLS 64
 #define HPCAP_MAX_FILTERS 256
 #define HPCAP_MAX_FILTER_STRLEN 50
 /********************************************************************************/
@@ -194,6 +292,14 @@ struct hpcap_dup_info {
 
 /***********************************************
  IOCTL commands
+
+ Besides read() and the ioctls, the data of a
+ handle can be splice()d to a pipe and the pipe
+ to a file. Splicing the pipe to a socket is not
+ supported: the socket releases the pages before
+ the data is sent, and the driver may overwrite
+ them. Copy the data to sockets instead, see
+ hpcap_write_block.
 ***********************************************/
 #define HPCAP_IOC_MAGIC 70
 #define HPCAP_IOC_LSTOP _IOWR(HPCAP_IOC_MAGIC, 1, struct hpcap_listener_op*)
@@ -206,6 +312,15 @@ struct hpcap_dup_info {
 #define HPCAP_IOC_STATUS_INFO _IOR(HPCAP_IOC_MAGIC, 10, struct hpcap_ioc_status_info*)
 #define HPCAP_IOC_BUFCHECK _IO(HPCAP_IOC_MAGIC, 11)
 #define HPCAP_IOC_KILL_LST _IOR(HPCAP_IOC_MAGIC, 12, int)
+#define HPCAP_IOC_BURST_CONF _IOW(HPCAP_IOC_MAGIC, 13, struct hpcap_burst_conf*)
+#define HPCAP_IOC_BURST_STATS _IOR(HPCAP_IOC_MAGIC, 14, struct hpcap_burst_info*)
+#define HPCAP_IOC_BURST_BINS _IOWR(HPCAP_IOC_MAGIC, 15, struct hpcap_burst_bins_op*)
+#define HPCAP_IOC_LATENCY _IOWR(HPCAP_IOC_MAGIC, 16, struct hpcap_latency_info*)
+#define HPCAP_IOC_STATS _IOWR(HPCAP_IOC_MAGIC, 17, struct hpcap_stats_info*)
+#define HPCAP_IOC_GROUP _IOW(HPCAP_IOC_MAGIC, 18, int)
+#define HPCAP_IOC_LOSSY _IOW(HPCAP_IOC_MAGIC, 19, size_t)
+#define HPCAP_IOC_OVERWRITE _IOW(HPCAP_IOC_MAGIC, 20, int)
+#define HPCAP_IOC_SNAPSHOT _IOWR(HPCAP_IOC_MAGIC, 21, struct hpcap_snapshot*)
 #define MAX_HUGETLB_FILE_LEN 256
 #define MAX_PCI_BUS_NAME_LEN 20
 #define MAX_NETDEV_NAME 10
@@ -220,6 +335,30 @@ struct  __attribute__((__packed__)) raw_header {
 	uint16_t len;
 };
 
+/**
+ * Value of raw_header.nsec in the header of a loss record, which is not a
+ * valid nanosecond count. Its sec is 0 as in the padding (sec == 0 and
+ * nsec == 0), so the readers that only check sec skip it. caplen is the size
+ * of the struct hpcap_loss_record that follows and len is 0.
+ */
+#define HPCAP_LOSS_NSEC 0xffffffffu
+
+/**
+ * Payload of a loss record: the frames of the queue that are missing from the
+ * stream since the previous loss record of the same consumer. The time range
+ * covers the frames the driver dropped and, for the NIC drops, the two reads
+ * of the NIC counters between which they happened.
+ */
+struct __attribute__((__packed__)) hpcap_loss_record {
+	uint64_t frames;		/**< Frames the driver received and could not store */
+	uint64_t bytes;			/**< Length on the wire of those frames */
+	uint64_t nic_frames;	/**< Frames the NIC dropped because the ring of the queue was full */
+	uint64_t first_ns;		/**< Time of the first loss */
+	uint64_t last_ns;		/**< Time of the last loss */
+};
+
+#define HPCAP_LOSS_RECLEN (RAW_HLEN + sizeof(struct hpcap_loss_record))
+
 /**
  * @addtogroup HPCAP
  * @{
@@ -236,6 +375,9 @@ struct hpcap_buffer_info {
 	size_t offset; 		 /**< Offset of the buffer in the page. Written by driver. */
 	char file_name[MAX_HUGETLB_FILE_LEN]; /**< Name of the file that backs the hugepage buffer. R/W. */
 	short has_hugepages; /**< 1 if the buffer is backed by hugepages, 0 if not. */
+	int file_count;		 /**< Files backing the hugepage buffer, each with an equal part of it: file_name, file_name.1, file_name.2... R/W. */
+	size_t page_size;	 /**< Size of the hugepages of the buffer. Written by driver. */
+	short direct_map;	 /**< 1 if the driver writes the hugepages through its linear mapping (huge TLB entries), 0 if through a vmap of 4 KB pages. Written by driver. */
 };
 
 /**
@@ -253,6 +395,10 @@ struct hpcap_ioc_status_info_listener {
 	u64 bufferWrOffset; /**< Offset of the last write in the HPCAP buffer. */
 	u64 bufferRdOffset; /**< Offset of the last read from the client in the buffer */
 	size_t buffer_size; /**< Size of the buffer. */
+	int group;		/**< ID of the listener group it belongs to, 0 if none. */
+	u64 max_lag;	/**< Bytes the listener can lag before it is skipped, 0 if lossless. */
+	u64 skipped_bytes;	/**< Bytes skipped because the listener lagged. */
+	u64 skips;		/**< Times the listener was skipped. */
 };
 
 struct hpcap_ioc_status_info {
@@ -268,7 +414,22 @@ struct hpcap_ioc_status_info {
 	long thread_state;
 
 	size_t consumer_write_off; 	/**< Internal write offset */
-	size_t consumer_read_off; 	/**< Internal read offset */
+	size_t consumer_read_off; 	/**< Internal read offset, in the same stream of bytes as consumer_write_off */
+
+	int overwrite;				/**< 1 if the buffer is in overwrite mode */
+	u64 overwritten_bytes;		/**< Bytes dropped by the overwrite mode */
+};
+
+/**
+ * Time window of a snapshot (see hpcap_snapshot).
+ */
+struct hpcap_snapshot {
+	uint64_t before_ns;	/**< Nanoseconds before the trigger the window starts. Read by driver. */
+	uint64_t after_ns;	/**< Nanoseconds after the trigger the window ends. Read by driver. */
+	uint64_t start_ns;	/**< Start of the window, in the clock of the timestamps. Written by driver. */
+	uint64_t end_ns;	/**< End of the window. Written by driver. */
+	uint64_t read_offset;	/**< New read offset of the listener, at a frame at or before the window. Written by driver. */
+	uint64_t available_bytes;	/**< Bytes available from there. Written by driver. */
 };
 
 
@@ -284,8 +445,143 @@ struct hpcap_listener_op {
 	uint64_t read_offset;
 	uint64_t write_offset;
 	uint64_t timeout_ns;
+	uint64_t skipped_bytes;	/**< Bytes of a lossy listener skipped since the last operation. If not 0, read_offset and available_bytes are set */
+};
+
+/**
+ * Counters of a consumer thread of a queue, cumulative since the driver was
+ * loaded. The drop counters are always kept; the rest only while the
+ * statistics are enabled with HPCAP_IOC_STATS.
+ */
+struct hpcap_rx_counters {
+	uint64_t polls;				/**< Calls to the RX loop */
+	uint64_t descriptors;		/**< Descriptors read */
+	uint64_t bytes;				/**< Bytes of the frames of those descriptors */
+	uint64_t empty_polls;		/**< Calls that found the ring empty */
+	uint64_t not_owned_polls;	/**< Calls that stopped at a descriptor of the segment of the next consumer */
+	uint64_t budget_exhausted;	/**< Calls that stopped because their share of the free space of the buffer was full */
+	uint64_t releases;			/**< Times descriptors were returned to the NIC */
+	uint64_t sleeps;			/**< Times the thread slept because the ring was empty */
+	uint64_t sleep_ns;			/**< Time spent sleeping */
+	uint64_t filter_drops;		/**< Frames rejected by the filters */
+	uint64_t dup_drops;			/**< Duplicated frames removed */
+	uint64_t buffer_full_drops;	/**< Frames lost because the buffer was full (client loss) */
+	uint64_t unbuffered_drops;	/**< Frames lost because the descriptor had no buffer attached (client discard) */
 };
 
+/**
+ * Counters of all the consumers of a queue, read with HPCAP_IOC_STATS. The
+ * collection of the optional counters is switched for all the queues of the
+ * driver at once.
+ */
+struct hpcap_stats_info {
+	int32_t enable;		/**< In: 1 to start collecting the optional counters, 0 to stop, negative to leave it as it is */
+	uint32_t enabled;	/**< Out: whether the optional counters are being collected */
+	uint32_t consumers;	/**< Out: consumers (valid entries of counters) */
+	struct hpcap_rx_counters counters[MAX_CONSUMERS_PER_Q];
+};
+
+/**
+ * Configuration of the burst detector of a queue, set with
+ * HPCAP_IOC_BURST_CONF. Every consumer restarts its bins when it sees a new
+ * configuration.
+ */
+struct hpcap_burst_conf {
+	uint32_t bin_ns;	/**< Width of the bins in ns, between HPCAP_BURST_MIN_NS and HPCAP_BURST_MAX_NS. 0 for the default */
+	uint32_t threshold;	/**< Bytes in a bin of a consumer above which the bin is part of a burst. 0 for 80% of the line rate, shared among the consumers */
+};
+
+/**
+ * Burst statistics of a consumer. Bins are numbered by their start time:
+ * bin i covers [i * bin_ns, (i + 1) * bin_ns) ns since the epoch, so the bins
+ * of all the consumers of a queue are aligned.
+ */
+struct hpcap_burst_stats {
+	uint32_t bin_ns;		/**< Width of the bins */
+	uint32_t threshold;		/**< Burst threshold in bytes per bin */
+	uint64_t first_bin;		/**< First bin since the detector (re)started */
+	uint64_t bins;			/**< Bins closed, the next bin to close is first_bin + bins */
+	uint64_t bytes;			/**< Bytes accounted in the closed bins */
+	uint64_t peak_bytes;	/**< Maximum bytes in a bin */
+	uint64_t peak_bin;		/**< Bin with the maximum bytes */
+	uint64_t bursts;		/**< Runs of consecutive bins above the threshold */
+	uint64_t burst_bins;	/**< Bins above the threshold */
+	uint64_t longest_burst;	/**< Length in bins of the longest burst */
+	uint64_t last_burst;	/**< First bin of the last burst */
+	uint64_t last_burst_bins;	/**< Length in bins of the last burst, 0 if none */
+};
+
+/**
+ * Burst statistics of all the consumers of a queue, read with
+ * HPCAP_IOC_BURST_STATS.
+ */
+struct hpcap_burst_info {
+	uint32_t consumers;		/**< Consumers (valid entries of stats) */
+	struct hpcap_burst_stats stats[MAX_CONSUMERS_PER_Q];
+};
+
+/**
+ * Request of the bins of a consumer with HPCAP_IOC_BURST_BINS.
+ */
+struct hpcap_burst_bins_op {
+	uint32_t consumer;		/**< Consumer to read */
+	uint32_t count;			/**< In: room in bins. Out: bins copied */
+	uint64_t from;			/**< In: first bin wanted. Out: first bin copied */
+	uint32_t __user *bins;	/**< Bytes of each bin, from bin 'from' on */
+};
+
+/**
+ * Log-linear latency histogram, in ns. Values below HPCAP_LATENCY_SUB have a
+ * bucket each; above, every power of two is split in HPCAP_LATENCY_SUB
+ * buckets. See hpcap_latency_bucket and hpcap_latency_bucket_low.
+ */
+struct hpcap_latency_hist {
+	uint64_t count;		/**< Values recorded */
+	uint64_t sum_ns;	/**< Sum of the values recorded */
+	uint64_t counts[HPCAP_LATENCY_BUCKETS];
+};
+
+/**
+ * Latency histograms of a queue, read with HPCAP_IOC_LATENCY: the histograms
+ * of all the consumers (or listeners) added up.
+ */
+struct hpcap_latency_info {
+	uint32_t reset;		/**< In: if not 0, start new histograms after reading these */
+	uint32_t samplers;	/**< Out: consumers whose probe histograms were added up */
+	struct hpcap_latency_hist probe;	/**< Deviation of the inter-arrival time of the probes from the one they were sent with */
+	struct hpcap_latency_hist delivery;	/**< Time since the reception of the oldest frame a listener had not seen until it is returned to it */
+};
+
+/**
+ * Bucket of a latency histogram for the given value.
+ */
+static inline size_t hpcap_latency_bucket(uint64_t ns)
+{
+	size_t shift, bucket;
+
+	if (ns < HPCAP_LATENCY_SUB)
+		return ns;
+
+	// Position of the most significant bit, minus the bits that select the sub-bucket
+	shift = 63 - __builtin_clzll(ns) - HPCAP_LATENCY_SUB_BITS;
+	bucket = (shift + 1) * HPCAP_LATENCY_SUB + (ns >> shift) - HPCAP_LATENCY_SUB;
+
+	return bucket < HPCAP_LATENCY_BUCKETS ? bucket : HPCAP_LATENCY_BUCKETS - 1;
+}
+
+/**
+ * Lowest value of a bucket of a latency histogram.
+ */
+static inline uint64_t hpcap_latency_bucket_low(size_t bucket)
+{
+	size_t shift = bucket / HPCAP_LATENCY_SUB;
+
+	if (shift == 0)
+		return bucket;
+
+	return (uint64_t)(HPCAP_LATENCY_SUB + bucket % HPCAP_LATENCY_SUB) << (shift - 1);
+}
+
 /** @} */
 
 /**********************************************/
@@ -332,6 +628,9 @@ struct hpcap_handle {
 	void* hugepage_addr;	/**< Address of the hugepage buffer */
 	size_t hugepage_len;	/**< Length of the hugepage buffer */
 	/** @} */
+
+	uint64_t lost_bytes;	/**< Bytes the driver skipped because the listener lagged (see hpcap_set_lossy) */
+	struct hpcap_loss_record loss;	/**< Sum of the loss records hpcap_read_packet skipped */
 };
 
 #ifdef DEBUG
@@ -442,6 +741,94 @@ int hpcap_ioc_killwait(struct hpcap_handle *handle);
  */
 int hpcap_ioc_kill(struct hpcap_handle* handle, int listener_id);
 
+/**
+ * Join the listener group with the given ID (any positive number chosen by the
+ * application), or leave the current group with group_id 0.
+ *
+ * The members of a group split the traffic of the queue: every frame goes to
+ * only one of them. Each hpcap_ack_wait of a member that read all its data
+ * claims the next block of frames of the group, at least the bytes it waits for
+ * and up to HPCAP_GROUP_BLOCK, and a slow member does not stop the others. Call
+ * it after opening the handle and before reading: the data not read yet is
+ * dropped. The bytes of the handle are not the stream of the queue, so
+ * hpcap_write_block does not write valid capture files.
+ *
+ * @param  handle   HPCAP handle.
+ * @param  group_id Group ID, 0 to leave the group.
+ * @return          HPCAP_OK/HPCAP_ERR. Errno will be set appropiately.
+ */
+int hpcap_join_group(struct hpcap_handle* handle, int group_id);
+
+/**
+ * Make the listener lossy: when it lags more than max_lag bytes behind the
+ * capture, the driver skips its read offset forward to a frame boundary at
+ * most max_lag bytes behind, instead of letting it fill the buffer and make
+ * every listener lose frames. The bytes skipped are added to lost_bytes of the
+ * handle by the next hpcap_wait or hpcap_ack_wait, which also move the handle
+ * past them. Frames being read during a skip may be overwritten.
+ *
+ * Listeners are lossless by default, as when max_lag is 0. Members of a group
+ * cannot be lossy.
+ *
+ * @param  handle  HPCAP handle.
+ * @param  max_lag Bytes the listener can lag, less than the buffer size and
+ *                 more than a frame. 0 for a lossless listener.
+ * @return         HPCAP_OK/HPCAP_ERR. Errno will be set appropiately.
+ */
+int hpcap_set_lossy(struct hpcap_handle* handle, size_t max_lag);
+
+/**
+ * Set the overwrite mode of the queue of the handle. In overwrite mode the
+ * queue works as a flight recorder: it captures even without listeners and
+ * keeps the frames in the buffer after the listeners read them until it is
+ * nearly full, when it drops the oldest ones instead of the new ones. The
+ * lossless listeners still hold the data they did not read, and the lossy ones
+ * are skipped forward (see hpcap_set_lossy). New listeners start at the new
+ * frames: hpcap_snapshot moves a handle back in time. Turning it off without
+ * listeners drops the data in the buffer.
+ *
+ * @param  handle HPCAP handle.
+ * @param  enable 1 to overwrite the oldest data, 0 to drop the new frames.
+ * @return        HPCAP_OK/HPCAP_ERR. Errno will be set appropiately.
+ */
+int hpcap_set_overwrite(struct hpcap_handle* handle, int enable);
+
+/**
+ * Freeze the frames received from before_ns nanoseconds before now to
+ * after_ns nanoseconds after now: the read offset of the handle moves back
+ * (or forward) to a frame at or before the start of the window that is still
+ * in the buffer, and the listener holds the data from there as any lossless
+ * listener. Open a new handle for each snapshot, write the window out with
+ * hpcap_snapshot_write and close it to give the space back.
+ *
+ * The window starts at the oldest data in the buffer if it is longer than what
+ * the buffer holds. Lossy listeners and members of groups cannot take
+ * snapshots.
+ *
+ * @param  handle    HPCAP handle, mapped.
+ * @param  before_ns Nanoseconds of the window before the trigger.
+ * @param  after_ns  Nanoseconds of the window after the trigger.
+ * @param  snap      Filled with the window and the new offsets.
+ * @return           HPCAP_OK/HPCAP_ERR. Errno will be set appropiately.
+ */
+int hpcap_snapshot(struct hpcap_handle* handle, uint64_t before_ns, uint64_t after_ns, struct hpcap_snapshot* snap);
+
+/**
+ * Write the frames of a snapshot to a file, as a RAW stream without padding
+ * records (raw2pcap reads it), nor loss records of losses that ended before
+ * the window. Writes the data in large contiguous chunks straight from the
+ * buffer and acknowledges it as it goes, so the consumers keep capturing in
+ * the space freed. Returns once it reads a frame stamped after the end of
+ * the window, or when the end of the window has passed and no more data
+ * arrives.
+ *
+ * @param  handle HPCAP handle on which hpcap_snapshot was called.
+ * @param  snap   Window returned by hpcap_snapshot.
+ * @param  fd     Output file descriptor.
+ * @return        Bytes written, -1 on error.
+ */
+int64_t hpcap_snapshot_write(struct hpcap_handle* handle, const struct hpcap_snapshot* snap, int fd);
+
 /**
  * Retrieve information of the HPCAP buffer
  * @param  handle HPCAP handle
@@ -450,6 +837,63 @@ int hpcap_ioc_kill(struct hpcap_handle* handle, int listener_id);
  */
 int hpcap_status_info(struct hpcap_handle* handle, struct hpcap_ioc_status_info* info);
 
+/**
+ * Retrieve the RX counters of every consumer of the queue.
+ * @param  handle HPCAP handle
+ * @param  info   Counters to be filled
+ * @param  enable 1 to start collecting the optional counters, 0 to stop,
+ *                negative to leave it as it is. Applies to every queue.
+ * @return        HPCAP_OK/HPCAP_ERR
+ */
+int hpcap_rx_stats(struct hpcap_handle* handle, struct hpcap_stats_info* info, int enable);
+
+/**
+ * Configure the burst detector of the queue of the handle.
+ * @param  handle    HPCAP handle
+ * @param  bin_ns    Width of the bins in ns, 0 for the default.
+ * @param  threshold Bytes per bin and consumer that mark a burst, 0 for the default.
+ * @return           HPCAP_OK/HPCAP_ERR
+ */
+int hpcap_burst_conf(struct hpcap_handle* handle, uint32_t bin_ns, uint32_t threshold);
+
+/**
+ * Retrieve the burst statistics of every consumer of the queue.
+ * @param  handle HPCAP handle
+ * @param  info   Information structure to be filled
+ * @return        HPCAP_OK/HPCAP_ERR
+ */
+int hpcap_burst_stats(struct hpcap_handle* handle, struct hpcap_burst_info* info);
+
+/**
+ * Copy the bins of a consumer still in its ring, starting at bin *from.
+ * @param  handle   HPCAP handle
+ * @param  consumer Consumer index
+ * @param  from     First bin wanted. Updated with the first bin copied, which
+ *                  is later if the wanted one is no longer in the ring.
+ * @param  bins     Destination of the bytes of each bin
+ * @param  count    Room in bins
+ * @return          Bins copied, or -1 on error.
+ */
+int hpcap_burst_bins(struct hpcap_handle* handle, uint32_t consumer, uint64_t* from, uint32_t* bins, uint32_t count);
+
+/**
+ * Retrieve the latency histograms of the queue of the handle.
+ * @param  handle HPCAP handle
+ * @param  info   Histograms to be filled
+ * @param  reset  If not 0, the driver starts new histograms after these, with
+ *                no sample lost or counted twice.
+ * @return        HPCAP_OK/HPCAP_ERR
+ */
+int hpcap_latency_info(struct hpcap_handle* handle, struct hpcap_latency_info* info, int reset);
+
+/**
+ * Value below which the given fraction of the samples of a histogram fall.
+ * @param  hist     Histogram
+ * @param  fraction Fraction of the samples, e.g. 0.999 for the 99.9th percentile.
+ * @return          Upper bound of the bucket of the percentile, in ns, or 0 if the histogram is empty.
+ */
+uint64_t hpcap_latency_percentile(const struct hpcap_latency_hist* hist, double fraction);
+
 #ifdef REMOVE_DUPS
 /**
  * Print the duplicates table for the given handle.
@@ -480,7 +924,8 @@ void hpcap_pcap_header(void *header, u32 secs, u32 nsecs, u16 len, u16 caplen);
 uint8_t* hpcap_get_memory_at_readable_offset(struct hpcap_handle* handle, size_t offset);
 
 /**
- * Reads the next frame from the HPCAP buffer, discarding padding frames.
+ * Reads the next frame from the HPCAP buffer, discarding padding frames and
+ * loss records (whose counts are added to hp->loss).
  *
  * @param  hp          HPCAP handle.
  * @param  pbuffer     When returning, its content will point to the buffer
@@ -499,6 +944,14 @@ u64 hpcap_read_packet(struct hpcap_handle *hp, u_char **pbuffer, u_char *auxbuf,
 
 /**
  * Writes a block from the HPCAP buffer to the given file.
+ *
+ * To move the data without mapping the buffer or copying it to user space,
+ * splice() the file descriptor of the handle to a pipe and the pipe to the
+ * file (see samples/hpcapsplice): the driver acknowledges the data when the
+ * pipe releases it. Don't splice the pipe to a socket, which releases it
+ * before the data is sent: write the blocks to the socket with this function
+ * instead. Don't mix splice() with the ack functions in a handle.
+ *
  * @param  handle             handle pointer to read data from
  * @param  fd                 file descriptor of the output file (nothing will be written if fd==0)
  * @param  max_bytes_to_write maximum amount of bytes to be written to the output file
@@ -529,6 +982,26 @@ uint64_t hpcap_write_block(struct hpcap_handle *hp, int fd, uint64_t max_bytes_t
  */
 int hpcap_map_huge(struct hpcap_handle* handle, const char* hugetlbfs_path, size_t bufsize);
 
+/**
+ * Configures the HPCAP driver to use a hugepage buffer made of several files,
+ * each with an equal part of the buffer and optionally bound to a NUMA node.
+ *
+ * The page size is the one of the hugetlbfs mount (pagesize=2M or 1G), and
+ * bufsize must be a multiple of num_files pages. The files are named as with
+ * hpcap_map_huge, with a .1, .2... suffix after the first one, and mapped one
+ * after the other. When the pages happen to be physically contiguous (e.g. a
+ * single 1 GB page) the driver writes them through its linear mapping, which
+ * uses huge TLB entries; otherwise it maps them with 4 KB pages.
+ *
+ * @param handle         HPCAP descriptor.
+ * @param hugetlbfs_path hugetlbfs filesystem path. Max 240 characters.
+ * @param bufsize        Size of the buffer that will be allocated.
+ * @param nodes          NUMA node of each file, or NULL to use the default policy.
+ * @param num_files      Number of files.
+ * @return               HPCAP_OK or HPCAP_ERR depending on the operation result.
+ */
+int hpcap_map_huge_nodes(struct hpcap_handle* handle, const char* hugetlbfs_path, size_t bufsize, const int* nodes, int num_files);
+
 /**
  * Releases the hugepage buffer from the adapter.
  * @param handle        HPCAP handle.
@@ -557,6 +1030,14 @@ void hpcap_print_listener_status(FILE* out, struct hpcap_handle* handle);
  */
 short hpcap_is_header_padding(struct raw_header* header);
 
+/**
+ * Return whether a given header is a loss record (see HPCAP_LOSS_NSEC), which
+ * is followed by a struct hpcap_loss_record.
+ * @param  header Header pointer
+ * @return        1 if loss record, 0 if not.
+ */
+short hpcap_is_header_loss(struct raw_header* header);
+
 /**
  * @internal
  * Read the next header and frame in the buffer
@@ -589,6 +1070,82 @@ size_t hpcap_ioc_listener_info_available_bytes(struct hpcap_ioc_status_info_list
  */
 double hpcap_ioc_listener_occupation(struct hpcap_ioc_status_info_listener* l);
 
+/**
+ * Set up a handle over RAW records in memory instead of a device, e.g. a
+ * block received with hpcap_stream_recv, so that _hpcap_read_next and
+ * hpcap_read_packet walk them as they walk the buffer of a queue. The
+ * functions that talk to the driver can't be used with it.
+ * @param handle Handle structure, zeroed before use.
+ * @param buf    Records.
+ * @param len    Bytes of records.
+ */
+void hpcap_open_memory(struct hpcap_handle* handle, void* buf, size_t len);
+
+/**
+ * @name Remote streaming
+ *
+ * Framing of the RAW stream that samples/hpcapstream sends to a collector
+ * (samples/hpcaprecv) over one or several TCP connections. Each connection
+ * starts with a struct hpcap_stream_hello, followed by blocks of whole RAW
+ * records, each after a struct hpcap_stream_block. The blocks are numbered
+ * across the connections of the stream, and every connection carries them in
+ * increasing order, so the receiver puts them back in order and knows which
+ * ones are missing. The records keep the byte order of the sender.
+ *
+ * @{
+ */
+#define HPCAP_STREAM_MAGIC 0x54535048u	/**< "HPST" */
+#define HPCAP_STREAM_VERSION 1
+#define HPCAP_STREAM_MAX_CONNS 32		/**< Maximum connections of a stream */
+#define HPCAP_STREAM_BLOCK (1024 * 1024ul)	/**< Maximum bytes of records in a block */
+#define HPCAP_STREAM_ZLIB 0x1			/**< Flag of the blocks with a payload compressed with zlib */
+
+/**
+ * First message of every connection of a stream.
+ */
+struct __attribute__((__packed__)) hpcap_stream_hello {
+	uint32_t magic;			/**< HPCAP_STREAM_MAGIC */
+	uint16_t version;		/**< HPCAP_STREAM_VERSION */
+	uint16_t connections;	/**< Connections of the stream */
+	uint64_t stream_id;		/**< Same in all the connections of a stream */
+};
+
+/**
+ * Header of a block of records.
+ */
+struct __attribute__((__packed__)) hpcap_stream_block {
+	uint32_t magic;			/**< HPCAP_STREAM_MAGIC */
+	uint32_t flags;			/**< HPCAP_STREAM_ZLIB */
+	uint64_t seq;			/**< Number of the block in the stream, from 0 */
+	uint32_t raw_len;		/**< Bytes of records, at most HPCAP_STREAM_BLOCK */
+	uint32_t payload_len;	/**< Bytes that follow the header */
+};
+
+/**
+ * Send a block of records, compressed if a level is given and it gets smaller.
+ * Sets every field of the header but seq and raw_len.
+ * @param  fd    Socket.
+ * @param  block Header of the block.
+ * @param  raw   Records.
+ * @param  aux   Space for the compressed payload, HPCAP_STREAM_BLOCK bytes.
+ * @param  level zlib compression level, 0 to send it as is.
+ * @return       HPCAP_OK or HPCAP_ERR, with errno set.
+ */
+int hpcap_stream_send(int fd, struct hpcap_stream_block* block, const void* raw, void* aux, int level);
+
+/**
+ * Receive a block of records, uncompressed.
+ * @param  fd    Socket.
+ * @param  block [Out] Header of the block.
+ * @param  raw   [Out] Records, HPCAP_STREAM_BLOCK bytes.
+ * @param  aux   Space for the compressed payload, HPCAP_STREAM_BLOCK bytes.
+ * @return       1 if a block was received, 0 if the connection was closed
+ *               before a block, HPCAP_ERR on errors or malformed blocks.
+ */
+int hpcap_stream_recv(int fd, struct hpcap_stream_block* block, void* raw, void* aux);
+
+/** @} */
+
 /** @} */
 
 #endif /* !__KERNEL__ */
@@ -115,6 +115,8 @@ typedef struct {
 typedef void (*packet_handler)(uint8_t *payload, struct pcap_pkthdr *header, void *arg);
 typedef void (*flow_handler)(IPFlow *record, void *arg);
 typedef void (*mrtg_handler)(mrtg *stat, void *arg);
+typedef void (*flow_vector_handler)(IPFlow *records, size_t count, void *arg);
+typedef void (*mrtg_vector_handler)(mrtg *stats, size_t count, void *arg);
 
 /**
  * Receives frames from the given interface/adapter in a loop.
@@ -128,7 +130,8 @@ typedef void (*mrtg_handler)(mrtg *stat, void *arg);
 int mgmon_packet_online_loop(int cpu, int ifindex, int qindex, packet_handler callback, void *arg);
 
 /**
- * Receives flows from the given interface/adapter in a loop.
+ * Receives flows from the given interface/adapter in a loop. Accepts
+ * datagrams of compact records and datagrams with a raw IPFlow.
  * @param  cpu      CPU core to bind the process to.
  * @param  ifindex  Interface index.
  * @param  qindex   Queue index.
@@ -149,8 +152,573 @@ int mgmon_flow_online_loop(int cpu, int ifindex, int qindex, flow_handler callba
  */
 int mgmon_mrtg_online_loop(int cpu, int ifindex, int qindex, mrtg_handler callback, void *arg);
 
+/**
+ * Same as mgmon_flow_online_loop, but the callback receives vectors with all
+ * the records of up to batch datagrams, read with a single recvmmsg call.
+ * @param  batch Datagrams read per call (0 for MGMON_DEFAULT_BATCH).
+ */
+int mgmon_flow_online_loop_batch(int cpu, int ifindex, int qindex, size_t batch, flow_vector_handler callback, void *arg);
+
+/**
+ * Same as mgmon_mrtg_online_loop, but the callback receives vectors with the
+ * statistics of up to batch datagrams, read with a single recvmmsg call.
+ * @param  batch Datagrams read per call (0 for MGMON_DEFAULT_BATCH).
+ */
+int mgmon_mrtg_online_loop_batch(int cpu, int ifindex, int qindex, size_t batch, mrtg_vector_handler callback, void *arg);
+
+/**
+ * Opens a socket to send to the multicast group of the given mode
+ * (MCAST_FLOW, MCAST_MRTG) and queue, through the BIND_IFACE_IP interface.
+ * @param  dstAddr Where to store the address of the group.
+ * @return         The socket, or 0 on error.
+ */
 int open_multicast_tx_socket(int mode, int ifindex, int qindex, struct sockaddr_in *dstAddr);
 
+/**
+ * Opens a socket that receives from the multicast group of the given mode
+ * and queue, with a timeout of 1 second.
+ * @return The socket, or 0 on error.
+ */
+int open_multicast_rx_socket(int mode, int ifindex, int qindex);
+
+/**
+ * Waits for SIGINT (which must be blocked in the calling threads) and sets
+ * the stop flag of the mgmon_signal passed as argument.
+ */
+void *mgmon_signal_thread(void *arg);
+
+/**
+ * @name Batched datagram I/O
+ *
+ * Pools of datagram buffers sent with sendmmsg and received with recvmmsg,
+ * so that the cost of a system call is paid once per batch instead of once
+ * per datagram.
+ *
+ * @{
+ */
+
+#define MGMON_DEFAULT_BATCH 64	/**< Datagrams per system call */
+
+struct mgmon_batch_stats {
+	uint64_t datagrams;	/**< Datagrams sent or received */
+	uint64_t calls;		/**< System calls */
+	uint64_t dropped;	/**< Datagrams not sent after an error, or received truncated */
+};
+
+struct mgmon_tx_batch;
+struct mgmon_rx_batch;
+
+/**
+ * Creates a pool of datagrams to be sent through a socket.
+ * @param  sd         Socket.
+ * @param  dst        Destination of the datagrams.
+ * @param  batch      Datagrams per sendmmsg call (0 for MGMON_DEFAULT_BATCH).
+ * @param  dgram_size Maximum size of a datagram.
+ * @return            The pool, or NULL on error.
+ */
+struct mgmon_tx_batch *mgmon_tx_batch_create(int sd, const struct sockaddr_in *dst, size_t batch, size_t dgram_size);
+
+/**
+ * Sends the queued datagrams and releases the pool. The socket is not closed.
+ */
+void mgmon_tx_batch_destroy(struct mgmon_tx_batch *b);
+
+/**
+ * @return Buffer of dgram_size bytes where the next datagram can be built,
+ *         to be queued with mgmon_tx_batch_commit.
+ */
+uint8_t *mgmon_tx_batch_buffer(struct mgmon_tx_batch *b);
+
+/**
+ * Queues the datagram built in the buffer returned by mgmon_tx_batch_buffer,
+ * and sends the batch if it is complete.
+ * @return Datagrams sent, or -1 if len is bigger than the buffers.
+ */
+int mgmon_tx_batch_commit(struct mgmon_tx_batch *b, size_t len);
+
+/**
+ * Copies a datagram to the pool and queues it.
+ * @return Same as mgmon_tx_batch_commit.
+ */
+int mgmon_tx_batch_send(struct mgmon_tx_batch *b, const void *data, size_t len);
+
+/**
+ * Sends the queued datagrams.
+ * @return Datagrams sent.
+ */
+int mgmon_tx_batch_flush(struct mgmon_tx_batch *b);
+
+void mgmon_tx_batch_get_stats(struct mgmon_tx_batch *b, struct mgmon_batch_stats *stats);
+
+/**
+ * Creates a pool of datagrams to be received from a socket.
+ * @param  batch      Datagrams per recvmmsg call (0 for MGMON_DEFAULT_BATCH).
+ * @param  dgram_size Size of the buffers. Bigger datagrams are dropped.
+ * @return            The pool, or NULL on error.
+ */
+struct mgmon_rx_batch *mgmon_rx_batch_create(int sd, size_t batch, size_t dgram_size);
+
+void mgmon_rx_batch_destroy(struct mgmon_rx_batch *b);
+
+/**
+ * Receives up to batch datagrams with a single system call, replacing the
+ * ones of the previous call.
+ * @param  wait 1 to wait for the first datagram (up to the timeout of the
+ *              socket), 0 to return immediately if there is none.
+ * @return      Datagrams received, 0 if there were none and -1 on error.
+ */
+int mgmon_rx_batch_recv(struct mgmon_rx_batch *b, short wait);
+
+/**
+ * @return The i-th datagram of the last call to mgmon_rx_batch_recv, or NULL
+ *         if it does not exist or was truncated.
+ */
+const uint8_t *mgmon_rx_batch_datagram(struct mgmon_rx_batch *b, size_t i, size_t *len);
+
+void mgmon_rx_batch_get_stats(struct mgmon_rx_batch *b, struct mgmon_batch_stats *stats);
+
+/** @} */
+
+/**
+ * @name Shared memory channels
+ *
+ * Alternative to the multicast groups for producers and consumers in the same
+ * host: a named ring in shared memory (hugetlbfs if mounted at
+ * MGMON_SHM_HUGETLB_PATH, /dev/shm otherwise) with one producer and up to
+ * MGMON_SHM_MAX_CONSUMERS consumers, each with its own cursor. Messages are
+ * the same datagrams sent to the multicast groups. The producer never blocks:
+ * messages that do not fit because of the slowest consumer are dropped.
+ *
+ * @{
+ */
+
+#define MGMON_TRANSPORT_MCAST 0	/**< Loopback multicast groups (default) */
+#define MGMON_TRANSPORT_SHM 1	/**< Shared memory rings */
+
+#define MGMON_SHM_HUGETLB_PATH "/mnt/hugetlb"
+#define MGMON_SHM_DEFAULT_SIZE (64UL << 20)
+#define MGMON_SHM_MAX_CONSUMERS 32
+
+struct mgmon_shm_stats {
+	uint64_t published;		/**< Messages published in the ring */
+	uint64_t dropped;		/**< Messages dropped by the producer because the ring was full */
+	uint64_t consumed;		/**< Messages read by this consumer */
+	uint64_t consumers;		/**< Consumers attached */
+};
+
+struct mgmon_shm;
+
+/**
+ * Selects the transport of the channels opened afterwards by the online loops
+ * and the flow meter loop. The callbacks do not change.
+ * @param transport MGMON_TRANSPORT_MCAST or MGMON_TRANSPORT_SHM.
+ */
+void mgmon_set_transport(int transport);
+
+int mgmon_get_transport(void);
+
+/**
+ * Opens the shared memory channel of the given mode (MCAST_FLOW, MCAST_MRTG)
+ * and queue, creating it if it does not exist.
+ * @param  size Bytes of the ring when it is created, rounded up to a power of
+ *              two (0 for MGMON_SHM_DEFAULT_SIZE).
+ * @return      The channel, or NULL on error.
+ */
+struct mgmon_shm *mgmon_shm_open(int mode, int ifindex, int qindex, size_t size);
+
+/**
+ * Releases the consumer slot, if any, and unmaps the channel. The channel is
+ * kept for the other processes.
+ */
+void mgmon_shm_close(struct mgmon_shm *shm);
+
+/**
+ * Removes the channel. Processes that have it open keep using it.
+ * @return 0 on OK, -1 if it did not exist.
+ */
+int mgmon_shm_unlink(int mode, int ifindex, int qindex);
+
+/**
+ * Publishes a message. Only one process can publish in a channel.
+ * @return 0 on OK, -1 if it was dropped.
+ */
+int mgmon_shm_publish(struct mgmon_shm *shm, const void *data, size_t len);
+
+/**
+ * Takes a consumer slot. Messages published from now on will be returned by
+ * mgmon_shm_next. Called by mgmon_shm_next if needed.
+ * @return The slot, or -1 if there are no free slots.
+ */
+int mgmon_shm_attach(struct mgmon_shm *shm);
+
+/**
+ * Releases the message returned by the previous call and returns the next one.
+ * @param  timeout_ns Time to wait for a message (0 to return immediately).
+ * @param  len        Where to store the length of the message.
+ * @return            The message, valid until the next call, or NULL on timeout.
+ */
+const uint8_t *mgmon_shm_next(struct mgmon_shm *shm, uint64_t timeout_ns, size_t *len);
+
+void mgmon_shm_get_stats(struct mgmon_shm *shm, struct mgmon_shm_stats *stats);
+
+/** @} */
+
+/**
+ * @name Flow meter
+ *
+ * Builds IPFlow records from the frames of an HPCAP queue. Flows are
+ * unidirectional and keyed by the IPv4 5-tuple. IP addresses are kept in
+ * network byte order (as in struct in_addr), ports in host byte order and
+ * timestamps and inter-arrival times in nanoseconds.
+ *
+ * @{
+ */
+
+#define MGMON_FLOW_DEFAULT_MAX_FLOWS (1 << 20)
+#define MGMON_FLOW_DEFAULT_IDLE_TIMEOUT (15ULL * 1000000000ULL)
+#define MGMON_FLOW_DEFAULT_ACTIVE_TIMEOUT (300ULL * 1000000000ULL)
+#define MGMON_FLOW_BURST 32 /**< Frames in every stage of the mgmon_flow_meter_burst pipeline */
+
+/**
+ * Frame to be processed by the flow meter.
+ */
+struct mgmon_flow_pkt {
+	const uint8_t *data;	/**< Frame data, starting at the Ethernet header */
+	uint16_t caplen;		/**< Captured bytes */
+	uint16_t len;			/**< Frame length in the wire */
+	uint64_t ts;			/**< Timestamp in nanoseconds */
+};
+
+/**
+ * Counters of the flow meter.
+ */
+struct mgmon_flow_meter_stats {
+	uint64_t packets;			/**< Frames processed */
+	uint64_t bytes;				/**< Bytes of the processed frames */
+	uint64_t non_ip;			/**< Frames ignored because they are not IPv4 */
+	uint64_t flows_created;
+	uint64_t flows_exported;
+	uint64_t expired_idle;		/**< Flows exported by the idle timeout */
+	uint64_t expired_active;	/**< Flows exported by the active timeout */
+	uint64_t expired_flags;		/**< Flows exported after a FIN or RST */
+	uint64_t evicted;			/**< Flows exported early because the table was full */
+};
+
+struct mgmon_flow_meter;
+
+/**
+ * Creates a flow meter.
+ * @param  max_flows      Maximum number of concurrent flows.
+ * @param  idle_timeout   A flow without frames for this time (ns) is exported.
+ * @param  active_timeout A flow active for longer than this time (ns) is exported
+ *                        and started again.
+ * @param  callback       Function that receives every expired flow. The record is
+ *                        only valid during the call.
+ * @param  arg            Argument to pass to the callback function.
+ * @return                The meter, or NULL on error.
+ */
+struct mgmon_flow_meter *mgmon_flow_meter_create(size_t max_flows, uint64_t idle_timeout, uint64_t active_timeout, flow_handler callback, void *arg);
+
+/**
+ * Exports all the active flows and releases the meter.
+ */
+void mgmon_flow_meter_destroy(struct mgmon_flow_meter *fm);
+
+/**
+ * Accounts one frame.
+ * @return 0 if the frame was accounted in a flow, -1 if it was ignored.
+ */
+int mgmon_flow_meter_packet(struct mgmon_flow_meter *fm, const uint8_t *data, uint16_t caplen, uint16_t len, uint64_t ts);
+
+/**
+ * Accounts a group of frames. They are processed in groups of
+ * MGMON_FLOW_BURST, overlapping the memory accesses of the flow table
+ * lookups, so it is faster than calling mgmon_flow_meter_packet for each
+ * frame, more so with bigger groups.
+ */
+void mgmon_flow_meter_burst(struct mgmon_flow_meter *fm, const struct mgmon_flow_pkt *pkts, size_t count);
+
+/**
+ * Exports the flows that have expired at the given time, with a resolution of
+ * about 1 ms. The timestamps of the frames already advance the expiration
+ * timers, so it is only needed when no traffic is received. Time must not go
+ * backwards.
+ */
+void mgmon_flow_meter_expire(struct mgmon_flow_meter *fm, uint64_t now);
+
+/**
+ * Exports all the active flows.
+ */
+void mgmon_flow_meter_flush(struct mgmon_flow_meter *fm);
+
+/**
+ * @return Number of flows in the table.
+ */
+size_t mgmon_flow_meter_active(struct mgmon_flow_meter *fm);
+
+void mgmon_flow_meter_get_stats(struct mgmon_flow_meter *fm, struct mgmon_flow_meter_stats *stats);
+
+/**
+ * Meters the frames of hpcapXqY in a loop and exports the expired flows
+ * through the MCAST_FLOW group of the queue as compact records, so they can
+ * be received with mgmon_flow_online_loop. The traffic statistics of every
+ * second, with the number of active flows, are published through the
+ * MCAST_MRTG channel, as mgmon_stats_loop does.
+ * @param  cpu       CPU core to bind the process to.
+ * @param  ifindex   Interface index.
+ * @param  qindex    Queue index.
+ * @param  max_flows Maximum number of concurrent flows (0 for the default).
+ * @return           0 on OK, -1 on error.
+ */
+int mgmon_flow_meter_loop(int cpu, int ifindex, int qindex, size_t max_flows);
+
+/**
+ * Computes the derived statistics of a record (average and standard
+ * deviation of the frame sizes and of the inter-arrival times) from its
+ * counters.
+ */
+void mgmon_flow_record_stats(IPFlow *rec);
+
+/** @} */
+
+/**
+ * @name Compact flow records
+ *
+ * Variable length encoding of IPFlow records for export, several records per
+ * datagram. Zero fields are not sent and integers are sent as varints, so a
+ * typical record takes tens of bytes instead of sizeof(IPFlow). The packet
+ * samples and the payload are optional sections. The format is described in
+ * mgmon_flowrec.c.
+ *
+ * @{
+ */
+
+#define MGMON_FLOWREC_MAGIC 0x4D46	/**< "MF" */
+#define MGMON_FLOWREC_VERSION 1
+#define MGMON_FLOWREC_HEADER 10		/**< Bytes of the datagram header */
+#define MGMON_FLOWREC_DATAGRAM 1472	/**< Maximum datagram size: an UDP payload that fits a 1500 bytes MTU */
+
+#define MGMON_FLOWREC_SAMPLES 0x01	/**< Send the timestamps and sizes of the first frames */
+#define MGMON_FLOWREC_PAYLOAD 0x02	/**< Send the payload of the first frames */
+
+/**
+ * Builds datagrams of compact flow records.
+ */
+struct mgmon_flowrec_writer {
+	uint8_t buf[MGMON_FLOWREC_DATAGRAM];
+	size_t len;			/**< Bytes used in buf, including the header */
+	uint16_t count;		/**< Records in buf */
+	uint32_t seq;		/**< Sequence number of the next datagram */
+	int sections;		/**< MGMON_FLOWREC_* sections sent */
+};
+
+/**
+ * Encodes one record.
+ * @param  sections MGMON_FLOWREC_* sections to include.
+ * @return          Bytes written, or 0 if the record does not fit in size bytes.
+ */
+size_t mgmon_flowrec_encode(const IPFlow *rec, int sections, uint8_t *buf, size_t size);
+
+/**
+ * Decodes one record.
+ * @return Bytes read, or -1 if the record is not valid.
+ */
+int mgmon_flowrec_decode(const uint8_t *buf, size_t size, IPFlow *rec);
+
+void mgmon_flowrec_writer_init(struct mgmon_flowrec_writer *w, int sections);
+
+/**
+ * Adds a record to the datagram of the writer.
+ * @return 0 on OK, -1 if the datagram is full: it must be sent with
+ *         mgmon_flowrec_writer_finish and the record added again.
+ */
+int mgmon_flowrec_writer_add(struct mgmon_flowrec_writer *w, const IPFlow *rec);
+
+/**
+ * Completes the datagram of the writer, which is left in w->buf, and starts
+ * the next one.
+ * @return Length of the datagram, 0 if it has no records.
+ */
+size_t mgmon_flowrec_writer_finish(struct mgmon_flowrec_writer *w);
+
+/**
+ * Decodes a datagram and calls the callback with each of its records.
+ * @param  seq Where to store the sequence number of the datagram, or NULL.
+ * @return     Number of records, or -1 if the datagram is not valid.
+ */
+int mgmon_flowrec_parse(const uint8_t *buf, size_t size, uint32_t *seq, flow_handler callback, void *arg);
+
+/** @} */
+
+/**
+ * @name Timing wheel
+ *
+ * Hierarchical timing wheel for large numbers of timers, such as the
+ * expiration of the flows of the flow meter. Time is given by the caller (for
+ * example, the timestamps of the captured frames), so it works both live and
+ * offline.
+ *
+ * @{
+ */
+
+#define MGMON_WHEEL_LEVELS 4
+#define MGMON_WHEEL_BITS 8	/**< log2 of the slots of every level */
+
+typedef void (*wheel_handler)(uint32_t id, void *arg);
+
+struct mgmon_wheel;
+
+/**
+ * Creates a timing wheel.
+ * @param  max_timers Number of timers. They are identified by their index.
+ * @param  tick_shift Resolution of the wheel: the timers fire in ticks of
+ *                    2^tick_shift time units. The wheel covers
+ *                    2^(MGMON_WHEEL_LEVELS * MGMON_WHEEL_BITS) ticks, later
+ *                    expirations are brought forward to that limit.
+ * @param  callback   Function called for every expired timer. It can schedule
+ *                    or cancel any timer, including the one that fired.
+ * @param  arg        Argument to pass to the callback function.
+ * @return            The wheel, or NULL on error.
+ */
+struct mgmon_wheel *mgmon_wheel_create(size_t max_timers, unsigned int tick_shift, wheel_handler callback, void *arg);
+
+void mgmon_wheel_destroy(struct mgmon_wheel *w);
+
+/**
+ * Schedules a timer, or moves it if it was already scheduled. O(1).
+ * Expiration times already passed fire in the next call to mgmon_wheel_advance.
+ */
+void mgmon_wheel_schedule(struct mgmon_wheel *w, uint32_t id, uint64_t expires);
+
+/**
+ * Removes a timer from the wheel, if it was scheduled. O(1).
+ */
+void mgmon_wheel_cancel(struct mgmon_wheel *w, uint32_t id);
+
+/**
+ * @return 1 if the timer is scheduled, 0 if not.
+ */
+short mgmon_wheel_pending(struct mgmon_wheel *w, uint32_t id);
+
+/**
+ * Fires all the timers that expire at or before now (with the resolution of
+ * the wheel). The time must not go backwards.
+ * @return Number of timers fired.
+ */
+size_t mgmon_wheel_advance(struct mgmon_wheel *w, uint64_t now);
+
+/**
+ * @return Number of scheduled timers.
+ */
+size_t mgmon_wheel_count(struct mgmon_wheel *w);
+
+/** @} */
+
+/**
+ * @name Traffic statistics
+ *
+ * Per queue counters of bytes, frames, frame sizes and concurrent flows,
+ * rolled up in intervals of 1 ms, 1 s and 1 min. The closed intervals of
+ * every resolution are kept in a fixed size ring that other threads can query
+ * without locks while the statistics are being updated, and the intervals of
+ * one resolution are published as mrtg records.
+ *
+ * @{
+ */
+
+#define MGMON_STATS_1MS 0		/**< Resolutions of the statistics */
+#define MGMON_STATS_1S 1
+#define MGMON_STATS_1MIN 2
+#define MGMON_STATS_LEVELS 3
+
+#define MGMON_STATS_1MS_HISTORY 1024	/**< Intervals kept of every resolution (about 1 s, 1 h and 1 day) */
+#define MGMON_STATS_1S_HISTORY 4096
+#define MGMON_STATS_1MIN_HISTORY 2048
+
+/**
+ * Frame size classes of the histogram: up to 64, 128, 256, 512, 1024, 2048
+ * and 4096 bytes, and bigger.
+ */
+#define MGMON_STATS_SIZE_CLASSES 8
+
+/**
+ * Statistics of an interval.
+ */
+struct mgmon_stats_bin {
+	uint64_t timestamp;		/**< Start of the interval (ns) */
+	uint64_t bytes;
+	uint64_t packets;
+	uint64_t flows;			/**< Maximum number of concurrent flows reported during the interval */
+	uint64_t sizes[MGMON_STATS_SIZE_CLASSES];	/**< Frames of every size class */
+};
+
+struct mgmon_stats;
+
+/**
+ * Creates a statistics engine.
+ * @param  level    Resolution whose intervals are passed to the callback and
+ *                  published, if mgmon_stats_export is called.
+ * @param  callback Function called with every closed interval of that
+ *                  resolution, or NULL.
+ * @param  arg      Argument to pass to the callback function.
+ * @return          The engine, or NULL on error.
+ */
+struct mgmon_stats *mgmon_stats_create(int level, mrtg_handler callback, void *arg);
+
+void mgmon_stats_destroy(struct mgmon_stats *s);
+
+/**
+ * Publishes the intervals through the MCAST_MRTG channel of the queue, with
+ * the transport selected by mgmon_set_transport, so they can be received with
+ * mgmon_mrtg_online_loop.
+ * @return 0 on OK, -1 on error.
+ */
+int mgmon_stats_export(struct mgmon_stats *s, int ifindex, int qindex);
+
+/**
+ * Accounts one frame. Timestamps must not go backwards more than an interval.
+ */
+void mgmon_stats_packet(struct mgmon_stats *s, uint64_t ts, uint16_t len);
+
+/**
+ * Accounts a group of frames. Only the ts and len fields are used.
+ */
+void mgmon_stats_burst(struct mgmon_stats *s, const struct mgmon_flow_pkt *pkts, size_t count);
+
+/**
+ * Closes the intervals that end at or before now. The timestamps of the frames
+ * already close them, so it is only needed when no traffic is received.
+ */
+void mgmon_stats_advance(struct mgmon_stats *s, uint64_t now);
+
+/**
+ * Reports the current number of concurrent flows, for example from
+ * mgmon_flow_meter_active.
+ */
+void mgmon_stats_set_flows(struct mgmon_stats *s, uint64_t flows);
+
+/**
+ * Copies the closed intervals of a resolution that start in [from, to), oldest
+ * first. Can be called from any thread.
+ * @param  level MGMON_STATS_1MS, MGMON_STATS_1S or MGMON_STATS_1MIN.
+ * @param  max   Size of bins. If there are more intervals, the latest ones are
+ *               copied.
+ * @return       Number of intervals copied.
+ */
+size_t mgmon_stats_query(struct mgmon_stats *s, int level, uint64_t from, uint64_t to, struct mgmon_stats_bin *bins, size_t max);
+
+/**
+ * Computes the statistics of hpcapXqY in a loop and publishes the intervals of
+ * 1 s through the MCAST_MRTG channel of the queue.
+ * @param  cpu     CPU core to bind the process to.
+ * @param  ifindex Interface index.
+ * @param  qindex  Queue index.
+ * @return         0 on OK, -1 on error.
+ */
+int mgmon_stats_loop(int cpu, int ifindex, int qindex);
+
+/** @} */
+
 /** @} */
 
 #endif /* _MGMON_LIB_ */
@@ -0,0 +1,167 @@
+/**
+ * @brief Prints the microburst statistics of a HPCAP queue.
+ *
+ * Optionally configures the burst detector of the queue, and then prints the
+ * statistics of every consumer periodically: peak rate, bursts and their
+ * length. With -d, also prints the rate of every new bin, adding up the bins
+ * of all the consumers, which see disjoint sets of frames.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../include/hpcap.h"
+
+static double gbps(uint64_t bytes, uint32_t bin_ns)
+{
+	return bin_ns ? bytes * 8.0 / bin_ns : 0;
+}
+
+static void print_stats(struct hpcap_burst_info *info)
+{
+	struct hpcap_burst_stats *s;
+	uint32_t i;
+
+	printf("%8s %10s %12s %10s %12s %12s %10s %10s %14s\n", "consumer", "bin ns", "bins", "peak Gbps", "threshold",
+		   "bursts", "burst bins", "longest", "last burst");
+
+	for (i = 0; i < info->consumers; i++) {
+		s = &info->stats[i];
+
+		printf("%8u %10u %12lu %10.2f %12u %12lu %10lu %10lu %14lu\n", i, s->bin_ns, s->bins,
+			   gbps(s->peak_bytes, s->bin_ns), s->threshold, s->bursts, s->burst_bins, s->longest_burst,
+			   s->last_burst_bins ? s->last_burst : 0);
+	}
+}
+
+/**
+ * Prints the bins closed by every consumer since the last call, from *next on.
+ */
+static void dump_bins(struct hpcap_handle *hp, struct hpcap_burst_info *info, uint64_t *next, uint32_t *bins, uint64_t *sum)
+{
+	uint64_t from, end = UINT64_MAX, first;
+	uint32_t bin_ns = info->stats[0].bin_ns;
+	int i, j, n;
+
+	// Only the bins closed by every consumer are complete
+	for (i = 0; i < (int) info->consumers; i++)
+		end = minimo(end, info->stats[i].first_bin + info->stats[i].bins);
+
+	if (*next == 0 || end - *next > HPCAP_BURST_BINS)
+		*next = end > HPCAP_BURST_BINS ? end - HPCAP_BURST_BINS : 0;
+
+	if (end <= *next)
+		return;
+
+	memset(sum, 0, sizeof(uint64_t) * (end - *next));
+
+	for (i = 0; i < (int) info->consumers; i++) {
+		first = *next;
+		n = hpcap_burst_bins(hp, i, &first, bins, end - *next);
+
+		for (j = 0; j < n && first + j < end; j++)
+			sum[first + j - *next] += bins[j];
+	}
+
+	for (from = *next; from < end; from++)
+		printf("bin %lu (%lu.%09lu): %.3f Gbps\n", from, from * bin_ns / 1000000000UL, from * bin_ns % 1000000000UL,
+			   gbps(sum[from - *next], bin_ns));
+
+	*next = end;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] <adapter index> <queue index>\n", prog);
+	fprintf(stderr, "  -w ns        Set the width of the bins (%lu to %lu ns, 0 for the default)\n", HPCAP_BURST_MIN_NS,
+			HPCAP_BURST_MAX_NS);
+	fprintf(stderr, "  -T bytes     Set the burst threshold in bytes per bin and consumer (0 for the default)\n");
+	fprintf(stderr, "  -i seconds   Interval between reports (default 1)\n");
+	fprintf(stderr, "  -n reports   Reports to print, 0 for no limit (default 0)\n");
+	fprintf(stderr, "  -d           Print every bin, with the bins of all the consumers added up\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct hpcap_handle hp;
+	struct hpcap_burst_info info;
+	uint32_t bin_ns = 0, threshold = 0, *bins;
+	uint64_t next = 0, *sum;
+	int configure = 0, dump = 0, opt;
+	unsigned int interval = 1, reports = 0, r;
+
+	while ((opt = getopt(argc, argv, "w:T:i:n:dh")) != -1) {
+		switch (opt) {
+			case 'w':
+				bin_ns = strtoul(optarg, NULL, 0);
+				configure = 1;
+				break;
+
+			case 'T':
+				threshold = strtoul(optarg, NULL, 0);
+				configure = 1;
+				break;
+
+			case 'i':
+				interval = maximo(atoi(optarg), 1);
+				break;
+
+			case 'n':
+				reports = atoi(optarg);
+				break;
+
+			case 'd':
+				dump = 1;
+				break;
+
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind < 2) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (hpcap_open(&hp, atoi(argv[optind]), atoi(argv[optind + 1])) != HPCAP_OK)
+		return EXIT_FAILURE;
+
+	if (configure && hpcap_burst_conf(&hp, bin_ns, threshold) != HPCAP_OK) {
+		fprintf(stderr, "Cannot configure the burst detector\n");
+		hpcap_close(&hp);
+		return EXIT_FAILURE;
+	}
+
+	bins = malloc(sizeof(uint32_t) * HPCAP_BURST_BINS);
+	sum = malloc(sizeof(uint64_t) * HPCAP_BURST_BINS);
+
+	if (bins == NULL || sum == NULL) {
+		hpcap_close(&hp);
+		return EXIT_FAILURE;
+	}
+
+	for (r = 0; reports == 0 || r < reports; r++) {
+		sleep(interval);
+
+		if (hpcap_burst_stats(&hp, &info) != HPCAP_OK) {
+			fprintf(stderr, "Cannot read the burst statistics\n");
+			break;
+		}
+
+		if (dump && info.consumers > 0)
+			dump_bins(&hp, &info, &next, bins, sum);
+
+		print_stats(&info);
+	}
+
+	free(bins);
+	free(sum);
+	hpcap_close(&hp);
+
+	return EXIT_SUCCESS;
+}
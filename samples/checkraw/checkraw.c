@@ -17,6 +17,17 @@ struct  __attribute__((__packed__)) raw_header {
 	uint16_t len;
 };
 
+/* Loss records, as in hpcap.h */
+#define HPCAP_LOSS_NSEC 0xffffffffu
+
+struct __attribute__((__packed__)) hpcap_loss_record {
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t nic_frames;
+	uint64_t first_ns;
+	uint64_t last_ns;
+};
+
 static long min_tstamp;
 static short had_errors;
 static size_t max_errors = 20;
@@ -31,6 +42,7 @@ static void usage()
 	printf("checkraw: helper binary for checking the integrity of RAW files.\n");
 	printf("usage: checkraw [OPTIONS] file/dir(s)\n\n");
 	printf("file/dir(s) is one or more RAW files or directories where RAW files are stored.\n");
+	printf("The loss records of the driver are reported in lines starting with LOSS.\n");
 	printf("Options:\n");
 	printf("  -t min_tstamp : Only check files with a timestamp greater than min_tstamp\n");
 	printf("  -c            : Don't detect frames with caplen < 64 as errors.\n");
@@ -90,10 +102,11 @@ static short fix_capture(FILE* file, size_t frame_start_offset, size_t file_size
 	return 1;
 }
 
-static long read_raw(const char* fname, long file_tstamp, size_t* error_count)
+static long read_raw(const char* fname, long file_tstamp, size_t* error_count, struct hpcap_loss_record* lost)
 {
 	FILE* file;
 	struct raw_header header;
+	struct hpcap_loss_record loss;
 	size_t frame_count = 0;
 	size_t read_bytes = 0;
 	short found_padding = 0;
@@ -101,6 +114,7 @@ static long read_raw(const char* fname, long file_tstamp, size_t* error_count)
 	size_t frame_start_position = 0;
 
 	*error_count = 0;
+	memset(lost, 0, sizeof(struct hpcap_loss_record));
 
 	if (fix_errors)
 		file = fopen(fname, "r+");
@@ -156,6 +170,28 @@ static long read_raw(const char* fname, long file_tstamp, size_t* error_count)
 			break;
 		}
 
+		if (header.sec == 0 && header.nsec == HPCAP_LOSS_NSEC) {
+			if (header.caplen != sizeof(struct hpcap_loss_record) || header.len != 0) {
+				fprintf(stderr, "ERROR %s - f%zu: Wrong loss record header (len = %hu, caplen = %hu)\n", fname, frame_count, header.len, header.caplen);
+				(*error_count)++;
+				fseek(file, header.caplen, SEEK_CUR);
+			} else if (fread(&loss, sizeof(struct hpcap_loss_record), 1, file) != 1) {
+				fprintf(stderr, "ERROR %s - f%zu: Truncated loss record\n", fname, frame_count);
+				(*error_count)++;
+				break;
+			} else {
+				printf("LOSS %s - f%zu: %" PRIu64 " frames (%" PRIu64 " bytes) dropped by the driver and %" PRIu64 " by the NIC between %" PRIu64 ".%09" PRIu64 " and %" PRIu64 ".%09" PRIu64 "\n",
+					   fname, frame_count, loss.frames, loss.bytes, loss.nic_frames, loss.first_ns / NSECS_PER_SEC, loss.first_ns % NSECS_PER_SEC,
+					   loss.last_ns / NSECS_PER_SEC, loss.last_ns % NSECS_PER_SEC);
+
+				lost->frames += loss.frames;
+				lost->bytes += loss.bytes;
+				lost->nic_frames += loss.nic_frames;
+			}
+
+			continue;
+		}
+
 		frame_count++;
 
 		if (header.sec == 0 && header.nsec == 0) {
@@ -225,6 +261,7 @@ static void explore_file(const char* path)
 	long file_tstamp;
 	long frames;
 	size_t error_count;
+	struct hpcap_loss_record lost;
 	const char* extension;
 	char path_copy[1024]; // For basename, as it can modify the string.
 	const char* filename;
@@ -250,7 +287,7 @@ static void explore_file(const char* path)
 
 		fflush(stdout);
 
-		frames = read_raw(path, file_tstamp, &error_count);
+		frames = read_raw(path, file_tstamp, &error_count, &lost);
 
 		if (error_count > 0)
 			had_errors = 1;
@@ -258,7 +295,12 @@ static void explore_file(const char* path)
 		tmp = localtime(&file_tstamp);
 		strftime(time_str, sizeof(time_str), "%a %d/%m/%y %T", tmp);
 
-		printf("%s (%s) - %zu frames | %zu errors\n", path, time_str, frames, error_count);
+		printf("%s (%s) - %zu frames | %zu errors", path, time_str, frames, error_count);
+
+		if (lost.frames > 0 || lost.nic_frames > 0)
+			printf(" | %" PRIu64 " frames lost (%" PRIu64 " by the NIC)", lost.frames + lost.nic_frames, lost.nic_frames);
+
+		printf("\n");
 	}
 }
 
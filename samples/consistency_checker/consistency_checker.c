@@ -138,7 +138,7 @@ int main(int argc, char **argv)
 			_hpcap_read_next(&hp, &raw_hdr, NULL, auxbuf);
 
 			if ((hpcap_is_header_padding(raw_hdr) && hp.rdoff >= frame_in_buffer_size)
-				|| (!hpcap_is_header_padding(raw_hdr) && raw_hdr->caplen != frame_size)) {
+				|| (!hpcap_is_header_padding(raw_hdr) && !hpcap_is_header_loss(raw_hdr) && raw_hdr->caplen != frame_size)) {
 				hp.rdoff = prev_rdoff;
 				hp.acks = prev_acks;
 
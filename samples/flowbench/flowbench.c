@@ -0,0 +1,207 @@
+/**
+ * @brief Benchmark of the libmgmon flow meter.
+ *
+ * Builds a synthetic trace of minimum size TCP and UDP frames spread over a
+ * number of flows, with timestamps 67.2 ns apart (10 GbE line rate for 64 byte
+ * frames), and measures the rate at which the flow meter processes it. The
+ * target is 14.88 Mpps in one core.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "../include/hpcap.h"
+#include "../include/libmgmon.h"
+
+#define FRAME_LEN 60		/**< 64 bytes in the wire, without the FCS */
+#define FRAME_GAP_PS 67200	/**< Time between frames at 10 Gbps, in picoseconds */
+#define LINE_RATE_MPPS 14.88
+
+static uint64_t exported = 0;
+
+static void count_flow(IPFlow *record, void *arg)
+{
+	(void) arg;
+	(void) record;
+	exported++;
+}
+
+static uint64_t xorshift(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+
+	return *state;
+}
+
+static void build_frame(uint8_t *frame, uint32_t flow, uint32_t seq)
+{
+	uint8_t *ip = frame + 14, *l4 = ip + 20;
+	uint8_t proto = (flow & 3) ? 6 : 17;
+	uint32_t src = htonl(0x0A000000 | (flow & 0xFFFFFF)), dst = htonl(0xC0A80001 + (flow >> 24));
+	uint16_t sport = 1024 + (flow % 50000), dport = (flow & 3) ? 443 : 53;
+
+	memset(frame, 0, FRAME_LEN);
+	memcpy(frame, "\x00\x1b\x21\x00\x00\x01\x00\x1b\x21\x00\x00\x02\x08\x00", 14);
+
+	ip[0] = 0x45;
+	ip[2] = 0;
+	ip[3] = FRAME_LEN - 14;
+	ip[4] = seq >> 8;
+	ip[5] = seq;
+	ip[8] = 64;
+	ip[9] = proto;
+	memcpy(ip + 12, &src, 4);
+	memcpy(ip + 16, &dst, 4);
+
+	l4[0] = sport >> 8;
+	l4[1] = sport;
+	l4[2] = dport >> 8;
+	l4[3] = dport;
+
+	if (proto == 6) {
+		l4[4] = seq >> 24;
+		l4[5] = seq >> 16;
+		l4[6] = seq >> 8;
+		l4[7] = seq;
+		l4[12] = 5 << 4;
+		l4[13] = 0x10; // ACK
+		l4[14] = 0x10;
+	} else
+		l4[5] = FRAME_LEN - 14 - 20;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	fprintf(stderr, "  -n frames  Frames in the trace (default 4000000)\n");
+	fprintf(stderr, "  -f flows   Distinct flows in the trace (default 100000)\n");
+	fprintf(stderr, "  -t size    Flow table size (default %d)\n", MGMON_FLOW_DEFAULT_MAX_FLOWS);
+	fprintf(stderr, "  -r runs    Passes over the trace (default 5)\n");
+	fprintf(stderr, "  -b frames  Frames per call to mgmon_flow_meter_burst (default 256)\n");
+	fprintf(stderr, "  -1         Use mgmon_flow_meter_packet instead of the burst interface\n");
+}
+
+int main(int argc, char **argv)
+{
+	size_t frames = 4000000, flows = 100000, table = MGMON_FLOW_DEFAULT_MAX_FLOWS, runs = 5, burst = 256;
+	short single = 0;
+	uint8_t *trace;
+	struct mgmon_flow_pkt *pkts;
+	struct mgmon_flow_meter *fm;
+	struct mgmon_flow_meter_stats stats;
+	struct timespec start, end;
+	uint64_t rng = 0x9E3779B97F4A7C15ULL, ts_ps = 0;
+	double ns, best = 0, mpps;
+	size_t i, j;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:f:t:r:b:1h")) != -1) {
+		switch (opt) {
+			case 'n':
+				frames = strtoull(optarg, NULL, 0);
+				break;
+
+			case 'f':
+				flows = strtoull(optarg, NULL, 0);
+				break;
+
+			case 't':
+				table = strtoull(optarg, NULL, 0);
+				break;
+
+			case 'r':
+				runs = strtoull(optarg, NULL, 0);
+				break;
+
+			case 'b':
+				burst = strtoull(optarg, NULL, 0);
+				break;
+
+			case '1':
+				single = 1;
+				break;
+
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (frames == 0 || flows == 0 || runs == 0 || burst == 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	trace = malloc(frames * FRAME_LEN);
+	pkts = malloc(frames * sizeof(struct mgmon_flow_pkt));
+
+	if (!trace || !pkts) {
+		fprintf(stderr, "Cannot allocate a trace of %zu frames\n", frames);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < frames; i++) {
+		build_frame(trace + i * FRAME_LEN, xorshift(&rng) % flows, i);
+		pkts[i].data = trace + i * FRAME_LEN;
+		pkts[i].caplen = FRAME_LEN;
+		pkts[i].len = FRAME_LEN;
+	}
+
+	if (single)
+		printf("# flowbench: %zu frames, %zu flows, table of %zu flows, single frame interface\n", frames, flows, table);
+	else
+		printf("# flowbench: %zu frames, %zu flows, table of %zu flows, bursts of %zu frames\n", frames, flows, table, burst);
+
+	fm = mgmon_flow_meter_create(table, MGMON_FLOW_DEFAULT_IDLE_TIMEOUT, MGMON_FLOW_DEFAULT_ACTIVE_TIMEOUT, count_flow, NULL);
+
+	if (fm == NULL)
+		return EXIT_FAILURE;
+
+	for (j = 0; j < runs; j++) {
+		// Timestamps keep growing between runs, as in a longer trace
+		for (i = 0; i < frames; i++) {
+			ts_ps += FRAME_GAP_PS;
+			pkts[i].ts = ts_ps / 1000;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		if (single) {
+			for (i = 0; i < frames; i++)
+				mgmon_flow_meter_packet(fm, pkts[i].data, pkts[i].caplen, pkts[i].len, pkts[i].ts);
+		} else {
+			for (i = 0; i < frames; i += burst)
+				mgmon_flow_meter_burst(fm, pkts + i, minimo(frames - i, burst));
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+		mpps = frames / ns * 1e3;
+
+		if (mpps > best)
+			best = mpps;
+
+		printf("run %zu: %.2f Mpps, %.1f ns/pkt, %zu active flows\n", j, mpps, ns / frames, mgmon_flow_meter_active(fm));
+	}
+
+	mgmon_flow_meter_get_stats(fm, &stats);
+	mgmon_flow_meter_destroy(fm);
+
+	printf("frames %lu, non IP %lu, flows created %lu, exported %lu (idle %lu, active %lu, flags %lu, evicted %lu)\n",
+		   stats.packets, stats.non_ip, stats.flows_created, exported, stats.expired_idle, stats.expired_active,
+		   stats.expired_flags, stats.evicted);
+	printf("best: %.2f Mpps (%s %.2f Mpps)\n", best, best >= LINE_RATE_MPPS ? "above" : "below", LINE_RATE_MPPS);
+
+	free(trace);
+	free(pkts);
+
+	return best >= LINE_RATE_MPPS ? EXIT_SUCCESS : EXIT_FAILURE;
+}
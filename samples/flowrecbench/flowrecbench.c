@@ -0,0 +1,365 @@
+/**
+ * @brief Benchmark of the compact flow record format against raw IPFlow
+ * datagrams.
+ *
+ * Generates a set of synthetic flow records (a few long flows and many short
+ * ones, TCP and UDP, with payload in the first frames) and measures, for raw
+ * IPFlow datagrams and for compact records with each combination of optional
+ * sections, the bytes per record, the records per datagram and the encoding
+ * and decoding rates. Every decoded record is compared with the original one.
+ *
+ * With -s the datagrams are also sent through a loopback UDP socket and
+ * received and decoded in the same thread, which gives the end to end export
+ * rate including the system calls.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../include/hpcap.h"
+#include "../include/libmgmon.h"
+
+#define SEND_CHUNK 32	/**< Datagrams sent before draining the receiving socket */
+
+struct check {
+	const IPFlow *recs;
+	size_t next;
+	size_t errors;
+	int sections;
+};
+
+static uint64_t xorshift(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+
+	return *state;
+}
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void build_record(IPFlow *rec, uint64_t *rng, uint64_t ts)
+{
+	uint64_t r = xorshift(rng), iat;
+	uint32_t i, n, size, used = 0, stored;
+	short tcp = (r & 3) != 0;
+
+	memset(rec, 0, sizeof(IPFlow));
+
+	rec->source_ip = htonl(0x0A000000 | (xorshift(rng) & 0xFFFFFF));
+	rec->destination_ip = htonl(0xC0A80000 | (xorshift(rng) & 0xFFFF));
+	rec->source_mac = 0x001B21000001ULL;
+	rec->destination_mac = 0x001B21000002ULL;
+	rec->source_port = 1024 + xorshift(rng) % 60000;
+	rec->destination_port = tcp ? 443 : 53;
+	rec->transport_protocol = tcp ? 6 : 17;
+
+	// Most flows are short, a few are long
+	n = 1 + xorshift(rng) % (1U << (xorshift(rng) % 14));
+	rec->npack = n;
+	rec->firstpacket_timestamp = ts;
+	rec->previous_timestamp = ts;
+
+	for (i = 0; i < n; i++) {
+		size = 60 + xorshift(rng) % 1455;
+		iat = i ? xorshift(rng) % 5000000 : 0;
+
+		ts += iat;
+		rec->nbytes += size;
+		rec->nbytes_sqr += (uint64_t) size * size;
+
+		if (i == 0 || size > rec->max_pack_size)
+			rec->max_pack_size = size;
+
+		if (i == 0 || size < rec->min_pack_size)
+			rec->min_pack_size = size;
+
+		if (i > 0) {
+			if (i == 1 || iat < rec->min_int_time)
+				rec->min_int_time = iat;
+
+			if (iat > rec->max_int_time)
+				rec->max_int_time = iat;
+
+			rec->sum_int_time += iat;
+			rec->sum_int_time_sqr += (double) iat * iat;
+		}
+
+		if (i < MAX_PACK) {
+			rec->timestamp[i] = ts;
+			rec->size[i] = size;
+
+			if (size > 100 && used < MAX_PAYLOAD) {
+				stored = minimo(size - 54, MAX_PAYLOAD - used);
+				rec->packet_offset[rec->npack_payload++] = used;
+
+				for (; stored > 0; stored--)
+					rec->payload[used++] = 1 + xorshift(rng) % 255;
+			}
+		}
+	}
+
+	rec->previous_timestamp = ts;
+	rec->lastpacket_timestamp = ts;
+	rec->duration = ts - rec->firstpacket_timestamp;
+
+	if (tcp) {
+		rec->num_flags[4] = n;
+		rec->num_flags[1] = 1;
+		rec->num_flags[3] = n / 2;
+		rec->num_flags[0] = r & 4 ? 1 : 0;
+		rec->flags = 0x1A | (r & 4 ? 0x01 : 0);
+		rec->rtt_syn = 20000 + xorshift(rng) % 1000000;
+		rec->rtt_syn_done = 1;
+		rec->current_seq_number = xorshift(rng);
+		rec->previous_seq_number = rec->current_seq_number - 1448;
+		rec->flag_ACK_nulo = 1;
+		rec->flag_FIN = rec->expired_by_flags = (r & 4) != 0;
+		rec->offset = 54;
+	} else
+		rec->offset = 42;
+
+	rec->ip_id = xorshift(rng);
+	rec->dataLen = rec->size[0] - rec->offset;
+	rec->payload_ptr = rec->payload;
+
+	mgmon_flow_record_stats(rec);
+}
+
+static void check_record(IPFlow *record, void *arg)
+{
+	struct check *c = arg;
+	IPFlow expected = c->recs[c->next++];
+
+	if (!(c->sections & MGMON_FLOWREC_SAMPLES)) {
+		memset(expected.timestamp, 0, sizeof(expected.timestamp));
+		memset(expected.size, 0, sizeof(expected.size));
+	}
+
+	if (!(c->sections & MGMON_FLOWREC_PAYLOAD)) {
+		memset(expected.packet_offset, 0, sizeof(expected.packet_offset));
+		memset(expected.payload, 0, sizeof(expected.payload));
+		expected.npack_payload = 0;
+	}
+
+	expected.payload_ptr = record->payload_ptr;
+
+	if (memcmp(&expected, record, sizeof(IPFlow)) != 0)
+		c->errors++;
+}
+
+static int open_loopback(int *tx, int *rx, struct sockaddr_in *addr)
+{
+	socklen_t len = sizeof(*addr);
+	int size = 8 << 20;
+
+	*tx = socket(AF_INET, SOCK_DGRAM, 0);
+	*rx = socket(AF_INET, SOCK_DGRAM, 0);
+
+	if (*tx < 0 || *rx < 0)
+		return -1;
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(*rx, (struct sockaddr *) addr, sizeof(*addr)) < 0 || getsockname(*rx, (struct sockaddr *) addr, &len) < 0)
+		return -1;
+
+	setsockopt(*rx, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	return 0;
+}
+
+/**
+ * Sends the datagrams through the loopback socket and decodes them at the
+ * other end.
+ * @return Records received.
+ */
+static size_t send_datagrams(int tx, int rx, struct sockaddr_in *addr, const uint8_t *dgrams, const size_t *lens,
+							 size_t count, short raw, uint64_t *elapsed)
+{
+	static uint8_t buf[65536];
+	IPFlow record;
+	size_t i, j, received = 0;
+	uint64_t start = now_ns();
+	ssize_t n;
+	int ret;
+
+	for (i = 0; i < count; i += SEND_CHUNK) {
+		for (j = i; j < count && j < i + SEND_CHUNK; j++) {
+			if (sendto(tx, dgrams + j * MGMON_FLOWREC_DATAGRAM, lens[j], 0, (struct sockaddr *) addr, sizeof(*addr)) < 0)
+				perror("sendto");
+		}
+
+		while ((n = recv(rx, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+			if (raw) {
+				memcpy(&record, buf, sizeof(IPFlow));
+				received++;
+			} else if ((ret = mgmon_flowrec_parse(buf, n, NULL, NULL, NULL)) > 0)
+				received += ret;
+		}
+	}
+
+	*elapsed = now_ns() - start;
+
+	return received;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	fprintf(stderr, "  -n records  Records to encode (default 200000)\n");
+	fprintf(stderr, "  -s          Also send the datagrams through a loopback UDP socket\n");
+}
+
+int main(int argc, char **argv)
+{
+	static const int modes[] = { -1, 0, MGMON_FLOWREC_SAMPLES, MGMON_FLOWREC_SAMPLES | MGMON_FLOWREC_PAYLOAD };
+	static const char *names[] = { "raw IPFlow", "compact", "compact+samples", "compact+samples+payload" };
+	size_t count = 200000, i, m, ndgrams, bytes, received;
+	short do_send = 0;
+	IPFlow *recs;
+	uint8_t *dgrams;
+	size_t *lens;
+	struct mgmon_flowrec_writer *w;
+	struct check c;
+	struct sockaddr_in addr;
+	uint64_t rng = 0x9E3779B97F4A7C15ULL, start, enc_ns, dec_ns, send_ns;
+	int opt, tx = -1, rx = -1;
+
+	while ((opt = getopt(argc, argv, "n:sh")) != -1) {
+		switch (opt) {
+			case 'n':
+				count = strtoull(optarg, NULL, 0);
+				break;
+
+			case 's':
+				do_send = 1;
+				break;
+
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (count == 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	recs = malloc(count * sizeof(IPFlow));
+	dgrams = malloc(count * MGMON_FLOWREC_DATAGRAM);
+	lens = malloc(count * sizeof(size_t));
+	w = malloc(sizeof(struct mgmon_flowrec_writer));
+
+	if (!recs || !dgrams || !lens || !w) {
+		fprintf(stderr, "Cannot allocate %zu records\n", count);
+		return EXIT_FAILURE;
+	}
+
+	// Fault the datagram buffer in before the measurements
+	memset(dgrams, 0, count * MGMON_FLOWREC_DATAGRAM);
+
+	if (do_send && open_loopback(&tx, &rx, &addr) < 0) {
+		perror("Cannot open the loopback sockets");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < count; i++)
+		build_record(&recs[i], &rng, 1500000000000000000ULL + i * 1000);
+
+	printf("# flowrecbench: %zu records, sizeof(IPFlow) %zu bytes, datagrams of up to %d bytes\n",
+		   count, sizeof(IPFlow), MGMON_FLOWREC_DATAGRAM);
+	printf("%-24s %10s %10s %12s %12s %10s%s\n", "format", "B/record", "rec/dgram", "encode Mr/s", "decode Mr/s", "errors",
+		   do_send ? "  loopback Mr/s" : "");
+
+	for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+		memset(&c, 0, sizeof(c));
+		c.recs = recs;
+		c.sections = modes[m] < 0 ? MGMON_FLOWREC_SAMPLES | MGMON_FLOWREC_PAYLOAD : modes[m];
+		ndgrams = bytes = 0;
+
+		start = now_ns();
+
+		if (modes[m] < 0) {
+			// One record per datagram, as sent by the flow exporter before
+			for (i = 0; i < count; i++) {
+				memcpy(dgrams + i * MGMON_FLOWREC_DATAGRAM, &recs[i], sizeof(IPFlow));
+				lens[i] = sizeof(IPFlow);
+			}
+
+			ndgrams = count;
+		} else {
+			mgmon_flowrec_writer_init(w, modes[m]);
+
+			for (i = 0; i < count; i++) {
+				if (mgmon_flowrec_writer_add(w, &recs[i]) == 0)
+					continue;
+
+				lens[ndgrams] = mgmon_flowrec_writer_finish(w);
+				memcpy(dgrams + ndgrams * MGMON_FLOWREC_DATAGRAM, w->buf, lens[ndgrams]);
+				ndgrams++;
+				mgmon_flowrec_writer_add(w, &recs[i]);
+			}
+
+			lens[ndgrams] = mgmon_flowrec_writer_finish(w);
+			memcpy(dgrams + ndgrams * MGMON_FLOWREC_DATAGRAM, w->buf, lens[ndgrams]);
+			ndgrams++;
+		}
+
+		enc_ns = now_ns() - start;
+
+		for (i = 0; i < ndgrams; i++)
+			bytes += lens[i];
+
+		start = now_ns();
+
+		for (i = 0; i < ndgrams; i++) {
+			if (modes[m] < 0)
+				check_record((IPFlow *)(dgrams + i * MGMON_FLOWREC_DATAGRAM), &c);
+			else if (mgmon_flowrec_parse(dgrams + i * MGMON_FLOWREC_DATAGRAM, lens[i], NULL, check_record, &c) < 0)
+				c.errors++;
+		}
+
+		dec_ns = now_ns() - start;
+
+		if (c.next != count)
+			c.errors += count - c.next;
+
+		printf("%-24s %10.1f %10.1f %12.2f %12.2f %10zu", names[m], (double) bytes / count, (double) count / ndgrams,
+			   count * 1e3 / enc_ns, count * 1e3 / dec_ns, c.errors);
+
+		if (do_send) {
+			received = send_datagrams(tx, rx, &addr, dgrams, lens, ndgrams, modes[m] < 0, &send_ns);
+			printf("  %14.2f (%zu lost)", received * 1e3 / send_ns, count - received);
+		}
+
+		printf("\n");
+	}
+
+	if (do_send) {
+		close(tx);
+		close(rx);
+	}
+
+	free(recs);
+	free(dgrams);
+	free(lens);
+	free(w);
+
+	return EXIT_SUCCESS;
+}
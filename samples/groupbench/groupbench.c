@@ -0,0 +1,243 @@
+/**
+ * @brief Benchmark of the listener groups with several worker processes.
+ *
+ * For every number of workers, forks that many processes that open the same
+ * queue, join a listener group and read frames for the given time, spending a
+ * fixed amount of work on each one as a CPU-heavy analysis would. Reports the
+ * frames per second of the group and of each worker. While the traffic of the
+ * queue is more than the workers can process, the rate of the group should
+ * grow linearly with the workers, and the frames should be split evenly.
+ *
+ * Up to MAX_LISTENERS workers, minus the other listeners of the queue.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "../include/hpcap.h"
+
+#define MAX_SWEEP 16
+
+struct worker_result {
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t ns;
+	int error;
+};
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Work on a frame: rounds of a hash over its first bytes.
+ */
+static uint64_t analyze(const u_char *frame, size_t len, size_t rounds)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	size_t i, r;
+
+	len = len < 64 ? len : 64;
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < len; i++)
+			h = (h ^ frame[i]) * 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+static void worker(int adapter, int queue, int group, uint64_t duration_ns, size_t rounds, struct worker_result *res)
+{
+	struct hpcap_handle hp;
+	u_char *bp = NULL;
+	u_char auxbuf[RAW_HLEN + MAX_PACKET_SIZE];
+	uint16_t caplen;
+	uint64_t start, sink = 0;
+
+	memset(res, 0, sizeof(struct worker_result));
+
+	if (hpcap_open(&hp, adapter, queue) != HPCAP_OK) {
+		res->error = 1;
+		return;
+	}
+
+	if (hpcap_map(&hp) != HPCAP_OK || hpcap_join_group(&hp, group) != HPCAP_OK) {
+		perror("Cannot map the buffer or join the group");
+		res->error = 1;
+		hpcap_close(&hp);
+		return;
+	}
+
+	start = now_ns();
+
+	while (now_ns() - start < duration_ns) {
+		if (hp.acks == hp.avail)
+			hpcap_ack_wait_timeout(&hp, 1, 100000000);
+
+		if (hp.acks < hp.avail) {
+			hpcap_read_packet(&hp, &bp, auxbuf, &caplen, NULL);
+
+			if (bp && caplen > 0) {
+				sink += analyze(bp + RAW_HLEN, caplen, rounds);
+				res->frames++;
+				res->bytes += caplen;
+			}
+		}
+	}
+
+	res->ns = now_ns() - start;
+
+	hpcap_ack(&hp);
+	hpcap_unmap(&hp);
+	hpcap_close(&hp);
+
+	__asm__ __volatile__("" :: "r"(sink));
+}
+
+static size_t parse_list(const char *s, size_t *list)
+{
+	size_t n = 0;
+	char *end;
+
+	while (*s && n < MAX_SWEEP) {
+		list[n++] = strtoul(s, &end, 0);
+
+		if (*end != ',')
+			break;
+
+		s = end + 1;
+	}
+
+	return n;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] <adapter index> <queue index>\n", prog);
+	fprintf(stderr, "  -w workers    Numbers of workers, comma separated (default 1,2,4)\n");
+	fprintf(stderr, "  -d seconds    Duration of every measurement (default 5)\n");
+	fprintf(stderr, "  -r rounds     Rounds of work per frame (default 20)\n");
+	fprintf(stderr, "  -g group      Group ID (default 1)\n");
+}
+
+int main(int argc, char **argv)
+{
+	size_t workers[MAX_SWEEP] = { 1, 2, 4 }, nworkers = 3;
+	size_t rounds = 20, i, j;
+	uint64_t duration_ns = 5000000000ULL, frames, bytes, min, max;
+	double base = 0, mpps;
+	struct worker_result *res;
+	int adapter, queue, group = 1, opt, error;
+	pid_t pid;
+
+	while ((opt = getopt(argc, argv, "w:d:r:g:h")) != -1) {
+		switch (opt) {
+			case 'w':
+				nworkers = parse_list(optarg, workers);
+				break;
+
+			case 'd':
+				duration_ns = strtod(optarg, NULL) * 1e9;
+				break;
+
+			case 'r':
+				rounds = strtoul(optarg, NULL, 0);
+				break;
+
+			case 'g':
+				group = atoi(optarg);
+				break;
+
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind != 2 || group <= 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	adapter = atoi(argv[optind]);
+	queue = atoi(argv[optind + 1]);
+
+	for (i = 0; i < nworkers; i++) {
+		if (workers[i] == 0 || workers[i] > MAX_LISTENERS) {
+			fprintf(stderr, "Workers must be between 1 and %d\n", MAX_LISTENERS);
+			return EXIT_FAILURE;
+		}
+	}
+
+	res = mmap(NULL, MAX_LISTENERS * sizeof(struct worker_result), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (res == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+
+	printf("# groupbench: hpcap%dq%d, group %d, %zu rounds of work per frame, %.1f s per measurement\n",
+		   adapter, queue, group, rounds, duration_ns / 1e9);
+	printf("%7s %10s %8s %8s %12s %12s\n", "workers", "frames", "Mpps", "scaling", "min/worker", "max/worker");
+
+	for (i = 0; i < nworkers; i++) {
+		memset(res, 0, MAX_LISTENERS * sizeof(struct worker_result));
+
+		for (j = 0; j < workers[i]; j++) {
+			pid = fork();
+
+			if (pid == 0) {
+				worker(adapter, queue, group, duration_ns, rounds, &res[j]);
+				_exit(res[j].error ? EXIT_FAILURE : EXIT_SUCCESS);
+			} else if (pid < 0) {
+				perror("fork");
+				return EXIT_FAILURE;
+			}
+		}
+
+		while (wait(NULL) > 0);
+
+		frames = bytes = max = 0;
+		min = UINT64_MAX;
+		mpps = 0;
+		error = 0;
+
+		for (j = 0; j < workers[i]; j++) {
+			error |= res[j].error;
+			frames += res[j].frames;
+			bytes += res[j].bytes;
+			mpps += res[j].ns ? res[j].frames * 1e3 / res[j].ns : 0;
+			min = res[j].frames < min ? res[j].frames : min;
+			max = res[j].frames > max ? res[j].frames : max;
+		}
+
+		if (error) {
+			fprintf(stderr, "Some workers could not read from hpcap%dq%d\n", adapter, queue);
+			return EXIT_FAILURE;
+		}
+
+		if (i == 0)
+			base = mpps / workers[0];
+
+		printf("%7zu %10"PRIu64" %8.3f %8.2f %12"PRIu64" %12"PRIu64"\n", workers[i], frames, mpps,
+			   base > 0 ? mpps / base : 0, min, max);
+		fflush(stdout);
+	}
+
+	munmap(res, MAX_LISTENERS * sizeof(struct worker_result));
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,367 @@
+/**
+ * @brief Collector of the streams of hpcapstream.
+ *
+ * Accepts the connections of a stream, puts its blocks back in order and
+ * writes the RAW records to a file (or the standard output), which raw2pcap
+ * and the other RAW tools read as a local capture. The blocks are also
+ * walked with a handle over memory (hpcap_open_memory), as a local consumer
+ * would read them, to count and check the records. Missing blocks are
+ * reported; the loss records of the sender are kept in the stream.
+ *
+ * The blocks that come too early wait in a window, and the connections that
+ * bring them stop reading until the window moves, so a slow output slows
+ * down the sender instead of growing the memory of the collector.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "../include/hpcap.h"
+
+#define WINDOW_BLOCKS 128			/**< Blocks held to put them back in order */
+#define RCVBUF_SIZE (4 * 1024 * 1024)
+
+struct connection {
+	pthread_t thread;
+	int fd;
+	int open;
+	int has_seq;
+	uint64_t last_seq;		/**< Last block received, the connection only brings later ones */
+	struct collector* col;
+};
+
+struct collector {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint8_t* window[WINDOW_BLOCKS];
+	uint32_t window_len[WINDOW_BLOCKS];
+	uint64_t next;			/**< Next block to write */
+	struct connection conns[HPCAP_STREAM_MAX_CONNS];
+	int nconns;
+	uint64_t errors;
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] -p port\n", prog);
+	fprintf(stderr, "  -p port       TCP port to listen on\n");
+	fprintf(stderr, "  -o file       Write the RAW stream to the given file, - for the standard output\n");
+}
+
+static void* connection_run(void* arg)
+{
+	struct connection* conn = arg;
+	struct collector* col = conn->col;
+	struct hpcap_stream_block block;
+	uint8_t* raw = NULL, *aux;
+	size_t slot;
+	int r;
+
+	aux = malloc(HPCAP_STREAM_BLOCK);
+
+	while (aux != NULL) {
+		if (raw == NULL && (raw = malloc(HPCAP_STREAM_BLOCK)) == NULL)
+			break;
+
+		r = hpcap_stream_recv(conn->fd, &block, raw, aux);
+
+		if (r <= 0) {
+			if (r < 0)
+				fprintf(stderr, "Error receiving from connection %d: %s\n", (int)(conn - col->conns), strerror(errno));
+
+			break;
+		}
+
+		pthread_mutex_lock(&col->lock);
+
+		if (conn->has_seq && block.seq <= conn->last_seq) {
+			fprintf(stderr, "Block %" PRIu64 " after block %" PRIu64 " in connection %d\n", block.seq, conn->last_seq, (int)(conn - col->conns));
+			col->errors++;
+			pthread_mutex_unlock(&col->lock);
+			break;
+		}
+
+		conn->has_seq = 1;
+		conn->last_seq = block.seq;
+		pthread_cond_broadcast(&col->cond);
+
+		while (block.seq >= col->next + WINDOW_BLOCKS)
+			pthread_cond_wait(&col->cond, &col->lock);
+
+		slot = block.seq % WINDOW_BLOCKS;
+
+		// Behind the window only if its gap was given up, see next_gap
+		if (block.seq >= col->next && col->window[slot] == NULL) {
+			col->window[slot] = raw;
+			col->window_len[slot] = block.raw_len;
+			raw = NULL;
+			pthread_cond_broadcast(&col->cond);
+		} else {
+			fprintf(stderr, "Block %" PRIu64 " came too late\n", block.seq);
+			col->errors++;
+		}
+
+		pthread_mutex_unlock(&col->lock);
+	}
+
+	free(raw);
+	free(aux);
+
+	pthread_mutex_lock(&col->lock);
+	conn->open = 0;
+	pthread_cond_broadcast(&col->cond);
+	pthread_mutex_unlock(&col->lock);
+
+	return NULL;
+}
+
+/**
+ * Where to go on when the next block is missing for good: every connection is
+ * closed or brought a later block, and they come in order. Called with the
+ * lock held.
+ * @return The next block that can come, UINT64_MAX if none, 0 if the missing
+ *         block can still come.
+ */
+static uint64_t next_gap(struct collector* col)
+{
+	uint64_t next = UINT64_MAX;
+	size_t i;
+
+	for (i = 0; i < col->nconns; i++) {
+		if (col->conns[i].open && (!col->conns[i].has_seq || col->conns[i].last_seq <= col->next))
+			return 0;
+
+		if (col->conns[i].open)
+			next = minimo(next, col->conns[i].last_seq);
+	}
+
+	for (i = 1; i < WINDOW_BLOCKS; i++) {
+		if (col->window[(col->next + i) % WINDOW_BLOCKS] != NULL) {
+			next = minimo(next, col->next + i);
+			break;
+		}
+	}
+
+	return next;
+}
+
+/**
+ * Walk the records of a block as a consumer of a queue does.
+ * @return 0 if the records fill the block, -1 if not.
+ */
+static int check_block(uint8_t* raw, size_t len, uint64_t* frames, uint64_t* bytes, struct hpcap_loss_record* lost)
+{
+	struct hpcap_handle hp;
+	struct hpcap_loss_record loss;
+	struct raw_header* rawh;
+	uint8_t* frame;
+
+	hpcap_open_memory(&hp, raw, len);
+
+	while (hp.acks < hp.avail && _hpcap_read_next(&hp, &rawh, &frame, NULL)) {
+		if (hp.acks > hp.avail)
+			break;
+
+		if (hpcap_is_header_loss(rawh) && rawh->caplen == sizeof(struct hpcap_loss_record)) {
+			memcpy(&loss, frame, sizeof(struct hpcap_loss_record));
+			lost->frames += loss.frames;
+			lost->bytes += loss.bytes;
+			lost->nic_frames += loss.nic_frames;
+		} else if (!hpcap_is_header_padding(rawh)) {
+			(*frames)++;
+			*bytes += rawh->len;
+		}
+	}
+
+	return hp.acks == hp.avail ? 0 : -1;
+}
+
+static int write_all(int fd, const uint8_t* buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(fd, buf, len);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret <= 0)
+			return -1;
+
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct collector col;
+	struct hpcap_stream_hello hello, first;
+	struct hpcap_loss_record lost;
+	struct sockaddr_in6 addr;
+	const char* output = NULL;
+	uint64_t blocks = 0, missing = 0, frames = 0, bytes = 0, raw_bytes = 0, gap;
+	uint8_t* raw;
+	size_t slot;
+	uint32_t len;
+	int opt, port = -1, lfd, fd, out = -1, one = 1, rcvbuf = RCVBUF_SIZE, i, ret = EXIT_SUCCESS;
+
+	while ((opt = getopt(argc, argv, "p:o:h")) != -1) {
+		switch (opt) {
+			case 'p':
+				port = atoi(optarg);
+				break;
+
+			case 'o':
+				output = optarg;
+				break;
+
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (port < 0 || port > 65535 || optind != argc) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (output != NULL) {
+		out = strcmp(output, "-") == 0 ? STDOUT_FILENO : open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+		if (out < 0) {
+			fprintf(stderr, "Error opening %s: %s\n", output, strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	lfd = socket(AF_INET6, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_addr = in6addr_any;
+	addr.sin6_port = htons(port);
+
+	if (lfd < 0 || setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0
+			|| setsockopt(lfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) != 0
+			|| bind(lfd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(lfd, HPCAP_STREAM_MAX_CONNS) != 0) {
+		fprintf(stderr, "Error listening on port %d: %s\n", port, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	memset(&col, 0, sizeof(col));
+	memset(&lost, 0, sizeof(lost));
+	memset(&first, 0, sizeof(first));
+	pthread_mutex_init(&col.lock, NULL);
+	pthread_cond_init(&col.cond, NULL);
+
+	// The first connection tells how many make the stream
+	do {
+		fd = accept(lfd, NULL, NULL);
+
+		if (fd < 0) {
+			fprintf(stderr, "Error accepting connections: %s\n", strerror(errno));
+			return EXIT_FAILURE;
+		}
+
+		if (recv(fd, &hello, sizeof(hello), MSG_WAITALL) != sizeof(hello) || hello.magic != HPCAP_STREAM_MAGIC || hello.version != HPCAP_STREAM_VERSION
+				|| hello.connections == 0 || hello.connections > HPCAP_STREAM_MAX_CONNS
+				|| (col.nconns > 0 && hello.stream_id != first.stream_id)) {
+			fprintf(stderr, "Connection rejected: not a connection of %s\n", col.nconns > 0 ? "this stream" : "a stream");
+			close(fd);
+			continue;
+		}
+
+		if (col.nconns == 0)
+			first = hello;
+
+		col.conns[col.nconns].fd = fd;
+		col.conns[col.nconns].open = 1;
+		col.conns[col.nconns].col = &col;
+
+		if (pthread_create(&col.conns[col.nconns].thread, NULL, connection_run, &col.conns[col.nconns]) != 0) {
+			fprintf(stderr, "Error creating the connection threads\n");
+			return EXIT_FAILURE;
+		}
+
+		col.nconns++;
+	} while (col.nconns == 0 || col.nconns < first.connections);
+
+	close(lfd);
+	fprintf(stderr, "Receiving stream %016" PRIx64 " over %d connections\n", first.stream_id, col.nconns);
+
+	pthread_mutex_lock(&col.lock);
+
+	for (;;) {
+		slot = col.next % WINDOW_BLOCKS;
+
+		if (col.window[slot] != NULL) {
+			raw = col.window[slot];
+			len = col.window_len[slot];
+			col.window[slot] = NULL;
+			col.next++;
+			pthread_cond_broadcast(&col.cond);
+			pthread_mutex_unlock(&col.lock);
+
+			if (check_block(raw, len, &frames, &bytes, &lost) != 0) {
+				fprintf(stderr, "Block %" PRIu64 " does not hold whole records\n", col.next - 1);
+				ret = EXIT_FAILURE;
+			}
+
+			if (out >= 0 && write_all(out, raw, len) != 0) {
+				fprintf(stderr, "Error writing the stream: %s\n", strerror(errno));
+				ret = EXIT_FAILURE;
+			}
+
+			blocks++;
+			raw_bytes += len;
+			free(raw);
+
+			pthread_mutex_lock(&col.lock);
+			continue;
+		}
+
+		gap = next_gap(&col);
+
+		if (gap == UINT64_MAX)
+			break;
+		else if (gap > 0) {
+			fprintf(stderr, "Blocks %" PRIu64 " to %" PRIu64 " are missing\n", col.next, gap - 1);
+			missing += gap - col.next;
+			col.next = gap;
+			pthread_cond_broadcast(&col.cond);
+			continue;
+		}
+
+		pthread_cond_wait(&col.cond, &col.lock);
+	}
+
+	pthread_mutex_unlock(&col.lock);
+
+	for (i = 0; i < col.nconns; i++) {
+		pthread_join(col.conns[i].thread, NULL);
+		close(col.conns[i].fd);
+	}
+
+	if (out >= 0 && out != STDOUT_FILENO)
+		close(out);
+
+	fprintf(stderr, "%" PRIu64 " blocks, %" PRIu64 " bytes of records, %" PRIu64 " frames of %" PRIu64 " bytes\n", blocks, raw_bytes, frames, bytes);
+	fprintf(stderr, "%" PRIu64 " blocks missing, %" PRIu64 " errors. Loss records: %" PRIu64 " frames (%" PRIu64 " bytes) dropped by the driver and %" PRIu64 " by the NIC\n",
+			missing, col.errors, lost.frames, lost.bytes, lost.nic_frames);
+
+	return ret == EXIT_SUCCESS && missing == 0 && col.errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
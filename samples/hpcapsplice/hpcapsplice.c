@@ -0,0 +1,233 @@
+/**
+ * @brief Move the RAW stream of a queue to a file with splice(), without
+ * copying the data to user space, or copy it to a TCP collector.
+ *
+ * The data spliced from the device is acknowledged when the pipe releases it,
+ * which the file does once it has copied the data. The pipe must not go to a
+ * socket: it releases the pipe buffers before sending the pages, which the
+ * driver could overwrite by then. The stream to a collector is thus copied
+ * from the mapped buffer with hpcap_write_block, in blocks of HPCAP_BS bytes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "../include/hpcap.h"
+
+#define SPLICE_CHUNK (1 << 20)
+
+static volatile int stop = 0;
+
+static void handle_signal(int sig)
+{
+	stop = 1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] <adapter index> <queue index>\n", prog);
+	fprintf(stderr, "  -o file       Write the stream to the given raw file\n");
+	fprintf(stderr, "  -c host:port  Copy the stream to a TCP collector\n");
+	fprintf(stderr, "  -n bytes      Stop after the given number of bytes\n");
+}
+
+static int connect_collector(char *addr)
+{
+	struct addrinfo hints, *res, *ai;
+	char *port = strrchr(addr, ':');
+	int fd = -1;
+
+	if (port == NULL) {
+		fprintf(stderr, "Collector must be host:port\n");
+		return -1;
+	}
+
+	*port++ = '\0';
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo(addr, port, &hints, &res) != 0) {
+		fprintf(stderr, "Can't resolve %s:%s\n", addr, port);
+		return -1;
+	}
+
+	for (ai = res; ai != NULL && fd < 0; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+		if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+
+	freeaddrinfo(res);
+
+	if (fd < 0)
+		fprintf(stderr, "Error connecting to %s:%s: %s\n", addr, port, strerror(errno));
+
+	return fd;
+}
+
+/* Copy whole blocks of HPCAP_BS bytes from the mapped buffer: -n is rounded down */
+static int copy_stream(struct hpcap_handle *hp, int out, uint64_t limit, uint64_t *total)
+{
+	uint64_t sent;
+	int ret = 0;
+
+	if (hpcap_map(hp) != HPCAP_OK) {
+		fprintf(stderr, "Error mapping the buffer: %s\n", strerror(errno));
+		return -1;
+	}
+
+	while (!stop && (limit == 0 || *total + HPCAP_BS <= limit)) {
+		hpcap_ack_wait_timeout(hp, HPCAP_BS, 1000000000/*1 sec*/);
+
+		if (hp->avail < HPCAP_BS)
+			continue;
+
+		sent = hpcap_write_block(hp, out, HPCAP_BS);
+
+		if (sent == (uint64_t) -1) {
+			fprintf(stderr, "Error sending to the collector\n");
+			ret = -1;
+			break;
+		}
+
+		*total += sent;
+	}
+
+	hpcap_ack(hp);
+	hpcap_unmap(hp);
+	return ret;
+}
+
+static int splice_stream(struct hpcap_handle *hp, int out, uint64_t limit, uint64_t *total)
+{
+	int pipefd[2], ret = 0;
+	ssize_t in, moved;
+
+	if (pipe(pipefd) != 0) {
+		fprintf(stderr, "Error creating the pipe: %s\n", strerror(errno));
+		return -1;
+	}
+
+	// A larger pipe takes more data per call; the default size also works
+	fcntl(pipefd[1], F_SETPIPE_SZ, SPLICE_CHUNK);
+
+	while (!stop && (limit == 0 || *total < limit)) {
+		in = splice(hp->fd, NULL, pipefd[1], NULL, limit == 0 ? SPLICE_CHUNK : minimo(SPLICE_CHUNK, limit - *total), SPLICE_F_MOVE);
+
+		if (in < 0 && errno == EINTR)
+			continue;
+
+		if (in <= 0) {
+			if (in < 0) {
+				fprintf(stderr, "Error splicing from the device: %s\n", strerror(errno));
+				ret = -1;
+			}
+
+			break;
+		}
+
+		// Everything in the pipe must go out before the next splice, or the buffer can't release it
+		while (in > 0) {
+			moved = splice(pipefd[0], NULL, out, NULL, in, SPLICE_F_MOVE);
+
+			if (moved < 0 && errno == EINTR)
+				continue;
+
+			if (moved <= 0) {
+				fprintf(stderr, "Error splicing to the output: %s\n", moved < 0 ? strerror(errno) : "closed");
+				ret = -1;
+				goto close_pipe;
+			}
+
+			in -= moved;
+			*total += moved;
+		}
+	}
+
+close_pipe:
+	close(pipefd[0]);
+	close(pipefd[1]);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct hpcap_handle hp;
+	char *output = NULL, *collector = NULL;
+	uint64_t limit = 0, total = 0;
+	int adapter, queue, opt, out, ret = EXIT_FAILURE;
+
+	while ((opt = getopt(argc, argv, "o:c:n:h")) != -1) {
+		switch (opt) {
+			case 'o':
+				output = optarg;
+				break;
+
+			case 'c':
+				collector = optarg;
+				break;
+
+			case 'n':
+				limit = strtoull(optarg, NULL, 10);
+				break;
+
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind != 2 || (output == NULL) == (collector == NULL)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	adapter = atoi(argv[optind]);
+	queue = atoi(argv[optind + 1]);
+
+	if (collector != NULL) {
+		out = connect_collector(collector);
+
+		if (out < 0)
+			return EXIT_FAILURE;
+	} else {
+		out = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+		if (out < 0) {
+			fprintf(stderr, "Error opening %s: %s\n", output, strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (hpcap_open(&hp, adapter, queue) != HPCAP_OK) {
+		fprintf(stderr, "Error opening hpcap%dq%d: %s\n", adapter, queue, strerror(errno));
+		goto close_out;
+	}
+
+	signal(SIGINT, handle_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	if ((collector != NULL ? copy_stream(&hp, out, limit, &total) : splice_stream(&hp, out, limit, &total)) == 0) {
+		printf("%" PRIu64 " bytes moved to %s\n", total, collector != NULL ? collector : output);
+		ret = EXIT_SUCCESS;
+	}
+
+	hpcap_close(&hp);
+close_out:
+	close(out);
+	return ret;
+}
@@ -0,0 +1,609 @@
+/**
+ * @brief Stream the traffic of a queue to a remote collector (hpcaprecv).
+ *
+ * Packs the RAW records in numbered blocks, optionally truncated to a snap
+ * length, filtered with a BPF expression and compressed, and sends them over
+ * one or several TCP connections. The loss records of the driver are kept and
+ * the file paddings dropped. When the network can't keep up, the blocks are
+ * spilled to a local file (-S) and sent from there, in order, once it catches
+ * up, instead of holding the buffer of the queue until the driver drops
+ * frames.
+ *
+ * It can also stream a RAW file (-r) instead of a queue.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include <pcap.h>
+
+#include "../include/hpcap.h"
+
+#define QUEUE_BLOCKS 64				/**< Blocks waiting for the connections in memory */
+#define FLUSH_NS 100000000ull		/**< Blocks not full are sent when they are this old */
+#define SNDBUF_SIZE (4 * 1024 * 1024)
+
+struct block {
+	struct hpcap_stream_block hdr;
+	uint8_t raw[HPCAP_STREAM_BLOCK];
+};
+
+/**
+ * Blocks waiting to be sent, in memory and, once it is full, in the spill
+ * file. The blocks only go to memory while the spill file is empty, so they
+ * leave in the order they came in.
+ */
+struct block_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	struct block* ring[QUEUE_BLOCKS];
+	size_t head;
+	size_t count;
+	struct block** free;		/**< Blocks not in use */
+	size_t nfree;
+	int spill_fd;				/**< -1 without spill file */
+	off_t spill_rd;
+	off_t spill_wr;
+	uint64_t spilled;			/**< Blocks that went through the spill file */
+	int done;					/**< No more blocks will come in */
+	int failed;					/**< The blocks can't be sent */
+};
+
+struct sender {
+	pthread_t thread;
+	int fd;
+	struct block_queue* queue;
+	int level;
+	uint64_t blocks;
+	uint64_t raw_bytes;
+	uint64_t sent_bytes;
+	uint8_t aux[HPCAP_STREAM_BLOCK];
+};
+
+static volatile int stop = 0;
+
+static void handle_signal(int sig)
+{
+	stop = 1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] -c host:port <adapter index> <queue index>\n", prog);
+	fprintf(stderr, "       %s [options] -c host:port -r file.raw\n", prog);
+	fprintf(stderr, "  -c host:port  Collector to send the stream to\n");
+	fprintf(stderr, "  -n conns      Parallel connections (default 1, up to %d)\n", HPCAP_STREAM_MAX_CONNS);
+	fprintf(stderr, "  -z level      Compress the blocks with the given zlib level (default 0, none)\n");
+	fprintf(stderr, "  -s snaplen    Truncate the frames to the given length\n");
+	fprintf(stderr, "  -f filter     Send only the frames that match the BPF filter\n");
+	fprintf(stderr, "  -S file       Spill the blocks to this file when the network is slower than the traffic\n");
+	fprintf(stderr, "  -r file       Stream a RAW file instead of a queue\n");
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int connect_collector(const char *host, const char *port)
+{
+	struct addrinfo hints, *res, *ai;
+	int fd = -1, sndbuf = SNDBUF_SIZE;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo(host, port, &hints, &res) != 0) {
+		fprintf(stderr, "Can't resolve %s:%s\n", host, port);
+		return -1;
+	}
+
+	for (ai = res; ai != NULL && fd < 0; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+		if (fd < 0)
+			continue;
+
+		setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+
+	freeaddrinfo(res);
+
+	if (fd < 0)
+		fprintf(stderr, "Error connecting to %s:%s: %s\n", host, port, strerror(errno));
+
+	return fd;
+}
+
+static int queue_init(struct block_queue* q, size_t nblocks, const char* spill)
+{
+	size_t i;
+
+	memset(q, 0, sizeof(struct block_queue));
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+	q->spill_fd = -1;
+
+	q->free = calloc(nblocks, sizeof(struct block*));
+
+	if (q->free == NULL)
+		return -1;
+
+	for (i = 0; i < nblocks; i++) {
+		q->free[i] = malloc(sizeof(struct block));
+
+		if (q->free[i] == NULL)
+			return -1;
+
+		q->nfree++;
+	}
+
+	if (spill != NULL) {
+		q->spill_fd = open(spill, O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+		if (q->spill_fd < 0) {
+			fprintf(stderr, "Error opening the spill file %s: %s\n", spill, strerror(errno));
+			return -1;
+		}
+
+		unlink(spill);
+	}
+
+	return 0;
+}
+
+static void queue_free(struct block_queue* q)
+{
+	while (q->nfree > 0)
+		free(q->free[--q->nfree]);
+
+	free(q->free);
+
+	if (q->spill_fd >= 0)
+		close(q->spill_fd);
+}
+
+/**
+ * Queue a block. The caller gets a free block in its place.
+ * @return 0 if OK, -1 if the blocks can't be sent.
+ */
+static int queue_push(struct block_queue* q, struct block** b)
+{
+	size_t len = sizeof(struct hpcap_stream_block) + (*b)->hdr.raw_len;
+	int ret = 0;
+
+	pthread_mutex_lock(&q->lock);
+
+	while (q->spill_fd < 0 && q->count == QUEUE_BLOCKS && !q->failed)
+		pthread_cond_wait(&q->not_full, &q->lock);
+
+	if (q->failed)
+		ret = -1;
+	else if (q->count == QUEUE_BLOCKS || q->spill_wr > q->spill_rd) {
+		if (pwrite(q->spill_fd, *b, len, q->spill_wr) != (ssize_t) len) {
+			fprintf(stderr, "Error writing to the spill file: %s\n", strerror(errno));
+			q->failed = 1;
+			ret = -1;
+		} else {
+			q->spill_wr += len;
+			q->spilled++;
+		}
+	} else {
+		q->ring[(q->head + q->count) % QUEUE_BLOCKS] = *b;
+		q->count++;
+		*b = q->free[--q->nfree];
+	}
+
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->lock);
+
+	return ret;
+}
+
+/**
+ * Take the oldest block.
+ * @return The block, NULL once there are no more.
+ */
+static struct block* queue_pop(struct block_queue* q)
+{
+	struct block* b = NULL;
+
+	pthread_mutex_lock(&q->lock);
+
+	while (q->count == 0 && q->spill_rd == q->spill_wr && !q->done && !q->failed)
+		pthread_cond_wait(&q->not_empty, &q->lock);
+
+	if (q->failed)
+		goto out;
+
+	if (q->count > 0) {
+		b = q->ring[q->head];
+		q->head = (q->head + 1) % QUEUE_BLOCKS;
+		q->count--;
+		pthread_cond_signal(&q->not_full);
+	} else if (q->spill_rd < q->spill_wr) {
+		b = q->free[--q->nfree];
+
+		if (pread(q->spill_fd, &b->hdr, sizeof(struct hpcap_stream_block), q->spill_rd) != sizeof(struct hpcap_stream_block)
+				|| pread(q->spill_fd, b->raw, b->hdr.raw_len, q->spill_rd + sizeof(struct hpcap_stream_block)) != (ssize_t) b->hdr.raw_len) {
+			fprintf(stderr, "Error reading from the spill file: %s\n", strerror(errno));
+			q->free[q->nfree++] = b;
+			b = NULL;
+			q->failed = 1;
+			pthread_cond_broadcast(&q->not_empty);
+			pthread_cond_broadcast(&q->not_full);
+			goto out;
+		}
+
+		q->spill_rd += sizeof(struct hpcap_stream_block) + b->hdr.raw_len;
+
+		// Start over once it is empty, so the spill file does not grow forever
+		if (q->spill_rd == q->spill_wr) {
+			q->spill_rd = q->spill_wr = 0;
+
+			if (ftruncate(q->spill_fd, 0) != 0)
+				fprintf(stderr, "Error truncating the spill file: %s\n", strerror(errno));
+		}
+	}
+
+out:
+	pthread_mutex_unlock(&q->lock);
+
+	return b;
+}
+
+static void queue_release(struct block_queue* q, struct block* b)
+{
+	pthread_mutex_lock(&q->lock);
+	q->free[q->nfree++] = b;
+	pthread_mutex_unlock(&q->lock);
+}
+
+static void queue_end(struct block_queue* q, int failed)
+{
+	pthread_mutex_lock(&q->lock);
+
+	if (failed)
+		q->failed = 1;
+
+	q->done = 1;
+	pthread_cond_broadcast(&q->not_empty);
+	pthread_cond_broadcast(&q->not_full);
+	pthread_mutex_unlock(&q->lock);
+}
+
+static void* sender_run(void* arg)
+{
+	struct sender* s = arg;
+	struct block* b;
+
+	while ((b = queue_pop(s->queue)) != NULL) {
+		if (hpcap_stream_send(s->fd, &b->hdr, b->raw, s->aux, s->level) != HPCAP_OK) {
+			fprintf(stderr, "Error sending block %" PRIu64 ": %s\n", b->hdr.seq, strerror(errno));
+			queue_release(s->queue, b);
+			queue_end(s->queue, 1);
+			stop = 1;
+			break;
+		}
+
+		s->blocks++;
+		s->raw_bytes += b->hdr.raw_len;
+		s->sent_bytes += sizeof(struct hpcap_stream_block) + b->hdr.payload_len;
+		queue_release(s->queue, b);
+	}
+
+	return NULL;
+}
+
+/**
+ * Number the block and queue it, taking a free one in its place.
+ * @return 0 if OK, -1 if the blocks can't be sent.
+ */
+static int flush_block(struct block_queue* q, struct block** b, uint64_t* seq)
+{
+	(*b)->hdr.seq = (*seq)++;
+
+	if (queue_push(q, b) != 0)
+		return -1;
+
+	(*b)->hdr.raw_len = 0;
+
+	return 0;
+}
+
+/**
+ * Next record of the queue, waiting a while for it.
+ * @return 1 if there is a record, 0 if not yet.
+ */
+static int next_queue_record(struct hpcap_handle* hp, struct raw_header** rawh, uint8_t** frame, uint8_t* copy)
+{
+	if (_hpcap_read_next(hp, rawh, frame, copy))
+		return 1;
+
+	hpcap_ack_wait_timeout(hp, 1, FLUSH_NS / 4);
+
+	return _hpcap_read_next(hp, rawh, frame, copy);
+}
+
+/**
+ * Next record of the RAW file.
+ * @return 1 if there is a record, -1 at the end of the file.
+ */
+static int next_file_record(FILE* file, struct raw_header** rawh, uint8_t** frame, uint8_t* copy)
+{
+	*rawh = (struct raw_header*) copy;
+	*frame = copy + RAW_HLEN;
+
+	// A padding ends the file
+	if (fread(*rawh, RAW_HLEN, 1, file) != 1 || hpcap_is_header_padding(*rawh))
+		return -1;
+
+	if (fread(*frame, 1, (*rawh)->caplen, file) != (*rawh)->caplen) {
+		fprintf(stderr, "Truncated record at the end of the file\n");
+		return -1;
+	}
+
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	static uint8_t copy[RAW_HLEN + 65536];
+	struct hpcap_handle hp;
+	struct block_queue queue;
+	struct sender* senders = NULL;
+	struct hpcap_stream_hello hello;
+	struct block* block;
+	struct raw_header* rawh, hdr;
+	struct bpf_program prog;
+	struct pcap_pkthdr pkthdr;
+	pcap_t* dead = NULL;
+	FILE* file = NULL;
+	char *collector = NULL, *port, *filter = NULL, *spill = NULL, *rawfile = NULL;
+	uint8_t* frame;
+	uint64_t seq = 0, block_ns = 0, frames = 0, filtered = 0, lost = 0, raw_bytes = 0, sent_bytes = 0;
+	int opt, conns = 1, level = 0, snaplen = 0, started = 0, r, i, ret = EXIT_FAILURE;
+
+	while ((opt = getopt(argc, argv, "c:n:z:s:f:S:r:h")) != -1) {
+		switch (opt) {
+			case 'c':
+				collector = optarg;
+				break;
+
+			case 'n':
+				conns = atoi(optarg);
+				break;
+
+			case 'z':
+				level = atoi(optarg);
+				break;
+
+			case 's':
+				snaplen = atoi(optarg);
+				break;
+
+			case 'f':
+				filter = optarg;
+				break;
+
+			case 'S':
+				spill = optarg;
+				break;
+
+			case 'r':
+				rawfile = optarg;
+				break;
+
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (collector == NULL || (port = strrchr(collector, ':')) == NULL || conns < 1 || conns > HPCAP_STREAM_MAX_CONNS
+			|| level < 0 || level > 9 || argc - optind != (rawfile == NULL ? 2 : 0)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	*port++ = '\0';
+
+	if (filter != NULL) {
+		dead = pcap_open_dead(DLT_EN10MB, 65535);
+
+		if (pcap_compile(dead, &prog, filter, 1, PCAP_NETMASK_UNKNOWN) != 0) {
+			fprintf(stderr, "Error compiling the filter: %s\n", pcap_geterr(dead));
+			pcap_close(dead);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (rawfile != NULL) {
+		file = fopen(rawfile, "r");
+
+		if (file == NULL) {
+			fprintf(stderr, "Error opening %s: %s\n", rawfile, strerror(errno));
+			goto free_filter;
+		}
+	} else {
+		if (hpcap_open(&hp, atoi(argv[optind]), atoi(argv[optind + 1])) != HPCAP_OK) {
+			fprintf(stderr, "Error opening hpcap%sq%s: %s\n", argv[optind], argv[optind + 1], strerror(errno));
+			goto free_filter;
+		}
+
+		if (hpcap_map(&hp) != HPCAP_OK) {
+			fprintf(stderr, "Error mapping the buffer: %s\n", strerror(errno));
+			hpcap_close(&hp);
+			goto free_filter;
+		}
+	}
+
+	// Every connection holds a block while it sends it, and the reader fills one
+	if (queue_init(&queue, QUEUE_BLOCKS + conns + 1, spill) != 0) {
+		fprintf(stderr, "Error allocating the blocks\n");
+		goto free_queue;
+	}
+
+	senders = calloc(conns, sizeof(struct sender));
+
+	if (senders == NULL)
+		goto free_queue;
+
+	srand(time(NULL) ^ getpid());
+	hello.magic = HPCAP_STREAM_MAGIC;
+	hello.version = HPCAP_STREAM_VERSION;
+	hello.connections = conns;
+	hello.stream_id = ((uint64_t) rand() << 32) ^ rand() ^ now_ns();
+
+	for (i = 0; i < conns; i++) {
+		senders[i].fd = connect_collector(collector, port);
+
+		if (senders[i].fd < 0 || write(senders[i].fd, &hello, sizeof(hello)) != sizeof(hello)) {
+			if (senders[i].fd >= 0) {
+				fprintf(stderr, "Error sending the hello: %s\n", strerror(errno));
+				close(senders[i].fd);
+			}
+
+			goto join;
+		}
+
+		senders[i].queue = &queue;
+		senders[i].level = level;
+	}
+
+	for (started = 0; started < conns; started++) {
+		if (pthread_create(&senders[started].thread, NULL, sender_run, &senders[started]) != 0) {
+			fprintf(stderr, "Error creating the sender threads\n");
+			queue_end(&queue, 1);
+			goto join;
+		}
+	}
+
+	signal(SIGINT, handle_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	block = queue.free[--queue.nfree];
+	block->hdr.raw_len = 0;
+	ret = EXIT_SUCCESS;
+
+	while (!stop) {
+		r = rawfile != NULL ? next_file_record(file, &rawh, &frame, copy) : next_queue_record(&hp, &rawh, &frame, copy);
+
+		if (r < 0)
+			break;
+
+		if (r == 0 || hpcap_is_header_padding(rawh)) {
+			if (r == 0 && block->hdr.raw_len > 0 && now_ns() - block_ns >= FLUSH_NS && flush_block(&queue, &block, &seq) != 0) {
+				ret = EXIT_FAILURE;
+				break;
+			}
+
+			continue;
+		}
+
+		hdr = *rawh;
+
+		if (hpcap_is_header_loss(rawh))
+			lost++;
+		else {
+			frames++;
+
+			if (filter != NULL) {
+				pkthdr.ts.tv_sec = hdr.sec;
+				pkthdr.ts.tv_usec = hdr.nsec / 1000;
+				pkthdr.caplen = hdr.caplen;
+				pkthdr.len = hdr.len;
+
+				if (!pcap_offline_filter(&prog, &pkthdr, frame)) {
+					filtered++;
+					continue;
+				}
+			}
+
+			if (snaplen > 0 && hdr.caplen > snaplen)
+				hdr.caplen = snaplen;
+		}
+
+		if (block->hdr.raw_len + RAW_HLEN + hdr.caplen > HPCAP_STREAM_BLOCK && flush_block(&queue, &block, &seq) != 0) {
+			ret = EXIT_FAILURE;
+			break;
+		}
+
+		if (block->hdr.raw_len == 0)
+			block_ns = now_ns();
+
+		memcpy(block->raw + block->hdr.raw_len, &hdr, RAW_HLEN);
+		memcpy(block->raw + block->hdr.raw_len + RAW_HLEN, frame, hdr.caplen);
+		block->hdr.raw_len += RAW_HLEN + hdr.caplen;
+	}
+
+	if (ret == EXIT_SUCCESS && block->hdr.raw_len > 0 && flush_block(&queue, &block, &seq) != 0)
+		ret = EXIT_FAILURE;
+
+	queue_release(&queue, block);
+	queue_end(&queue, 0);
+
+join:
+
+	for (i = 0; i < started; i++) {
+		pthread_join(senders[i].thread, NULL);
+		raw_bytes += senders[i].raw_bytes;
+		sent_bytes += senders[i].sent_bytes;
+	}
+
+	for (i = 0; i < conns && senders[i].queue != NULL; i++)
+		close(senders[i].fd);
+
+	if (started == conns) {
+		printf("%" PRIu64 " frames read, %" PRIu64 " filtered out, %" PRIu64 " loss records\n", frames, filtered, lost);
+		printf("%" PRIu64 " blocks, %" PRIu64 " bytes of records sent in %" PRIu64 " bytes (%.1f %%) over %d connections, %" PRIu64 " blocks went through the spill file\n",
+			   seq, raw_bytes, sent_bytes, raw_bytes > 0 ? 100.0 * sent_bytes / raw_bytes : 0, conns, queue.spilled);
+
+		if (queue.failed)
+			ret = EXIT_FAILURE;
+	} else
+		ret = EXIT_FAILURE;
+
+free_queue:
+	free(senders);
+	queue_free(&queue);
+
+	if (rawfile != NULL)
+		fclose(file);
+	else {
+		hpcap_ack(&hp);
+		hpcap_unmap(&hp);
+		hpcap_close(&hp);
+	}
+
+free_filter:
+
+	if (filter != NULL) {
+		pcap_freecode(&prog);
+		pcap_close(dead);
+	}
+
+	return ret;
+}
@@ -14,10 +14,12 @@
 #include "../include/hpcap.h"
 
 #define HUGETLB_PATH "/mnt/hugetlb"
+#define MAX_NODES 16
 
 static inline void usage()
 {
-	printf("Usage: huge_map adapter queue (map|unmap) buffer-size [hugetlb path]\n");
+	printf("Usage: huge_map adapter queue (map|unmap) buffer-size [hugetlb path [nodes]]\n");
+	printf("  nodes: comma separated NUMA nodes, the buffer is split in one file per node\n");
 }
 
 static size_t parse_size(char* sz)
@@ -57,14 +59,22 @@ int main(int argc, char *argv[])
 	size_t size;
 	struct hpcap_handle handle;
 	char* hugetlb_path;
+	char* node;
+	int nodes[MAX_NODES];
+	int num_nodes = 0;
 	int retval = -1;
 
-	if (argc != 5 && argc != 6) {
+	if (argc < 5 || argc > 7) {
 		usage();
 		return -1;
 	}
 
-	if (argc == 6)
+	if (argc == 7) {
+		for (node = strtok(argv[6], ","); node != NULL && num_nodes < MAX_NODES; node = strtok(NULL, ","))
+			nodes[num_nodes++] = atoi(node);
+	}
+
+	if (argc >= 6)
 		hugetlb_path = argv[5];
 	else
 		hugetlb_path = HUGETLB_PATH;
@@ -82,7 +92,10 @@ int main(int argc, char *argv[])
 	if (!strcmp(action, "map")) {
 		printf("Mapping on /dev/hpcap%d_%d buffer of size %zu\n", adapter, queue, size);
 
-		retval = hpcap_map_huge(&handle, hugetlb_path, size);
+		if (num_nodes > 0)
+			retval = hpcap_map_huge_nodes(&handle, hugetlb_path, size, nodes, num_nodes);
+		else
+			retval = hpcap_map_huge(&handle, hugetlb_path, size);
 
 		if (retval != HPCAP_OK)
 			fprintf(stderr, "Error mapping hugefile %s of size %s (%zu bytes)\n", hugetlb_path, argv[4], size);
@@ -0,0 +1,147 @@
+/**
+ * @brief Prints the latency histograms of a HPCAP queue.
+ *
+ * Reads the probe and delivery latency histograms of the queue periodically
+ * and prints their percentiles. By default each report covers the samples
+ * since the previous one (the driver starts new histograms on every read);
+ * with -c the histograms are read without resetting them, so the reports are
+ * cumulative.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../include/hpcap.h"
+
+static const double percentiles[] = { 0.5, 0.9, 0.99, 0.999, 0.9999, 1 };
+static const char *percentile_names[] = { "p50", "p90", "p99", "p99.9", "p99.99", "max" };
+
+#define NUM_PERCENTILES (sizeof(percentiles) / sizeof(percentiles[0]))
+
+static void print_header(void)
+{
+	size_t i;
+
+	printf("%-10s %12s %12s", "histogram", "samples", "mean ns");
+
+	for (i = 0; i < NUM_PERCENTILES; i++)
+		printf(" %12s", percentile_names[i]);
+
+	printf("\n");
+}
+
+static void print_hist(const char *name, const struct hpcap_latency_hist *h)
+{
+	size_t i;
+
+	printf("%-10s %12lu %12lu", name, h->count, h->count ? h->sum_ns / h->count : 0);
+
+	for (i = 0; i < NUM_PERCENTILES; i++)
+		printf(" %12lu", hpcap_latency_percentile(h, percentiles[i]));
+
+	printf("\n");
+}
+
+/**
+ * Prints the non-empty buckets of a histogram, with their value range.
+ */
+static void dump_hist(const char *name, const struct hpcap_latency_hist *h)
+{
+	size_t i;
+
+	for (i = 0; i < HPCAP_LATENCY_BUCKETS; i++) {
+		if (h->counts[i] > 0)
+			printf("%s [%lu, %lu] ns: %lu\n", name, hpcap_latency_bucket_low(i), hpcap_latency_bucket_low(i + 1) - 1,
+				   h->counts[i]);
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] <adapter index> <queue index>\n", prog);
+	fprintf(stderr, "  -i seconds   Interval between reports (default 1)\n");
+	fprintf(stderr, "  -n reports   Reports to print, 0 for no limit (default 0)\n");
+	fprintf(stderr, "  -c           Cumulative reports: do not reset the histograms\n");
+	fprintf(stderr, "  -d           Print the non-empty buckets of the histograms\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct hpcap_handle hp;
+	struct hpcap_latency_info *info;
+	int reset = 1, dump = 0, opt;
+	unsigned int interval = 1, reports = 0, r;
+
+	while ((opt = getopt(argc, argv, "i:n:cdh")) != -1) {
+		switch (opt) {
+			case 'i':
+				interval = maximo(atoi(optarg), 1);
+				break;
+
+			case 'n':
+				reports = atoi(optarg);
+				break;
+
+			case 'c':
+				reset = 0;
+				break;
+
+			case 'd':
+				dump = 1;
+				break;
+
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind < 2) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (hpcap_open(&hp, atoi(argv[optind]), atoi(argv[optind + 1])) != HPCAP_OK)
+		return EXIT_FAILURE;
+
+	info = malloc(sizeof(struct hpcap_latency_info));
+
+	if (info == NULL) {
+		hpcap_close(&hp);
+		return EXIT_FAILURE;
+	}
+
+	// Start the first report now
+	if (reset && hpcap_latency_info(&hp, info, 1) != HPCAP_OK) {
+		fprintf(stderr, "Cannot read the latency histograms\n");
+		free(info);
+		hpcap_close(&hp);
+		return EXIT_FAILURE;
+	}
+
+	for (r = 0; reports == 0 || r < reports; r++) {
+		sleep(interval);
+
+		if (hpcap_latency_info(&hp, info, reset) != HPCAP_OK) {
+			fprintf(stderr, "Cannot read the latency histograms\n");
+			break;
+		}
+
+		print_header();
+		print_hist("probe", &info->probe);
+		print_hist("delivery", &info->delivery);
+
+		if (dump) {
+			dump_hist("probe", &info->probe);
+			dump_hist("delivery", &info->delivery);
+		}
+	}
+
+	free(info);
+	hpcap_close(&hp);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,263 @@
+/**
+ * @brief Benchmark of the libmgmon multicast channels with and without
+ * batched I/O.
+ *
+ * Sends datagrams of compact flow records to the MCAST_FLOW group of a queue
+ * through the loopback interface and receives them in the same thread, first
+ * with one sendto/recvfrom per datagram and then with mgmon_tx_batch and
+ * mgmon_rx_batch for every batch size. The datagrams are sent in rounds of the
+ * batch size and each round is received before the next one, so no datagram
+ * is lost because of the size of the socket buffer.
+ *
+ * Reports datagrams and records per second, system calls per datagram and the
+ * datagrams lost. No HPCAP device is needed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../include/hpcap.h"
+#include "../include/libmgmon.h"
+
+#define MAX_BATCHES 16
+
+struct result {
+	uint64_t datagrams;
+	uint64_t records;
+	uint64_t calls;
+	uint64_t ns;
+};
+
+static uint64_t xorshift(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+
+	return *state;
+}
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Encodes records of short flows until count datagrams are full.
+ * @return Records encoded.
+ */
+static size_t build_datagrams(uint8_t *dgrams, size_t *lens, size_t count)
+{
+	struct mgmon_flowrec_writer *w = malloc(sizeof(struct mgmon_flowrec_writer));
+	uint64_t rng = 0x9E3779B97F4A7C15ULL;
+	size_t n = 0, records = 0;
+	IPFlow rec;
+
+	mgmon_flowrec_writer_init(w, 0);
+	memset(&rec, 0, sizeof(IPFlow));
+
+	while (n < count) {
+		rec.source_ip = xorshift(&rng);
+		rec.destination_ip = xorshift(&rng);
+		rec.source_port = xorshift(&rng);
+		rec.destination_port = 443;
+		rec.transport_protocol = 6;
+		rec.npack = 1 + xorshift(&rng) % 20;
+		rec.nbytes = rec.npack * 600;
+		rec.firstpacket_timestamp = 1500000000000000000ULL + n * 1000;
+		rec.lastpacket_timestamp = rec.previous_timestamp = rec.firstpacket_timestamp + rec.npack * 10000;
+
+		if (mgmon_flowrec_writer_add(w, &rec) == 0) {
+			records++;
+			continue;
+		}
+
+		lens[n] = mgmon_flowrec_writer_finish(w);
+		memcpy(dgrams + n * MGMON_FLOWREC_DATAGRAM, w->buf, lens[n]);
+		n++;
+	}
+
+	// The records of the last datagram, not finished, are not sent
+	records -= w->count;
+	free(w);
+
+	return records;
+}
+
+static size_t count_records(const uint8_t *buf, size_t len)
+{
+	int ret = mgmon_flowrec_parse(buf, len, NULL, NULL, NULL);
+
+	return ret > 0 ? ret : 0;
+}
+
+static void run_single(int tx, int rx, struct sockaddr_in *addr, const uint8_t *dgrams, const size_t *lens, size_t count,
+					   size_t round, struct result *r)
+{
+	static uint8_t buf[MGMON_FLOWREC_DATAGRAM];
+	size_t i, j;
+	ssize_t n;
+	uint64_t start = now_ns();
+
+	for (i = 0; i < count; i += round) {
+		for (j = i; j < count && j < i + round; j++) {
+			sendto(tx, dgrams + j * MGMON_FLOWREC_DATAGRAM, lens[j], 0, (struct sockaddr *) addr, sizeof(*addr));
+			r->calls++;
+		}
+
+		while ((n = recv(rx, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+			r->calls++;
+			r->datagrams++;
+			r->records += count_records(buf, n);
+		}
+
+		r->calls++;
+	}
+
+	r->ns = now_ns() - start;
+}
+
+static void run_batch(int tx, int rx, struct sockaddr_in *addr, const uint8_t *dgrams, const size_t *lens, size_t count,
+					  size_t batch, struct result *r)
+{
+	struct mgmon_tx_batch *txb = mgmon_tx_batch_create(tx, addr, batch, MGMON_FLOWREC_DATAGRAM);
+	struct mgmon_rx_batch *rxb = mgmon_rx_batch_create(rx, batch, MGMON_FLOWREC_DATAGRAM);
+	struct mgmon_batch_stats txs, rxs;
+	const uint8_t *buf;
+	size_t i, len;
+	int n, j;
+	uint64_t start;
+
+	if (txb == NULL || rxb == NULL)
+		exit(EXIT_FAILURE);
+
+	start = now_ns();
+
+	for (i = 0; i < count; i++) {
+		// A complete batch is sent by the call that queues its last datagram
+		if (mgmon_tx_batch_send(txb, dgrams + i * MGMON_FLOWREC_DATAGRAM, lens[i]) == 0 && i + 1 < count)
+			continue;
+
+		mgmon_tx_batch_flush(txb);
+
+		while ((n = mgmon_rx_batch_recv(rxb, 0)) > 0) {
+			for (j = 0; j < n; j++) {
+				if ((buf = mgmon_rx_batch_datagram(rxb, j, &len)) != NULL) {
+					r->datagrams++;
+					r->records += count_records(buf, len);
+				}
+			}
+		}
+	}
+
+	r->ns = now_ns() - start;
+
+	mgmon_tx_batch_get_stats(txb, &txs);
+	mgmon_rx_batch_get_stats(rxb, &rxs);
+	r->calls = txs.calls + rxs.calls;
+
+	mgmon_tx_batch_destroy(txb);
+	mgmon_rx_batch_destroy(rxb);
+}
+
+static void print_result(const char *name, size_t batch, const struct result *r, size_t count, size_t records)
+{
+	printf("%-10s %6zu %12.3f %12.3f %10.2f %8lu %8lu\n", name, batch, r->datagrams * 1e3 / r->ns, r->records * 1e3 / r->ns,
+		   (double) r->calls / maximo(r->datagrams, 1), count - r->datagrams, records - r->records);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	fprintf(stderr, "  -n dgrams  Datagrams to send (default 200000)\n");
+	fprintf(stderr, "  -b list    Batch sizes, comma separated (default 1,8,32,64)\n");
+	fprintf(stderr, "  -i ifindex -q qindex  Multicast group to use (default 99, 0)\n");
+}
+
+int main(int argc, char **argv)
+{
+	size_t count = 200000, batches[MAX_BATCHES] = { 1, 8, 32, 64 }, nbatches = 4, records, i;
+	int ifindex = 99, qindex = 0, tx, rx, opt;
+	struct sockaddr_in addr;
+	struct result r;
+	uint8_t *dgrams;
+	size_t *lens;
+	char *tok;
+
+	while ((opt = getopt(argc, argv, "n:b:i:q:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				count = strtoull(optarg, NULL, 0);
+				break;
+
+			case 'b':
+				for (nbatches = 0, tok = strtok(optarg, ","); tok && nbatches < MAX_BATCHES; tok = strtok(NULL, ","))
+					batches[nbatches++] = strtoull(tok, NULL, 0);
+
+				break;
+
+			case 'i':
+				ifindex = atoi(optarg);
+				break;
+
+			case 'q':
+				qindex = atoi(optarg);
+				break;
+
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	for (i = 0; i < nbatches; i++) {
+		if (batches[i] == 0 || count == 0) {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	tx = open_multicast_tx_socket(MCAST_FLOW, ifindex, qindex, &addr);
+	rx = open_multicast_rx_socket(MCAST_FLOW, ifindex, qindex);
+
+	if (tx == 0 || rx == 0)
+		return EXIT_FAILURE;
+
+	dgrams = malloc(count * MGMON_FLOWREC_DATAGRAM);
+	lens = malloc(count * sizeof(size_t));
+
+	if (!dgrams || !lens) {
+		fprintf(stderr, "Cannot allocate %zu datagrams\n", count);
+		return EXIT_FAILURE;
+	}
+
+	records = build_datagrams(dgrams, lens, count);
+
+	printf("# mcastbench: %zu datagrams, %zu records, group %s:%d\n", count, records, inet_ntoa(addr.sin_addr), MCAST_PORT);
+	printf("%-10s %6s %12s %12s %10s %8s %8s\n", "mode", "batch", "Mdgrams/s", "Mrecords/s", "calls/dgram", "lost", "rec lost");
+
+	for (i = 0; i < nbatches; i++) {
+		memset(&r, 0, sizeof(r));
+		run_single(tx, rx, &addr, dgrams, lens, count, batches[i], &r);
+		print_result("sendto", batches[i], &r, count, records);
+
+		memset(&r, 0, sizeof(r));
+		run_batch(tx, rx, &addr, dgrams, lens, count, batches[i], &r);
+		print_result("sendmmsg", batches[i], &r, count, records);
+	}
+
+	close(tx);
+	close(rx);
+	free(dgrams);
+	free(lens);
+
+	return EXIT_SUCCESS;
+}
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <sched.h>
 #include <unistd.h>
@@ -33,6 +34,8 @@ int main(int argc, char **argv)
 	int i = 0, j = 0, ret = 0;
 	char filename[100];
 	uint64_t filesize = 0;
+	struct hpcap_loss_record loss;
+	uint64_t lost = 0;
 
 	if (argc != 3) {
 		printf("Uso: %s <fichero_RAW_de_entrada> <fichero_PCAP_de_salida>\n", argv[0]);
@@ -74,6 +77,21 @@ int main(int argc, char **argv)
 				break;
 			}
 
+			/* Registro de perdidas: no va al PCAP, se informa de el */
+			if (secs == 0 && nsecs == HPCAP_LOSS_NSEC) {
+				if (fread(&caplen, 1, sizeof(uint16_t), fraw) != sizeof(uint16_t) || fread(&len, 1, sizeof(uint16_t), fraw) != sizeof(uint16_t)
+					|| caplen != sizeof(struct hpcap_loss_record) || fread(&loss, 1, sizeof(struct hpcap_loss_record), fraw) != sizeof(struct hpcap_loss_record)) {
+					printf("Wrong loss record\n");
+					break;
+				}
+
+				printf("Loss: %" PRIu64 " frames (%" PRIu64 " bytes) dropped by the driver and %" PRIu64 " by the NIC between %" PRIu64 ".%09" PRIu64 " and %" PRIu64 ".%09" PRIu64 " (after pkt=%d)\n",
+					   loss.frames, loss.bytes, loss.nic_frames, loss.first_ns / NSECS_PER_SEC, loss.first_ns % NSECS_PER_SEC,
+					   loss.last_ns / NSECS_PER_SEC, loss.last_ns % NSECS_PER_SEC, i);
+				lost += loss.frames + loss.nic_frames;
+				continue;
+			}
+
 			if (nsecs >= NSECS_PER_SEC) {
 				printf("Wrong NS value (file=%d,pkt=%d)\n", j, i);
 				printf("[%09u.%09u] %u bytes (cap %d), %lu, %d,%d\n", secs, nsecs, len, caplen, filesize, j, i);
@@ -181,6 +199,9 @@ int main(int argc, char **argv)
 	printf("%d paquetes leidos\n", i);
 #endif
 
+	if (lost > 0)
+		printf("%" PRIu64 " paquetes perdidos en la captura\n", lost);
+
 	printf("%d ficheros generados\n", j);
 	fclose(fraw);
 
@@ -22,7 +22,7 @@
 int main(int argc, char **argv)
 {
 	FILE *fraw, *fout;
-	u_char buf[4096];
+	u_char buf[CAPLEN];
 	uint32_t secs, nsecs;
 	uint64_t tstamp;
 	uint64_t epoch = 0;
@@ -65,6 +65,17 @@ int main(int argc, char **argv)
 			break;
 		}
 
+		/* Loss record: skip its payload, caplen bytes */
+		if (secs == 0 && nsecs == HPCAP_LOSS_NSEC) {
+			if (fread(&caplen, 1, sizeof(uint16_t), fraw) != sizeof(uint16_t) || fread(&len, 1, sizeof(uint16_t), fraw) != sizeof(uint16_t)
+				|| fread(buf, 1, caplen, fraw) != caplen) {
+				printf("Registro de perdidas\n");
+				break;
+			}
+
+			continue;
+		}
+
 		if (nsecs >= NSECS_PER_SEC) {
 			printf("Wrong NS value (file=%d,pkt=%d)\n", j, i);
 			//break;
@@ -104,11 +115,11 @@ int main(int argc, char **argv)
 		tstamp *= 1000000000ul;
 		tstamp += nsecs;
 
-		/* Lectura del paquete */
-		if (len > 0) {
-			ret = fread(buf, 1, len, fraw);
+		/* Lectura del paquete: solo hay caplen bytes en el fichero */
+		if (caplen > 0) {
+			ret = fread(buf, 1, caplen, fraw);
 
-			if (ret != len) {
+			if (ret != caplen) {
 				printf("Lectura del paquete\n");
 				break;
 			}
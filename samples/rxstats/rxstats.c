@@ -0,0 +1,192 @@
+/**
+ * @brief Prints the RX counters of the consumers of a HPCAP queue.
+ *
+ * Optionally enables or disables the collection of the optional counters (for
+ * every queue of the driver), and then prints the counters of every consumer
+ * periodically. By default each report shows the increments since the
+ * previous one; with -p the cumulative counters are printed once in the
+ * Prometheus text exposition format, for node_exporter's textfile collector
+ * or any exporter that can run a command.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include "../include/hpcap.h"
+
+struct counter_desc {
+	const char *name;
+	const char *help;
+	size_t offset;
+	short optional;
+};
+
+#define COUNTER(field, help, optional) { #field, help, offsetof(struct hpcap_rx_counters, field), optional }
+
+static const struct counter_desc counters[] = {
+	COUNTER(polls, "Calls to the RX loop", 1),
+	COUNTER(descriptors, "Descriptors read", 1),
+	COUNTER(bytes, "Bytes of the frames read", 1),
+	COUNTER(empty_polls, "Calls that found the ring empty", 1),
+	COUNTER(not_owned_polls, "Calls that stopped at a descriptor of the next consumer", 1),
+	COUNTER(budget_exhausted, "Calls that filled their share of the buffer", 1),
+	COUNTER(releases, "Returns of descriptors to the NIC", 1),
+	COUNTER(sleeps, "Times the thread slept with the ring empty", 1),
+	COUNTER(sleep_ns, "Time spent sleeping in ns", 1),
+	COUNTER(filter_drops, "Frames rejected by the filters", 0),
+	COUNTER(dup_drops, "Duplicated frames removed", 0),
+	COUNTER(buffer_full_drops, "Frames lost because the buffer was full", 0),
+	COUNTER(unbuffered_drops, "Frames lost because the descriptor had no buffer", 0),
+};
+
+#define NUM_COUNTERS (sizeof(counters) / sizeof(counters[0]))
+
+static uint64_t counter_value(const struct hpcap_rx_counters *c, size_t i)
+{
+	return *(const uint64_t *) ((const char *) c + counters[i].offset);
+}
+
+static void print_prometheus(const struct hpcap_stats_info *info, int adapter, int queue)
+{
+	size_t i;
+	uint32_t j;
+
+	for (i = 0; i < NUM_COUNTERS; i++) {
+		if (counters[i].optional && !info->enabled)
+			continue;
+
+		printf("# HELP hpcap_rx_%s_total %s\n", counters[i].name, counters[i].help);
+		printf("# TYPE hpcap_rx_%s_total counter\n", counters[i].name);
+
+		for (j = 0; j < info->consumers; j++)
+			printf("hpcap_rx_%s_total{adapter=\"%d\",queue=\"%d\",consumer=\"%u\"} %lu\n", counters[i].name, adapter,
+				   queue, j, counter_value(&info->counters[j], i));
+	}
+}
+
+static void print_deltas(const struct hpcap_stats_info *info, const struct hpcap_stats_info *prev)
+{
+	size_t i;
+	uint32_t j;
+
+	printf("%-18s", "consumer");
+
+	for (j = 0; j < info->consumers; j++)
+		printf(" %14u", j);
+
+	printf("\n");
+
+	for (i = 0; i < NUM_COUNTERS; i++) {
+		if (counters[i].optional && !info->enabled)
+			continue;
+
+		printf("%-18s", counters[i].name);
+
+		for (j = 0; j < info->consumers; j++)
+			printf(" %14lu", counter_value(&info->counters[j], i) - counter_value(&prev->counters[j], i));
+
+		printf("\n");
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] <adapter index> <queue index>\n", prog);
+	fprintf(stderr, "  -e           Enable the optional counters in every queue\n");
+	fprintf(stderr, "  -d           Disable the optional counters in every queue\n");
+	fprintf(stderr, "  -i seconds   Interval between reports (default 1)\n");
+	fprintf(stderr, "  -n reports   Reports to print, 0 for no limit (default 0)\n");
+	fprintf(stderr, "  -p           Print the cumulative counters once in the Prometheus text format\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct hpcap_handle hp;
+	struct hpcap_stats_info *info, *prev, *aux;
+	int enable = -1, prometheus = 0, opt, adapter, queue;
+	unsigned int interval = 1, reports = 0, r;
+
+	while ((opt = getopt(argc, argv, "edi:n:ph")) != -1) {
+		switch (opt) {
+			case 'e':
+				enable = 1;
+				break;
+
+			case 'd':
+				enable = 0;
+				break;
+
+			case 'i':
+				interval = maximo(atoi(optarg), 1);
+				break;
+
+			case 'n':
+				reports = atoi(optarg);
+				break;
+
+			case 'p':
+				prometheus = 1;
+				break;
+
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind < 2) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	adapter = atoi(argv[optind]);
+	queue = atoi(argv[optind + 1]);
+
+	if (hpcap_open(&hp, adapter, queue) != HPCAP_OK)
+		return EXIT_FAILURE;
+
+	info = malloc(sizeof(struct hpcap_stats_info));
+	prev = malloc(sizeof(struct hpcap_stats_info));
+
+	if (info == NULL || prev == NULL || hpcap_rx_stats(&hp, prev, enable) != HPCAP_OK) {
+		fprintf(stderr, "Cannot read the RX counters\n");
+		free(info);
+		free(prev);
+		hpcap_close(&hp);
+		return EXIT_FAILURE;
+	}
+
+	if (prometheus) {
+		print_prometheus(prev, adapter, queue);
+		goto out;
+	}
+
+	if (!prev->enabled)
+		printf("Optional counters disabled, only the drops are counted (use -e to enable them)\n");
+
+	for (r = 0; reports == 0 || r < reports; r++) {
+		sleep(interval);
+
+		if (hpcap_rx_stats(&hp, info, -1) != HPCAP_OK) {
+			fprintf(stderr, "Cannot read the RX counters\n");
+			break;
+		}
+
+		print_deltas(info, prev);
+
+		aux = prev;
+		prev = info;
+		info = aux;
+	}
+
+out:
+	free(info);
+	free(prev);
+	hpcap_close(&hp);
+
+	return EXIT_SUCCESS;
+}
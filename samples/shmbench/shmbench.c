@@ -0,0 +1,384 @@
+/**
+ * @brief Benchmark of the libmgmon shared memory channels against the
+ * loopback multicast groups.
+ *
+ * A producer thread and a consumer thread exchange messages through the
+ * MCAST_FLOW channel of a queue, first through its multicast group (with
+ * batched I/O) and then through its shared memory ring. Two tests are run on
+ * each transport:
+ *
+ * - Throughput: the producer sends pre-encoded datagrams of compact flow
+ *   records as fast as it can, and the consumer counts the records. Neither
+ *   transport blocks the producer, so messages the consumer cannot keep up
+ *   with are lost.
+ * - Latency: the producer sends a small message with its send time every
+ *   interval, and the consumer measures the time until it has it.
+ *
+ * No HPCAP device is needed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../include/hpcap.h"
+#include "../include/libmgmon.h"
+
+#define LAT_MSG 64
+
+struct bench {
+	int transport;
+	int ifindex;
+	int qindex;
+	size_t batch;
+
+	const uint8_t *dgrams;	/**< Throughput test: datagrams to send */
+	const size_t *lens;
+	size_t count;
+	uint64_t interval_ns;	/**< Latency test: time between messages, 0 for the throughput test */
+
+	// Consumer results
+	volatile int ready;
+	volatile int done;
+	uint64_t received;
+	uint64_t records;
+	uint64_t first_ns;
+	uint64_t last_ns;
+	uint64_t *latencies;
+};
+
+static uint64_t xorshift(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+
+	return *state;
+}
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Encodes records of short flows until count datagrams are full.
+ * @return Records encoded.
+ */
+static size_t build_datagrams(uint8_t *dgrams, size_t *lens, size_t count)
+{
+	struct mgmon_flowrec_writer *w = malloc(sizeof(struct mgmon_flowrec_writer));
+	uint64_t rng = 0x9E3779B97F4A7C15ULL;
+	size_t n = 0, records = 0;
+	IPFlow rec;
+
+	mgmon_flowrec_writer_init(w, 0);
+	memset(&rec, 0, sizeof(IPFlow));
+
+	while (n < count) {
+		rec.source_ip = xorshift(&rng);
+		rec.destination_ip = xorshift(&rng);
+		rec.source_port = xorshift(&rng);
+		rec.destination_port = 443;
+		rec.transport_protocol = 6;
+		rec.npack = 1 + xorshift(&rng) % 20;
+		rec.nbytes = rec.npack * 600;
+		rec.firstpacket_timestamp = 1500000000000000000ULL + n * 1000;
+		rec.lastpacket_timestamp = rec.previous_timestamp = rec.firstpacket_timestamp + rec.npack * 10000;
+
+		if (mgmon_flowrec_writer_add(w, &rec) == 0) {
+			records++;
+			continue;
+		}
+
+		lens[n] = mgmon_flowrec_writer_finish(w);
+		memcpy(dgrams + n * MGMON_FLOWREC_DATAGRAM, w->buf, lens[n]);
+		n++;
+	}
+
+	records -= w->count;
+	free(w);
+
+	return records;
+}
+
+static void consume(struct bench *b, const uint8_t *buf, size_t len)
+{
+	uint64_t now = now_ns(), sent;
+	int ret;
+
+	if (b->received == 0)
+		b->first_ns = now;
+
+	b->last_ns = now;
+
+	if (b->interval_ns) {
+		memcpy(&sent, buf, sizeof(sent));
+		b->latencies[b->received] = now - sent;
+	} else if ((ret = mgmon_flowrec_parse(buf, len, NULL, NULL, NULL)) > 0) {
+		b->records += ret;
+	}
+
+	b->received++;
+}
+
+static void *consumer(void *arg)
+{
+	struct bench *b = arg;
+	struct mgmon_rx_batch *rx = NULL;
+	struct mgmon_shm *shm = NULL;
+	const uint8_t *buf;
+	size_t len;
+	int sd = 0, n, i;
+
+	if (b->transport == MGMON_TRANSPORT_SHM) {
+		shm = mgmon_shm_open(MCAST_FLOW, b->ifindex, b->qindex, 0);
+
+		if (shm == NULL || mgmon_shm_attach(shm) < 0)
+			exit(EXIT_FAILURE);
+	} else {
+		sd = open_multicast_rx_socket(MCAST_FLOW, b->ifindex, b->qindex);
+		rx = sd ? mgmon_rx_batch_create(sd, b->batch, MGMON_FLOWREC_DATAGRAM) : NULL;
+
+		if (rx == NULL)
+			exit(EXIT_FAILURE);
+	}
+
+	__atomic_store_n(&b->ready, 1, __ATOMIC_RELEASE);
+
+	while (b->received < b->count) {
+		if (shm) {
+			buf = mgmon_shm_next(shm, 100000000ULL, &len);
+
+			if (buf != NULL)
+				consume(b, buf, len);
+			else if (__atomic_load_n(&b->done, __ATOMIC_ACQUIRE))
+				break;
+
+			continue;
+		}
+
+		n = mgmon_rx_batch_recv(rx, 0);
+
+		for (i = 0; i < n; i++) {
+			if ((buf = mgmon_rx_batch_datagram(rx, i, &len)) != NULL)
+				consume(b, buf, len);
+		}
+
+		if (n <= 0 && __atomic_load_n(&b->done, __ATOMIC_ACQUIRE) && now_ns() - b->last_ns > 100000000ULL)
+			break;
+
+		if (n <= 0)
+			sched_yield();
+	}
+
+	if (shm) {
+		mgmon_shm_close(shm);
+	} else {
+		mgmon_rx_batch_destroy(rx);
+		close(sd);
+	}
+
+	return NULL;
+}
+
+static void produce(struct bench *b)
+{
+	struct mgmon_tx_batch *tx = NULL;
+	struct mgmon_shm *shm = NULL;
+	struct sockaddr_in addr;
+	uint8_t msg[LAT_MSG];
+	struct timespec ts;
+	uint64_t t, next;
+	size_t i;
+	int sd = 0;
+
+	if (b->transport == MGMON_TRANSPORT_SHM) {
+		shm = mgmon_shm_open(MCAST_FLOW, b->ifindex, b->qindex, 0);
+
+		if (shm == NULL)
+			exit(EXIT_FAILURE);
+	} else {
+		sd = open_multicast_tx_socket(MCAST_FLOW, b->ifindex, b->qindex, &addr);
+		// Latency messages are sent one by one
+		tx = sd ? mgmon_tx_batch_create(sd, &addr, b->interval_ns ? 1 : b->batch, MGMON_FLOWREC_DATAGRAM) : NULL;
+
+		if (tx == NULL)
+			exit(EXIT_FAILURE);
+	}
+
+	memset(msg, 0, sizeof(msg));
+	next = now_ns();
+
+	for (i = 0; i < b->count; i++) {
+		if (b->interval_ns) {
+			// Sleep, so the consumer can run even with a single CPU
+			ts.tv_sec = next / 1000000000ULL;
+			ts.tv_nsec = next % 1000000000ULL;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+			next += b->interval_ns;
+			t = now_ns();
+			memcpy(msg, &t, sizeof(t));
+
+			if (shm)
+				mgmon_shm_publish(shm, msg, sizeof(msg));
+			else
+				mgmon_tx_batch_send(tx, msg, sizeof(msg));
+		} else if (shm) {
+			mgmon_shm_publish(shm, b->dgrams + i * MGMON_FLOWREC_DATAGRAM, b->lens[i]);
+		} else {
+			mgmon_tx_batch_send(tx, b->dgrams + i * MGMON_FLOWREC_DATAGRAM, b->lens[i]);
+		}
+	}
+
+	if (shm) {
+		mgmon_shm_close(shm);
+	} else {
+		mgmon_tx_batch_destroy(tx);
+		close(sd);
+	}
+}
+
+static void run(struct bench *b)
+{
+	pthread_t tid;
+
+	b->ready = b->done = 0;
+	b->received = b->records = b->first_ns = b->last_ns = 0;
+
+	pthread_create(&tid, NULL, consumer, b);
+
+	while (!__atomic_load_n(&b->ready, __ATOMIC_ACQUIRE))
+		sched_yield();
+
+	produce(b);
+	__atomic_store_n(&b->done, 1, __ATOMIC_RELEASE);
+	pthread_join(tid, NULL);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	fprintf(stderr, "  -n dgrams  Datagrams of the throughput test (default 200000)\n");
+	fprintf(stderr, "  -l msgs    Messages of the latency test (default 20000)\n");
+	fprintf(stderr, "  -t ns      Interval between latency messages (default 20000)\n");
+	fprintf(stderr, "  -b batch   Batch of the multicast I/O (default %d)\n", MGMON_DEFAULT_BATCH);
+	fprintf(stderr, "  -i ifindex -q qindex  Channel to use (default 99, 0)\n");
+}
+
+int main(int argc, char **argv)
+{
+	static const char *names[] = { "mcast", "shm" };
+	size_t count = 200000, lat_count = 20000, records, lost;
+	uint64_t interval = 20000;
+	struct bench b;
+	uint8_t *dgrams;
+	size_t *lens;
+	int opt, t;
+
+	memset(&b, 0, sizeof(b));
+	b.ifindex = 99;
+	b.batch = MGMON_DEFAULT_BATCH;
+
+	while ((opt = getopt(argc, argv, "n:l:t:b:i:q:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				count = strtoull(optarg, NULL, 0);
+				break;
+
+			case 'l':
+				lat_count = strtoull(optarg, NULL, 0);
+				break;
+
+			case 't':
+				interval = strtoull(optarg, NULL, 0);
+				break;
+
+			case 'b':
+				b.batch = strtoull(optarg, NULL, 0);
+				break;
+
+			case 'i':
+				b.ifindex = atoi(optarg);
+				break;
+
+			case 'q':
+				b.qindex = atoi(optarg);
+				break;
+
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (count == 0 || lat_count == 0 || interval == 0 || b.batch == 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	dgrams = malloc(count * MGMON_FLOWREC_DATAGRAM);
+	lens = malloc(count * sizeof(size_t));
+	b.latencies = malloc(lat_count * sizeof(uint64_t));
+
+	if (!dgrams || !lens || !b.latencies) {
+		fprintf(stderr, "Cannot allocate %zu datagrams\n", count);
+		return EXIT_FAILURE;
+	}
+
+	records = build_datagrams(dgrams, lens, count);
+	mgmon_shm_unlink(MCAST_FLOW, b.ifindex, b.qindex);
+
+	printf("# shmbench: %zu datagrams, %zu records; %zu latency messages every %lu ns\n", count, records, lat_count,
+		   interval);
+	printf("%-6s %12s %12s %10s %10s %10s %10s\n", "mode", "Mdgrams/s", "Mrecords/s", "lost", "lat p50", "lat p99",
+		   "lat max");
+
+	for (t = MGMON_TRANSPORT_MCAST; t <= MGMON_TRANSPORT_SHM; t++) {
+		b.transport = t;
+
+		b.dgrams = dgrams;
+		b.lens = lens;
+		b.count = count;
+		b.interval_ns = 0;
+		run(&b);
+
+		printf("%-6s %12.3f %12.3f %10zu", names[t], b.received * 1e3 / maximo(b.last_ns - b.first_ns, 1),
+			   b.records * 1e3 / maximo(b.last_ns - b.first_ns, 1), count - b.received);
+
+		b.count = lat_count;
+		b.interval_ns = interval;
+		run(&b);
+		lost = lat_count - b.received;
+		qsort(b.latencies, b.received, sizeof(uint64_t), cmp_u64);
+
+		if (b.received > 0)
+			printf(" %10lu %10lu %10lu", b.latencies[b.received / 2], b.latencies[b.received * 99 / 100],
+				   b.latencies[b.received - 1]);
+
+		printf("%s\n", lost ? " (latency messages lost)" : "");
+	}
+
+	mgmon_shm_unlink(MCAST_FLOW, b.ifindex, b.qindex);
+	free(dgrams);
+	free(lens);
+	free(b.latencies);
+
+	return EXIT_SUCCESS;
+}
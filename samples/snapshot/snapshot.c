@@ -0,0 +1,123 @@
+/**
+ * @brief Trigger a snapshot of the frames around now and write it to a file.
+ *
+ * Turns the overwrite mode of the queue on or off (-O), so that it keeps the
+ * latest frames as a flight recorder, and/or freezes the frames received from
+ * the given milliseconds before now to the given milliseconds after now and
+ * writes them to a raw file that raw2pcap converts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../include/hpcap.h"
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] <adapter index> <queue index>\n", prog);
+	fprintf(stderr, "  -O on|off     Turn the overwrite mode of the queue on or off\n");
+	fprintf(stderr, "  -b ms         Milliseconds of the snapshot before now (default 1000)\n");
+	fprintf(stderr, "  -a ms         Milliseconds of the snapshot after now (default 0)\n");
+	fprintf(stderr, "  -o file       Write the snapshot to the given raw file\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct hpcap_handle hp;
+	struct hpcap_snapshot snap;
+	uint64_t before_ns = 1000000000ULL, after_ns = 0;
+	const char *output = NULL;
+	int adapter, queue, overwrite = -1, opt, fd, ret = EXIT_FAILURE;
+	int64_t written;
+
+	while ((opt = getopt(argc, argv, "O:b:a:o:h")) != -1) {
+		switch (opt) {
+			case 'O':
+				overwrite = strcmp(optarg, "on") == 0;
+				break;
+
+			case 'b':
+				before_ns = strtod(optarg, NULL) * 1e6;
+				break;
+
+			case 'a':
+				after_ns = strtod(optarg, NULL) * 1e6;
+				break;
+
+			case 'o':
+				output = optarg;
+				break;
+
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind != 2 || (overwrite == -1 && output == NULL)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	adapter = atoi(argv[optind]);
+	queue = atoi(argv[optind + 1]);
+
+	if (hpcap_open(&hp, adapter, queue) != HPCAP_OK) {
+		fprintf(stderr, "Error opening hpcap%dq%d: %s\n", adapter, queue, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if (overwrite != -1 && hpcap_set_overwrite(&hp, overwrite) != HPCAP_OK) {
+		fprintf(stderr, "Error setting the overwrite mode: %s\n", strerror(errno));
+		goto close;
+	}
+
+	if (output == NULL) {
+		ret = EXIT_SUCCESS;
+		goto close;
+	}
+
+	if (hpcap_map(&hp) != HPCAP_OK) {
+		fprintf(stderr, "Error mapping the buffer: %s\n", strerror(errno));
+		goto close;
+	}
+
+	if (hpcap_snapshot(&hp, before_ns, after_ns, &snap) != HPCAP_OK) {
+		fprintf(stderr, "Error taking the snapshot: %s\n", strerror(errno));
+		goto unmap;
+	}
+
+	fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (fd < 0) {
+		fprintf(stderr, "Error opening %s: %s\n", output, strerror(errno));
+		goto unmap;
+	}
+
+	printf("Snapshot from %" PRIu64 ".%09" PRIu64 " to %" PRIu64 ".%09" PRIu64 ", %" PRIu64 " bytes in the buffer from offset %" PRIu64 "\n",
+		   snap.start_ns / 1000000000, snap.start_ns % 1000000000, snap.end_ns / 1000000000, snap.end_ns % 1000000000,
+		   snap.available_bytes, snap.read_offset);
+
+	written = hpcap_snapshot_write(&hp, &snap, fd);
+
+	if (written < 0)
+		fprintf(stderr, "Error writing the snapshot: %s\n", strerror(errno));
+	else {
+		printf("%" PRId64 " bytes written to %s\n", written, output);
+		ret = EXIT_SUCCESS;
+	}
+
+	close(fd);
+
+unmap:
+	hpcap_unmap(&hp);
+close:
+	hpcap_close(&hp);
+	return ret;
+}
@@ -0,0 +1,231 @@
+/**
+ * @brief Benchmark of the libmgmon traffic statistics.
+ *
+ * Accounts synthetic frames (random sizes, timestamps spaced for the given
+ * rate) with mgmon_stats_burst and mgmon_stats_packet and reports the cost
+ * per frame. The frames are taken from a window that fits in the L1 cache, as
+ * the headers read from HPCAP would be, whose timestamps are moved forward
+ * after every pass; the cost of moving them is measured apart and subtracted.
+ * Then checks that the rollups of every resolution returned by
+ * mgmon_stats_query add up to the frames and bytes accounted, and measures
+ * the queries. No HPCAP device is needed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../include/hpcap.h"
+#include "../include/libmgmon.h"
+
+#define BURST 128
+#define WINDOW 1024	/**< Frames of the window, a multiple of BURST */
+
+static uint64_t published = 0;
+
+static uint64_t xorshift(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+
+	return *state;
+}
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void count_mrtg(mrtg *stat, void *arg)
+{
+	(void) stat;
+	(void) arg;
+
+	published++;
+}
+
+/**
+ * Builds count frames: sizes mostly of 64 or 1514 bytes, as in a link with
+ * bulk transfers and their acknowledgements, and the rest uniform.
+ */
+static void build_frames(struct mgmon_flow_pkt *pkts, size_t count, double mpps, uint64_t *bytes)
+{
+	uint64_t rng = 0x9E3779B97F4A7C15ULL, r;
+	size_t i;
+
+	*bytes = 0;
+
+	for (i = 0; i < count; i++) {
+		r = xorshift(&rng);
+
+		if (r % 4 == 0)
+			pkts[i].len = 64;
+		else if (r % 4 == 1)
+			pkts[i].len = 1514;
+		else
+			pkts[i].len = 64 + (r >> 8) % 1451;
+
+		pkts[i].caplen = pkts[i].len;
+		pkts[i].data = NULL;
+		pkts[i].ts = 1500000000000000000ULL + (uint64_t)(i * 1000.0 / mpps);
+		*bytes += pkts[i].len;
+	}
+}
+
+static void check(struct mgmon_stats *s, int level, const char *name, uint64_t packets, uint64_t bytes)
+{
+	static struct mgmon_stats_bin bins[MGMON_STATS_1S_HISTORY];
+	uint64_t p = 0, b = 0, start;
+	size_t n, i;
+
+	start = now_ns();
+	n = mgmon_stats_query(s, level, 0, UINT64_MAX, bins, MGMON_STATS_1S_HISTORY);
+	start = now_ns() - start;
+
+	for (i = 0; i < n; i++) {
+		p += bins[i].packets;
+		b += bins[i].bytes;
+	}
+
+	printf("%-6s %8zu intervals, query %8.1f us: %12lu frames %14lu bytes %s\n", name, n, start / 1e3, p, b,
+		   p == packets && b == bytes ? "OK" : n > 0 && bins[0].timestamp > 1500000000000000000ULL ? "(history full)" : "MISMATCH");
+}
+
+/**
+ * Moves the timestamps of the window forward to the next pass.
+ */
+static inline void next_window(struct mgmon_flow_pkt *pkts, uint64_t span)
+{
+	size_t i;
+
+	for (i = 0; i < WINDOW; i++)
+		pkts[i].ts += span;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	fprintf(stderr, "  -n frames  Frames to account (default 20000000)\n");
+	fprintf(stderr, "  -r mpps    Rate of the timestamps in Mpps (default 14.88)\n");
+	fprintf(stderr, "  -l loops   Times the frames are accounted (default 5)\n");
+}
+
+int main(int argc, char **argv)
+{
+	size_t count = 20000000, loops = 5, i, j, l;
+	double mpps = 14.88;
+	uint64_t bytes, window_bytes, span, start, t;
+	uint64_t best_burst = UINT64_MAX, best_single = UINT64_MAX, best_window = UINT64_MAX;
+	struct mgmon_flow_pkt pkts[WINDOW];
+	struct mgmon_stats *s = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:r:l:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				count = strtoull(optarg, NULL, 0);
+				break;
+
+			case 'r':
+				mpps = atof(optarg);
+				break;
+
+			case 'l':
+				loops = strtoull(optarg, NULL, 0);
+				break;
+
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (loops == 0 || mpps <= 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// Whole passes over the window
+	count = maximo((count + WINDOW - 1) / WINDOW, 1) * WINDOW;
+	span = WINDOW * 1000.0 / mpps;
+
+	printf("# statsbench: %zu frames at %.2f Mpps (%.3f s of traffic)\n", count, mpps, count / mpps / 1e6);
+
+	for (l = 0; l < loops; l++) {
+		build_frames(pkts, WINDOW, mpps, &window_bytes);
+		start = now_ns();
+
+		for (i = 0; i < count; i += WINDOW)
+			next_window(pkts, span);
+
+		t = now_ns() - start;
+		best_window = minimo(best_window, t);
+
+		s = mgmon_stats_create(MGMON_STATS_1S, count_mrtg, NULL);
+
+		if (s == NULL)
+			return EXIT_FAILURE;
+
+		build_frames(pkts, WINDOW, mpps, &window_bytes);
+		start = now_ns();
+
+		for (i = 0; i < count; i += WINDOW) {
+			for (j = 0; j < WINDOW; j += BURST)
+				mgmon_stats_burst(s, pkts + j, BURST);
+
+			next_window(pkts, span);
+		}
+
+		t = now_ns() - start;
+		best_burst = minimo(best_burst, t);
+		mgmon_stats_destroy(s);
+
+		s = mgmon_stats_create(MGMON_STATS_1S, count_mrtg, NULL);
+
+		if (s == NULL)
+			return EXIT_FAILURE;
+
+		build_frames(pkts, WINDOW, mpps, &window_bytes);
+		published = 0;
+		start = now_ns();
+
+		for (i = 0; i < count; i += WINDOW) {
+			for (j = 0; j < WINDOW; j++)
+				mgmon_stats_packet(s, pkts[j].ts, pkts[j].len);
+
+			next_window(pkts, span);
+		}
+
+		t = now_ns() - start;
+		best_single = minimo(best_single, t);
+
+		if (l + 1 < loops)
+			mgmon_stats_destroy(s);
+	}
+
+	bytes = window_bytes * (count / WINDOW);
+	best_burst -= minimo(best_window, best_burst);
+	best_single -= minimo(best_window, best_single);
+
+	printf("burst  %6.2f ns/frame\n", (double) best_burst / count);
+	printf("packet %6.2f ns/frame\n", (double) best_single / count);
+
+	// Close the last intervals
+	mgmon_stats_advance(s, pkts[0].ts + 120000000000ULL);
+	check(s, MGMON_STATS_1MS, "1 ms", count, bytes);
+	check(s, MGMON_STATS_1S, "1 s", count, bytes);
+	check(s, MGMON_STATS_1MIN, "1 min", count, bytes);
+	printf("%lu mrtg records published\n", published);
+
+	mgmon_stats_destroy(s);
+
+	return EXIT_SUCCESS;
+}
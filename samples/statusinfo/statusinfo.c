@@ -45,6 +45,10 @@ int main(int argc, char *argv[])
 	printf("bufinfo, %zu bytes at %p + %zu, hugepages = %hd\n",
 		   bufinfo.size, bufinfo.addr, bufinfo.offset, bufinfo.has_hugepages);
 
+	if (bufinfo.has_hugepages)
+		printf("hugepage buffer %s, %d files, %zu KB pages, %s\n", bufinfo.file_name, bufinfo.file_count,
+			   bufinfo.page_size >> 10, bufinfo.direct_map ? "linear mapping" : "vmap of 4 KB pages");
+
 	printf("Consumer atomic offsets: Read %zu, write %zu\n", info.consumer_read_off, info.consumer_write_off);
 
 	//Global listener
@@ -54,12 +58,23 @@ int main(int argc, char *argv[])
 	printf("Buffer occupation rate: %.2f %%\n", 100 * hpcap_ioc_listener_occupation(&info.global_listener));
 
 	//Other listeners
+	if (info.overwrite)
+		printf("Overwrite mode: %llu bytes of old frames dropped\n", (unsigned long long) info.overwritten_bytes);
+
 	printf("%d active listeners\n", info.num_listeners);
 
 	for (i = 0; i < info.num_listeners; i++) {
 		printf("Listener %d: Kill %d. Read Offset: %ld. Write Offset: %ld. Occupation rate: %.2f %%\n",
 			   info.listeners[i].id, info.listeners[i].kill, info.listeners[i].bufferRdOffset, info.listeners[i].bufferWrOffset,
 			   100 * hpcap_ioc_listener_occupation(&info.listeners[i]));
+
+		if (info.listeners[i].group != 0)
+			printf("  Member of group %d\n", info.listeners[i].group);
+
+		if (info.listeners[i].max_lag > 0)
+			printf("  Lossy, max lag %llu bytes: %llu bytes skipped in %llu skips\n",
+				   (unsigned long long) info.listeners[i].max_lag, (unsigned long long) info.listeners[i].skipped_bytes,
+				   (unsigned long long) info.listeners[i].skips);
 	}
 
 	if (info.thread_state == -1)
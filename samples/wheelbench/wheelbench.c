@@ -0,0 +1,203 @@
+/**
+ * @brief Benchmark of the libmgmon timing wheel with millions of flows.
+ *
+ * Schedules the idle timeout of a large number of concurrent flows and then
+ * replays a stream of frames at 10 GbE line rate (one frame every 67.2 ns)
+ * that hit random flows. Flows that expire are replaced by new ones, so the
+ * number of concurrent flows stays constant.
+ *
+ * By default timers are refreshed lazily, as the flow meter does: a frame only
+ * updates the last timestamp of its flow, and the timer checks it when it
+ * fires. With -e every frame moves the timer of its flow.
+ *
+ * Reports the cost per frame, the longest single call to mgmon_wheel_advance
+ * and, for comparison, the time of one scan over the last timestamps of all
+ * the flows, which is what a scan-based expiration would pay periodically.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../include/hpcap.h"
+#include "../include/libmgmon.h"
+
+#define FRAME_GAP_PS 67200
+#define TICK_SHIFT 20
+
+struct bench {
+	struct mgmon_wheel *wheel;
+	uint64_t *last_ts;
+	uint64_t now;
+	uint64_t timeout;
+	uint64_t expired;
+	uint64_t rescheduled;
+};
+
+static uint64_t xorshift(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+
+	return *state;
+}
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void flow_timer(uint32_t id, void *arg)
+{
+	struct bench *b = arg;
+	uint64_t deadline = b->last_ts[id] + b->timeout;
+
+	if (deadline > b->now) {
+		b->rescheduled++;
+		mgmon_wheel_schedule(b->wheel, id, deadline);
+		return;
+	}
+
+	// Export the flow and start a new one in the same entry
+	b->expired++;
+	b->last_ts[id] = b->now;
+	mgmon_wheel_schedule(b->wheel, id, b->now + b->timeout);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	fprintf(stderr, "  -f flows    Concurrent flows (default 10000000)\n");
+	fprintf(stderr, "  -n frames   Frames to replay (default 100000000)\n");
+	fprintf(stderr, "  -t ms       Idle timeout in milliseconds (default 2000)\n");
+	fprintf(stderr, "  -e          Move the timer of the flow with every frame\n");
+}
+
+int main(int argc, char **argv)
+{
+	size_t flows = 10000000, frames = 100000000, i;
+	short eager = 0;
+	struct bench b;
+	uint64_t rng = 0x9E3779B97F4A7C15ULL, ts_ps, start, end, t0, t1, max_advance = 0, advance_ns = 0, advances = 0;
+	uint64_t tick = 0, oldest;
+	uint32_t id;
+	int opt;
+
+	memset(&b, 0, sizeof(b));
+	b.timeout = 2000ULL * 1000000ULL;
+
+	while ((opt = getopt(argc, argv, "f:n:t:eh")) != -1) {
+		switch (opt) {
+			case 'f':
+				flows = strtoull(optarg, NULL, 0);
+				break;
+
+			case 'n':
+				frames = strtoull(optarg, NULL, 0);
+				break;
+
+			case 't':
+				b.timeout = strtoull(optarg, NULL, 0) * 1000000ULL;
+				break;
+
+			case 'e':
+				eager = 1;
+				break;
+
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (flows == 0 || flows >= UINT32_MAX) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	b.wheel = mgmon_wheel_create(flows, TICK_SHIFT, flow_timer, &b);
+	b.last_ts = malloc(flows * sizeof(uint64_t));
+
+	if (!b.wheel || !b.last_ts) {
+		fprintf(stderr, "Cannot allocate %zu flows\n", flows);
+		return EXIT_FAILURE;
+	}
+
+	printf("# wheelbench: %zu flows, %zu frames, idle timeout %lu ms, %s timers\n",
+		   flows, frames, b.timeout / 1000000, eager ? "eager" : "lazy");
+
+	// Flows start spread over the first timeout, as if they were already running
+	ts_ps = 1000000000000000ULL;
+	b.now = ts_ps / 1000;
+
+	tick = b.now >> TICK_SHIFT;
+	mgmon_wheel_advance(b.wheel, b.now);
+
+	start = now_ns();
+
+	for (i = 0; i < flows; i++) {
+		b.last_ts[i] = b.now - xorshift(&rng) % b.timeout;
+		mgmon_wheel_schedule(b.wheel, i, b.last_ts[i] + b.timeout);
+	}
+
+	end = now_ns();
+	printf("schedule: %.1f ns/timer\n", (double)(end - start) / flows);
+
+	start = now_ns();
+
+	for (i = 0; i < frames; i++) {
+		ts_ps += FRAME_GAP_PS;
+		b.now = ts_ps / 1000;
+		id = xorshift(&rng) % flows;
+
+		b.last_ts[id] = b.now;
+
+		if (eager)
+			mgmon_wheel_schedule(b.wheel, id, b.now + b.timeout);
+
+		if ((b.now >> TICK_SHIFT) > tick) {
+			tick = b.now >> TICK_SHIFT;
+			t0 = now_ns();
+			mgmon_wheel_advance(b.wheel, b.now);
+			t1 = now_ns();
+
+			advance_ns += t1 - t0;
+			advances++;
+
+			if (t1 - t0 > max_advance)
+				max_advance = t1 - t0;
+		}
+	}
+
+	end = now_ns();
+
+	printf("frames: %.1f ns/frame (%.2f Mpps), %lu expired, %lu timers checked again, %zu scheduled\n",
+		   (double)(end - start) / frames, frames * 1e3 / (end - start), b.expired, b.rescheduled, mgmon_wheel_count(b.wheel));
+	printf("advance: %lu calls, %.1f us mean, %.1f us max (%.0f frames at line rate)\n",
+		   advances, advance_ns / 1e3 / maximo(advances, 1), max_advance / 1e3, max_advance * 1000.0 / FRAME_GAP_PS);
+
+	// What a scan of the whole table would cost every time it runs
+	start = now_ns();
+	oldest = UINT64_MAX;
+
+	for (i = 0; i < flows; i++)
+		oldest = minimo(oldest, b.last_ts[i]);
+
+	end = now_ns();
+
+	printf("full scan for comparison: %.1f us (%.0f frames at line rate), oldest flow idle %lu ms\n",
+		   (end - start) / 1e3, (end - start) * 1000.0 / FRAME_GAP_PS, (b.now - oldest) / 1000000);
+
+	mgmon_wheel_destroy(b.wheel);
+	free(b.last_ts);
+
+	return EXIT_SUCCESS;
+}
@@ -101,6 +101,7 @@ function fill()
 	for i in $(seq 0 $(( $num - 1 )) )
 	do
 		leido=$(read_value_param "${arg}${i}")
+		leido=${leido:-$3} # Optional default for missing values
 		if [ $i != 0 ]
 		then
 			ret="${ret},$leido"
@@ -342,6 +343,11 @@ function parse_driver_args()
 
 	args+="Core=$(fill_cores $nif) "
 	args+="Caplen=$(fill caplen $nif) "
+
+	if [ "$driver_type" = "ixgbe" ] || [ "$driver_type" = "i40e" ]; then
+		args+="MTU=$(fill mtu $nif 0) "
+	fi
+
 	args+="Mode=$(fill mode $nif | tr 3 2) " # Mode 3 is the same that mode 2 at the driver level.
 	args+="Dup=$(fill dup $nif) "
 	args+="Pages=$(fill pages $nif)"
@@ -746,6 +752,11 @@ function is_paramfile_valid()
 		test_is_param_in_bounds "core${i}" -1 || has_error=1
 		test_is_param_in_bounds "dup${i}" 0 1 || has_error=1
 		test_is_param_in_bounds "caplen${i}" 0 || has_error=1
+
+		if [ ! -z "$(read_value_param "mtu${i}")" ]; then
+			test_is_param_in_bounds "mtu${i}" 0 9710 || has_error=1
+		fi
+
 		test_is_param_in_bounds "pages${i}" 0 $max_pages || has_error=1
 
 		if [ -z "$speed" ]; then
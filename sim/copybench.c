@@ -0,0 +1,301 @@
+/**
+ * @brief Microbenchmark of the copies of the frames to the HPCAP buffer.
+ *
+ * For every frame size, copies a ring of frames (raw header and frame, as
+ * hpcap_rx does) to the buffer with each copy of hpcap_copy.h: cached stores,
+ * non-temporal stores, and the selection of hpcap_copy_init. Reports the TSC
+ * cycles per frame of the copies and, as their cache pollution, the cycles per
+ * line of walking a hot set (the descriptor ring and the working set of the
+ * consumer) that was cached before the copies. The walk follows a random
+ * chain of pointers, so every line costs a load latency: a few cycles if the
+ * copies left it cached, a memory access if they evicted it.
+ *
+ * With -a, the space of every frame is reserved with a locked add, as in
+ * queues with several consumers, which also waits for the non-temporal stores
+ * of the previous frame.
+ */
+
+#include <getopt.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include "hpcap_sim.h"
+
+#define MAX_SWEEP 16
+#define CACHE_LINE 64
+#define RING_FRAMES 4096
+
+static short locked_reserve;
+static atomic_t reserved;
+
+enum copy_mode {
+	COPY_CACHED,
+	COPY_NT,
+	COPY_AUTO,
+	COPY_MODES
+};
+
+static const char *copy_modes[] = { "cached", "nt", "auto" };
+
+struct bench_result {
+	u64 frames;
+	u64 copy_cycles;
+	u64 lines;
+	u64 walk_cycles;
+};
+
+static double tsc_ghz(void)
+{
+	struct timespec start, end;
+	u64 tsc_start, tsc_end;
+	double ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	tsc_start = __rdtsc();
+
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+	} while (ns < 200e6);
+
+	tsc_end = __rdtsc();
+
+	return (tsc_end - tsc_start) / ns;
+}
+
+/**
+ * Link the lines of the hot set in a random cycle.
+ */
+static void hot_set_init(void **hot, size_t lines)
+{
+	size_t *order = malloc(lines * sizeof(size_t));
+	size_t i, j, tmp;
+
+	for (i = 0; i < lines; i++)
+		order[i] = i;
+
+	for (i = lines - 1; i > 0; i--) {
+		j = rand() % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	for (i = 0; i < lines; i++)
+		hot[order[i] * (CACHE_LINE / sizeof(void *))] = &hot[order[(i + 1) % lines] * (CACHE_LINE / sizeof(void *))];
+
+	free(order);
+}
+
+static void *hot_set_walk(void **hot, size_t lines)
+{
+	void **p = hot;
+	size_t i;
+
+	for (i = 0; i < lines; i++)
+		p = *p;
+
+	return p;
+}
+
+/**
+ * Copy a ring of frames to the buffer, wrapping to its start as the RX loop
+ * does with its padding.
+ */
+static size_t copy_ring(u8 *buf, size_t bufsize, size_t offset, u8 *frames, size_t len)
+{
+	struct raw_header rawh = { .sec = 1, .nsec = 2, .caplen = len, .len = len };
+	short nt = hpcap_copy_use_nt(len);
+	size_t i;
+
+	for (i = 0; i < RING_FRAMES; i++) {
+		if (offset + RAW_HLEN + len > bufsize)
+			offset = 0;
+
+		if (locked_reserve)
+			atomic_add_return(RAW_HLEN + len, &reserved);
+
+		hpcap_copy_header(buf + offset, &rawh);
+		hpcap_copy_frame(buf + offset + RAW_HLEN, frames + i * MAX_DESCR_SIZE, len, nt);
+		offset += RAW_HLEN + len;
+	}
+
+	hpcap_copy_fence();
+
+	return offset;
+}
+
+static void bench_one(u8 *buf, size_t bufsize, u8 *frames, void **hot, size_t lines, size_t len,
+					  u64 nframes, struct bench_result *res)
+{
+	size_t offset = 0;
+	u64 start, mid, end;
+	void *sink = NULL;
+
+	memset(res, 0, sizeof(struct bench_result));
+
+	/* One untimed round to warm up the code */
+	offset = copy_ring(buf, bufsize, offset, frames, len);
+
+	while (res->frames < nframes) {
+		sink = hot_set_walk(hot, lines);
+
+		start = __rdtsc();
+		offset = copy_ring(buf, bufsize, offset, frames, len);
+		mid = __rdtsc();
+		sink = hot_set_walk(sink, lines);
+		end = __rdtsc();
+
+		res->frames += RING_FRAMES;
+		res->copy_cycles += mid - start;
+		res->lines += lines;
+		res->walk_cycles += end - mid;
+	}
+
+	__asm__ __volatile__("" :: "r"(sink));
+}
+
+static size_t parse_list(const char *s, size_t *list)
+{
+	size_t n = 0;
+	char *end;
+
+	while (*s && n < MAX_SWEEP) {
+		list[n++] = strtoul(s, &end, 0);
+
+		if (*end != ',')
+			break;
+
+		s = end + 1;
+	}
+
+	return n;
+}
+
+static size_t parse_size(const char *s)
+{
+	size_t size = strtoull(s, NULL, 0);
+
+	if (strchr(s, 'M') || strchr(s, 'm'))
+		size *= 1024 * 1024;
+	else if (strchr(s, 'K') || strchr(s, 'k'))
+		size *= 1024;
+
+	return size;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	fprintf(stderr, "  -f sizes      Captured bytes of the frames, comma separated (default 60,128,256,512,1024,1514)\n");
+	fprintf(stderr, "  -n frames     Frames per measurement (default 4000000)\n");
+	fprintf(stderr, "  -b bytes      HPCAP buffer size (default 64M)\n");
+	fprintf(stderr, "  -w bytes      Hot set walked after each ring of copies (default 512K)\n");
+	fprintf(stderr, "  -a            Reserve the space of every frame with a locked add (several consumers)\n");
+}
+
+int main(int argc, char **argv)
+{
+	size_t sizes[MAX_SWEEP] = { 60, 128, 256, 512, 1024, 1514 }, nsizes = 6;
+	size_t bufsize = 64 * 1024 * 1024, hotsize = 512 * 1024;
+	size_t auto_nt_min, lines, i, j;
+	u64 nframes = 4000000;
+	u8 *buf, *frames;
+	void **hot;
+	struct bench_result res;
+	double ghz;
+	int opt;
+
+	sim_printk_enabled = 0;
+
+	while ((opt = getopt(argc, argv, "f:n:b:w:ah")) != -1) {
+		switch (opt) {
+			case 'f':
+				nsizes = parse_list(optarg, sizes);
+				break;
+
+			case 'n':
+				nframes = strtoull(optarg, NULL, 0);
+				break;
+
+			case 'b':
+				bufsize = parse_size(optarg);
+				break;
+
+			case 'w':
+				hotsize = parse_size(optarg);
+				break;
+
+			case 'a':
+				locked_reserve = 1;
+				break;
+
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	for (i = 0; i < nsizes; i++) {
+		if (sizes[i] == 0 || sizes[i] > MAX_DESCR_SIZE || sizes[i] + RAW_HLEN > bufsize) {
+			fprintf(stderr, "Frame size %zu out of range\n", sizes[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	lines = hotsize / CACHE_LINE;
+
+	if (lines == 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	buf = aligned_alloc(PAGE_SIZE, bufsize);
+	frames = aligned_alloc(PAGE_SIZE, RING_FRAMES * MAX_DESCR_SIZE);
+	hot = aligned_alloc(PAGE_SIZE, lines * CACHE_LINE);
+
+	if (buf == NULL || frames == NULL || hot == NULL) {
+		fprintf(stderr, "Could not allocate the buffers\n");
+		return EXIT_FAILURE;
+	}
+
+	memset(buf, 0, bufsize);
+
+	for (i = 0; i < RING_FRAMES * MAX_DESCR_SIZE; i++)
+		frames[i] = (u8) (i * 7 + 1);
+
+	hot_set_init(hot, lines);
+
+	hpcap_copy_init();
+	auto_nt_min = hpcap_copy_nt_min;
+	ghz = tsc_ghz();
+
+	printf("# copybench: buffer %zu MB, hot set %zu KB, TSC %.2f GHz, auto copies non-temporal from %zu bytes, %s reservations\n",
+		   bufsize >> 20, hotsize >> 10, ghz, auto_nt_min, locked_reserve ? "locked" : "plain");
+	printf("%6s %7s %11s %8s %12s\n", "frame", "copy", "cycles/pkt", "GB/s", "hot cyc/line");
+
+	for (i = 0; i < nsizes; i++) {
+		for (j = 0; j < COPY_MODES; j++) {
+			if (j == COPY_CACHED)
+				hpcap_copy_nt_min = SIZE_MAX;
+			else if (j == COPY_NT)
+				hpcap_copy_nt_min = 0;
+			else
+				hpcap_copy_nt_min = auto_nt_min;
+
+			bench_one(buf, bufsize, frames, hot, lines, sizes[i], nframes, &res);
+
+			printf("%6zu %7s %11.1f %8.2f %12.1f\n", sizes[i], copy_modes[j],
+				   (double) res.copy_cycles / res.frames,
+				   (double) res.frames * (sizes[i] + RAW_HLEN) / (res.copy_cycles / ghz),
+				   (double) res.walk_cycles / res.lines);
+			fflush(stdout);
+		}
+	}
+
+	free(hot);
+	free(frames);
+	free(buf);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,1115 @@
+/**
+ * @brief Userspace simulation of a HPCAP RX queue.
+ *
+ * @see hpcap_sim.h
+ */
+
+#include <sys/mman.h>
+
+#include "hpcap_sim.h"
+#include "hpcap_debug.h"
+
+/**
+ * The RX core expects these from driver_hpcap.c and the driver glue.
+ */
+int adapters_found = 0;
+HW_ADAPTER * adapters[HPCAP_MAX_NIC];
+
+void hpcap_check_naming(HW_ADAPTER * adapter)
+{
+}
+
+/**
+ * Same as the ixgbe function: update next_to_use and bump the tail
+ * register, which in this case is read by the simulated NIC.
+ */
+void ixgbe_release_rx_desc(struct ixgbe_ring *rx_ring, u32 val)
+{
+	rx_ring->next_to_use = val;
+	wmb();
+	writel(val, rx_ring->tail);
+}
+
+#define is_power_of_2(n) ((n) != 0 && (((n) & ((n) - 1)) == 0))
+
+void hpcap_sim_default_config(struct hpcap_sim_config *cfg)
+{
+	memset(cfg, 0, sizeof(struct hpcap_sim_config));
+
+	cfg->ring_size = IXGBE_MAX_TXD;
+	cfg->consumers = 1;
+	cfg->bufsize = 16 * 1024 * 1024;
+	cfg->caplen = 0;
+	cfg->listeners = 1;
+	cfg->frame_len = 0;
+	cfg->max_frame_len = SIM_MAX_FRAME_LEN;
+	cfg->frame_ns = 67;
+	cfg->validate = 1;
+	cfg->seed = 1;
+}
+
+static u64 splitmix64(u64 x)
+{
+	x += 0x9E3779B97F4A7C15ull;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+
+size_t hpcap_sim_frame_len(const struct hpcap_sim *sim, u64 seq)
+{
+	if (sim->cfg.frame_len)
+		return sim->cfg.frame_len;
+
+	return SIM_MIN_FRAME_LEN + splitmix64(seq ^ ((u64) sim->cfg.seed << 32)) % (sim->cfg.max_frame_len - SIM_MIN_FRAME_LEN + 1);
+}
+
+static int hpcap_sim_check_config(const struct hpcap_sim_config *cfg)
+{
+	if (cfg->ring_size == 0 || cfg->ring_size > IXGBE_MAX_TXD) {
+		fprintf(stderr, "Ring size must be between 1 and %d\n", IXGBE_MAX_TXD);
+		return -1;
+	}
+
+	if (cfg->consumers == 0 || cfg->consumers > MAX_CONSUMERS_PER_Q || cfg->ring_size % cfg->consumers != 0) {
+		fprintf(stderr, "Consumers must be between 1 and %d and divide the ring size\n", MAX_CONSUMERS_PER_Q);
+		return -1;
+	}
+
+	if (!is_power_of_2(cfg->bufsize) || cfg->bufsize < 2 * MAX_PACKET_SIZE) {
+		fprintf(stderr, "Buffer size must be a power of two (and hold at least two frames)\n");
+		return -1;
+	}
+
+	if ((cfg->listeners == 0 && !cfg->overwrite) || cfg->listeners > MAX_LISTENERS) {
+		fprintf(stderr, "Listeners must be between 1 (0 in overwrite mode) and %d\n", MAX_LISTENERS);
+		return -1;
+	}
+
+	if (cfg->snapshot_ns && (!cfg->overwrite || cfg->group || cfg->listeners >= MAX_LISTENERS)) {
+		fprintf(stderr, "Snapshots need the overwrite mode, no groups and a free listener\n");
+		return -1;
+	}
+
+	if (cfg->caplen != 0 && cfg->caplen < SIM_SEQ_LEN) {
+		fprintf(stderr, "Caplen must be 0 or at least %d bytes\n", SIM_SEQ_LEN);
+		return -1;
+	}
+
+	if (cfg->frame_len != 0 && (cfg->frame_len < SIM_SEQ_LEN || cfg->frame_len > MAX_PACKET_SIZE)) {
+		fprintf(stderr, "Frame length must be between %d and %d bytes\n", SIM_SEQ_LEN, MAX_PACKET_SIZE);
+		return -1;
+	}
+
+	if (cfg->max_frame_len < SIM_MIN_FRAME_LEN || cfg->max_frame_len > MAX_PACKET_SIZE) {
+		fprintf(stderr, "Maximum frame length must be between %d and %d bytes\n", SIM_MIN_FRAME_LEN, MAX_PACKET_SIZE);
+		return -1;
+	}
+
+	/* As the MTU parameter of the driver */
+	if ((cfg->frame_len ? cfg->frame_len : cfg->max_frame_len) > MAX_DESCR_SIZE && cfg->consumers > 1) {
+		fprintf(stderr, "Frames over %d bytes span several descriptors and need one consumer\n", MAX_DESCR_SIZE);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+#define SIM_HUGE_2M (2ul << 20)
+
+/**
+ * Allocates the HPCAP buffer with the pages of the configuration. The driver
+ * writes its vmalloc buffer through 4 KB pages, and a hugepage buffer through
+ * 2 MB or 1 GB pages if they are contiguous (hpcap_hugepages.c). 2 MB pages
+ * come from the hugetlb pool if it has them, or else are transparent
+ * hugepages, which the kernel may not find.
+ */
+static void *hpcap_sim_alloc_buffer(struct hpcap_sim *sim, size_t size)
+{
+	size_t page = sim->cfg.buf_page_size;
+	u8 *region, *buf;
+
+	sim->buf_map_len = 0;
+
+	if (page == 0) {
+		sim->buf_pages = "default";
+		return aligned_alloc(PAGE_SIZE, size);
+	}
+
+	size = (size + page - 1) / page * page;
+
+	if (page > PAGE_SIZE) {
+		buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+				   ((page == SIM_HUGE_2M ? 21 : 30) << MAP_HUGE_SHIFT), -1, 0);
+
+		if (buf != MAP_FAILED) {
+			sim->buf_map_len = size;
+			sim->buf_pages = page == SIM_HUGE_2M ? "2M hugetlb" : "1G hugetlb";
+			return buf;
+		}
+
+		if (page != SIM_HUGE_2M)
+			return NULL;
+	}
+
+	/* Aligned to 2 MB, so the whole buffer can be made of transparent hugepages */
+	region = mmap(NULL, size + SIM_HUGE_2M, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (region == MAP_FAILED)
+		return NULL;
+
+	buf = (u8 *) (((uintptr_t) region + SIM_HUGE_2M - 1) & ~(SIM_HUGE_2M - 1));
+
+	if (buf != region)
+		munmap(region, buf - region);
+
+	munmap(buf + size, region + SIM_HUGE_2M - buf);
+
+	madvise(buf, size, page > PAGE_SIZE ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+	sim->buf_map_len = size;
+	sim->buf_pages = page > PAGE_SIZE ? "2M THP" : "4K";
+
+	return buf;
+}
+
+static int hpcap_sim_init_buffer(struct hpcap_sim *sim)
+{
+	struct hpcap_buf *bufp;
+
+	bufp = calloc(1, sizeof(struct hpcap_buf));
+
+	if (bufp == NULL)
+		return -1;
+
+	sim->bufp = bufp;
+
+	/* Same initialization as hpcap_buf_init, without the chardev and the static buffers */
+	atomic_set(&bufp->readCount, 0);
+	atomic_set(&bufp->mmapCount, 0);
+	bufp->adapter = sim->adapter.bd_number;
+	bufp->queue = 0;
+	atomic_set(&bufp->created, 0);
+	atomic_set(&bufp->mapped, 0);
+	atomic_set(&bufp->opened, 0);
+	atomic_set(&bufp->last_handle, 0);
+	atomic_set(&bufp->enabled_filter, 0);
+	bufp->max_opened = MAX_LISTENERS + 1;
+	sprintf(bufp->name, "hpcapPoll%dq%d", sim->adapter.bd_number, 0);
+	hpcap_burst_control_init(&bufp->burst_ctl);
+
+	bufp->bufSize = sim->cfg.bufsize;
+	bufp->bufferCopia = hpcap_sim_alloc_buffer(sim, bufp->bufSize);
+
+	if (bufp->bufferCopia == NULL)
+		return -1;
+
+	/* Touch the buffer now so page faults do not show up in the measurements */
+	memset(bufp->bufferCopia, 0, bufp->bufSize);
+
+	hpcap_init_listeners(&bufp->lstnr, bufp->bufSize);
+
+#ifdef HPCAP_MEASURE_LATENCY
+	hpcap_latency_init_buffer(bufp, 0);
+#endif
+
+	return 0;
+}
+
+static int hpcap_sim_init_ring(struct hpcap_sim *sim)
+{
+	struct ixgbe_ring *ring = &sim->ring;
+	size_t desc_size, windows, i;
+	union ixgbe_adv_rx_desc *rx_desc;
+
+	desc_size = (sim->cfg.ring_size * sizeof(union ixgbe_adv_rx_desc) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	windows = (sim->cfg.ring_size - 1) / IXGBE_SUBWINDOW_SIZE + 1;
+
+	sim->desc_mem = aligned_alloc(PAGE_SIZE, desc_size);
+	sim->window_mem = aligned_alloc(PAGE_SIZE, windows * IXGBE_SUBWINDOW_SIZE * MAX_DESCR_SIZE);
+
+	if (sim->desc_mem == NULL || sim->window_mem == NULL)
+		return -1;
+
+	memset(sim->desc_mem, 0, desc_size);
+	memset(sim->window_mem, 0, windows * IXGBE_SUBWINDOW_SIZE * MAX_DESCR_SIZE);
+
+	ring->desc = sim->desc_mem;
+	ring->count = sim->cfg.ring_size;
+	ring->tail = (u8 __iomem *) &sim->nic.tail;
+	ring->adapter = &sim->adapter;
+	ring->bufp = sim->bufp;
+	ring->window_size = IXGBE_SUBWINDOW_SIZE * MAX_DESCR_SIZE;
+
+	/**
+	 * The "DMA" address of each window is its virtual address, so the NIC can
+	 * write through the address in the descriptor. Windows are page aligned,
+	 * which keeps the DD bit clear when the driver re-arms a descriptor
+	 * (hdr_addr overlaps the status word).
+	 */
+	for (i = 0; i < windows; i++) {
+		ring->window[i] = (u8 *) sim->window_mem + i * IXGBE_SUBWINDOW_SIZE * MAX_DESCR_SIZE;
+		ring->dma_window[i] = (dma_addr_t) (uintptr_t) ring->window[i];
+	}
+
+	/**
+	 * Arm the ring as ixgbe_alloc_rx_buffers_hpcap does when the interface
+	 * goes up, giving count - 1 descriptors to the NIC. All descriptors get an
+	 * address, as the NIC will reach the last one when the tail wraps around.
+	 */
+	for (i = 0; i < ring->count; i++) {
+		rx_desc = IXGBE_RX_DESC(ring, i);
+		rx_desc->read.pkt_addr = rx_desc->read.hdr_addr = cpu_to_le64(packet_dma(ring, i));
+	}
+
+	sim->nic.head = 0;
+	ixgbe_release_rx_desc(ring, ring->count - 1);
+
+	return 0;
+}
+
+int hpcap_sim_init(struct hpcap_sim *sim, const struct hpcap_sim_config *cfg)
+{
+	size_t i;
+	int id;
+	struct hpcap_sim_listener *sl;
+
+	memset(sim, 0, sizeof(struct hpcap_sim));
+	sim->cfg = *cfg;
+
+	if (hpcap_sim_check_config(cfg))
+		return -1;
+
+	snprintf(sim->netdev.name, IFNAMSIZ, "hpcap0");
+
+	sim->adapter.netdev = &sim->netdev;
+	sim->adapter.rx_ring[0] = &sim->ring;
+	sim->adapter.num_rx_queues = 1;
+	sim->adapter.bd_number = 0;
+	sim->adapter.core = 0;
+	sim->adapter.numa_node = 0;
+	sim->adapter.work_mode = 2;
+	sim->adapter.consumers = cfg->consumers;
+	atomic_set(&sim->adapter.dup_mode, 0);
+	atomic_set(&sim->adapter.caplen, cfg->caplen);
+
+	adapters[0] = &sim->adapter;
+	adapters_found = 1;
+
+	/* As hpcap_register_adapters */
+	hpcap_copy_init();
+
+	/* Start the simulated clock at a sensible date so timestamps are never 0 */
+	sim_clock_ns = 1500000000ull * 1000000000ull;
+
+	sim->frame = malloc(MAX_PACKET_SIZE);
+
+	if (sim->frame == NULL)
+		goto err;
+
+	for (i = 0; i < MAX_PACKET_SIZE; i++)
+		sim->frame[i] = (u8) (i * 7 + 1);
+
+	if (hpcap_sim_init_buffer(sim) || hpcap_sim_init_ring(sim))
+		goto err;
+
+	for (i = 0; i < cfg->listeners; i++) {
+		sl = &sim->listeners[i];
+		id = i + 1;
+
+		hpcap_add_listener(&sim->bufp->lstnr, id);
+
+		if (hpcap_get_listener(&sim->bufp->lstnr, id) == NULL) {
+			fprintf(stderr, "Could not register listener %d\n", id);
+			goto err;
+		}
+
+		sl->id = id;
+
+		if (cfg->group && hpcap_join_group(&sim->bufp->lstnr, hpcap_get_listener(&sim->bufp->lstnr, id), 1)) {
+			fprintf(stderr, "Listener %d could not join the group\n", id);
+			goto err;
+		}
+
+		if (cfg->lossy_lag && i == cfg->listeners - 1 &&
+				hpcap_set_lossy(&sim->bufp->lstnr, hpcap_get_listener(&sim->bufp->lstnr, id), cfg->lossy_lag)) {
+			fprintf(stderr, "Listener %d could not be made lossy\n", id);
+			goto err;
+		}
+	}
+
+	atomic_set(&sim->bufp->overwrite, cfg->overwrite);
+	hpcap_init_consumers(&sim->adapter, sim->bufp, 0);
+
+	return 0;
+
+err:
+	hpcap_sim_destroy(sim);
+	return -1;
+}
+
+void hpcap_sim_destroy(struct hpcap_sim *sim)
+{
+	size_t i;
+
+	if (sim->threaded)
+		hpcap_sim_stop_threads(sim);
+
+	for (i = 0; i < MAX_LISTENERS; i++)
+		free(sim->listeners[i].seen);
+
+	if (sim->bufp) {
+		if (sim->buf_map_len)
+			munmap(sim->bufp->bufferCopia, sim->buf_map_len);
+		else
+			free(sim->bufp->bufferCopia);
+
+		for (i = 0; i < MAX_CONSUMERS_PER_Q; i++) {
+			hpcap_burst_free(&sim->bufp->consumers_thinfo[i].burst);
+			hpcap_latency_free(&sim->bufp->consumers_thinfo[i].lm.probe);
+		}
+
+		for (i = 0; i < MAX_LISTENERS; i++)
+			hpcap_latency_free(&sim->bufp->lstnr.listeners[i].delivery);
+
+		hpcap_latency_free(&sim->bufp->lstnr.global.delivery);
+	}
+
+	free(sim->bufp);
+	free(sim->desc_mem);
+	free(sim->window_mem);
+	free(sim->frame);
+
+	adapters[0] = NULL;
+	adapters_found = 0;
+
+	memset(sim, 0, sizeof(struct hpcap_sim));
+}
+
+size_t hpcap_sim_nic_room(struct hpcap_sim *sim)
+{
+	u32 tail = readl(&sim->nic.tail);
+
+	return (tail + sim->ring.count - sim->nic.head) % sim->ring.count;
+}
+
+size_t hpcap_sim_nic_inject(struct hpcap_sim *sim, size_t count)
+{
+	struct ixgbe_ring *ring = &sim->ring;
+	struct hpcap_sim_nic *nic = &sim->nic;
+	union ixgbe_adv_rx_desc *rx_desc;
+	size_t written = 0, len, parts, fraglen, off;
+	u64 missed = nic->missed;
+	u32 status;
+	u8 *buffer;
+
+	for (; count > 0; count--, nic->seq++) {
+		sim_clock_ns += sim->cfg.frame_ns;
+
+		len = hpcap_sim_frame_len(sim, nic->seq);
+		parts = DIV_ROUND_UP(len, MAX_DESCR_SIZE);
+
+		/* The NIC drops the frames that do not fit whole in the descriptors it owns */
+		if (hpcap_sim_nic_room(sim) < parts) {
+			nic->missed++;
+			continue;
+		}
+
+		/* Jumbo frames are written in a chain of descriptors, only the last with EOP */
+		for (off = 0; off < len; off += fraglen) {
+			fraglen = minimo(len - off, MAX_DESCR_SIZE);
+
+			rx_desc = IXGBE_RX_DESC(ring, nic->head);
+			buffer = (u8 *) (uintptr_t) le64_to_cpu(rx_desc->read.pkt_addr);
+
+			if (buffer != (u8 *) (uintptr_t) packet_dma(ring, nic->head)) {
+				nic->bad_addr++;
+				buffer = ring_get_buffer(rx_desc, ring, nic->head);
+			}
+
+			if (off == 0) {
+				memcpy(buffer, &nic->seq, SIM_SEQ_LEN);
+				memcpy(buffer + SIM_SEQ_LEN, sim->frame + SIM_SEQ_LEN, fraglen - SIM_SEQ_LEN);
+			} else
+				memcpy(buffer, sim->frame + off, fraglen);
+
+			rx_desc->wb.lower.lo_dword.data = 0;
+			rx_desc->wb.lower.hi_dword.rss = cpu_to_le32((u32) splitmix64(nic->seq));
+			rx_desc->wb.upper.length = cpu_to_le16(fraglen);
+			rx_desc->wb.upper.vlan = 0;
+
+			status = IXGBE_RXD_STAT_DD;
+
+			if (off + fraglen == len)
+				status |= IXGBE_RXD_STAT_EOP;
+
+			/* Descriptor done goes last, once the frame and the length are visible */
+			wmb();
+			__atomic_store_n(&rx_desc->wb.upper.status_error, cpu_to_le32(status), __ATOMIC_RELEASE);
+
+			nic->head = (nic->head + 1) % ring->count;
+		}
+
+		written++;
+	}
+
+#ifdef HPCAP_LOSS_RECORDS
+	/* As the read of the drop counter of the queue (QPRDC) */
+	hpcap_mark_nic_drops(sim->bufp, nic->missed - missed);
+#endif
+
+	return written;
+}
+
+u64 hpcap_sim_consumer_step(struct hpcap_sim *sim, size_t consumer)
+{
+	struct hpcap_buf *bufp = sim->bufp;
+	struct hpcap_rx_thinfo *thinfo = &bufp->consumers_thinfo[consumer];
+	uint8_t *rxbuf = NULL;
+	size_t limit;
+	u64 ret;
+
+	if (atomic_read(&bufp->overwrite)) {
+		rxbuf = (uint8_t *) bufp->bufferCopia;
+		hpcap_update_listener_offsets(bufp);
+	} else if (hpcap_listener_count(&bufp->lstnr) <= 0) {
+		hpcap_global_listener_reset_offset(&bufp->lstnr);
+		hpcap_reset_buffer_offsets(bufp);
+	} else
+		rxbuf = (uint8_t *) bufp->bufferCopia;
+
+	limit = hpcap_buffer_free(bufp) / bufp->writers;
+	ret = hpcap_rx(thinfo->rx_ring, limit, rxbuf, thinfo);
+
+	return ret;
+}
+
+static void copy_from_circular(void *dst, const u8 *buf, size_t bufsize, size_t offset, size_t len)
+{
+	size_t first = minimo(len, bufsize - offset);
+
+	memcpy(dst, buf + offset, first);
+
+	if (len > first)
+		memcpy((u8 *) dst + first, buf, len - first);
+}
+
+static int hpcap_sim_mark_seen(struct hpcap_sim_listener *sl, u64 seq)
+{
+	size_t byte = seq / 8, newlen;
+	u8 *seen;
+
+	if (byte >= sl->seen_len) {
+		newlen = maximo(2 * sl->seen_len, byte + 4096);
+		seen = realloc(sl->seen, newlen);
+
+		if (seen == NULL)
+			return -1;
+
+		memset(seen + sl->seen_len, 0, newlen - sl->seen_len);
+		sl->seen = seen;
+		sl->seen_len = newlen;
+	}
+
+	if (sl->seen[byte] & (1 << (seq % 8)))
+		return 1;
+
+	sl->seen[byte] |= 1 << (seq % 8);
+
+	return 0;
+}
+
+/**
+ * Validates a frame record. Returns 0 if it is correct.
+ */
+static int hpcap_sim_check_frame(struct hpcap_sim *sim, struct hpcap_sim_listener *sl, struct raw_header *rawh, size_t data_off, u64 stream_off)
+{
+	struct hpcap_buf *bufp = sim->bufp;
+	u8 data[MAX_PACKET_SIZE];
+	size_t expected_caplen;
+	u64 seq;
+
+	if (rawh->nsec >= 1000000000u) {
+		fprintf(stderr, "Listener %d: wrong timestamp %u.%09u at stream offset %llu\n", sl->id, rawh->sec, rawh->nsec, stream_off);
+		return -1;
+	}
+
+	copy_from_circular(data, (u8 *) bufp->bufferCopia, bufp->bufSize, data_off, rawh->caplen);
+	memcpy(&seq, data, SIM_SEQ_LEN);
+
+	if (seq >= sim->nic.seq) {
+		fprintf(stderr, "Listener %d: unknown frame %llu at stream offset %llu\n", sl->id, seq, stream_off);
+		return -1;
+	}
+
+	if (rawh->len != hpcap_sim_frame_len(sim, seq)) {
+		fprintf(stderr, "Listener %d: frame %llu has length %u, expected %zu\n", sl->id, seq, rawh->len, hpcap_sim_frame_len(sim, seq));
+		return -1;
+	}
+
+	expected_caplen = sim->cfg.caplen ? minimo(sim->cfg.caplen, rawh->len) : rawh->len;
+
+	if (rawh->caplen != expected_caplen) {
+		fprintf(stderr, "Listener %d: frame %llu has caplen %u, expected %zu\n", sl->id, seq, rawh->caplen, expected_caplen);
+		return -1;
+	}
+
+	if (memcmp(data + SIM_SEQ_LEN, sim->frame + SIM_SEQ_LEN, rawh->caplen - SIM_SEQ_LEN) != 0) {
+		fprintf(stderr, "Listener %d: frame %llu has corrupted contents\n", sl->id, seq);
+		return -1;
+	}
+
+	if (sl->first_ns == 0)
+		sl->first_ns = rawh->sec * 1000000000ull + rawh->nsec;
+
+	switch (hpcap_sim_mark_seen(sim->cfg.group ? &sim->listeners[0] : sl, seq)) {
+		case 1:
+			fprintf(stderr, "Listener %d: frame %llu received twice\n", sl->id, seq);
+			sl->dups++;
+			return -1;
+
+		case -1:
+			fprintf(stderr, "Listener %d: cannot allocate the sequence bitmap\n", sl->id);
+			return -1;
+	}
+
+	return 0;
+}
+
+#ifdef HPCAP_LOSS_RECORDS
+/**
+ * Validates a loss record and adds its counts to the listener. Returns 0 if it
+ * is correct.
+ */
+static int hpcap_sim_check_loss(struct hpcap_sim *sim, struct hpcap_sim_listener *sl, struct raw_header *rawh, size_t data_off)
+{
+	struct hpcap_loss_record loss;
+	struct timespec now;
+
+	if (rawh->caplen != sizeof(struct hpcap_loss_record) || rawh->len != 0) {
+		fprintf(stderr, "Listener %d: loss record with caplen %u, len %u\n", sl->id, rawh->caplen, rawh->len);
+		return -1;
+	}
+
+	copy_from_circular(&loss, (u8 *) sim->bufp->bufferCopia, sim->bufp->bufSize, data_off, sizeof(struct hpcap_loss_record));
+	getnstimeofday(&now);
+
+	if (loss.frames + loss.nic_frames == 0 || loss.first_ns > loss.last_ns
+			|| loss.last_ns > now.tv_sec * 1000000000ull + now.tv_nsec) {
+		fprintf(stderr, "Listener %d: loss record of %llu + %llu frames from %llu to %llu ns\n", sl->id,
+				(u64) loss.frames, (u64) loss.nic_frames, (u64) loss.first_ns, (u64) loss.last_ns);
+		return -1;
+	}
+
+	sl->lost_frames += loss.frames;
+	sl->lost_nic += loss.nic_frames;
+
+	return 0;
+}
+#endif
+
+size_t hpcap_sim_listener_drain(struct hpcap_sim *sim, size_t idx, size_t max_bytes)
+{
+	struct hpcap_buf *bufp = sim->bufp;
+	struct hpcap_sim_listener *sl = &sim->listeners[idx];
+	struct hpcap_listener *l = hpcap_get_listener(&bufp->lstnr, sl->id);
+	struct raw_header rawh;
+	struct hpcap_listener_op lstop;
+	size_t avail, done = 0, offset, reclen, file_off;
+	u64 skipped;
+
+	if (l == NULL)
+		return 0;
+
+	/* As the listener waiting for data, members of a group claim a block if they have none */
+	avail = hpcap_poll_listener(&bufp->lstnr, l, 1);
+
+	/* As the HPCAP_IOC_LSTOP ioctl, reports the skips of a lossy listener after the wait */
+	skipped = hpcap_listener_skipped(&bufp->lstnr, l, &lstop);
+
+	if (skipped > 0) {
+		avail = lstop.available_bytes;
+		sl->stream_off += skipped;
+		sl->skipped += skipped;
+	}
+
+	/* The lossy listener reads slowly, so it lags */
+	if (l->max_lag > 0 && (max_bytes == 0 || max_bytes > SIM_LOSSY_READ))
+		max_bytes = SIM_LOSSY_READ;
+
+	/* The blocks of a member are not contiguous: find the stream offset of this one */
+	if (l->group != HPCAP_NO_GROUP && avail > 0)
+		sl->stream_off = (u32) (bufp->published_off - distance(l->bufferRdOffset, bufp->published_off % bufp->bufSize, bufp->bufSize));
+
+#ifdef HPCAP_MEASURE_LATENCY
+
+	/* As the HPCAP_IOC_LSTOP ioctl returning data to the listener */
+	if (avail > 0)
+		hpcap_listener_delivered(l);
+
+#endif
+
+	if (!sim->cfg.validate) {
+		done = avail;
+		goto ack;
+	}
+
+	if (max_bytes > 0 && avail > max_bytes)
+		avail = max_bytes;
+
+	offset = l->bufferRdOffset;
+
+	while (done + RAW_HLEN <= avail) {
+		copy_from_circular(&rawh, (u8 *) bufp->bufferCopia, bufp->bufSize, offset, RAW_HLEN);
+		reclen = RAW_HLEN + rawh.caplen;
+		file_off = (sl->stream_off + done) % HPCAP_FILESIZE;
+
+#ifdef HPCAP_LOSS_RECORDS
+
+		if (rawh.sec == 0 && rawh.nsec == HPCAP_LOSS_NSEC) {
+			if (done + reclen > avail)
+				break;
+
+			if (hpcap_sim_check_loss(sim, sl, &rawh, (offset + RAW_HLEN) % bufp->bufSize))
+				sl->errors++;
+
+			done += reclen;
+			offset = (offset + reclen) % bufp->bufSize;
+			continue;
+		}
+
+#endif
+
+		if ((rawh.sec != 0 || rawh.nsec != 0) && (rawh.caplen > rawh.len || rawh.caplen < SIM_SEQ_LEN || rawh.caplen > MAX_PACKET_SIZE)) {
+			/**
+			 * Not a frame header: the stream is corrupted and we cannot find the
+			 * next record. Skip everything that is available, the write offset
+			 * is always at a record boundary.
+			 */
+			fprintf(stderr, "Listener %d: invalid record header (caplen %u, len %u) at stream offset %llu, skipping %zu bytes\n",
+					sl->id, rawh.caplen, rawh.len, sl->stream_off + done, used_bytes(l) - done);
+			sl->errors++;
+			done = used_bytes(l);
+			break;
+		}
+
+		if (done + reclen > avail)
+			break;
+
+		if (file_off + reclen > HPCAP_FILESIZE) {
+			fprintf(stderr, "Listener %d: record of %zu bytes at file offset %zu crosses the file boundary\n", sl->id, reclen, file_off);
+			sl->errors++;
+		}
+
+		if (rawh.sec == 0 && rawh.nsec == 0) {
+			if (rawh.caplen != rawh.len) {
+				fprintf(stderr, "Listener %d: padding with caplen %u != len %u at file offset %zu\n", sl->id, rawh.caplen, rawh.len, file_off);
+				sl->errors++;
+			}
+
+			sl->paddings++;
+		} else {
+			if (hpcap_sim_check_frame(sim, sl, &rawh, (offset + RAW_HLEN) % bufp->bufSize, sl->stream_off + done))
+				sl->errors++;
+
+			sl->frames++;
+		}
+
+		done += reclen;
+		offset = (offset + reclen) % bufp->bufSize;
+	}
+
+ack:
+
+	if (done > 0) {
+		hpcap_ack_listener(&bufp->lstnr, l, done);
+		atomic_set(&bufp->lstnr.already_popped, 1);
+
+		/* As the HPCAP_IOC_LSTOP ioctl after the ack, gives the space back to the consumers */
+		hpcap_update_listener_offsets(bufp);
+
+		sl->stream_off += done;
+		sl->bytes += done;
+	}
+
+	return done;
+}
+
+int hpcap_sim_start_threads(struct hpcap_sim *sim)
+{
+	hpcap_launch_poll_threads(&sim->adapter);
+
+	if (!atomic_read(&sim->bufp->created))
+		return -1;
+
+	sim->threaded = 1;
+
+	return 0;
+}
+
+void hpcap_sim_stop_threads(struct hpcap_sim *sim)
+{
+	if (!sim->threaded)
+		return;
+
+	hpcap_stop_poll_threads(&sim->adapter);
+	sim->threaded = 0;
+}
+
+#ifdef HPCAP_BURST_DETECTOR
+/**
+ * Check that the burst detectors accounted every byte received, both in their
+ * statistics and in the bins still in their rings.
+ */
+static u64 hpcap_sim_check_bursts(struct hpcap_sim *sim, FILE *out)
+{
+	static u32 bins[HPCAP_BURST_BINS];
+	struct hpcap_burst_stats stats;
+	struct hpcap_burst *b;
+	u64 bytes = 0, in_bins, from, errors = 0;
+	size_t i, j, n;
+
+	for (i = 0; i < sim->cfg.consumers; i++) {
+		b = &sim->bufp->consumers_thinfo[i].burst;
+		hpcap_burst_get_stats(b, &stats);
+		bytes += stats.bytes + b->cur_bytes;
+
+		from = 0;
+		n = hpcap_burst_copy_bins(b, &from, bins, HPCAP_BURST_BINS);
+
+		for (in_bins = 0, j = 0; j < n; j++)
+			in_bins += bins[j];
+
+		fprintf(out, "Bursts %zu: %llu bins of %u ns, peak %llu bytes, %llu bursts (%llu bins, longest %llu)\n", i,
+				(u64) stats.bins, stats.bin_ns, (u64) stats.peak_bytes, (u64) stats.bursts, (u64) stats.burst_bins,
+				(u64) stats.longest_burst);
+
+		if (stats.bins <= HPCAP_BURST_BINS && (from != stats.first_bin || n != stats.bins || in_bins != stats.bytes)) {
+			fprintf(out, "Error: consumer %zu has %zu bins with %llu bytes in its ring, expected %llu with %llu bytes\n",
+					i, n, in_bins, (u64) stats.bins, (u64) stats.bytes);
+			errors++;
+		}
+	}
+
+	if (bytes != sim->ring.stats.bytes) {
+		fprintf(out, "Error: the burst detectors accounted %llu bytes, %llu were received\n", bytes, sim->ring.stats.bytes);
+		errors++;
+	}
+
+	return errors;
+}
+#endif
+
+#ifdef HPCAP_MEASURE_LATENCY
+static u64 hist_percentile(const struct hpcap_latency_hist *h, double fraction)
+{
+	u64 seen = 0;
+	size_t i;
+
+	for (i = 0; i < HPCAP_LATENCY_BUCKETS; i++) {
+		seen += h->counts[i];
+
+		if (seen > 0 && seen >= fraction * h->count)
+			return hpcap_latency_bucket_low(i + 1) - 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Report the delivery latency, and check that the reset of the histograms
+ * keeps every sample exactly once.
+ */
+static u64 hpcap_sim_check_latency(struct hpcap_sim *sim, FILE *out, u64 captured)
+{
+	static struct hpcap_latency_info info, after;
+	u64 errors = 0;
+
+	info.reset = 1;
+	hpcap_latency_get_info(sim->bufp, &info);
+	after.reset = 0;
+	hpcap_latency_get_info(sim->bufp, &after);
+
+	fprintf(out, "Delivery latency: %llu samples, mean %llu ns, p50 %llu ns, p99.9 %llu ns, max %llu ns\n",
+			(u64) info.delivery.count, (u64) (info.delivery.count ? info.delivery.sum_ns / info.delivery.count : 0),
+			hist_percentile(&info.delivery, 0.5), hist_percentile(&info.delivery, 0.999), hist_percentile(&info.delivery, 1));
+
+	if (captured > 0 && sim->cfg.listeners > 0 && info.delivery.count == 0) {
+		fprintf(out, "Error: no delivery latency was recorded\n");
+		errors++;
+	}
+
+	if (after.delivery.count != 0 || after.probe.count != 0) {
+		fprintf(out, "Error: %llu samples left in the histograms after the reset\n", (u64) (after.delivery.count + after.probe.count));
+		errors++;
+	}
+
+	return errors;
+}
+#endif
+
+/**
+ * Check the RX counters of the consumers against the ring. The optional ones
+ * are only checked if they were enabled during the whole run.
+ */
+static u64 hpcap_sim_check_stats(struct hpcap_sim *sim, FILE *out)
+{
+	struct hpcap_stats_info *info;
+	struct hpcap_rx_counters sum;
+	uint64_t *src, *dst;
+	u64 errors = 0;
+	size_t i, j;
+
+	info = calloc(1, sizeof(struct hpcap_stats_info));
+
+	if (info == NULL)
+		return 1;
+
+	info->enable = -1;
+	hpcap_stats_get_info(sim->bufp, info);
+	memset(&sum, 0, sizeof(sum));
+
+	for (i = 0; i < info->consumers; i++) {
+		src = (uint64_t *) &info->counters[i];
+		dst = (uint64_t *) &sum;
+
+		for (j = 0; j < sizeof(struct hpcap_rx_counters) / sizeof(uint64_t); j++)
+			dst[j] += src[j];
+	}
+
+	fprintf(out, "Stats (%s): %llu polls (%llu empty, %llu not owned, %llu exhausted), %llu descriptors, %llu releases, %llu sleeps\n",
+			info->enabled ? "enabled" : "disabled", (u64) sum.polls, (u64) sum.empty_polls, (u64) sum.not_owned_polls,
+			(u64) sum.budget_exhausted, (u64) sum.descriptors, (u64) sum.releases, (u64) sum.sleeps);
+
+	if (info->enabled && (sum.descriptors != sim->ring.stats.packets || sum.bytes != sim->ring.stats.bytes)) {
+		fprintf(out, "Error: the counters have %llu descriptors and %llu bytes, %llu frames and %llu bytes were received\n",
+				(u64) sum.descriptors, (u64) sum.bytes, sim->ring.stats.packets, sim->ring.stats.bytes);
+		errors++;
+	}
+
+	if (info->enabled && sum.descriptors > 0 && sum.releases == 0) {
+		fprintf(out, "Error: no descriptors were returned to the NIC\n");
+		errors++;
+	}
+
+	free(info);
+
+	return errors;
+}
+
+#ifdef HPCAP_LOSS_RECORDS
+/**
+ * Check that the loss records of a complete stream (the first listener, or the
+ * whole group), with the losses the consumers did not report yet, account for
+ * every frame the driver and the NIC dropped.
+ */
+static u64 hpcap_sim_check_losses(struct hpcap_sim *sim, FILE *out, u64 loss)
+{
+	struct hpcap_buf *bufp = sim->bufp;
+	u64 frames = 0, nic = 0, pending = 0, pending_nic = atomic64_read(&bufp->nic_drops);
+	size_t i, streams = sim->cfg.group ? sim->cfg.listeners : 1;
+
+	for (i = 0; i < bufp->consumers; i++) {
+		pending += bufp->consumers_thinfo[i].loss.frames;
+		pending_nic += bufp->consumers_thinfo[i].loss.nic_frames;
+	}
+
+	for (i = 0; i < streams; i++) {
+		frames += sim->listeners[i].lost_frames;
+		nic += sim->listeners[i].lost_nic;
+	}
+
+	fprintf(out, "Loss records: %llu frames dropped by HPCAP and %llu by the NIC, %llu and %llu not reported yet\n",
+			frames, nic, pending, pending_nic);
+
+	if (frames + pending != loss || nic + pending_nic != sim->nic.missed) {
+		fprintf(out, "Error: the loss records account for %llu + %llu frames, %llu + %llu were dropped\n",
+				frames + pending, nic + pending_nic, loss, sim->nic.missed);
+		return 1;
+	}
+
+	return 0;
+}
+#endif
+
+/**
+ * Take a snapshot of the last snapshot_ns with a new listener and check that it
+ * is a valid stream, that the frames still in the buffer before it are all
+ * before the window and, if no frame was lost, that it has every frame up to
+ * the last one.
+ */
+static u64 hpcap_sim_check_snapshot(struct hpcap_sim *sim, FILE *out, short complete)
+{
+	struct hpcap_buf *bufp = sim->bufp;
+	size_t idx = sim->cfg.listeners, used, offset, done;
+	struct hpcap_sim_listener *sl = &sim->listeners[idx];
+	struct hpcap_listener *l;
+	struct hpcap_snapshot snap;
+	struct raw_header rawh;
+	u64 errors = 0, seq, first = 0, last = 0, ts = 0;
+
+	sl->id = idx + 1;
+	hpcap_add_listener(&bufp->lstnr, sl->id);
+	l = hpcap_get_listener(&bufp->lstnr, sl->id);
+
+	snap.before_ns = sim->cfg.snapshot_ns;
+	snap.after_ns = 0;
+
+	if (l == NULL || hpcap_snapshot(&bufp->lstnr, l, &snap)) {
+		fprintf(out, "Error: could not take a snapshot\n");
+		return 1;
+	}
+
+	sl->stream_off = (u32) (bufp->published_off - snap.available_bytes);
+
+	while (hpcap_sim_listener_drain(sim, idx, 0) > 0)
+		;
+
+	for (seq = 0; seq < sl->seen_len * 8; seq++) {
+		if (sl->seen[seq / 8] & (1 << (seq % 8))) {
+			if (last == 0)
+				first = seq;
+
+			last = seq + 1;
+		}
+	}
+
+	fprintf(out, "Snapshot of the last %llu ns: %llu bytes, %llu frames (%llu to %llu), first one %lld ns before the window\n",
+			sim->cfg.snapshot_ns, sl->bytes, sl->frames, first, last ? last - 1 : 0, (long long) (snap.start_ns - sl->first_ns));
+
+	errors += sl->errors;
+
+	// With the real clock, the window can end before the check
+	if (sl->frames == 0 && sim_virtual_clock) {
+		fprintf(out, "Error: the snapshot is empty\n");
+		errors++;
+	}
+
+	// Every frame still in the buffer before the snapshot is before the window
+	used = used_bytes(&bufp->lstnr.global) - snap.available_bytes;
+	offset = bufp->lstnr.global.bufferRdOffset;
+
+	for (done = 0; done < used; done += RAW_HLEN + rawh.caplen) {
+		copy_from_circular(&rawh, (u8 *) bufp->bufferCopia, bufp->bufSize, (offset + done) % bufp->bufSize, RAW_HLEN);
+		ts = rawh.sec * 1000000000ull + rawh.nsec;
+
+		// Paddings and loss records have no time
+		if (rawh.sec == 0)
+			continue;
+
+		if (ts >= snap.start_ns) {
+			fprintf(out, "Error: frame at %zu bytes before the snapshot is in the window\n", used - done);
+			errors++;
+			break;
+		}
+	}
+
+	if (done != used && ts < snap.start_ns) {
+		fprintf(out, "Error: the snapshot does not start at a frame\n");
+		errors++;
+	}
+
+	if (complete && sl->frames > 0 && (last != sim->nic.seq || sl->frames != last - first)) {
+		fprintf(out, "Error: the snapshot does not have every frame from %llu to the last one\n", first);
+		errors++;
+	}
+
+	hpcap_del_listener(&bufp->lstnr, sl->id);
+
+	return errors;
+}
+
+u64 hpcap_sim_check(struct hpcap_sim *sim, FILE *out)
+{
+	struct hpcap_sim_listener *sl;
+	struct hpcap_listener *l;
+	u64 errors = 0, group_frames = 0;
+	u64 received, loss, discard, captured;
+	size_t i;
+
+	hpcap_stats_update_adapter(&sim->adapter);
+	received = sim->ring.stats.packets;
+	loss = sim->adapter.hpcap_client_loss;
+	discard = sim->adapter.hpcap_client_discard;
+	captured = received - loss - discard;
+
+	fprintf(out, "NIC: %llu frames injected, %llu missed (no descriptors), %llu received by HPCAP\n",
+			sim->nic.seq, sim->nic.missed, received);
+	fprintf(out, "HPCAP: %llu captured, %llu lost (buffer full), %llu discarded (no listeners)\n",
+			captured, loss, discard);
+
+	if (sim->nic.seq != sim->nic.missed + received) {
+		fprintf(out, "Error: %llu frames are still in the ring\n", sim->nic.seq - sim->nic.missed - received);
+		errors++;
+	}
+
+	if (sim->nic.bad_addr > 0) {
+		fprintf(out, "Error: %llu descriptors were given to the NIC without a valid buffer address\n", sim->nic.bad_addr);
+		errors++;
+	}
+
+	for (i = 0; i < sim->cfg.listeners; i++) {
+		sl = &sim->listeners[i];
+
+		fprintf(out, "Listener %d: %llu frames, %llu paddings, %llu bytes, %llu errors, %llu duplicates\n",
+				sl->id, sl->frames, sl->paddings, sl->bytes, sl->errors, sl->dups);
+
+		errors += sl->errors;
+		group_frames += sl->frames;
+
+		if (sim->cfg.lossy_lag && i == sim->cfg.listeners - 1) {
+			l = hpcap_get_listener(&sim->bufp->lstnr, sl->id);
+			fprintf(out, "Listener %d: lossy, %llu bytes skipped in %llu skips\n", sl->id, l->skipped_bytes, l->skips);
+
+			if (sl->skipped != l->skipped_bytes) {
+				fprintf(out, "Error: listener %d followed %llu skipped bytes, the driver skipped %llu\n", sl->id, sl->skipped, l->skipped_bytes);
+				errors++;
+			}
+
+			if (i > 0 && sl->bytes + sl->skipped != sim->listeners[0].bytes) {
+				fprintf(out, "Error: listener %d read and skipped %llu bytes, listener %d read %llu\n",
+						sl->id, sl->bytes + sl->skipped, sim->listeners[0].id, sim->listeners[0].bytes);
+				errors++;
+			}
+
+			continue;
+		}
+
+		if (sim->cfg.validate && !sim->cfg.group && sl->frames != captured) {
+			fprintf(out, "Error: listener %d received %llu frames, %llu were captured\n", sl->id, sl->frames, captured);
+			errors++;
+		}
+	}
+
+	if (sim->cfg.validate && sim->cfg.group && group_frames != captured) {
+		fprintf(out, "Error: the group received %llu frames, %llu were captured\n", group_frames, captured);
+		errors++;
+	}
+
+#ifdef HPCAP_LOSS_RECORDS
+
+	// Without listeners the losses are not reported, and a lossy listener skips records
+	if (sim->cfg.validate && discard == 0 && sim->cfg.listeners > 0 && !(sim->cfg.lossy_lag && sim->cfg.listeners == 1))
+		errors += hpcap_sim_check_losses(sim, out, loss);
+
+#endif
+
+	if (sim->cfg.overwrite) {
+		fprintf(out, "Overwrite mode: %llu bytes of old frames dropped\n", sim->bufp->lstnr.overwritten_bytes);
+
+		if (sim->cfg.snapshot_ns)
+			errors += hpcap_sim_check_snapshot(sim, out, loss == 0 && sim->nic.missed == 0);
+	}
+
+#ifdef HPCAP_BURST_DETECTOR
+	errors += hpcap_sim_check_bursts(sim, out);
+#endif
+
+#ifdef HPCAP_MEASURE_LATENCY
+	errors += hpcap_sim_check_latency(sim, out, captured);
+#endif
+
+	errors += hpcap_sim_check_stats(sim, out);
+
+	return errors;
+}
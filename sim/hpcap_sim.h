@@ -0,0 +1,194 @@
+/**
+ * @brief Userspace simulation of a HPCAP RX queue.
+ *
+ * Builds the unmodified RX core (hpcap_rx.c, hpcap_listeners.c, hpcap_dups.c)
+ * against the kernel shim in shim/ and drives it with a mock ixgbe descriptor
+ * ring. The simulated NIC writes frames through the descriptors it owns
+ * ([head, tail)) exactly as the hardware would: it takes the buffer address
+ * from the read format of the descriptor, copies the frame and then writes
+ * back the length and DD/EOP bits.
+ *
+ * Every frame carries its sequence number in the first 8 bytes and a known
+ * byte pattern afterwards, so the listeners can validate the RAW stream they
+ * receive: record format, caplen, padding and file boundaries, and that every
+ * captured frame is received exactly once.
+ *
+ * @addtogroup sim
+ * @{
+ */
+
+#ifndef HPCAP_SIM_H
+#define HPCAP_SIM_H
+
+#include "driver_hpcap.h"
+#include "hpcap_rx.h"
+#include "hpcap_listeners.h"
+#include "hpcap_copy.h"
+
+#define SIM_SEQ_LEN 8			/**< Bytes used by the sequence number at the start of each frame */
+#define SIM_MIN_FRAME_LEN 60	/**< Minimum Ethernet frame length, without FCS */
+#define SIM_MAX_FRAME_LEN 1514	/**< Maximum non-jumbo frame length, without FCS */
+#define SIM_LOSSY_READ 4096		/**< Maximum bytes the lossy listener reads per step, so it lags */
+
+/**
+ * Configuration of a simulated queue.
+ */
+struct hpcap_sim_config {
+	size_t ring_size;	/**< Descriptors in the RX ring (up to IXGBE_MAX_TXD) */
+	size_t consumers;	/**< Consumers (descriptor segments) of the queue */
+	size_t bufsize;		/**< Size of the HPCAP buffer. Must be a power of two */
+	size_t caplen;		/**< Capture length, 0 to capture whole frames */
+	size_t listeners;	/**< Number of listeners registered at start */
+	size_t frame_len;	/**< Length of the injected frames, 0 for random lengths */
+	size_t max_frame_len;	/**< Maximum of the random lengths, over MAX_DESCR_SIZE for jumbo frames */
+	u64 frame_ns;		/**< Time between frames in the simulated clock */
+	short validate;		/**< If 0, listeners acknowledge data without parsing it */
+	short group;		/**< If 1, the listeners join a group and split the frames */
+	size_t lossy_lag;	/**< If not 0, the last listener is lossy with this maximum lag and reads slowly */
+	short overwrite;	/**< If 1, the buffer is in overwrite mode (listeners can be 0) */
+	u64 snapshot_ns;	/**< If not 0, a snapshot of the last snapshot_ns is taken and checked at the end */
+	unsigned int seed;	/**< Seed for random frame lengths */
+	size_t buf_page_size;	/**< Pages of the HPCAP buffer: 4 KB, 2 MB or 1 GB, or 0 for those of the allocator */
+};
+
+/**
+ * State of the simulated NIC.
+ */
+struct hpcap_sim_nic {
+	u32 head;		/**< Next descriptor the NIC will write */
+	u32 tail;		/**< Tail register, written by the driver */
+	u64 seq;		/**< Sequence number of the next frame */
+	u64 missed;		/**< Frames dropped because the NIC did not own any descriptor */
+	u64 bad_addr;	/**< Descriptors found with a buffer address that was not re-armed */
+};
+
+/**
+ * A listener reading the HPCAP buffer, and the results of validating its stream.
+ */
+struct hpcap_sim_listener {
+	int id;				/**< Listener ID in the HPCAP buffer */
+	u64 stream_off;		/**< Bytes read since the start, used to track the file offset */
+	u64 frames;			/**< Frames received */
+	u64 bytes;			/**< Bytes received (including headers and padding) */
+	u64 paddings;		/**< Padding records received */
+	u64 errors;			/**< Validation errors */
+	u64 dups;			/**< Frames received more than once */
+	u64 skipped;		/**< Bytes skipped by the driver (lossy listener) */
+	u64 first_ns;		/**< Timestamp of the first frame received, 0 if none */
+	u64 lost_frames;	/**< Frames dropped by the driver, from the loss records received */
+	u64 lost_nic;		/**< Frames dropped by the NIC, from the loss records received */
+	u8 *seen;			/**< Bitmap of received sequence numbers (of the first listener for all the members of a group) */
+	size_t seen_len;	/**< Size in bytes of the bitmap */
+};
+
+/**
+ * A simulated HPCAP queue: adapter, ring, buffer, NIC and listeners.
+ */
+struct hpcap_sim {
+	struct hpcap_sim_config cfg;
+	struct hpcap_sim_nic nic;
+	struct net_device netdev;
+	struct ixgbe_adapter adapter;
+	struct ixgbe_ring ring;
+	struct hpcap_buf *bufp;
+	struct hpcap_sim_listener listeners[MAX_LISTENERS];
+	void *desc_mem;
+	void *window_mem;
+	u8 *frame;			/**< Template for the frame contents */
+	short threaded;		/**< Whether the poll threads are running */
+	size_t buf_map_len;	/**< Length of the mapping of the HPCAP buffer, 0 if it comes from aligned_alloc */
+	const char *buf_pages;	/**< Description of the pages backing the HPCAP buffer */
+};
+
+/**
+ * Fills the configuration with the default values.
+ * @param cfg Configuration.
+ */
+void hpcap_sim_default_config(struct hpcap_sim_config *cfg);
+
+/**
+ * Allocates and initializes the simulated queue, registers the listeners
+ * and prepares the consumers. Only one simulation can exist at a time
+ * (it is registered as adapter 0).
+ *
+ * @param  sim Simulation.
+ * @param  cfg Configuration.
+ * @return     0 if OK, -1 on error.
+ */
+int hpcap_sim_init(struct hpcap_sim *sim, const struct hpcap_sim_config *cfg);
+
+/**
+ * Frees all the resources of the simulation, stopping the poll threads if needed.
+ * @param sim Simulation.
+ */
+void hpcap_sim_destroy(struct hpcap_sim *sim);
+
+/**
+ * Length of the frame with the given sequence number.
+ */
+size_t hpcap_sim_frame_len(const struct hpcap_sim *sim, u64 seq);
+
+/**
+ * Injects frames in the NIC. Frames that do not find a descriptor owned by
+ * the NIC are dropped and counted as missed.
+ *
+ * @param  sim   Simulation.
+ * @param  count Frames to inject.
+ * @return       Frames written to the ring.
+ */
+size_t hpcap_sim_nic_inject(struct hpcap_sim *sim, size_t count);
+
+/**
+ * Descriptors currently owned by the NIC.
+ */
+size_t hpcap_sim_nic_room(struct hpcap_sim *sim);
+
+/**
+ * Runs one iteration of the given consumer, as hpcap_poll does: computes the
+ * limit from the free space of the buffer and calls hpcap_rx.
+ *
+ * @param  sim      Simulation.
+ * @param  consumer Consumer index.
+ * @return          Bytes written to the buffer.
+ */
+u64 hpcap_sim_consumer_step(struct hpcap_sim *sim, size_t consumer);
+
+/**
+ * Reads and acknowledges data from a listener. Publishes the data written by
+ * the consumers before reading and after the ack, as the driver does when the
+ * listener waits for data.
+ *
+ * @param  sim       Simulation.
+ * @param  idx       Listener index.
+ * @param  max_bytes Maximum bytes to read, 0 for everything available. The
+ *                   listener always stops at a record boundary.
+ * @return           Bytes acknowledged.
+ */
+size_t hpcap_sim_listener_drain(struct hpcap_sim *sim, size_t idx, size_t max_bytes);
+
+/**
+ * Launches the real poll threads (hpcap_launch_poll_threads) over the
+ * simulated adapter.
+ */
+int hpcap_sim_start_threads(struct hpcap_sim *sim);
+
+/**
+ * Stops the poll threads.
+ */
+void hpcap_sim_stop_threads(struct hpcap_sim *sim);
+
+/**
+ * Checks the final accounting: every injected frame was either missed by the
+ * NIC, lost/discarded by HPCAP or received exactly once by every listener.
+ * If configured, takes and checks a snapshot of the last frames. Prints a
+ * summary.
+ *
+ * @param  sim Simulation.
+ * @param  out Output stream for the summary.
+ * @return     Number of errors found.
+ */
+u64 hpcap_sim_check(struct hpcap_sim *sim, FILE *out);
+
+/** @} */
+
+#endif
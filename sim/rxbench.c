@@ -0,0 +1,398 @@
+/**
+ * @brief Microbenchmark of the HPCAP RX core.
+ *
+ * For each combination of frame size, capture length and number of consumers,
+ * fills the simulated ring (untimed), runs one iteration of every consumer
+ * (hpcap_rx plus the listener bookkeeping of the first one) and acknowledges
+ * the data from a listener (untimed). Reports the rate, the TSC cycles per
+ * frame and the last level cache and data TLB misses per frame of the timed
+ * part, optionally with the buffer backed by hugepages as the driver does with
+ * a hugepage buffer.
+ *
+ * Consumers run one after the other on the same core, so the results for
+ * several consumers measure the per-frame cost of splitting the ring, not the
+ * parallel speedup.
+ */
+
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <x86intrin.h>
+
+#include "hpcap_sim.h"
+
+#define MAX_SWEEP 16
+#define CACHE_LINE 64
+
+/**
+ * Counters of the timed part: last level cache misses and data TLB load and
+ * store misses (the page walks of the copies to the buffer).
+ */
+enum { PERF_LLC, PERF_DTLB_LOAD, PERF_DTLB_STORE, PERF_COUNTERS };
+
+struct bench_result {
+	u64 frames;
+	u64 cycles;
+	u64 misses;
+	u64 tlb_misses;
+	short has_misses;
+	short has_tlb_misses;
+};
+
+static int perf_fd[PERF_COUNTERS] = { -1, -1, -1 };
+static short stats;
+static int tstamp_mode = HPCAP_TSTAMP_MODE;
+
+static const char *tstamp_modes[] = { "clock", "frame", "batch", "spread" };
+
+static int perf_open(u32 type, u64 config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = type;
+	attr.size = sizeof(attr);
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void perf_ioctl(unsigned long request)
+{
+	int i;
+
+	for (i = 0; i < PERF_COUNTERS; i++)
+		if (perf_fd[i] >= 0)
+			ioctl(perf_fd[i], request, 0);
+}
+
+static short perf_read(int counter, u64 *value)
+{
+	long long count;
+
+	if (perf_fd[counter] < 0 || read(perf_fd[counter], &count, sizeof(count)) != sizeof(count))
+		return 0;
+
+	*value += count;
+	return 1;
+}
+
+static double tsc_ghz(void)
+{
+	struct timespec start, end;
+	u64 tsc_start, tsc_end;
+	double ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	tsc_start = __rdtsc();
+
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+	} while (ns < 200e6);
+
+	tsc_end = __rdtsc();
+
+	return (tsc_end - tsc_start) / ns;
+}
+
+static void flush_range(void *addr, size_t len)
+{
+	u8 *p = addr, *end = p + len;
+
+	for (; p < end; p += CACHE_LINE)
+		_mm_clflush(p);
+
+	_mm_mfence();
+}
+
+/**
+ * Evicts the descriptors and the frame buffers from the cache, as if the NIC
+ * had written them to memory without DDIO.
+ */
+static void flush_nic(struct hpcap_sim *sim)
+{
+	size_t windows = (sim->ring.count - 1) / IXGBE_SUBWINDOW_SIZE + 1;
+
+	flush_range(sim->desc_mem, sim->ring.count * sizeof(union ixgbe_adv_rx_desc));
+	flush_range(sim->window_mem, windows * IXGBE_SUBWINDOW_SIZE * MAX_DESCR_SIZE);
+}
+
+static int bench_one(struct hpcap_sim_config *cfg, u64 frames, short cold, struct bench_result *res, const char **pages)
+{
+	struct hpcap_sim sim;
+	u64 start, end, prev, batch;
+	short tlb_load, tlb_store;
+	size_t i;
+
+	if (hpcap_sim_init(&sim, cfg)) {
+		if (cfg->buf_page_size)
+			fprintf(stderr, "Could not allocate the buffer with %zu KB pages\n", cfg->buf_page_size >> 10);
+
+		return -1;
+	}
+
+	*pages = sim.buf_pages;
+
+	hpcap_stats_set_enabled(sim.bufp, stats);
+
+	for (i = 0; i < cfg->consumers; i++)
+		sim.bufp->consumers_thinfo[i].ts.mode = tstamp_mode;
+
+	memset(res, 0, sizeof(struct bench_result));
+
+	perf_ioctl(PERF_EVENT_IOC_RESET);
+
+	/* One untimed round to warm up the buffer and the code */
+	hpcap_sim_nic_inject(&sim, hpcap_sim_nic_room(&sim));
+
+	for (i = 0; i < cfg->consumers; i++)
+		hpcap_sim_consumer_step(&sim, i);
+
+	hpcap_sim_listener_drain(&sim, 0, 0);
+
+	while (res->frames < frames) {
+		hpcap_sim_nic_inject(&sim, hpcap_sim_nic_room(&sim));
+
+		if (cold)
+			flush_nic(&sim);
+
+		prev = sim.ring.stats.packets;
+
+		perf_ioctl(PERF_EVENT_IOC_ENABLE);
+
+		start = __rdtsc();
+
+		for (i = 0; i < cfg->consumers; i++)
+			hpcap_sim_consumer_step(&sim, i);
+
+		end = __rdtsc();
+
+		perf_ioctl(PERF_EVENT_IOC_DISABLE);
+
+		batch = sim.ring.stats.packets - prev;
+
+		if (batch == 0) {
+			fprintf(stderr, "The consumers did not make progress, aborting\n");
+			hpcap_sim_destroy(&sim);
+			return -1;
+		}
+
+		res->frames += batch;
+		res->cycles += end - start;
+
+		hpcap_sim_listener_drain(&sim, 0, 0);
+	}
+
+	res->has_misses = perf_read(PERF_LLC, &res->misses);
+	tlb_load = perf_read(PERF_DTLB_LOAD, &res->tlb_misses);
+	tlb_store = perf_read(PERF_DTLB_STORE, &res->tlb_misses);
+	res->has_tlb_misses = tlb_load || tlb_store;
+
+	hpcap_stats_update_adapter(&sim.adapter);
+
+	if (sim.adapter.hpcap_client_loss > 0)
+		fprintf(stderr, "Warning: %llu frames lost, the buffer is too small\n", sim.adapter.hpcap_client_loss);
+
+	hpcap_sim_destroy(&sim);
+
+	return 0;
+}
+
+static size_t parse_list(const char *s, size_t *list)
+{
+	size_t n = 0;
+	char *end;
+
+	while (*s && n < MAX_SWEEP) {
+		list[n] = strtoul(s, &end, 0);
+
+		if (*end == 'K' || *end == 'k')
+			list[n] <<= 10;
+		else if (*end == 'M' || *end == 'm')
+			list[n] <<= 20;
+		else if (*end == 'G' || *end == 'g')
+			list[n] <<= 30;
+
+		if (*end != '\0' && *end != ',')
+			end++;
+
+		n++;
+
+		if (*end != ',')
+			break;
+
+		s = end + 1;
+	}
+
+	return n;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	fprintf(stderr, "  -f sizes      Frame sizes with FCS, comma separated (default 64,128,256,512,1024,1518)\n");
+	fprintf(stderr, "  -s caplens    Capture lengths, 0 for full frames (default 0,64)\n");
+	fprintf(stderr, "  -c consumers  Consumers per queue (default 1,2,4)\n");
+	fprintf(stderr, "  -n frames     Frames per measurement (default 4000000)\n");
+	fprintf(stderr, "  -b bytes      HPCAP buffer size, power of two (default 64M)\n");
+	fprintf(stderr, "  -r ring       Descriptors in the ring (default %d)\n", IXGBE_MAX_TXD);
+	fprintf(stderr, "  -x            Evict descriptors and frames from the cache before each batch\n");
+	fprintf(stderr, "  -V            Use the simulated clock instead of getnstimeofday and the TSC\n");
+	fprintf(stderr, "  -T mode       Timestamps: clock, frame, batch or spread (default %s)\n", tstamp_modes[HPCAP_TSTAMP_MODE]);
+	fprintf(stderr, "  -P            Collect the optional RX counters (HPCAP_IOC_STATS)\n");
+	fprintf(stderr, "  -H pages      Pages of the buffer: 4K, 2M or 1G, comma separated (default: the allocator's)\n");
+}
+
+int main(int argc, char **argv)
+{
+	size_t sizes[MAX_SWEEP] = { 64, 128, 256, 512, 1024, 1518 }, nsizes = 6;
+	size_t caplens[MAX_SWEEP] = { 0, 64 }, ncaplens = 2;
+	size_t consumers[MAX_SWEEP] = { 1, 2, 4 }, nconsumers = 3;
+	size_t pages[MAX_SWEEP] = { 0 }, npages = 1;
+	size_t i, j, k, p;
+	u64 frames = 4000000;
+	short cold = 0;
+	struct hpcap_sim_config cfg;
+	struct bench_result res;
+	double ghz, mpps;
+	char caplen_str[24];
+	const char *page_desc;
+	int opt;
+
+	hpcap_sim_default_config(&cfg);
+	cfg.bufsize = 64 * 1024 * 1024;
+	cfg.validate = 0;
+	sim_printk_enabled = 0;
+	sim_virtual_clock = 0;
+
+	while ((opt = getopt(argc, argv, "f:s:c:n:b:r:xVPT:H:h")) != -1) {
+		switch (opt) {
+			case 'f':
+				nsizes = parse_list(optarg, sizes);
+				break;
+
+			case 's':
+				ncaplens = parse_list(optarg, caplens);
+				break;
+
+			case 'c':
+				nconsumers = parse_list(optarg, consumers);
+				break;
+
+			case 'n':
+				frames = strtoull(optarg, NULL, 0);
+				break;
+
+			case 'b':
+				cfg.bufsize = strtoull(optarg, NULL, 0);
+
+				if (strchr(optarg, 'M') || strchr(optarg, 'm'))
+					cfg.bufsize *= 1024 * 1024;
+
+				break;
+
+			case 'r':
+				cfg.ring_size = strtoul(optarg, NULL, 0);
+				break;
+
+			case 'x':
+				cold = 1;
+				break;
+
+			case 'V':
+				sim_virtual_clock = 1;
+				break;
+
+			case 'P':
+				stats = 1;
+				break;
+
+			case 'T':
+				for (tstamp_mode = 0; tstamp_mode < 4; tstamp_mode++)
+					if (strcmp(optarg, tstamp_modes[tstamp_mode]) == 0)
+						break;
+
+				if (tstamp_mode == 4) {
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+
+				break;
+
+			case 'H':
+				npages = parse_list(optarg, pages);
+
+				for (p = 0; p < npages; p++) {
+					if (pages[p] != PAGE_SIZE && pages[p] != 2ul << 20 && pages[p] != 1ul << 30) {
+						usage(argv[0]);
+						return EXIT_FAILURE;
+					}
+				}
+
+				break;
+
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	perf_fd[PERF_LLC] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	perf_fd[PERF_DTLB_LOAD] = perf_open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+										(PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	perf_fd[PERF_DTLB_STORE] = perf_open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+										 (PERF_COUNT_HW_CACHE_OP_WRITE << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	ghz = tsc_ghz();
+
+	printf("# rxbench: ring %zu, buffer %zu MB, TSC %.2f GHz, %s NIC buffers, %s timestamps, RX counters %s%s%s\n",
+		   cfg.ring_size, cfg.bufsize >> 20, ghz, cold ? "cold" : "warm",
+		   sim_virtual_clock ? "simulated" : tstamp_modes[tstamp_mode], stats ? "on" : "off",
+		   perf_fd[PERF_LLC] < 0 ? ", cache miss counter not available" : "",
+		   perf_fd[PERF_DTLB_LOAD] < 0 && perf_fd[PERF_DTLB_STORE] < 0 ? ", TLB miss counters not available" : "");
+	printf("%6s %7s %9s %11s %9s %11s %11s %11s\n", "frame", "caplen", "consumers", "pages", "Mpps", "cycles/pkt", "misses/pkt", "dTLB/pkt");
+
+	for (i = 0; i < nsizes; i++) {
+		for (j = 0; j < ncaplens; j++) {
+			for (k = 0; k < nconsumers; k++) {
+				for (p = 0; p < npages; p++) {
+					cfg.frame_len = maximo(sizes[i], SIM_MIN_FRAME_LEN + 4) - 4; // The NIC strips the FCS
+					cfg.caplen = caplens[j];
+					cfg.consumers = consumers[k];
+					cfg.buf_page_size = pages[p];
+
+					if (bench_one(&cfg, frames, cold, &res, &page_desc))
+						return EXIT_FAILURE;
+
+					mpps = res.frames / (res.cycles / ghz) * 1e3;
+
+					if (caplens[j])
+						snprintf(caplen_str, sizeof(caplen_str), "%zu", caplens[j]);
+					else
+						snprintf(caplen_str, sizeof(caplen_str), "full");
+
+					printf("%6zu %7s %9zu %11s %9.2f %11.1f", sizes[i], caplen_str, consumers[k], page_desc, mpps, (double) res.cycles / res.frames);
+
+					if (res.has_misses)
+						printf(" %11.3f", (double) res.misses / res.frames);
+					else
+						printf(" %11s", "n/a");
+
+					if (res.has_tlb_misses)
+						printf(" %11.4f\n", (double) res.tlb_misses / res.frames);
+					else
+						printf(" %11s\n", "n/a");
+
+					fflush(stdout);
+				}
+			}
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
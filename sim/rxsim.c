@@ -0,0 +1,335 @@
+/**
+ * @brief Functional test of the HPCAP RX core in userspace.
+ *
+ * Injects frames in a simulated ixgbe ring and runs the consumers and the
+ * listeners of the queue either with a deterministic scheduler (seeded, so any
+ * failure can be replayed) or with the real poll threads. At the end, checks
+ * that every listener received a valid RAW stream with every captured frame
+ * exactly once (or, with -g, that every frame went to one member of the group).
+ */
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include "hpcap_sim.h"
+
+#define SIM_SCHED_RR 0
+#define SIM_SCHED_RANDOM 1
+
+static unsigned int rng_state;
+
+static unsigned int rng(void)
+{
+	rng_state = rng_state * 1103515245u + 12345u;
+	return rng_state >> 8;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	fprintf(stderr, "  -n frames     Frames to inject (default 2000000)\n");
+	fprintf(stderr, "  -r ring       Descriptors in the ring (default %d)\n", IXGBE_MAX_TXD);
+	fprintf(stderr, "  -c consumers  Consumers per queue (default 1)\n");
+	fprintf(stderr, "  -b bytes      HPCAP buffer size, power of two (default 16M)\n");
+	fprintf(stderr, "  -l listeners  Listeners (default 1, max %d)\n", MAX_LISTENERS);
+	fprintf(stderr, "  -s caplen     Capture length, 0 for full frames (default 0)\n");
+	fprintf(stderr, "  -f length     Frame length, 0 for random lengths (default 0)\n");
+	fprintf(stderr, "  -J length     Maximum random frame length (default %d, up to %d).\n", SIM_MAX_FRAME_LEN, MAX_PACKET_SIZE);
+	fprintf(stderr, "                Frames over %d bytes span several descriptors\n", MAX_DESCR_SIZE);
+	fprintf(stderr, "  -B burst      Maximum frames injected per NIC step (default 64)\n");
+	fprintf(stderr, "  -a bytes      Maximum bytes a listener reads per step, 0 for all (default 0)\n");
+	fprintf(stderr, "  -g            The listeners join a group and split the frames\n");
+	fprintf(stderr, "  -L bytes      The last listener is lossy with this maximum lag, and reads\n");
+	fprintf(stderr, "                at most %d bytes per step\n", SIM_LOSSY_READ);
+	fprintf(stderr, "  -O            Overwrite mode: the oldest frames are dropped (listeners can be 0)\n");
+	fprintf(stderr, "  -W ns         With -O, check a snapshot of the last ns at the end\n");
+	fprintf(stderr, "  -m rr|random  Scheduler: round robin, or random interleaving of NIC,\n");
+	fprintf(stderr, "                consumers and listeners (default rr)\n");
+	fprintf(stderr, "  -S seed       Seed for the scheduler and frame lengths (default 1)\n");
+	fprintf(stderr, "  -w ns         Width of the burst detector bins, 0 for the default (%lu)\n", HPCAP_BURST_DEFAULT_NS);
+	fprintf(stderr, "  -t            Run the real poll threads instead of the scheduler\n");
+	fprintf(stderr, "  -v            Show driver messages\n");
+	fprintf(stderr, "\nHPCAP_FILESIZE is %llu bytes in this build.\n", (unsigned long long) HPCAP_FILESIZE);
+}
+
+static size_t parse_size(const char *s)
+{
+	char *end;
+	size_t val = strtoull(s, &end, 0);
+
+	switch (*end) {
+		case 'k':
+		case 'K':
+			return val * 1024;
+
+		case 'm':
+		case 'M':
+			return val * 1024 * 1024;
+
+		case 'g':
+		case 'G':
+			return val * 1024 * 1024 * 1024;
+	}
+
+	return val;
+}
+
+static size_t drain_listeners(struct hpcap_sim *sim, size_t max_bytes)
+{
+	size_t i, done = 0;
+
+	for (i = 0; i < sim->cfg.listeners; i++)
+		done += hpcap_sim_listener_drain(sim, i, max_bytes);
+
+	return done;
+}
+
+/**
+ * Lets the consumers and listeners process everything left in the ring.
+ */
+static void flush(struct hpcap_sim *sim)
+{
+	size_t i, idle = 0;
+	u64 progress, prev_received;
+
+	while (idle < 3) {
+		prev_received = sim->ring.stats.packets;
+		progress = 0;
+
+		for (i = 0; i < sim->cfg.consumers; i++)
+			progress += hpcap_sim_consumer_step(sim, i);
+
+		progress += drain_listeners(sim, 0);
+		progress += sim->ring.stats.packets - prev_received;
+
+		idle = progress ? 0 : idle + 1;
+	}
+}
+
+static void run_scheduler(struct hpcap_sim *sim, u64 frames, size_t burst, size_t ack_bytes, int mode)
+{
+	size_t i, actors = 1 + sim->cfg.consumers + sim->cfg.listeners, actor;
+
+	while (sim->nic.seq < frames) {
+		if (mode == SIM_SCHED_RR) {
+			hpcap_sim_nic_inject(sim, minimo(1 + rng() % burst, frames - sim->nic.seq));
+
+			for (i = 0; i < sim->cfg.consumers; i++)
+				hpcap_sim_consumer_step(sim, i);
+
+			for (i = 0; i < sim->cfg.listeners; i++)
+				hpcap_sim_listener_drain(sim, i, ack_bytes);
+		} else {
+			actor = rng() % actors;
+
+			if (actor == 0)
+				hpcap_sim_nic_inject(sim, minimo(1 + rng() % burst, frames - sim->nic.seq));
+			else if (actor <= sim->cfg.consumers)
+				hpcap_sim_consumer_step(sim, actor - 1);
+			else
+				hpcap_sim_listener_drain(sim, actor - 1 - sim->cfg.consumers, ack_bytes);
+		}
+	}
+
+	flush(sim);
+}
+
+static int run_threaded(struct hpcap_sim *sim, u64 frames, size_t burst, size_t ack_bytes)
+{
+	size_t room;
+	u64 prev_received;
+	int idle = 0;
+
+	if (hpcap_sim_start_threads(sim)) {
+		fprintf(stderr, "Could not start the poll threads\n");
+		return -1;
+	}
+
+	while (sim->nic.seq < frames) {
+		room = hpcap_sim_nic_room(sim);
+
+		if (room > 0)
+			hpcap_sim_nic_inject(sim, minimo(minimo(1 + rng() % burst, room), frames - sim->nic.seq));
+		else
+			sched_yield();
+
+		drain_listeners(sim, ack_bytes);
+	}
+
+	/* Wait until the poll threads go idle and the listeners have read everything */
+	while (idle < 100) {
+		prev_received = __atomic_load_n(&sim->ring.stats.packets, __ATOMIC_RELAXED);
+		usleep(1000);
+
+		if (drain_listeners(sim, 0) == 0 && prev_received == __atomic_load_n(&sim->ring.stats.packets, __ATOMIC_RELAXED))
+			idle++;
+		else
+			idle = 0;
+	}
+
+	hpcap_sim_stop_threads(sim);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct hpcap_sim sim;
+	struct hpcap_sim_config cfg;
+	u64 frames = 2000000, errors;
+	size_t burst = 64, ack_bytes = 0;
+	char lengths[64];
+	int mode = SIM_SCHED_RR, threaded = 0, opt;
+	double start, elapsed;
+	struct hpcap_burst_conf burst_conf = { 0, 0 };
+
+	hpcap_sim_default_config(&cfg);
+	sim_printk_enabled = 0;
+
+	while ((opt = getopt(argc, argv, "n:r:c:b:l:s:f:J:B:a:gL:OW:m:S:w:tvh")) != -1) {
+		switch (opt) {
+			case 'n':
+				frames = parse_size(optarg);
+				break;
+
+			case 'r':
+				cfg.ring_size = parse_size(optarg);
+				break;
+
+			case 'c':
+				cfg.consumers = parse_size(optarg);
+				break;
+
+			case 'b':
+				cfg.bufsize = parse_size(optarg);
+				break;
+
+			case 'l':
+				cfg.listeners = parse_size(optarg);
+				break;
+
+			case 's':
+				cfg.caplen = parse_size(optarg);
+				break;
+
+			case 'f':
+				cfg.frame_len = parse_size(optarg);
+				break;
+
+			case 'J':
+				cfg.max_frame_len = parse_size(optarg);
+				break;
+
+			case 'B':
+				burst = maximo(parse_size(optarg), 1);
+				break;
+
+			case 'a':
+				ack_bytes = parse_size(optarg);
+				break;
+
+			case 'g':
+				cfg.group = 1;
+				break;
+
+			case 'L':
+				cfg.lossy_lag = parse_size(optarg);
+				break;
+
+			case 'O':
+				cfg.overwrite = 1;
+				break;
+
+			case 'W':
+				cfg.snapshot_ns = parse_size(optarg);
+				break;
+
+			case 'm':
+				if (strcmp(optarg, "rr") == 0)
+					mode = SIM_SCHED_RR;
+				else if (strcmp(optarg, "random") == 0)
+					mode = SIM_SCHED_RANDOM;
+				else {
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+
+				break;
+
+			case 'S':
+				cfg.seed = parse_size(optarg);
+				break;
+
+			case 'w':
+				burst_conf.bin_ns = parse_size(optarg);
+				break;
+
+			case 't':
+				threaded = 1;
+				break;
+
+			case 'v':
+				sim_printk_enabled = 1;
+				break;
+
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	rng_state = cfg.seed;
+
+	/* The deterministic scheduler needs a reproducible clock. Threads use the real one. */
+	sim_virtual_clock = !threaded;
+
+	if (hpcap_sim_init(&sim, &cfg))
+		return EXIT_FAILURE;
+
+	/* Taken by the consumers on their first reception, as a change through the ioctl */
+	if (hpcap_burst_control_set(&sim.bufp->burst_ctl, &burst_conf)) {
+		fprintf(stderr, "Invalid burst bin width %u ns\n", burst_conf.bin_ns);
+		hpcap_sim_destroy(&sim);
+		return EXIT_FAILURE;
+	}
+
+	/* Collect all the RX counters, so they can be checked against the ring */
+	hpcap_stats_set_enabled(sim.bufp, 1);
+
+	if (cfg.frame_len)
+		snprintf(lengths, sizeof(lengths), "%zu", cfg.frame_len);
+	else
+		snprintf(lengths, sizeof(lengths), "random up to %zu, seed %u", cfg.max_frame_len, cfg.seed);
+
+	printf("rxsim: %llu frames, ring %zu, %zu consumers, buffer %zu%s, %zu listeners%s%s, caplen %zu, frame length %s, %s\n",
+		   frames, cfg.ring_size, cfg.consumers, cfg.bufsize, cfg.overwrite ? " (overwrite)" : "", cfg.listeners,
+		   cfg.group ? " in a group" : "", cfg.lossy_lag ? " (last one lossy)" : "", cfg.caplen, lengths,
+		   threaded ? "poll threads" : (mode == SIM_SCHED_RR ? "round robin scheduler" : "random scheduler"));
+
+	start = now();
+
+	if (threaded) {
+		if (run_threaded(&sim, frames, burst, ack_bytes)) {
+			hpcap_sim_destroy(&sim);
+			return EXIT_FAILURE;
+		}
+	} else
+		run_scheduler(&sim, frames, burst, ack_bytes, mode);
+
+	elapsed = now() - start;
+
+	errors = hpcap_sim_check(&sim, stdout);
+	printf("%s: %llu errors (%.2f s)\n", errors ? "FAIL" : "OK", errors, elapsed);
+
+	hpcap_sim_destroy(&sim);
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
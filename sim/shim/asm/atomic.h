@@ -0,0 +1,4 @@
+#ifndef SIM_ASM_ATOMIC_H
+#define SIM_ASM_ATOMIC_H
+#include <sim_kernel.h>
+#endif
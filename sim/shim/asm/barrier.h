@@ -0,0 +1,4 @@
+#ifndef SIM_ASM_BARRIER_H
+#define SIM_ASM_BARRIER_H
+#include <sim_kernel.h>
+#endif
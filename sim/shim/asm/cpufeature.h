@@ -0,0 +1,9 @@
+#ifndef SIM_ASM_CPUFEATURE_H
+#define SIM_ASM_CPUFEATURE_H
+#include <sim_kernel.h>
+
+/* Features are the names of __builtin_cpu_supports */
+#define X86_FEATURE_XMM2 "sse2"
+
+#define boot_cpu_has(feature) __builtin_cpu_supports(feature)
+#endif
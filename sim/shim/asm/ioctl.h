@@ -0,0 +1,4 @@
+#ifndef SIM_ASM_IOCTL_H
+#define SIM_ASM_IOCTL_H
+#include <asm-generic/ioctl.h>
+#endif
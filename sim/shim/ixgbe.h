@@ -0,0 +1,141 @@
+/**
+ * @brief Mock of the ixgbe driver header for the userspace RX simulation.
+ *
+ * Only the descriptor layout, status bits and the DEV_HPCAP fields of the
+ * ring and adapter structures that the common HPCAP code uses are defined
+ * here. Field names and types follow driver/hpcap_ixgbe-5.1.3/driver/ixgbe.h
+ * and ixgbe_type.h so hpcap_rx.c compiles unmodified.
+ *
+ * @addtogroup sim
+ * @{
+ */
+
+#ifndef _IXGBE_H_
+#define _IXGBE_H_
+
+#include <sim_kernel.h>
+
+#define PFX "hpcap-sim: "
+
+#define IXGBE_MAX_TXD			4096
+
+#define IXGBE_SUBWINDOW_BITS	10
+#define IXGBE_SUBWINDOW_SIZE	(1 << IXGBE_SUBWINDOW_BITS)
+#define IXGBE_SUBWINDOW_MASK	(IXGBE_SUBWINDOW_SIZE - 1)
+#define IXGBE_MAX_SUBWINDOWS	(IXGBE_MAX_TXD / IXGBE_SUBWINDOW_SIZE)
+
+#define IXGBE_RXD_STAT_DD	0x01 /* Descriptor Done */
+#define IXGBE_RXD_STAT_EOP	0x02 /* End of Packet */
+
+#define IXGBE_RXDADV_ERR_CE		0x01000000 /* CRC Error */
+#define IXGBE_RXDADV_ERR_LE		0x02000000 /* Length Error */
+#define IXGBE_RXDADV_ERR_PE		0x08000000 /* Packet Error */
+#define IXGBE_RXDADV_ERR_OSE	0x10000000 /* Oversize Error */
+#define IXGBE_RXDADV_ERR_USE	0x20000000 /* Undersize Error */
+#define IXGBE_RXDADV_ERR_FRAME_ERR_MASK ( \
+				IXGBE_RXDADV_ERR_CE | \
+				IXGBE_RXDADV_ERR_LE | \
+				IXGBE_RXDADV_ERR_PE | \
+				IXGBE_RXDADV_ERR_OSE | \
+				IXGBE_RXDADV_ERR_USE)
+
+/* Receive Descriptor - Advanced */
+union ixgbe_adv_rx_desc {
+	struct {
+		__le64 pkt_addr; /* Packet buffer address */
+		__le64 hdr_addr; /* Header buffer address */
+	} read;
+	struct {
+		struct {
+			union {
+				__le32 data;
+				struct {
+					__le16 pkt_info; /* RSS, Pkt type */
+					__le16 hdr_info; /* Splithdr, hdrlen */
+				} hs_rss;
+			} lo_dword;
+			union {
+				__le32 rss; /* RSS Hash */
+				struct {
+					__le16 ip_id; /* IP id */
+					__le16 csum; /* Packet Checksum */
+				} csum_ip;
+			} hi_dword;
+		} lower;
+		struct {
+			__le32 status_error; /* ext status/error */
+			__le16 length; /* Packet length */
+			__le16 vlan; /* VLAN tag */
+		} upper;
+	} wb;  /* writeback */
+};
+
+#define IXGBE_RX_DESC(R, i)	\
+	(&(((union ixgbe_adv_rx_desc *)((R)->desc))[i]))
+
+struct ixgbe_queue_stats {
+	u64 packets;
+	u64 bytes;
+};
+
+struct ixgbe_adapter;
+
+struct ixgbe_ring {
+	void *desc;			/* descriptor ring memory */
+	u8 __iomem *tail;
+	u16 count;			/* amount of descriptors */
+	u8 queue_index;
+	u8 reg_idx;
+	u16 next_to_use;
+	u16 next_to_clean;
+	struct ixgbe_queue_stats stats;
+
+	struct ixgbe_adapter *adapter;
+	struct hpcap_buf *bufp;
+	int numa_node;
+	/* [queued, next_to_clean): packets waiting to be pulled */
+	u16 queued; /* only used for RX */
+
+	unsigned int total_bytes;
+	unsigned int total_packets;
+#ifdef REMOVE_DUPS
+	u64 total_dups;
+#endif
+
+	u8 *window[IXGBE_MAX_SUBWINDOWS];
+	dma_addr_t dma_window[IXGBE_MAX_SUBWINDOWS];
+	unsigned int window_size;
+};
+
+struct ixgbe_option {
+	const char *name;
+	const char *err;
+	int def;
+};
+
+struct ixgbe_adapter {
+	struct net_device *netdev;
+	struct ixgbe_ring *rx_ring[64];
+	int num_rx_queues;
+	u16 bd_number;
+
+	int core;
+	int numa_node;
+	int work_mode;
+	atomic_t dup_mode;
+	atomic_t caplen;
+	int hpcap_mtu; /**< MTU set at probe, 0 keeps the default */
+	size_t bufpages;
+	size_t consumers;
+	unsigned long long hpcap_client_loss;
+	unsigned long long hpcap_client_discard;
+#ifdef REMOVE_DUPS
+	unsigned long long total_dup_frames;
+#endif
+};
+
+void ixgbe_release_rx_desc(struct ixgbe_ring *rx_ring, u32 val);
+
+/** @} */
+
+#endif /* _IXGBE_H_ */
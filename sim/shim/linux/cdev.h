@@ -0,0 +1,4 @@
+#ifndef SIM_LINUX_CDEV_H
+#define SIM_LINUX_CDEV_H
+#include <sim_kernel.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef SIM_LINUX_DEVICE_H
+#define SIM_LINUX_DEVICE_H
+#include <sim_kernel.h>
+#endif
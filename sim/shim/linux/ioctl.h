@@ -0,0 +1,4 @@
+#ifndef SIM_LINUX_IOCTL_H
+#define SIM_LINUX_IOCTL_H
+#include <asm/ioctl.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef SIM_LINUX_JUMP_LABEL_H
+#define SIM_LINUX_JUMP_LABEL_H
+#include <sim_kernel.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef SIM_LINUX_KTIME_H
+#define SIM_LINUX_KTIME_H
+#include <sim_kernel.h>
+#endif
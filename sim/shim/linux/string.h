@@ -0,0 +1,4 @@
+#ifndef SIM_LINUX_STRING_H
+#define SIM_LINUX_STRING_H
+#include <sim_kernel.h>
+#endif
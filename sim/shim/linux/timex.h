@@ -0,0 +1,4 @@
+#ifndef SIM_LINUX_TIMEX_H
+#define SIM_LINUX_TIMEX_H
+#include <sim_kernel.h>
+#endif
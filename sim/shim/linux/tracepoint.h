@@ -0,0 +1,4 @@
+#ifndef SIM_LINUX_TRACEPOINT_H
+#define SIM_LINUX_TRACEPOINT_H
+#include <sim_kernel.h>
+#endif
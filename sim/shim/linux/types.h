@@ -0,0 +1,5 @@
+#ifndef SIM_LINUX_TYPES_H
+#define SIM_LINUX_TYPES_H
+#include_next <linux/types.h>
+#include <sim_kernel.h>
+#endif
@@ -0,0 +1,121 @@
+/**
+ * @brief Implementation of the non-inline parts of the kernel shim.
+ */
+
+#include <stdarg.h>
+#include <unistd.h>
+
+#include <sim_kernel.h>
+
+int sim_printk_enabled = 1;
+int sim_virtual_clock = 0;
+u64 sim_clock_ns = 0;
+unsigned long volatile jiffies = 0;
+
+u64 sim_tsc_khz = 2500000;
+s64 sim_tsc_ppm = 0;
+
+static u64 sim_tsc = 1000000000000ull;
+static u64 sim_tsc_clock = 0;
+static unsigned __int128 sim_tsc_rem = 0;
+
+cycles_t sim_virtual_cycles(void)
+{
+	const unsigned __int128 scale = 1000000000000ull;
+
+	if (sim_tsc_clock != 0 && sim_clock_ns > sim_tsc_clock) {
+		// Keep the remainder so the rate is exact however often it is read
+		sim_tsc_rem += (unsigned __int128) (sim_clock_ns - sim_tsc_clock) * sim_tsc_khz * (u64) (1000000 + sim_tsc_ppm);
+		sim_tsc += (u64) (sim_tsc_rem / scale);
+		sim_tsc_rem %= scale;
+	}
+
+	sim_tsc_clock = sim_clock_ns;
+
+	return sim_tsc;
+}
+
+static __thread struct task_struct *sim_current = NULL;
+
+static void *sim_kthread_main(void *arg)
+{
+	struct task_struct *k = arg;
+
+	sim_current = k;
+	k->threadfn(k->data);
+
+	return NULL;
+}
+
+struct task_struct *kthread_create(int (*threadfn)(void *data), void *data, const char *namefmt, ...)
+{
+	va_list ap;
+	struct task_struct *k = calloc(1, sizeof(struct task_struct));
+
+	if (k == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	k->threadfn = threadfn;
+	k->data = data;
+	k->cpu = -1;
+
+	va_start(ap, namefmt);
+	vsnprintf(k->comm, sizeof(k->comm), namefmt, ap);
+	va_end(ap);
+
+	return k;
+}
+
+void kthread_bind(struct task_struct *k, unsigned int cpu)
+{
+	k->cpu = cpu;
+}
+
+int wake_up_process(struct task_struct *k)
+{
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (k->started)
+		return 0;
+
+	pthread_attr_init(&attr);
+
+	if (k->cpu >= 0 && ncpus > 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(k->cpu % ncpus, &cpus);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+
+	if (pthread_create(&k->thread, &attr, sim_kthread_main, k) != 0) {
+		pthread_attr_destroy(&attr);
+		return 0;
+	}
+
+	pthread_attr_destroy(&attr);
+	pthread_setname_np(k->thread, k->comm);
+	k->started = 1;
+
+	return 1;
+}
+
+int kthread_should_stop(void)
+{
+	return sim_current != NULL && __atomic_load_n(&sim_current->should_stop, __ATOMIC_ACQUIRE);
+}
+
+int kthread_stop(struct task_struct *k)
+{
+	if (k == NULL || IS_ERR(k))
+		return -EINVAL;
+
+	__atomic_store_n(&k->should_stop, 1, __ATOMIC_RELEASE);
+
+	if (k->started)
+		pthread_join(k->thread, NULL);
+
+	free(k);
+
+	return 0;
+}
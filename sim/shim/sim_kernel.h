@@ -0,0 +1,519 @@
+/**
+ * @brief Minimal userspace implementation of the kernel API used by the
+ * HPCAP RX core (hpcap_rx.c, hpcap_listeners.c, hpcap_dups.c, hpcap_latency.c,
+ * hpcap_burst.c, hpcap_stats.c) and the tracepoints of hpcap_trace.h.
+ *
+ * This is not a general purpose kernel emulation layer: it provides just what
+ * the common driver code touches, with the same semantics as far as the RX
+ * path is concerned (atomics are real atomics, kernel threads are pthreads,
+ * wmb is a real store fence...). The linux/ and asm/ headers in this directory
+ * only include this file (linux/types.h also pulls the system UAPI types).
+ *
+ * @addtogroup sim
+ * @{
+ */
+
+#ifndef SIM_KERNEL_H
+#define SIM_KERNEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <linux/types.h>
+
+/*********************************************************************************
+ Basic types
+*********************************************************************************/
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef long long s64;
+
+typedef u64 dma_addr_t;
+
+#ifndef __cplusplus
+typedef _Bool bool;
+#define true 1
+#define false 0
+#endif
+
+#define __iomem
+#define __user
+#define __force
+
+#define BIT(n) (1UL << (n))
+#define BIT_ULL(n) (1ULL << (n))
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+
+/* Index of the first zero bit, undefined if there is none */
+#define ffz(x) ((unsigned long) __builtin_ctzl(~(unsigned long) (x)))
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b) min((t) (a), (t) (b))
+#define max_t(t, a, b) max((t) (a), (t) (b))
+#define max3(a, b, c) max(max(a, b), c)
+
+#define U64_MAX ((u64) ~0ULL)
+
+#define container_of(ptr, type, member) ((type *) ((char *) (ptr) - offsetof(type, member)))
+
+#define READ_ONCE(x) (*(const volatile __typeof__(x) *) &(x))
+#define WRITE_ONCE(x, val) (*(volatile __typeof__(x) *) &(x) = (val))
+
+#define IFNAMSIZ 16
+#define PAGE_SIZE 4096ul
+#define HZ 1000ul
+
+#define MAX_ERRNO 4095
+#define ERR_PTR(err) ((void *) (long) (err))
+#define PTR_ERR(ptr) ((long) (ptr))
+#define IS_ERR(ptr) ((unsigned long) (ptr) >= (unsigned long) - MAX_ERRNO)
+
+/*********************************************************************************
+ Byte order. The simulated NIC writes descriptors in host order.
+*********************************************************************************/
+
+#define le16_to_cpu(x) ((u16) (x))
+#define le32_to_cpu(x) ((u32) (x))
+#define le64_to_cpu(x) ((u64) (x))
+#define cpu_to_le16(x) ((__le16) (x))
+#define cpu_to_le32(x) ((__le32) (x))
+#define cpu_to_le64(x) ((__le64) (x))
+#define be16_to_cpu(x) __builtin_bswap16(x)
+#define be32_to_cpu(x) __builtin_bswap32(x)
+#define be64_to_cpu(x) __builtin_bswap64(x)
+#define cpu_to_be16(x) __builtin_bswap16(x)
+#define cpu_to_be32(x) __builtin_bswap32(x)
+#define cpu_to_be64(x) __builtin_bswap64(x)
+
+/*********************************************************************************
+ Barriers and MMIO
+*********************************************************************************/
+
+#define barrier() __asm__ __volatile__("" ::: "memory")
+#define mb() __asm__ __volatile__("mfence" ::: "memory")
+#define rmb() __asm__ __volatile__("lfence" ::: "memory")
+#define wmb() __asm__ __volatile__("sfence" ::: "memory")
+#define smp_mb() mb()
+#define smp_rmb() barrier()
+#define smp_wmb() barrier()
+#define cpu_relax() __builtin_ia32_pause()
+
+#define L1_CACHE_BYTES 64
+#define ____cacheline_aligned __attribute__((__aligned__(L1_CACHE_BYTES)))
+#define __read_mostly
+
+static inline void writel(u32 val, volatile void __iomem *addr)
+{
+	barrier();
+	*(volatile u32 *) addr = val;
+}
+
+static inline u32 readl(const volatile void __iomem *addr)
+{
+	u32 val = *(const volatile u32 *) addr;
+	barrier();
+	return val;
+}
+
+/*********************************************************************************
+ Atomics. Same width as the kernel atomic_t, so offset wrap-around behaves
+ exactly as in the driver.
+*********************************************************************************/
+
+typedef struct {
+	int counter;
+} atomic_t;
+
+#define ATOMIC_INIT(i) { (i) }
+
+static inline int atomic_read(const atomic_t *v)
+{
+	return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_set(atomic_t *v, int i)
+{
+	__atomic_store_n(&v->counter, i, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_add(int i, atomic_t *v)
+{
+	__atomic_add_fetch(&v->counter, i, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_sub(int i, atomic_t *v)
+{
+	__atomic_sub_fetch(&v->counter, i, __ATOMIC_SEQ_CST);
+}
+
+static inline int atomic_add_return(int i, atomic_t *v)
+{
+	return __atomic_add_fetch(&v->counter, i, __ATOMIC_SEQ_CST);
+}
+
+static inline int atomic_sub_return(int i, atomic_t *v)
+{
+	return __atomic_sub_fetch(&v->counter, i, __ATOMIC_SEQ_CST);
+}
+
+#define atomic_inc(v) atomic_add(1, (v))
+#define atomic_dec(v) atomic_sub(1, (v))
+#define atomic_inc_return(v) atomic_add_return(1, (v))
+#define atomic_dec_return(v) atomic_sub_return(1, (v))
+
+static inline int atomic_xchg(atomic_t *v, int i)
+{
+	return __atomic_exchange_n(&v->counter, i, __ATOMIC_SEQ_CST);
+}
+
+static inline int atomic_cmpxchg(atomic_t *v, int old, int new)
+{
+	__atomic_compare_exchange_n(&v->counter, &old, new, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return old;
+}
+
+typedef struct {
+	long long counter;
+} atomic64_t;
+
+static inline long long atomic64_read(const atomic64_t *v)
+{
+	return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);
+}
+
+static inline void atomic64_set(atomic64_t *v, long long i)
+{
+	__atomic_store_n(&v->counter, i, __ATOMIC_RELAXED);
+}
+
+static inline void atomic64_add(long long i, atomic64_t *v)
+{
+	__atomic_fetch_add(&v->counter, i, __ATOMIC_SEQ_CST);
+}
+
+static inline long long atomic64_xchg(atomic64_t *v, long long i)
+{
+	return __atomic_exchange_n(&v->counter, i, __ATOMIC_SEQ_CST);
+}
+
+static inline long long atomic64_cmpxchg(atomic64_t *v, long long old, long long new)
+{
+	__atomic_compare_exchange_n(&v->counter, &old, new, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return old;
+}
+
+/*********************************************************************************
+ Static keys. A flag checked at run time instead of patched code.
+*********************************************************************************/
+
+struct static_key_false {
+	int enabled;
+};
+
+#define DEFINE_STATIC_KEY_FALSE(name) struct static_key_false name = { 0 }
+#define DECLARE_STATIC_KEY_FALSE(name) extern struct static_key_false name
+
+#define static_key_enabled(key) READ_ONCE((key)->enabled)
+#define static_branch_unlikely(key) __builtin_expect(static_key_enabled(key), 0)
+#define static_branch_enable(key) WRITE_ONCE((key)->enabled, 1)
+#define static_branch_disable(key) WRITE_ONCE((key)->enabled, 0)
+
+/*********************************************************************************
+ Tracepoints. Every event is an empty function: the arguments are still type
+ checked, but nothing is recorded.
+*********************************************************************************/
+
+#define PARAMS(args...) args
+#define TP_PROTO(args...) args
+#define TP_ARGS(args...) args
+
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	static inline void trace_##name(proto) { } \
+	static inline bool trace_##name##_enabled(void) { return false; }
+#define DECLARE_EVENT_CLASS(name, proto, args, tstruct, assign, print)
+#define DEFINE_EVENT(template, name, proto, args) TRACE_EVENT(name, PARAMS(proto), PARAMS(args), , , )
+
+/*********************************************************************************
+ Locks
+*********************************************************************************/
+
+typedef struct {
+	int locked;
+} spinlock_t;
+
+static inline void spin_lock_init(spinlock_t *lock)
+{
+	lock->locked = 0;
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+	while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE))
+		while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED))
+			__builtin_ia32_pause();
+}
+
+static inline int spin_trylock(spinlock_t *lock)
+{
+	return !__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+	__atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+#define spin_lock_irqsave(l, f) do { (void) (f); spin_lock(l); } while (0)
+#define spin_unlock_irqrestore(l, f) do { (void) (f); spin_unlock(l); } while (0)
+
+typedef struct {
+	unsigned int sequence;
+} seqcount_t;
+
+static inline void seqcount_init(seqcount_t *s)
+{
+	s->sequence = 0;
+}
+
+static inline unsigned int read_seqcount_begin(const seqcount_t *s)
+{
+	unsigned int seq;
+
+	while ((seq = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE)) & 1)
+		__builtin_ia32_pause();
+
+	return seq;
+}
+
+static inline int read_seqcount_retry(const seqcount_t *s, unsigned int start)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&s->sequence, __ATOMIC_RELAXED) != start;
+}
+
+static inline void write_seqcount_begin(seqcount_t *s)
+{
+	__atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void write_seqcount_end(seqcount_t *s)
+{
+	__atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELEASE);
+}
+
+/*********************************************************************************
+ Logging
+*********************************************************************************/
+
+#define KERN_EMERG ""
+#define KERN_ALERT ""
+#define KERN_CRIT ""
+#define KERN_ERR ""
+#define KERN_WARNING ""
+#define KERN_NOTICE ""
+#define KERN_INFO ""
+#define KERN_DEBUG ""
+
+/** If zero, printk output is discarded. Set by the sim binaries. */
+extern int sim_printk_enabled;
+
+#define printk(fmt, args...) do { \
+	if (sim_printk_enabled) \
+		fprintf(stderr, fmt, ## args); \
+	} while (0)
+
+/*********************************************************************************
+ Time
+*********************************************************************************/
+
+/**
+ * If non-zero, getnstimeofday returns the simulated clock (sim_clock_ns)
+ * instead of the real one, so runs are reproducible.
+ */
+extern int sim_virtual_clock;
+extern u64 sim_clock_ns;
+
+static inline void getnstimeofday(struct timespec *ts)
+{
+	if (sim_virtual_clock) {
+		ts->tv_sec = sim_clock_ns / 1000000000ull;
+		ts->tv_nsec = sim_clock_ns % 1000000000ull;
+	} else
+		clock_gettime(CLOCK_REALTIME, ts);
+}
+
+#define NSEC_PER_SEC 1000000000L
+
+static inline s64 timespec_to_ns(const struct timespec *ts)
+{
+	return (s64) ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+static inline struct timespec ns_to_timespec(const s64 nsec)
+{
+	struct timespec ts;
+
+	ts.tv_sec = nsec / NSEC_PER_SEC;
+	ts.tv_nsec = nsec % NSEC_PER_SEC;
+
+	return ts;
+}
+
+/**
+ * TSC of the simulation. With the simulated clock, it advances with
+ * sim_clock_ns at sim_tsc_khz, plus sim_tsc_ppm parts per million: a TSC
+ * that drifts against the wall clock. It never goes backwards, even if the
+ * simulated clock does.
+ */
+typedef u64 cycles_t;
+
+extern u64 sim_tsc_khz;
+extern s64 sim_tsc_ppm;
+
+cycles_t sim_virtual_cycles(void);
+
+static inline cycles_t get_cycles(void)
+{
+	if (sim_virtual_clock)
+		return sim_virtual_cycles();
+
+	return __builtin_ia32_rdtsc();
+}
+
+static inline u64 ktime_get_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+extern unsigned long volatile jiffies;
+
+static inline long schedule_timeout(long timeout)
+{
+	(void) timeout;
+	sched_yield();
+	return 0;
+}
+
+#define touch_softlockup_watchdog() do {} while (0)
+#define cond_resched() sched_yield()
+
+static inline u64 div64_u64(u64 dividend, u64 divisor)
+{
+	return dividend / divisor;
+}
+
+static inline s64 div64_s64(s64 dividend, s64 divisor)
+{
+	return dividend / divisor;
+}
+
+static inline u64 mul_u64_u32_shr(u64 a, u32 mul, unsigned int shift)
+{
+	return (u64) (((unsigned __int128) a * mul) >> shift);
+}
+
+static inline unsigned long int_sqrt(unsigned long x)
+{
+	unsigned long r = x, y;
+
+	if (x <= 1)
+		return x;
+
+	y = (r + 1) / 2;
+
+	while (y < r) {
+		r = y;
+		y = (r + x / r) / 2;
+	}
+
+	return r;
+}
+
+/*********************************************************************************
+ Memory
+*********************************************************************************/
+
+#define GFP_KERNEL 0
+#define kmalloc(s, f) malloc(s)
+#define kzalloc(s, f) calloc(1, (s))
+#define kmalloc_node(s, f, n) malloc(s)
+#define kzalloc_node(s, f, n) calloc(1, (s))
+#define kfree(p) free(p)
+#define vmalloc(s) malloc(s)
+#define vfree(p) free(p)
+
+/*********************************************************************************
+ Kernel threads, implemented with pthreads.
+*********************************************************************************/
+
+struct task_struct {
+	pthread_t thread;
+	int (*threadfn)(void *data);
+	void *data;
+	int should_stop;
+	int started;
+	int cpu;
+	char comm[32];
+};
+
+struct task_struct *kthread_create(int (*threadfn)(void *data), void *data, const char *namefmt, ...);
+void kthread_bind(struct task_struct *k, unsigned int cpu);
+int wake_up_process(struct task_struct *k);
+int kthread_should_stop(void);
+int kthread_stop(struct task_struct *k);
+
+/*********************************************************************************
+ Opaque structures only referenced through pointers.
+*********************************************************************************/
+
+struct inode;
+struct page;
+struct vm_area_struct;
+struct pci_dev;
+struct device;
+struct module;
+struct pipe_inode_info;
+
+struct file {
+	void *private_data;
+};
+
+struct cdev {
+	int dummy;
+};
+
+struct net_device {
+	char name[IFNAMSIZ];
+};
+
+#define THIS_MODULE ((struct module *) 0)
+
+static inline int filp_close(struct file *filp, void *id)
+{
+	(void) filp;
+	(void) id;
+	return 0;
+}
+
+/** @} */
+
+#endif
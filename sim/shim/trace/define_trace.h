@@ -0,0 +1 @@
+/* Nothing to instantiate: the shim tracepoints are empty inline functions */
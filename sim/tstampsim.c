@@ -0,0 +1,467 @@
+/**
+ * @brief Validation of the TSC timestamps of the consumers in userspace.
+ *
+ * Drives the clock of a consumer (hpcap_tstamp.c) with the simulated wall
+ * clock and a simulated TSC that drifts against it. Frames arrive at random
+ * times and a consumer polls at random intervals, sometimes after long idle
+ * periods, stamping the frames that arrived since its last poll. For every
+ * timestamp mode it checks that:
+ *
+ *  - The stamps never go backwards, except when the consumer detects that
+ *    the wall clock was set back (-j) and steps its clock.
+ *  - The clock stays within -e ns of the wall clock once calibrated, even
+ *    when the drift of the TSC changes sign in the middle of the run (the
+ *    default tolerance is twice what that change accumulates in a calibration
+ *    period). Between setting the wall clock back and the next calibration it
+ *    is not checked.
+ *  - The spread mode places every frame between the start of its window and
+ *    the time of its poll.
+ *
+ * It also reports the mean difference between the stamps and the real
+ * arrival times, to compare the modes.
+ *
+ * Then it tests the correlation of hardware timestamps (hpcap_phc.c) with a
+ * simulated PHC that drifts against the wall clock in the same way and is
+ * sampled as the driver does it: every HPCAP_PHC_CORRELATION_NS, give or take
+ * 10%, with up to 100 ns of error in the wall clock time of the sample. Frames
+ * are stamped by the PHC at random times and converted before or after the
+ * next sample. It checks that the converted stamps are within -e ns of the
+ * wall clock (the default tolerance is scaled to the correlation period), also
+ * right after the PHC is set by 1 s at 5/8 of the run, and that the
+ * correlation steps only then and when the wall clock is set back (-j, at 3/4
+ * of the run), where the stamps until the next sample are not checked.
+ */
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include "hpcap_sim.h"
+#include "hpcap_tstamp.h"
+#include "hpcap_phc.h"
+
+static unsigned int rng_state;
+
+static unsigned int rng(void)
+{
+	rng_state = rng_state * 1103515245u + 12345u;
+	return rng_state >> 8;
+}
+
+/** Only 24 random bits per call */
+static u64 rng_wide(void)
+{
+	return ((u64) rng() << 24) | rng();
+}
+
+static const char *mode_names[] = { "clock", "frame", "batch", "spread" };
+
+struct tstamp_result {
+	u64 stamps;
+	u64 backwards;		/**< Stamps older than the previous one */
+	u64 out_of_window;	/**< Spread stamps outside their window */
+	u64 checked;		/**< Polls with the clock calibrated, compared against the wall clock */
+	u64 max_err;		/**< Largest difference with the wall clock in those polls */
+	double arrival_err;	/**< Sum of |stamp - arrival| */
+};
+
+struct tstamp_config {
+	u64 frames;
+	u64 gap_ns;			/**< Mean time between frames */
+	u64 poll_ns;		/**< Maximum time between polls */
+	s64 ppm;			/**< Drift of the TSC. Changes sign in the middle of the run */
+	u64 jump_ns;		/**< Wall clock set back by this at 3/4 of the run, 0 for none */
+	u64 tolerance;		/**< Maximum difference allowed with the wall clock */
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	fprintf(stderr, "  -n frames     Frames to stamp per mode (default 5000000)\n");
+	fprintf(stderr, "  -g ns         Mean time between frames (default 200)\n");
+	fprintf(stderr, "  -P ns         Maximum time between polls (default 5000)\n");
+	fprintf(stderr, "  -p ppm        Drift of the TSC against the wall clock (default 50)\n");
+	fprintf(stderr, "  -j ns         Set the wall clock back by ns at 3/4 of the run (default 0)\n");
+	fprintf(stderr, "  -e ns         Maximum difference allowed with the wall clock (default 2 * ppm * %lu / 10^6 + 200,\n"
+			"                2 * ppm * %lu / 10^6 + 500 for phc)\n", HPCAP_TSC_CALIBRATION_NS, HPCAP_PHC_CORRELATION_NS);
+	fprintf(stderr, "  -m mode       Only test this mode: clock, frame, batch, spread or phc (default all)\n");
+	fprintf(stderr, "  -S seed       Seed (default 1)\n");
+}
+
+static u64 llabs_diff(u64 a, u64 b)
+{
+	return a > b ? a - b : b - a;
+}
+
+static void run_mode(int mode, const struct tstamp_config *cfg, struct tstamp_result *res)
+{
+	struct hpcap_tstamp ts;
+	struct timespec tv;
+	u64 arrival, poll, window_start, ns, prev_ns = 0, i = 0, len;
+	u64 *arrivals;
+	size_t *lens;
+	size_t pending = 0, j, max_pending = 4096;
+	u64 steps = 0;
+	short jumped = 0, just_jumped = 0, stepped, drift_changed = 0;
+
+	memset(res, 0, sizeof(struct tstamp_result));
+
+	arrivals = malloc(max_pending * sizeof(u64));
+	lens = malloc(max_pending * sizeof(size_t));
+
+	sim_clock_ns = 1500000000ull * 1000000000ull;
+	sim_tsc_ppm = cfg->ppm;
+	hpcap_tstamp_init(&ts, mode);
+
+	arrival = poll = sim_clock_ns;
+
+	while (i < cfg->frames) {
+		// Next poll, sometimes after a long sleep
+		poll += rng() % 10000 == 0 ? 50000000 + rng() % 50000000 : 1 + rng() % cfg->poll_ns;
+
+		// Frames that arrived before it
+		pending = 0;
+
+		while (i < cfg->frames && pending < max_pending) {
+			len = SIM_MIN_FRAME_LEN + rng() % (SIM_MAX_FRAME_LEN - SIM_MIN_FRAME_LEN + 1);
+			ns = arrival + (len + HPCAP_TSTAMP_WIRE_OVERHEAD) * ts.ps_per_byte / 1000 + rng() % (2 * cfg->gap_ns);
+
+			if (ns > poll)
+				break;
+
+			arrival = ns;
+			arrivals[pending] = arrival;
+			lens[pending] = len;
+			pending++;
+			i++;
+		}
+
+		if (pending == max_pending)
+			poll = arrival;
+
+		sim_clock_ns = poll;
+
+		if (!drift_changed && i >= cfg->frames / 2) {
+			sim_tsc_ppm = -cfg->ppm;
+			drift_changed = 1;
+		}
+
+		if (cfg->jump_ns && !jumped && i >= cfg->frames * 3 / 4) {
+			// The simulated TSC keeps going forward
+			sim_clock_ns -= cfg->jump_ns;
+			poll = sim_clock_ns;
+			arrival -= cfg->jump_ns;
+			for (j = 0; j < pending; j++)
+				arrivals[j] -= cfg->jump_ns;
+			jumped = just_jumped = 1;
+		}
+
+		hpcap_tstamp_batch_start(&ts);
+		window_start = 0;
+
+		for (j = 0; j < pending; j++) {
+			hpcap_tstamp_frame(&ts, lens[j], &tv);
+			ns = tv.tv_sec * 1000000000ull + tv.tv_nsec;
+			res->stamps++;
+
+			// getnstimeofday just follows the wall clock back
+			stepped = ts.steps != steps || (mode == HPCAP_TSTAMP_CLOCK && just_jumped);
+			steps = ts.steps;
+			just_jumped = 0;
+
+			if (ns < prev_ns && !stepped)
+				res->backwards++;
+
+			if (mode == HPCAP_TSTAMP_SPREAD) {
+				// Known once the first frame of the call read the clock
+				if (j == 0)
+					window_start = ts.prev_batch_ns == 0 ? ts.batch_ns :
+								   ts.batch_ns - minimo(ts.batch_ns - ts.prev_batch_ns, HPCAP_TSTAMP_SPREAD_MAX_NS);
+
+				if (ns > ts.batch_ns || ns < window_start)
+					res->out_of_window++;
+			}
+
+			res->arrival_err += llabs_diff(ns, arrivals[j]);
+			prev_ns = ns;
+		}
+
+		/**
+		 * How far the clock is from the wall clock. The modes that read the TSC
+		 * converted it at the time of this poll.
+		 */
+		if (pending > 0 && ts.mult != 0 && mode != HPCAP_TSTAMP_CLOCK && (!jumped || ts.steps > 0)) {
+			ns = hpcap_tstamp_convert(&ts, get_cycles());
+			res->max_err = maximo(res->max_err, llabs_diff(ns, sim_clock_ns));
+			res->checked++;
+		}
+	}
+
+	printf("%-6s %10llu stamps, %6llu calibrations, %llu steps, %llu polls checked, max clock error %llu ns, "
+		   "mean error vs arrival %.0f ns, %llu backwards, %llu out of window\n",
+		   mode_names[mode], res->stamps, ts.calibrations, ts.steps, res->checked, res->max_err,
+		   res->stamps ? res->arrival_err / res->stamps : 0, res->backwards, res->out_of_window);
+
+	free(arrivals);
+	free(lens);
+}
+
+/**
+ * PHC that drifts sim_tsc_ppm against the simulated wall clock. Only moves
+ * forward with it, plus the steps given to phc_set.
+ */
+struct sim_phc {
+	u64 ns;
+	u64 sys;		/**< Wall clock time of ns */
+	u64 rem;		/**< Remainder of the drift, in 1/10^6 ns */
+};
+
+static void phc_advance(struct sim_phc *p, u64 sys)
+{
+	s64 drift;
+
+	if (sys <= p->sys)
+		return;
+
+	// (sys - p->sys) * ppm / 10^6, keeping the remainder
+	drift = (s64) (sys - p->sys) * sim_tsc_ppm + (s64) p->rem;
+	p->ns += sys - p->sys + drift / 1000000;
+	p->rem = drift % 1000000;
+
+	if ((s64) p->rem < 0) {
+		p->rem += 1000000;
+		p->ns--;
+	}
+
+	p->sys = sys;
+}
+
+struct phc_frame {
+	u64 phc;		/**< PHC time latched for the frame */
+	u64 sys;		/**< Wall clock time of its arrival */
+	short checked;	/**< Whether the conversion can be compared */
+};
+
+static void phc_check(const struct hpcap_phc *phc, const struct phc_frame *f, u64 tolerance,
+					  struct tstamp_result *res)
+{
+	u64 ns = hpcap_phc_convert(phc, f->phc), err = llabs_diff(ns, f->sys);
+
+	res->stamps++;
+
+	if (!f->checked)
+		return;
+
+	res->checked++;
+	res->arrival_err += err;
+	res->max_err = maximo(res->max_err, err);
+
+	if (err > tolerance)
+		res->out_of_window++;
+}
+
+#define PHC_FRAMES_PER_SAMPLE 32
+
+static void run_phc(const struct tstamp_config *cfg, u64 tolerance, struct tstamp_result *res)
+{
+	struct hpcap_phc phc;
+	struct sim_phc clock;
+	struct phc_frame frames[PHC_FRAMES_PER_SAMPLE];
+	u64 samples = maximo(cfg->frames / 1000, 100), sample, now, next, period, t[PHC_FRAMES_PER_SAMPLE], tmp;
+	u64 expected_steps = 1, noise;
+	short phc_set = 0, jumped = 0, unchecked = 0;
+	size_t i, j;
+
+	memset(res, 0, sizeof(struct tstamp_result));
+
+	sim_tsc_ppm = cfg->ppm;
+	now = 1500000000ull * 1000000000ull;
+	clock.ns = now;
+	clock.sys = now;
+	clock.rem = 0;
+
+	hpcap_phc_init(&phc);
+
+	for (sample = 0; sample < samples; sample++) {
+		period = HPCAP_PHC_CORRELATION_NS - HPCAP_PHC_CORRELATION_NS / 10 + rng_wide() % (HPCAP_PHC_CORRELATION_NS / 5);
+		next = now + period;
+
+		// Frames of the interval, in order of arrival
+		for (i = 0; i < PHC_FRAMES_PER_SAMPLE; i++)
+			t[i] = now + 1 + rng_wide() % period;
+
+		for (i = 1; i < PHC_FRAMES_PER_SAMPLE; i++)
+			for (j = i; j > 0 && t[j - 1] > t[j]; j--) {
+				tmp = t[j];
+				t[j] = t[j - 1];
+				t[j - 1] = tmp;
+			}
+
+		for (i = 0; i < PHC_FRAMES_PER_SAMPLE; i++) {
+			phc_advance(&clock, t[i]);
+			frames[i].phc = clock.ns;
+			frames[i].sys = t[i];
+			frames[i].checked = phc.mult != 0 && !unchecked;
+		}
+
+		now = next;
+		phc_advance(&clock, now);
+
+		if (sample == samples / 2)
+			sim_tsc_ppm = -cfg->ppm;
+
+		// The first half of the frames is converted before the sample, the rest after it
+		for (i = 0; i < PHC_FRAMES_PER_SAMPLE / 2; i++)
+			phc_check(&phc, &frames[i], tolerance, res);
+
+		if (!phc_set && sample >= samples * 5 / 8) {
+			// settime of the PHC, followed by a resync in the driver
+			clock.ns += 1000000000ull;
+			hpcap_phc_resync(&phc, clock.ns, now);
+			phc_set = 1;
+			expected_steps++;
+
+			// Latched before the PHC was set
+			for (; i < PHC_FRAMES_PER_SAMPLE; i++)
+				frames[i].checked = 0;
+		}
+
+		if (cfg->jump_ns && !jumped && sample >= samples * 3 / 4) {
+			// Only detected in the next sample
+			now -= cfg->jump_ns;
+			clock.sys = now;
+			jumped = unchecked = 1;
+			expected_steps++;
+
+			for (i = 0; i < PHC_FRAMES_PER_SAMPLE; i++)
+				frames[i].checked = 0;
+		} else {
+			// The wall clock time of the sample is off by the reading of the PHC
+			noise = rng() % 201;
+			hpcap_phc_update(&phc, clock.ns, now + noise - 100);
+
+			if (phc.steps == expected_steps)
+				unchecked = 0;
+		}
+
+		for (; i < PHC_FRAMES_PER_SAMPLE; i++)
+			phc_check(&phc, &frames[i], tolerance, res);
+	}
+
+	res->backwards = phc.steps > expected_steps ? phc.steps - expected_steps : expected_steps - phc.steps;
+
+	printf("%-6s %10llu stamps, %6llu samples, %llu steps (%llu expected), %llu stamps checked, max error %llu ns, "
+		   "mean error %.0f ns, %llu over the tolerance\n",
+		   "phc", res->stamps, phc.updates, phc.steps, expected_steps, res->checked, res->max_err,
+		   res->stamps ? res->arrival_err / res->stamps : 0, res->out_of_window);
+}
+
+int main(int argc, char **argv)
+{
+	struct tstamp_config cfg = { 5000000, 200, 5000, 50, 0, 0 };
+	struct tstamp_result res;
+	int opt, mode, only = -1;
+	u64 phc_tolerance;
+	u64 errors = 0;
+	unsigned int seed = 1;
+
+	while ((opt = getopt(argc, argv, "n:g:P:p:j:e:m:S:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				cfg.frames = strtoull(optarg, NULL, 0);
+				break;
+
+			case 'g':
+				cfg.gap_ns = maximo(strtoull(optarg, NULL, 0), 1);
+				break;
+
+			case 'P':
+				cfg.poll_ns = maximo(strtoull(optarg, NULL, 0), 1);
+				break;
+
+			case 'p':
+				cfg.ppm = strtoll(optarg, NULL, 0);
+				break;
+
+			case 'j':
+				cfg.jump_ns = strtoull(optarg, NULL, 0);
+				break;
+
+			case 'e':
+				cfg.tolerance = strtoull(optarg, NULL, 0);
+				break;
+
+			case 'm':
+				for (mode = 0; mode < 4; mode++)
+					if (strcmp(optarg, mode_names[mode]) == 0)
+						only = mode;
+
+				if (strcmp(optarg, "phc") == 0)
+					only = 4;
+
+				if (only < 0) {
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+
+				break;
+
+			case 'S':
+				seed = strtoul(optarg, NULL, 0);
+				break;
+
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	sim_virtual_clock = 1;
+
+	phc_tolerance = cfg.tolerance ? cfg.tolerance : 2 * llabs(cfg.ppm) * HPCAP_PHC_CORRELATION_NS / 1000000 + 500;
+
+	if (cfg.tolerance == 0)
+		cfg.tolerance = 2 * llabs(cfg.ppm) * HPCAP_TSC_CALIBRATION_NS / 1000000 + 200;
+
+	printf("tstampsim: %llu frames, %llu ns between frames, polls every %llu ns at most, TSC drift %+lld ppm "
+		   "(%+lld ppm from the middle), wall clock set back %llu ns, tolerance %llu ns (%llu ns for phc)\n",
+		   cfg.frames, cfg.gap_ns, cfg.poll_ns, cfg.ppm, -cfg.ppm, cfg.jump_ns, cfg.tolerance, phc_tolerance);
+
+	for (mode = 0; mode < 4; mode++) {
+		if (only >= 0 && mode != only)
+			continue;
+
+		rng_state = seed;
+		run_mode(mode, &cfg, &res);
+
+		errors += res.backwards + res.out_of_window;
+
+		if (res.max_err > cfg.tolerance) {
+			fprintf(stderr, "%s: clock error %llu ns over the tolerance\n", mode_names[mode], res.max_err);
+			errors++;
+		}
+
+		if (mode != HPCAP_TSTAMP_CLOCK && res.checked == 0) {
+			fprintf(stderr, "%s: the clock was never calibrated\n", mode_names[mode]);
+			errors++;
+		}
+	}
+
+	if (only < 0 || only == 4) {
+		rng_state = seed;
+		run_phc(&cfg, phc_tolerance, &res);
+
+		errors += res.backwards + res.out_of_window;
+
+		if (res.backwards)
+			fprintf(stderr, "phc: the correlation stepped %llu times more or less than expected\n", res.backwards);
+
+		if (res.checked == 0) {
+			fprintf(stderr, "phc: no stamp was checked\n");
+			errors++;
+		}
+	}
+
+	printf("%s: %llu errors\n", errors ? "FAIL" : "OK", errors);
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -14,8 +14,14 @@
 
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/vfs.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <time.h>
 
 #include <pcap.h>
+#include <zlib.h>
 
 #include "../include/hpcap.h"
 
@@ -44,6 +50,7 @@ int hpcap_open(struct hpcap_handle *handle, int adapter_idx, int queue_idx)
 	handle->bufoff = 0;
 	handle->bufSize = 0;
 	handle->size = 0;
+	handle->lost_bytes = 0;
 
 	return HPCAP_OK;
 }
@@ -67,30 +74,134 @@ void hpcap_close(struct hpcap_handle *handle)
 
 /**
  * @internal
- * Get the pointer for the buffer backed by the given hugepage file.
+ * Name of a file of a hugepage buffer: the name of the buffer for the first
+ * one, then name.1, name.2...
+ * @return Length of the name, MAX_HUGETLB_FILE_LEN or more if it does not fit.
+ */
+static int _hpcap_huge_file_name(char* dst, const char* name, int i)
+{
+	if (i == 0)
+		return snprintf(dst, MAX_HUGETLB_FILE_LEN, "%s", name);
+
+	return snprintf(dst, MAX_HUGETLB_FILE_LEN, "%s.%d", name, i);
+}
+
+/**
+ * @internal
+ * Removes the files of a hugepage buffer. Their pages are freed once nobody maps them.
+ */
+static void _hpcap_unlink_huge(const char* name, int files)
+{
+	char file[MAX_HUGETLB_FILE_LEN];
+	int i;
+
+	for (i = 0; i < maximo(files, 1); i++)
+		if (_hpcap_huge_file_name(file, name, i) < MAX_HUGETLB_FILE_LEN)
+			unlink(file);
+}
+
+/**
+ * @internal
+ * Get the pointer for the buffer backed by the given hugepage files.
+ *
+ * The files are mapped one after the other in a range aligned to the size of
+ * the hugepages, so the buffer is contiguous for the driver and the readers.
+ * If nodes is not NULL, the pages of each file are bound to the given node.
+ * The driver faults them in when it pins them, after the binding.
+ *
  * @param 	handle  HPCAP handle.
  * @param	bufinfo Structure with the HP buffer information.
+ * @param	nodes   NUMA node of each file, or NULL.
  * @return          HPCAP_OK or HPCAP_ERR.
  */
-static int _hpcap_mmap_hugetlb(struct hpcap_handle* handle, struct hpcap_buffer_info* bufinfo)
+static int _hpcap_mmap_hugetlb(struct hpcap_handle* handle, struct hpcap_buffer_info* bufinfo, const int* nodes)
 {
-	/* Open the file passed as argument, create it if it doesn't exist */
-	handle->hugepage_fd = open(bufinfo->file_name, O_CREAT | O_RDWR, 0755);
-
-	if (handle->hugepage_fd < 0) {
-		fprintf(stderr, "hpcap_map_huge/open: open(%s) failed: %s\n", handle->hugepage_name, strerror(errno));
+	char name[MAX_HUGETLB_FILE_LEN];
+	int files = maximo(bufinfo->file_count, 1);
+	size_t part = bufinfo->size / files;
+	size_t align = maximo(bufinfo->page_size, sysconf(_SC_PAGESIZE));
+	unsigned long nodemask;
+	uint8_t *region, *base;
+	int i, fd;
+
+	if (part * files != bufinfo->size || part % align != 0) {
+		fprintf(stderr, "hpcap_map_huge: a size of %zu bytes can't be split in %d files of %zu-byte pages\n", bufinfo->size, files, align);
 		return HPCAP_ERR;
 	}
 
-	handle->hugepage_addr = mmap(NULL, bufinfo->size, PROT_READ | PROT_WRITE, MAP_SHARED, handle->hugepage_fd, 0);
+	region = mmap(NULL, bufinfo->size + align, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
 
-	if (handle->hugepage_addr == MAP_FAILED) {
-		fprintf(stderr, "hpcap_map_huge/mmap: mmapping for a region of size %zu failed: %s\n", bufinfo->size, strerror(errno));
-		close(handle->hugepage_fd);
+	if (region == MAP_FAILED) {
+		fprintf(stderr, "hpcap_map_huge/mmap: reserving a region of size %zu failed: %s\n", bufinfo->size, strerror(errno));
 		return HPCAP_ERR;
 	}
 
+	/* Keep only the aligned part of the reservation */
+	base = (uint8_t*) (((uintptr_t) region + align - 1) & ~((uintptr_t) align - 1));
+
+	if (base != region)
+		munmap(region, base - region);
+
+	munmap(base + bufinfo->size, region + align - base);
+
+	handle->hugepage_addr = base;
+	handle->hugepage_len = bufinfo->size;
+	handle->hugepage_fd = -1;
+
+	for (i = 0; i < files; i++) {
+		if (_hpcap_huge_file_name(name, bufinfo->file_name, i) >= MAX_HUGETLB_FILE_LEN) {
+			fprintf(stderr, "hpcap_map_huge: file name of part %d too long\n", i);
+			goto error;
+		}
+
+		/* Open the file, create it if it doesn't exist */
+		fd = open(name, O_CREAT | O_RDWR, 0755);
+
+		if (fd < 0) {
+			fprintf(stderr, "hpcap_map_huge/open: open(%s) failed: %s\n", name, strerror(errno));
+			goto error;
+		}
+
+		if (mmap(base + i * part, part, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+			fprintf(stderr, "hpcap_map_huge/mmap: mmapping %s for a region of size %zu failed: %s\n", name, part, strerror(errno));
+			close(fd);
+			goto error;
+		}
+
+		/* Only the first file stays open, the mappings of the others keep them */
+		if (i == 0)
+			handle->hugepage_fd = fd;
+		else
+			close(fd);
+
+		if (nodes == NULL)
+			continue;
+
+		if (nodes[i] < 0 || nodes[i] >= (int) sizeof(nodemask) * 8 - 1) {
+			fprintf(stderr, "hpcap_map_huge: invalid NUMA node %d\n", nodes[i]);
+			goto error;
+		}
+
+		nodemask = 1UL << nodes[i];
+
+		if (syscall(SYS_mbind, base + i * part, part, MPOL_BIND, &nodemask, sizeof(nodemask) * 8, 0) != 0) {
+			fprintf(stderr, "hpcap_map_huge/mbind: binding %s to node %d failed: %s\n", name, nodes[i], strerror(errno));
+			goto error;
+		}
+	}
+
 	return HPCAP_OK;
+
+error:
+	munmap(base, bufinfo->size);
+	handle->hugepage_addr = MAP_FAILED;
+
+	if (handle->hugepage_fd >= 0)
+		close(handle->hugepage_fd);
+
+	handle->hugepage_fd = -1;
+
+	return HPCAP_ERR;
 }
 
 int hpcap_map(struct hpcap_handle *handle)
@@ -136,10 +247,11 @@ int hpcap_map(struct hpcap_handle *handle)
 
 		handle->buf = &(handle->page[ handle->bufoff ]);
 	} else {
-		/* The buffer is backed by hugepages. Map the corresponding file */
-		if (_hpcap_mmap_hugetlb(handle, &bufinfo))
+		/* The buffer is backed by hugepages. Map the corresponding files */
+		if (_hpcap_mmap_hugetlb(handle, &bufinfo, NULL))
 			return HPCAP_ERR;
 
+		handle->size = bufinfo.size;
 		handle->page = handle->hugepage_addr;
 		handle->buf = ((uint8_t*) handle->hugepage_addr) + handle->bufoff;
 	}
@@ -191,6 +303,30 @@ void _hpcap_advance_rdoff_to(struct hpcap_handle* handle, size_t new_offset)
 	_hpcap_advance_rdoff_by(handle, read_bytes);
 }
 
+/**
+ * @internal
+ * Follows the read offset of a lossy listener that the driver skipped forward.
+ * The bytes read and not acknowledged yet that were not skipped are still
+ * acknowledged later.
+ *
+ * @param handle HPCAP handle.
+ * @param lstop  Result of the listener operation.
+ */
+static void _hpcap_follow_skip(struct hpcap_handle* handle, const struct hpcap_listener_op* lstop)
+{
+	uint64_t driver_rdoff = (handle->rdoff + handle->bufSize - handle->acks) % handle->bufSize;
+	uint64_t moved = (lstop->read_offset + handle->bufSize - driver_rdoff) % handle->bufSize;
+
+	handle->lost_bytes += lstop->skipped_bytes;
+	handle->avail = lstop->available_bytes;
+
+	if (moved >= handle->acks) {
+		_hpcap_advance_rdoff_by(handle, moved - handle->acks);
+		handle->acks = 0;
+	} else
+		handle->acks -= moved;
+}
+
 /**
  * @internal
  * Common function to execute a listener operation with the driver.
@@ -213,6 +349,7 @@ static int _hpcap_do_listener_op(struct hpcap_handle* handle, size_t expect_byte
 
 	lstop.expect_bytes = expect_bytes;
 	lstop.timeout_ns = timeout_ns;
+	lstop.skipped_bytes = 0;
 
 	//	printdbg("lstop on %d: ack = %zu, expect = %zu, timeout = %lu\n",
 	//			 handle->fd, lstop.ack_bytes, lstop.expect_bytes, lstop.timeout_ns);
@@ -242,7 +379,9 @@ static int _hpcap_do_listener_op(struct hpcap_handle* handle, size_t expect_byte
 		handle->acks = 0;
 	}
 
-	if (expect_bytes > 0 && lstop.available_bytes >= expect_bytes) {
+	if (lstop.skipped_bytes > 0)
+		_hpcap_follow_skip(handle, &lstop);
+	else if (expect_bytes > 0 && lstop.available_bytes >= expect_bytes) {
 		handle->avail = lstop.available_bytes;
 		_hpcap_advance_rdoff_to(handle, lstop.read_offset);
 
@@ -318,6 +457,308 @@ int hpcap_ioc_kill(struct hpcap_handle* handle, int listener_id)
 	return ioctl(handle->fd, HPCAP_IOC_KILL_LST, listener_id);
 }
 
+int hpcap_join_group(struct hpcap_handle* handle, int group_id)
+{
+	if (ioctl(handle->fd, HPCAP_IOC_GROUP, group_id) < 0)
+		return HPCAP_ERR;
+
+	handle->avail = 0;
+	handle->acks = 0;
+
+	return HPCAP_OK;
+}
+
+int hpcap_set_lossy(struct hpcap_handle* handle, size_t max_lag)
+{
+	return ioctl(handle->fd, HPCAP_IOC_LOSSY, max_lag) < 0 ? HPCAP_ERR : HPCAP_OK;
+}
+
+int hpcap_set_overwrite(struct hpcap_handle* handle, int enable)
+{
+	return ioctl(handle->fd, HPCAP_IOC_OVERWRITE, enable != 0) < 0 ? HPCAP_ERR : HPCAP_OK;
+}
+
+int hpcap_snapshot(struct hpcap_handle* handle, uint64_t before_ns, uint64_t after_ns, struct hpcap_snapshot* snap)
+{
+	snap->before_ns = before_ns;
+	snap->after_ns = after_ns;
+
+	if (ioctl(handle->fd, HPCAP_IOC_SNAPSHOT, snap) < 0)
+		return HPCAP_ERR;
+
+	// The driver moved the listener: nothing read before is pending
+	handle->rdoff = snap->read_offset;
+	handle->avail = snap->available_bytes;
+	handle->acks = 0;
+
+	return HPCAP_OK;
+}
+
+#define SNAPSHOT_IOV 64
+#define SNAPSHOT_WAIT_NS 10000000ul
+
+/**
+ * @internal
+ * Writes all the vectors, retrying the partial writes.
+ * @return 0 if OK, -1 on error.
+ */
+static int _hpcap_writev_all(int fd, struct iovec* iov, int iovcnt)
+{
+	ssize_t ret;
+
+	while (iovcnt > 0) {
+		ret = writev(fd, iov, iovcnt);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		while (iovcnt > 0 && (size_t) ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (iovcnt > 0) {
+			iov->iov_base = (uint8_t*) iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @internal
+ * Adds a run of contiguous records of the buffer to the vectors, split at the
+ * end of the buffer, writing them out first if they are full.
+ * @return 0 if OK, -1 on error.
+ */
+static int _hpcap_snapshot_add_run(struct hpcap_handle* handle, int fd, struct iovec* iov, int* iovcnt, uint64_t start, uint64_t len)
+{
+	uint64_t first = minimo(len, handle->bufSize - start);
+
+	if (len == 0)
+		return 0;
+
+	if (*iovcnt + 2 > SNAPSHOT_IOV) {
+		if (_hpcap_writev_all(fd, iov, *iovcnt))
+			return -1;
+
+		*iovcnt = 0;
+	}
+
+	iov[*iovcnt].iov_base = handle->buf + start;
+	iov[*iovcnt].iov_len = first;
+	(*iovcnt)++;
+
+	if (len > first) {
+		iov[*iovcnt].iov_base = handle->buf;
+		iov[*iovcnt].iov_len = len - first;
+		(*iovcnt)++;
+	}
+
+	return 0;
+}
+
+/**
+ * Copy len bytes of the buffer from the given offset, wrapping at its end.
+ */
+static void _hpcap_copy_at(struct hpcap_handle* handle, uint64_t offset, void* dst, size_t len)
+{
+	size_t first = minimo(len, handle->bufSize - offset);
+
+	memcpy(dst, handle->buf + offset, first);
+	memcpy((uint8_t*) dst + first, handle->buf, len - first);
+}
+
+int64_t hpcap_snapshot_write(struct hpcap_handle* handle, const struct hpcap_snapshot* snap, int fd)
+{
+	struct iovec iov[SNAPSHOT_IOV];
+	struct raw_header rawh;
+	struct hpcap_loss_record loss;
+	struct timespec now;
+	uint64_t ts, reclen, run_start = 0, run_len = 0;
+	int64_t written = 0;
+	int iovcnt = 0;
+	short done = 0, got, keep;
+
+	while (!done) {
+		// Acknowledges what the previous round wrote, so the consumers can reuse it
+		if (hpcap_ack_wait_timeout(handle, RAW_HLEN, SNAPSHOT_WAIT_NS) != HPCAP_OK)
+			return -1;
+
+		got = 0;
+
+		while (handle->avail - handle->acks >= RAW_HLEN) {
+			_hpcap_copy_at(handle, handle->rdoff, &rawh, RAW_HLEN);
+
+			reclen = RAW_HLEN + rawh.caplen;
+
+			if (handle->avail - handle->acks < reclen)
+				break;
+
+			ts = rawh.sec * 1000000000ull + rawh.nsec;
+
+			if (hpcap_is_header_padding(&rawh))
+				keep = 0;
+			else if (hpcap_is_header_loss(&rawh)) {
+				// Loss records go with the window if the losses reach it
+				_hpcap_copy_at(handle, (handle->rdoff + RAW_HLEN) % handle->bufSize, &loss, sizeof(struct hpcap_loss_record));
+				keep = loss.last_ns >= snap->start_ns;
+			} else if (ts > snap->end_ns) {
+				done = 1;
+				break;
+			} else
+				keep = ts >= snap->start_ns;
+
+			// Frames in the window join the run, which paddings and earlier frames end
+			if (keep) {
+				if (run_len == 0)
+					run_start = handle->rdoff;
+
+				run_len += reclen;
+				written += reclen;
+			} else {
+				if (_hpcap_snapshot_add_run(handle, fd, iov, &iovcnt, run_start, run_len))
+					return -1;
+
+				run_len = 0;
+			}
+
+			_hpcap_advance_rdoff_by(handle, reclen);
+			handle->acks += reclen;
+			got = 1;
+		}
+
+		if (_hpcap_snapshot_add_run(handle, fd, iov, &iovcnt, run_start, run_len) || _hpcap_writev_all(fd, iov, iovcnt))
+			return -1;
+
+		run_len = 0;
+		iovcnt = 0;
+
+		if (!got && !done) {
+			clock_gettime(CLOCK_REALTIME, &now);
+			done = now.tv_sec * 1000000000ull + now.tv_nsec > snap->end_ns;
+		}
+	}
+
+	if (hpcap_ack(handle) != HPCAP_OK)
+		return -1;
+
+	return written;
+}
+
+/**
+ * @internal
+ * Reads len bytes, retrying the partial reads.
+ * @return Bytes read, less than len if the file ends, -1 on error.
+ */
+static ssize_t _hpcap_read_all(int fd, void* buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < len) {
+		ret = read(fd, (uint8_t*) buf + done, len - done);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		} else if (ret == 0)
+			break;
+
+		done += ret;
+	}
+
+	return done;
+}
+
+int hpcap_stream_send(int fd, struct hpcap_stream_block* block, const void* raw, void* aux, int level)
+{
+	struct iovec iov[2];
+	uLongf zlen = block->raw_len - 1;
+
+	block->magic = HPCAP_STREAM_MAGIC;
+	block->flags = 0;
+	block->payload_len = block->raw_len;
+	iov[1].iov_base = (void*) raw;
+
+	// The space for the compressed payload is smaller than the block, so the blocks that don't get smaller fail here
+	if (level > 0 && block->raw_len > 0 && compress2(aux, &zlen, raw, block->raw_len, level) == Z_OK) {
+		block->flags |= HPCAP_STREAM_ZLIB;
+		block->payload_len = zlen;
+		iov[1].iov_base = aux;
+	}
+
+	iov[0].iov_base = block;
+	iov[0].iov_len = sizeof(struct hpcap_stream_block);
+	iov[1].iov_len = block->payload_len;
+
+	return _hpcap_writev_all(fd, iov, 2) == 0 ? HPCAP_OK : HPCAP_ERR;
+}
+
+int hpcap_stream_recv(int fd, struct hpcap_stream_block* block, void* raw, void* aux)
+{
+	ssize_t ret;
+	uLongf rawlen;
+
+	ret = _hpcap_read_all(fd, block, sizeof(struct hpcap_stream_block));
+
+	if (ret == 0)
+		return 0;
+	else if (ret != sizeof(struct hpcap_stream_block))
+		goto truncated;
+
+	if (block->magic != HPCAP_STREAM_MAGIC || block->raw_len > HPCAP_STREAM_BLOCK || block->payload_len > HPCAP_STREAM_BLOCK
+			|| (!(block->flags & HPCAP_STREAM_ZLIB) && block->payload_len != block->raw_len)) {
+		printerr("Malformed block header (magic %08x, %u bytes, payload %u bytes)\n", block->magic, block->raw_len, block->payload_len);
+		errno = EPROTO;
+		return HPCAP_ERR;
+	}
+
+	ret = _hpcap_read_all(fd, (block->flags & HPCAP_STREAM_ZLIB) ? aux : raw, block->payload_len);
+
+	if (ret != block->payload_len)
+		goto truncated;
+
+	if (block->flags & HPCAP_STREAM_ZLIB) {
+		rawlen = block->raw_len;
+
+		if (uncompress(raw, &rawlen, aux, block->payload_len) != Z_OK || rawlen != block->raw_len) {
+			printerr("Block %" PRIu64 " does not uncompress to %u bytes\n", block->seq, block->raw_len);
+			errno = EPROTO;
+			return HPCAP_ERR;
+		}
+	}
+
+	return 1;
+
+truncated:
+
+	if (ret >= 0)
+		errno = EPIPE;
+
+	return HPCAP_ERR;
+}
+
+void hpcap_open_memory(struct hpcap_handle* handle, void* buf, size_t len)
+{
+	memset(handle, 0, sizeof(struct hpcap_handle));
+
+	handle->fd = -1;
+	handle->hugepage_fd = -1;
+	handle->buf = buf;
+	handle->bufSize = len;
+	handle->size = len;
+	handle->avail = len;
+}
+
 int hpcap_status_info(struct hpcap_handle* handle, struct hpcap_ioc_status_info* info)
 {
 	int ret = ioctl(handle->fd, HPCAP_IOC_STATUS_INFO, info);
@@ -325,6 +766,80 @@ int hpcap_status_info(struct hpcap_handle* handle, struct hpcap_ioc_status_info*
 	return ret < 0 ? HPCAP_ERR : HPCAP_OK;
 }
 
+int hpcap_rx_stats(struct hpcap_handle* handle, struct hpcap_stats_info* info, int enable)
+{
+	int ret;
+
+	info->enable = enable < 0 ? -1 : enable != 0;
+	ret = ioctl(handle->fd, HPCAP_IOC_STATS, info);
+
+	return ret < 0 ? HPCAP_ERR : HPCAP_OK;
+}
+
+int hpcap_burst_conf(struct hpcap_handle* handle, uint32_t bin_ns, uint32_t threshold)
+{
+	struct hpcap_burst_conf conf;
+	int ret;
+
+	conf.bin_ns = bin_ns;
+	conf.threshold = threshold;
+	ret = ioctl(handle->fd, HPCAP_IOC_BURST_CONF, &conf);
+
+	return ret < 0 ? HPCAP_ERR : HPCAP_OK;
+}
+
+int hpcap_burst_stats(struct hpcap_handle* handle, struct hpcap_burst_info* info)
+{
+	int ret = ioctl(handle->fd, HPCAP_IOC_BURST_STATS, info);
+
+	return ret < 0 ? HPCAP_ERR : HPCAP_OK;
+}
+
+int hpcap_burst_bins(struct hpcap_handle* handle, uint32_t consumer, uint64_t* from, uint32_t* bins, uint32_t count)
+{
+	struct hpcap_burst_bins_op op;
+
+	op.consumer = consumer;
+	op.count = count;
+	op.from = *from;
+	op.bins = bins;
+
+	if (ioctl(handle->fd, HPCAP_IOC_BURST_BINS, &op) < 0)
+		return -1;
+
+	*from = op.from;
+
+	return op.count;
+}
+
+int hpcap_latency_info(struct hpcap_handle* handle, struct hpcap_latency_info* info, int reset)
+{
+	int ret;
+
+	info->reset = reset != 0;
+	ret = ioctl(handle->fd, HPCAP_IOC_LATENCY, info);
+
+	return ret < 0 ? HPCAP_ERR : HPCAP_OK;
+}
+
+uint64_t hpcap_latency_percentile(const struct hpcap_latency_hist* hist, double fraction)
+{
+	uint64_t seen = 0;
+	size_t i;
+
+	if (hist->count == 0)
+		return 0;
+
+	for (i = 0; i < HPCAP_LATENCY_BUCKETS - 1; i++) {
+		seen += hist->counts[i];
+
+		if (seen >= fraction * hist->count)
+			break;
+	}
+
+	return hpcap_latency_bucket_low(i + 1) - 1;
+}
+
 size_t hpcap_ioc_listener_info_available_bytes(struct hpcap_ioc_status_info_listener* l)
 {
 	if (l->bufferRdOffset <= l->bufferWrOffset)
@@ -426,11 +941,28 @@ inline size_t copy_from_circ_buffer(const uint8_t* src, size_t src_offset, size_
 	return new_offset;
 }
 
+/**
+ * Add the counts of a loss record to the sum of the handle.
+ */
+static void _hpcap_add_loss(struct hpcap_loss_record* sum, const struct hpcap_loss_record* loss)
+{
+	if (sum->first_ns == 0 || loss->first_ns < sum->first_ns)
+		sum->first_ns = loss->first_ns;
+
+	if (loss->last_ns > sum->last_ns)
+		sum->last_ns = loss->last_ns;
+
+	sum->frames += loss->frames;
+	sum->bytes += loss->bytes;
+	sum->nic_frames += loss->nic_frames;
+}
+
 uint64_t hpcap_read_packet(struct hpcap_handle *handle, u_char **pbuffer, u_char *auxbuf, void *header, void (* read_header)(void *, u32, u32, u16, u16))
 {
 	u64 offs = handle->rdoff;
 	size_t acks = 0;
 	struct raw_header rawh;
+	struct hpcap_loss_record loss;
 	short has_padding;
 	size_t header_begin;
 
@@ -465,7 +997,13 @@ uint64_t hpcap_read_packet(struct hpcap_handle *handle, u_char **pbuffer, u_char
 			return 0;
 		}
 
-		if (rawh.sec == 0 && rawh.sec == 0) {
+		if (rawh.sec == 0) {
+			// Loss records are skipped as padding, adding their counts to the handle
+			if (hpcap_is_header_loss(&rawh) && rawh.caplen == sizeof(struct hpcap_loss_record)) {
+				copy_from_circ_buffer(handle->buf, offs, handle->bufSize, (uint8_t*) &loss, sizeof(struct hpcap_loss_record));
+				_hpcap_add_loss(&handle->loss, &loss);
+			}
+
 			has_padding = 1;
 			offs = (offs + rawh.caplen) % handle->bufSize;
 			acks += rawh.caplen;
@@ -566,10 +1104,17 @@ fin:
 }
 
 int hpcap_map_huge(struct hpcap_handle * handle, const char* hugetlbfs_path, size_t bufsize)
+{
+	return hpcap_map_huge_nodes(handle, hugetlbfs_path, bufsize, NULL, 1);
+}
+
+int hpcap_map_huge_nodes(struct hpcap_handle * handle, const char* hugetlbfs_path, size_t bufsize, const int* nodes, int num_files)
 {
 	char trailing_slash[2] = { 0, 0 };
+	char last_file[MAX_HUGETLB_FILE_LEN];
 	int pagefile_len;
 	struct hpcap_buffer_info bufinfo;
+	struct statfs fs;
 
 	if (handle->hugepage_addr != MAP_FAILED && handle->hugepage_addr != NULL && handle->hugepage_fd > 0) {
 		fprintf(stderr, "hpcap_map_huge: Hugepage already mapped\n");
@@ -578,6 +1123,17 @@ int hpcap_map_huge(struct hpcap_handle * handle, const char* hugetlbfs_path, siz
 
 	handle->hugepage_addr = MAP_FAILED;
 
+	if (num_files < 1) {
+		fprintf(stderr, "hpcap_map_huge: invalid number of files %d\n", num_files);
+		return HPCAP_ERR;
+	}
+
+	/* The block size of a hugetlbfs mount is the size of its pages (pagesize= option) */
+	if (statfs(hugetlbfs_path, &fs) != 0) {
+		fprintf(stderr, "hpcap_map_huge/statfs: %s: %s\n", hugetlbfs_path, strerror(errno));
+		return HPCAP_ERR;
+	}
+
 	if (hugetlbfs_path[strlen(hugetlbfs_path) - 1] != '/')
 		trailing_slash[0] = '/'; /* Ensure the path is slash-terminated */
 
@@ -585,21 +1141,24 @@ int hpcap_map_huge(struct hpcap_handle * handle, const char* hugetlbfs_path, siz
 	pagefile_len = snprintf(handle->hugepage_name, MAX_HUGETLB_FILE_LEN, "%s%shpcap%dq%d_buf",
 							hugetlbfs_path, trailing_slash, handle->adapter_idx, handle->queue_idx);
 
-	if (pagefile_len >= MAX_HUGETLB_FILE_LEN) {
+	if (pagefile_len >= MAX_HUGETLB_FILE_LEN || _hpcap_huge_file_name(last_file, handle->hugepage_name, num_files - 1) >= MAX_HUGETLB_FILE_LEN) {
 		fprintf(stderr, "hpcap_map_huge: hugetlbfs path too long\n");
 		return HPCAP_ERR;
 	}
 
+	memset(&bufinfo, 0, sizeof(bufinfo));
 	bufinfo.size = bufsize;
+	bufinfo.file_count = num_files;
+	bufinfo.page_size = fs.f_bsize;
 	strncpy(bufinfo.file_name, handle->hugepage_name, MAX_HUGETLB_FILE_LEN);
 
-	/* Create the file and get the pointer for the buffer */
-	if (_hpcap_mmap_hugetlb(handle, &bufinfo))
+	/* Create the files and get the pointer for the buffer */
+	if (_hpcap_mmap_hugetlb(handle, &bufinfo, nodes))
 		goto error;
 
 	bufinfo.addr = handle->hugepage_addr;
 
-	fprintf(stderr, "hpcap_map_huge: mapped buffer starts at %p\n", bufinfo.addr);
+	fprintf(stderr, "hpcap_map_huge: mapped buffer starts at %p (%d files, %zu KB pages)\n", bufinfo.addr, num_files, bufinfo.page_size >> 10);
 
 	/* Communicate the buffer to the HPCAP driver */
 	if (ioctl(handle->fd, HPCAP_IOC_HUGE_MAP, &bufinfo) < 0) {
@@ -607,10 +1166,14 @@ int hpcap_map_huge(struct hpcap_handle * handle, const char* hugetlbfs_path, siz
 		goto error;
 	}
 
+	if (!bufinfo.direct_map)
+		fprintf(stderr, "hpcap_map_huge: the hugepages are not physically contiguous, the driver maps them with 4 KB pages\n");
+
 	return HPCAP_OK;
 
 error:
 	/* Undo everything without notifying the driver. */
+	_hpcap_unlink_huge(handle->hugepage_name, num_files);
 	hpcap_unmap_huge(handle, 0);
 
 	return HPCAP_ERR;
@@ -636,8 +1199,8 @@ int hpcap_unmap_huge(struct hpcap_handle * handle, short notify_driver)
 		perror("ioctl");
 
 	if (retval == 0 && bufinfo.has_hugepages) {
-		unlink(bufinfo.file_name);
-		fprintf(stderr, "hpcap_unmap_huge: released hugetlb file (%s)\n", handle->hugepage_name);
+		_hpcap_unlink_huge(bufinfo.file_name, bufinfo.file_count);
+		fprintf(stderr, "hpcap_unmap_huge: released hugetlb file (%s, %d files)\n", bufinfo.file_name, bufinfo.file_count);
 		handle->hugepage_fd = -1;
 	}
 
@@ -656,6 +1219,11 @@ inline short hpcap_is_header_padding(struct raw_header* header)
 	return header->nsec == 0 && header->sec == 0;
 }
 
+inline short hpcap_is_header_loss(struct raw_header* header)
+{
+	return header->sec == 0 && header->nsec == HPCAP_LOSS_NSEC;
+}
+
 short _hpcap_read_next(struct hpcap_handle* handle, struct raw_header** rawh, uint8_t** frame, uint8_t* for_copy)
 {
 	size_t copy_buffer_offset = 0;
@@ -91,7 +91,7 @@ int mgmon_packet_online_loop(int cpu, int ifindex, int qindex, packet_handler ca
 }
 
 
-static int open_multicast_rx_socket(int mode, int ifindex, int qindex)
+int open_multicast_rx_socket(int mode, int ifindex, int qindex)
 {
 	char mcastgroup[20];
 	struct hostent *h;
@@ -100,6 +100,7 @@ static int open_multicast_rx_socket(int mode, int ifindex, int qindex)
 	int sd;
 	struct ip_mreq mreq;
 	struct timeval tv;
+	int size = 2129920, reuse = 1;
 
 	sprintf(mcastgroup, "%d.%d.%d.%d", MCAST_BASE, mode, ifindex, qindex);
 	h = gethostbyname(mcastgroup);
@@ -117,9 +118,13 @@ static int open_multicast_rx_socket(int mode, int ifindex, int qindex)
 		return 0;
 	}
 
+	// Several receivers of the same group can run in the same host
+	setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	/* Bound to the group: a socket bound to the address of the interface
+	 * does not receive the datagrams sent to the group. */
 	servAddr.sin_family = AF_INET;
-	//servAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-	servAddr.sin_addr.s_addr = inet_addr(BIND_IFACE_IP);
+	servAddr.sin_addr.s_addr = mcastAddr.s_addr;
 	servAddr.sin_port = htons(MCAST_PORT);
 
 	if (bind(sd, (struct sockaddr *) &servAddr, sizeof(servAddr)) < 0) {
@@ -128,14 +133,18 @@ static int open_multicast_rx_socket(int mode, int ifindex, int qindex)
 	}
 
 	mreq.imr_multiaddr.s_addr = mcastAddr.s_addr;
-	mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+	mreq.imr_interface.s_addr = inet_addr(BIND_IFACE_IP);
 
-	//mreq.imr_interface.s_addr = inet_addr(BIND_IFACE_IP);
 	if (setsockopt(sd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (void *) &mreq, sizeof(mreq)) < 0) {
 		printf("[MgMON] Error when joining multicast group %s\n", inet_ntoa(mcastAddr));
 		return 0;
 	}
 
+	if (setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) != 0) {
+		printf("[MgMON] Error when setting socket's RX buffer\n");
+		return 0;
+	}
+
 	tv.tv_sec = 1;
 	tv.tv_usec = 0;
 
@@ -155,6 +164,7 @@ int open_multicast_tx_socket(int mode, int ifindex, int qindex, struct sockaddr_
 	int sd;
 	unsigned char ttl = MCAST_TTL;
 	int size = 2129920;
+	struct in_addr iface;
 
 	sprintf(mcastgroup, "%d.%d.%d.%d", MCAST_BASE, mode, ifindex, qindex);
 	h = gethostbyname(mcastgroup);
@@ -190,6 +200,14 @@ int open_multicast_tx_socket(int mode, int ifindex, int qindex, struct sockaddr_
 		return 0;
 	}
 
+	// Send through the same interface the receivers join the group on
+	iface.s_addr = inet_addr(BIND_IFACE_IP);
+
+	if (setsockopt(sd, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface)) < 0) {
+		printf("[MgMON] Error when setting socket's multicast interface\n");
+		return 0;
+	}
+
 	if (setsockopt(sd, SOL_SOCKET, SO_SNDBUF, (char*)&size, sizeof(size)) != 0) {
 		printf("[MgMON] Error when setting socket's TX buffer\n");
 		return 0;
@@ -199,14 +217,191 @@ int open_multicast_tx_socket(int mode, int ifindex, int qindex, struct sockaddr_
 }
 
 
-int mgmon_flow_online_loop(int cpu, int ifindex, int qindex, flow_handler callback, void *arg)
+static int mgmon_transport = MGMON_TRANSPORT_MCAST;
+
+void mgmon_set_transport(int transport)
+{
+	mgmon_transport = transport;
+}
+
+int mgmon_get_transport(void)
+{
+	return mgmon_transport;
+}
+
+#define CHANNEL_TIMEOUT 1000000000ULL	/**< Same as the timeout of the multicast sockets */
+
+/**
+ * Receiving end of a channel, through its multicast group or its shared memory
+ * ring, depending on the transport.
+ */
+struct channel_rx {
+	int sd;
+	struct mgmon_rx_batch *rx;
+	struct mgmon_shm *shm;
+	size_t batch;
+};
+
+typedef void (*channel_handler)(const uint8_t *buf, size_t len, void *arg);
+
+static int channel_open_rx(struct channel_rx *ch, int mode, int ifindex, int qindex, size_t batch, size_t dgram_size)
+{
+	memset(ch, 0, sizeof(struct channel_rx));
+	ch->batch = batch ? batch : MGMON_DEFAULT_BATCH;
+
+	if (mgmon_transport == MGMON_TRANSPORT_SHM) {
+		ch->shm = mgmon_shm_open(mode, ifindex, qindex, 0);
+
+		if (ch->shm == NULL)
+			return -1;
+
+		if (mgmon_shm_attach(ch->shm) < 0) {
+			mgmon_shm_close(ch->shm);
+			return -1;
+		}
+
+		return 0;
+	}
+
+	ch->sd = open_multicast_rx_socket(mode, ifindex, qindex);
+
+	if (ch->sd == 0)
+		return -1;
+
+	ch->rx = mgmon_rx_batch_create(ch->sd, ch->batch, dgram_size);
+
+	if (ch->rx == NULL) {
+		close(ch->sd);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void channel_close_rx(struct channel_rx *ch)
+{
+	if (ch->shm) {
+		mgmon_shm_close(ch->shm);
+		return;
+	}
+
+	mgmon_rx_batch_destroy(ch->rx);
+	close(ch->sd);
+}
+
+/**
+ * Waits up to CHANNEL_TIMEOUT for a message and passes it, and the ones
+ * already available up to the size of the batch, to the handler.
+ * @return Messages received, -1 on error.
+ */
+static int channel_receive(struct channel_rx *ch, channel_handler handler, void *arg)
+{
+	const uint8_t *buf;
+	size_t len, i;
+	int n;
+
+	if (ch->shm) {
+		for (i = 0; i < ch->batch; i++) {
+			buf = mgmon_shm_next(ch->shm, i == 0 ? CHANNEL_TIMEOUT : 0, &len);
+
+			if (buf == NULL)
+				break;
+
+			handler(buf, len, arg);
+		}
+
+		return i;
+	}
+
+	n = mgmon_rx_batch_recv(ch->rx, 1);
+
+	for (i = 0; n > 0 && i < (size_t) n; i++) {
+		buf = mgmon_rx_batch_datagram(ch->rx, i, &len);
+
+		if (buf != NULL)
+			handler(buf, len, arg);
+	}
+
+	return n;
+}
+
+#define FLOW_VECTOR 256	/**< Records passed at most in a call to a flow_vector_handler */
+
+struct flow_vector {
+	IPFlow records[FLOW_VECTOR];
+	size_t count;
+	flow_vector_handler callback;
+	void *arg;
+
+	// Sequence of the compact datagrams, to report the lost ones
+	uint32_t expected;
+	short synced;
+	int ifindex;
+	int qindex;
+};
+
+static void flow_vector_dispatch(struct flow_vector *v)
+{
+	if (v->count > 0 && v->callback)
+		v->callback(v->records, v->count, v->arg);
+
+	v->count = 0;
+}
+
+static void flow_vector_add(IPFlow *record, void *arg)
+{
+	struct flow_vector *v = arg;
+
+	if (v->count == FLOW_VECTOR)
+		flow_vector_dispatch(v);
+
+	memcpy(&v->records[v->count], record, sizeof(IPFlow));
+	v->records[v->count].payload_ptr = v->records[v->count].payload;
+	v->count++;
+}
+
+static void flow_vector_datagram(const uint8_t *buf, size_t len, void *arg)
+{
+	struct flow_vector *v = arg;
+	uint32_t seq;
+
+	if (mgmon_flowrec_parse(buf, len, &seq, flow_vector_add, v) >= 0) {
+		if (v->synced && seq != v->expected)
+			printf("[MgMON] Lost %u flow datagrams from hpcap%dq%d\n", seq - v->expected, v->ifindex, v->qindex);
+
+		v->expected = seq + 1;
+		v->synced = 1;
+	} else if (len == sizeof(IPFlow)) {
+		// Raw IPFlow, as sent by older versions
+		flow_vector_add((IPFlow *) buf, v);
+	}
+}
+
+/**
+ * Adapts a flow_handler to a flow_vector_handler.
+ */
+struct flow_single {
+	flow_handler callback;
+	void *arg;
+};
+
+static void flow_single_dispatch(IPFlow *records, size_t count, void *arg)
+{
+	struct flow_single *s = arg;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		s->callback(&records[i], s->arg);
+}
+
+int mgmon_flow_online_loop_batch(int cpu, int ifindex, int qindex, size_t batch, flow_vector_handler callback, void *arg)
 {
 	pthread_t tid, sigtid;
 	cpu_set_t mask;
 	mgmon_signal ms;
-	int ret, sd;
-	int n;
-	IPFlow record;
+	int ret;
+	struct channel_rx ch;
+	struct flow_vector *vec;
 
 	tid = pthread_self();
 
@@ -219,10 +414,27 @@ int mgmon_flow_online_loop(int cpu, int ifindex, int qindex, flow_handler callba
 		return -1;
 	}
 
-	sd = open_multicast_rx_socket(MCAST_FLOW, ifindex, qindex);
+	// Raw IPFlow datagrams are smaller than the compact ones
+	if (channel_open_rx(&ch, MCAST_FLOW, ifindex, qindex, batch, maximo(MGMON_FLOWREC_DATAGRAM, sizeof(IPFlow))) < 0) {
+		printf("[MgMON] Cannot open the flow channel of hpcap%dq%d\n", ifindex, qindex);
+		return -1;
+	}
 
-	if (sd == 0)
+	vec = malloc(sizeof(struct flow_vector));
+
+	if (vec == NULL) {
+		printf("[MgMON] Cannot allocate the flow reception buffers\n");
+		channel_close_rx(&ch);
 		return -1;
+	}
+
+	vec->count = 0;
+	vec->callback = callback;
+	vec->arg = arg;
+	vec->expected = 0;
+	vec->synced = 0;
+	vec->ifindex = ifindex;
+	vec->qindex = qindex;
 
 	ms.stop = 0;
 	sigemptyset(&ms.signal_mask);
@@ -238,31 +450,71 @@ int mgmon_flow_online_loop(int cpu, int ifindex, int qindex, flow_handler callba
 	pthread_setaffinity_np(sigtid, sizeof(cpu_set_t), &mask);
 
 	while (!ms.stop) {
-		n = recvfrom(sd, &record, sizeof(IPFlow), 0, NULL, 0);
-		printf("Flow loop: %d bytes recibidos\n", n);
+		if (channel_receive(&ch, flow_vector_datagram, vec) < 0)
+			break;
 
-		if (n == sizeof(IPFlow)) {
-			if (callback)
-				callback(&record, arg);
-		}
+		flow_vector_dispatch(vec);
 	}
 
 	printf("[MgMON] stopping live flow capture for hpcap%dq%d\n", ifindex, qindex);
 
-	close(sd);
+	channel_close_rx(&ch);
+	free(vec);
 
 	return 0;
 }
 
+int mgmon_flow_online_loop(int cpu, int ifindex, int qindex, flow_handler callback, void *arg)
+{
+	struct flow_single s;
+
+	s.callback = callback;
+	s.arg = arg;
+
+	return mgmon_flow_online_loop_batch(cpu, ifindex, qindex, 0, callback ? flow_single_dispatch : NULL, &s);
+}
+
+/**
+ * Adapts a mrtg_handler to a mrtg_vector_handler.
+ */
+struct mrtg_single {
+	mrtg_handler callback;
+	void *arg;
+};
 
-int mgmon_mrtg_online_loop(int cpu, int ifindex, int qindex, mrtg_handler callback, void *arg)
+static void mrtg_single_dispatch(mrtg *stats, size_t count, void *arg)
+{
+	struct mrtg_single *s = arg;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		s->callback(&stats[i], s->arg);
+}
+
+struct mrtg_vector {
+	mrtg *stats;
+	size_t count;
+};
+
+static void mrtg_vector_datagram(const uint8_t *buf, size_t len, void *arg)
+{
+	struct mrtg_vector *v = arg;
+
+	if (len == sizeof(mrtg))
+		memcpy(&v->stats[v->count++], buf, sizeof(mrtg));
+}
+
+int mgmon_mrtg_online_loop_batch(int cpu, int ifindex, int qindex, size_t batch, mrtg_vector_handler callback, void *arg)
 {
 	pthread_t tid, sigtid;
 	cpu_set_t mask;
 	mgmon_signal ms;
-	int ret, sd;
-	int n;
-	mrtg stat;
+	int ret;
+	struct channel_rx ch;
+	struct mrtg_vector vec;
+
+	if (batch == 0)
+		batch = MGMON_DEFAULT_BATCH;
 
 	tid = pthread_self();
 
@@ -275,10 +527,18 @@ int mgmon_mrtg_online_loop(int cpu, int ifindex, int qindex, mrtg_handler callba
 		return -1;
 	}
 
-	sd = open_multicast_rx_socket(MCAST_MRTG, ifindex, qindex);
+	if (channel_open_rx(&ch, MCAST_MRTG, ifindex, qindex, batch, sizeof(mrtg)) < 0) {
+		printf("[MgMON] Cannot open the MRTG channel of hpcap%dq%d\n", ifindex, qindex);
+		return -1;
+	}
 
-	if (sd == 0)
+	vec.stats = malloc(batch * sizeof(mrtg));
+
+	if (vec.stats == NULL) {
+		printf("[MgMON] Cannot allocate the MRTG reception buffers\n");
+		channel_close_rx(&ch);
 		return -1;
+	}
 
 	ms.stop = 0;
 	sigemptyset(&ms.signal_mask);
@@ -294,17 +554,29 @@ int mgmon_mrtg_online_loop(int cpu, int ifindex, int qindex, mrtg_handler callba
 	pthread_setaffinity_np(sigtid, sizeof(cpu_set_t), &mask);
 
 	while (!ms.stop) {
-		n = recvfrom(sd, &stat, sizeof(mrtg), 0, NULL, 0);
+		vec.count = 0;
 
-		if (n == sizeof(mrtg)) {
-			if (callback)
-				callback(&stat, arg);
-		}
+		if (channel_receive(&ch, mrtg_vector_datagram, &vec) < 0)
+			break;
+
+		if (vec.count > 0 && callback)
+			callback(vec.stats, vec.count, arg);
 	}
 
 	printf("[MgMON] stopping live MRTG capture for hpcap%dq%d\n", ifindex, qindex);
 
-	close(sd);
+	channel_close_rx(&ch);
+	free(vec.stats);
 
 	return 0;
 }
+
+int mgmon_mrtg_online_loop(int cpu, int ifindex, int qindex, mrtg_handler callback, void *arg)
+{
+	struct mrtg_single s;
+
+	s.callback = callback;
+	s.arg = arg;
+
+	return mgmon_mrtg_online_loop_batch(cpu, ifindex, qindex, 0, callback ? mrtg_single_dispatch : NULL, &s);
+}
@@ -0,0 +1,261 @@
+/**
+ * @brief Batched datagram I/O for the libmgmon channels.
+ *
+ * Datagrams are queued in a pool of buffers and sent with one sendmmsg call
+ * per batch, and received with one recvmmsg call per batch, so the cost of
+ * the system calls is shared by all the datagrams of the batch.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include <hpcap.h>
+
+#include "libmgmon.h"
+
+struct mgmon_tx_batch {
+	int sd;
+	struct sockaddr_in dst;
+	size_t batch;
+	size_t dgram_size;
+	size_t count;		/**< Datagrams queued */
+	uint8_t *pool;		/**< batch buffers of dgram_size bytes */
+	struct mmsghdr *msgs;
+	struct iovec *iovs;
+	struct mgmon_batch_stats stats;
+};
+
+struct mgmon_rx_batch {
+	int sd;
+	size_t batch;
+	size_t dgram_size;
+	size_t count;		/**< Datagrams received by the last call */
+	uint8_t *pool;
+	struct mmsghdr *msgs;
+	struct iovec *iovs;
+	struct mgmon_batch_stats stats;
+};
+
+/**
+ * Allocates the buffer pool and the message vectors shared by both sides.
+ */
+static int batch_alloc(size_t batch, size_t dgram_size, uint8_t **pool, struct mmsghdr **msgs, struct iovec **iovs)
+{
+	size_t i;
+
+	*pool = malloc(batch * dgram_size);
+	*msgs = calloc(batch, sizeof(struct mmsghdr));
+	*iovs = calloc(batch, sizeof(struct iovec));
+
+	if (*pool == NULL || *msgs == NULL || *iovs == NULL) {
+		printf("[MgMON] Cannot allocate a batch of %zu datagrams of %zu bytes\n", batch, dgram_size);
+		free(*pool);
+		free(*msgs);
+		free(*iovs);
+		return -1;
+	}
+
+	for (i = 0; i < batch; i++) {
+		(*iovs)[i].iov_base = *pool + i * dgram_size;
+		(*iovs)[i].iov_len = dgram_size;
+		(*msgs)[i].msg_hdr.msg_iov = &(*iovs)[i];
+		(*msgs)[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	return 0;
+}
+
+struct mgmon_tx_batch *mgmon_tx_batch_create(int sd, const struct sockaddr_in *dst, size_t batch, size_t dgram_size)
+{
+	struct mgmon_tx_batch *b;
+	size_t i;
+
+	if (batch == 0)
+		batch = MGMON_DEFAULT_BATCH;
+
+	b = calloc(1, sizeof(struct mgmon_tx_batch));
+
+	if (b == NULL)
+		return NULL;
+
+	if (batch_alloc(batch, dgram_size, &b->pool, &b->msgs, &b->iovs) < 0) {
+		free(b);
+		return NULL;
+	}
+
+	b->sd = sd;
+	b->dst = *dst;
+	b->batch = batch;
+	b->dgram_size = dgram_size;
+
+	for (i = 0; i < batch; i++) {
+		b->msgs[i].msg_hdr.msg_name = &b->dst;
+		b->msgs[i].msg_hdr.msg_namelen = sizeof(b->dst);
+	}
+
+	return b;
+}
+
+void mgmon_tx_batch_destroy(struct mgmon_tx_batch *b)
+{
+	if (b == NULL)
+		return;
+
+	mgmon_tx_batch_flush(b);
+
+	free(b->pool);
+	free(b->msgs);
+	free(b->iovs);
+	free(b);
+}
+
+uint8_t *mgmon_tx_batch_buffer(struct mgmon_tx_batch *b)
+{
+	if (b->count == b->batch)
+		mgmon_tx_batch_flush(b);
+
+	return b->pool + b->count * b->dgram_size;
+}
+
+int mgmon_tx_batch_commit(struct mgmon_tx_batch *b, size_t len)
+{
+	if (len > b->dgram_size)
+		return -1;
+
+	b->iovs[b->count].iov_len = len;
+	b->count++;
+
+	if (b->count == b->batch)
+		return mgmon_tx_batch_flush(b);
+
+	return 0;
+}
+
+int mgmon_tx_batch_send(struct mgmon_tx_batch *b, const void *data, size_t len)
+{
+	if (len > b->dgram_size)
+		return -1;
+
+	memcpy(mgmon_tx_batch_buffer(b), data, len);
+
+	return mgmon_tx_batch_commit(b, len);
+}
+
+int mgmon_tx_batch_flush(struct mgmon_tx_batch *b)
+{
+	size_t sent = 0;
+	int ret;
+
+	while (sent < b->count) {
+		ret = sendmmsg(b->sd, b->msgs + sent, b->count - sent, 0);
+		b->stats.calls++;
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			perror("[MgMON] Error when sending datagrams");
+			b->stats.dropped += b->count - sent;
+			break;
+		}
+
+		sent += ret;
+	}
+
+	b->stats.datagrams += sent;
+	b->count = 0;
+
+	return sent;
+}
+
+void mgmon_tx_batch_get_stats(struct mgmon_tx_batch *b, struct mgmon_batch_stats *stats)
+{
+	*stats = b->stats;
+}
+
+struct mgmon_rx_batch *mgmon_rx_batch_create(int sd, size_t batch, size_t dgram_size)
+{
+	struct mgmon_rx_batch *b;
+
+	if (batch == 0)
+		batch = MGMON_DEFAULT_BATCH;
+
+	b = calloc(1, sizeof(struct mgmon_rx_batch));
+
+	if (b == NULL)
+		return NULL;
+
+	if (batch_alloc(batch, dgram_size, &b->pool, &b->msgs, &b->iovs) < 0) {
+		free(b);
+		return NULL;
+	}
+
+	b->sd = sd;
+	b->batch = batch;
+	b->dgram_size = dgram_size;
+
+	return b;
+}
+
+void mgmon_rx_batch_destroy(struct mgmon_rx_batch *b)
+{
+	if (b == NULL)
+		return;
+
+	free(b->pool);
+	free(b->msgs);
+	free(b->iovs);
+	free(b);
+}
+
+int mgmon_rx_batch_recv(struct mgmon_rx_batch *b, short wait)
+{
+	size_t i;
+	int ret;
+
+	for (i = 0; i < b->batch; i++) {
+		b->iovs[i].iov_len = b->dgram_size;
+		b->msgs[i].msg_hdr.msg_flags = 0;
+	}
+
+	b->count = 0;
+	ret = recvmmsg(b->sd, b->msgs, b->batch, wait ? MSG_WAITFORONE : MSG_DONTWAIT, NULL);
+	b->stats.calls++;
+
+	if (ret < 0) {
+		// Timeout of the socket, signal or nothing to read
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return 0;
+
+		perror("[MgMON] Error when receiving datagrams");
+		return -1;
+	}
+
+	b->count = ret;
+	b->stats.datagrams += ret;
+
+	return ret;
+}
+
+const uint8_t *mgmon_rx_batch_datagram(struct mgmon_rx_batch *b, size_t i, size_t *len)
+{
+	if (i >= b->count)
+		return NULL;
+
+	// Datagrams bigger than the buffers are dropped
+	if (b->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+		b->stats.dropped++;
+		*len = 0;
+		return NULL;
+	}
+
+	*len = b->msgs[i].msg_len;
+
+	return b->pool + i * b->dgram_size;
+}
+
+void mgmon_rx_batch_get_stats(struct mgmon_rx_batch *b, struct mgmon_batch_stats *stats)
+{
+	*stats = b->stats;
+}
@@ -0,0 +1,674 @@
+/**
+ * @brief Compact wire format for IPFlow records.
+ *
+ * Datagram:
+ *
+ *     0  magic (MGMON_FLOWREC_MAGIC, big endian)
+ *     2  version (MGMON_FLOWREC_VERSION)
+ *     3  flags (0)
+ *     4  number of records (big endian)
+ *     6  sequence number of the datagram (big endian)
+ *     10 records
+ *
+ * Record: its length as a varint, followed by fields. Every field starts with
+ * a key byte, (id << 2) | type, where type is one of:
+ *
+ *     0 varint (LEB128, 7 bits per byte, least significant first)
+ *     1 64 bit little endian (doubles)
+ *     2 varint length followed by that many bytes
+ *     3 32 bit, copied as is (IPv4 addresses, in network byte order)
+ *
+ * Fields equal to zero are not sent, and decoders skip the ids they do not
+ * know, so fields can be added without changing the version. Statistics that
+ * can be derived from other fields (averages and standard deviations, the
+ * last timestamp) are not sent either. Inter-arrival times are sent as
+ * varints when they are whole numbers of nanoseconds, which is the usual
+ * case, and as doubles otherwise.
+ *
+ * Sections (type 2):
+ *  - Flags: bitmap of the non zero counters of num_flags, and a varint for
+ *    each of them.
+ *  - Samples: number of samples, and for each one the difference with the
+ *    previous timestamp (zigzag varint, the first one relative to the first
+ *    timestamp of the flow) and the size.
+ *  - Payload: npack_payload, the offset of each payload sample and the
+ *    payload bytes without the trailing zeros.
+ *
+ * Decoding an encoded record gives back the same IPFlow, except for the
+ * sections that were not requested, which are left as zeros.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <endian.h>
+
+#include <hpcap.h>
+
+#include "libmgmon.h"
+
+#define FLOWREC_MAX_RECORD 1024	/**< Upper bound of the size of an encoded record */
+
+#define WIRE_VARINT 0
+#define WIRE_F64 1
+#define WIRE_BYTES 2
+#define WIRE_F32 3
+
+#define KEY(id, type) (((id) << 2) | (type))
+
+enum flowrec_field {
+	FR_SRC_IP = 1,
+	FR_DST_IP,
+	FR_SRC_PORT,
+	FR_DST_PORT,
+	FR_PROTO,
+	FR_NPACK,
+	FR_NBYTES,
+	FR_NBYTES_SQR,
+	FR_MIN_SIZE,
+	FR_MAX_SIZE,
+	FR_FIRST_TS,
+	FR_DURATION,
+	FR_PREV_TS,		/**< Last timestamp - previous_timestamp */
+	FR_MIN_IAT,
+	FR_MAX_IAT,
+	FR_SUM_IAT,
+	FR_SUM_IAT_SQR,
+	FR_RTT_SYN,
+	FR_STATE,		/**< FR_ST_* bits */
+	FR_TCP_FLAGS,
+	FR_NUM_FLAGS,
+	FR_NWINDOW_ZERO,
+	FR_CUR_SEQ,
+	FR_PREV_SEQ,
+	FR_DATA_LEN,
+	FR_OFFSET,
+	FR_IP_ID,
+	FR_SRC_MAC,
+	FR_DST_MAC,
+	FR_SAMPLES,
+	FR_PAYLOAD,
+};
+
+#define FR_ST_RTT_DONE 0x01
+#define FR_ST_FIN 0x02
+#define FR_ST_ACK_NULO 0x04
+#define FR_ST_FRAG 0x08
+#define FR_ST_BY_FLAGS 0x10
+
+static inline uint8_t *put_varint(uint8_t *p, uint64_t v)
+{
+	while (v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+
+	*p++ = v;
+
+	return p;
+}
+
+static inline uint8_t *put_uint(uint8_t *p, unsigned int id, uint64_t v)
+{
+	if (v == 0)
+		return p;
+
+	*p++ = KEY(id, WIRE_VARINT);
+
+	return put_varint(p, v);
+}
+
+static inline uint8_t *put_double(uint8_t *p, unsigned int id, double v)
+{
+	uint64_t bits;
+
+	if (v == 0)
+		return p;
+
+	if (v > 0 && v < 9007199254740992.0 && v == (double)(uint64_t) v)
+		return put_uint(p, id, (uint64_t) v);
+
+	*p++ = KEY(id, WIRE_F64);
+	memcpy(&bits, &v, 8);
+	bits = htole64(bits);
+	memcpy(p, &bits, 8);
+
+	return p + 8;
+}
+
+static inline uint64_t zigzag(int64_t v)
+{
+	return ((uint64_t) v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/**
+ * Opens a section. Sections are shorter than 16 KB, so their length is
+ * written as a 2 byte varint once the section is complete.
+ */
+static inline uint8_t *section_start(uint8_t *p, unsigned int id)
+{
+	*p = KEY(id, WIRE_BYTES);
+
+	return p + 3;
+}
+
+static inline uint8_t *section_end(uint8_t *start, uint8_t *p)
+{
+	size_t len = p - (start + 3);
+
+	start[1] = (len & 0x7F) | 0x80;
+	start[2] = len >> 7;
+
+	return p;
+}
+
+static uint8_t *flowrec_put(const IPFlow *rec, int sections, uint8_t *p)
+{
+	uint64_t last = rec->lastpacket_timestamp, prev;
+	uint8_t *sec, mask = 0, st = 0;
+	int i, j, n;
+
+	*p++ = KEY(FR_SRC_IP, WIRE_F32);
+	memcpy(p, &rec->source_ip, 4);
+	p += 4;
+	*p++ = KEY(FR_DST_IP, WIRE_F32);
+	memcpy(p, &rec->destination_ip, 4);
+	p += 4;
+
+	p = put_uint(p, FR_SRC_PORT, rec->source_port);
+	p = put_uint(p, FR_DST_PORT, rec->destination_port);
+	p = put_uint(p, FR_PROTO, rec->transport_protocol);
+	p = put_uint(p, FR_NPACK, rec->npack);
+	p = put_uint(p, FR_NBYTES, rec->nbytes);
+	p = put_uint(p, FR_NBYTES_SQR, rec->nbytes_sqr);
+	p = put_uint(p, FR_MIN_SIZE, rec->min_pack_size);
+	p = put_uint(p, FR_MAX_SIZE, rec->max_pack_size);
+	p = put_uint(p, FR_FIRST_TS, rec->firstpacket_timestamp);
+	p = put_uint(p, FR_DURATION, last - rec->firstpacket_timestamp);
+	p = put_uint(p, FR_PREV_TS, last - rec->previous_timestamp);
+	p = put_double(p, FR_MIN_IAT, rec->min_int_time);
+	p = put_double(p, FR_MAX_IAT, rec->max_int_time);
+	p = put_double(p, FR_SUM_IAT, rec->sum_int_time);
+	p = put_double(p, FR_SUM_IAT_SQR, rec->sum_int_time_sqr);
+	p = put_uint(p, FR_RTT_SYN, rec->rtt_syn);
+
+	st |= rec->rtt_syn_done ? FR_ST_RTT_DONE : 0;
+	st |= rec->flag_FIN ? FR_ST_FIN : 0;
+	st |= rec->flag_ACK_nulo ? FR_ST_ACK_NULO : 0;
+	st |= rec->frag_flag ? FR_ST_FRAG : 0;
+	st |= rec->expired_by_flags ? FR_ST_BY_FLAGS : 0;
+	p = put_uint(p, FR_STATE, st);
+	p = put_uint(p, FR_TCP_FLAGS, rec->flags);
+
+	for (i = 0; i < 8; i++)
+		mask |= rec->num_flags[i] ? 1 << i : 0;
+
+	if (mask) {
+		sec = p;
+		p = section_start(p, FR_NUM_FLAGS);
+		*p++ = mask;
+
+		for (i = 0; i < 8; i++) {
+			if (rec->num_flags[i])
+				p = put_varint(p, rec->num_flags[i]);
+		}
+
+		p = section_end(sec, p);
+	}
+
+	p = put_uint(p, FR_NWINDOW_ZERO, rec->nwindow_zero);
+	p = put_uint(p, FR_CUR_SEQ, rec->current_seq_number);
+	p = put_uint(p, FR_PREV_SEQ, rec->previous_seq_number);
+	p = put_uint(p, FR_DATA_LEN, rec->dataLen);
+	p = put_uint(p, FR_OFFSET, rec->offset);
+	p = put_uint(p, FR_IP_ID, rec->ip_id);
+	p = put_uint(p, FR_SRC_MAC, rec->source_mac);
+	p = put_uint(p, FR_DST_MAC, rec->destination_mac);
+
+	if (sections & MGMON_FLOWREC_SAMPLES) {
+		for (n = MAX_PACK; n > 0 && rec->timestamp[n - 1] == 0 && rec->size[n - 1] == 0; n--)
+			;
+
+		if (n > 0) {
+			sec = p;
+			p = section_start(p, FR_SAMPLES);
+			p = put_varint(p, n);
+			prev = rec->firstpacket_timestamp;
+
+			for (i = 0; i < n; i++) {
+				p = put_varint(p, zigzag(rec->timestamp[i] - prev));
+				p = put_varint(p, rec->size[i]);
+				prev = rec->timestamp[i];
+			}
+
+			p = section_end(sec, p);
+		}
+	}
+
+	if (sections & MGMON_FLOWREC_PAYLOAD) {
+		n = minimo(rec->npack_payload, MAX_PACK);
+
+		for (i = MAX_PAYLOAD; i > 0 && rec->payload[i - 1] == 0; i--)
+			;
+
+		if (n > 0 || i > 0) {
+			sec = p;
+			p = section_start(p, FR_PAYLOAD);
+			p = put_varint(p, n);
+
+			for (j = 0; j < n; j++)
+				p = put_varint(p, rec->packet_offset[j]);
+
+			memcpy(p, rec->payload, i);
+			p = section_end(sec, p + i);
+		}
+	}
+
+	return p;
+}
+
+size_t mgmon_flowrec_encode(const IPFlow *rec, int sections, uint8_t *buf, size_t size)
+{
+	uint8_t tmp[FLOWREC_MAX_RECORD], *start, *end;
+	size_t len;
+
+	// Encode in place if there is room for any record, leaving 2 bytes for the length
+	start = size >= FLOWREC_MAX_RECORD ? buf : tmp;
+	end = flowrec_put(rec, sections, start + 2);
+	len = end - (start + 2);
+
+	if (len + 2 > size)
+		return 0;
+
+	start[0] = (len & 0x7F) | 0x80;
+	start[1] = len >> 7;
+
+	if (start == tmp)
+		memcpy(buf, tmp, len + 2);
+
+	return len + 2;
+}
+
+static inline int get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+	unsigned int shift;
+	uint8_t b;
+
+	*v = 0;
+
+	for (shift = 0; shift < 64; shift += 7) {
+		if (*p >= end)
+			return -1;
+
+		b = *(*p)++;
+		*v |= (uint64_t)(b & 0x7F) << shift;
+
+		if (!(b & 0x80))
+			return 0;
+	}
+
+	return -1;
+}
+
+static inline double get_double(int type, uint64_t v)
+{
+	double d;
+
+	if (type == WIRE_VARINT)
+		return (double) v;
+
+	memcpy(&d, &v, 8);
+
+	return d;
+}
+
+static int flowrec_get_samples(IPFlow *rec, const uint8_t *p, const uint8_t *end)
+{
+	uint64_t n, v, ts = rec->firstpacket_timestamp;
+	size_t i;
+
+	if (get_varint(&p, end, &n) || n > MAX_PACK)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		if (get_varint(&p, end, &v))
+			return -1;
+
+		ts += unzigzag(v);
+		rec->timestamp[i] = ts;
+
+		if (get_varint(&p, end, &v))
+			return -1;
+
+		rec->size[i] = v;
+	}
+
+	return 0;
+}
+
+static int flowrec_get_payload(IPFlow *rec, const uint8_t *p, const uint8_t *end)
+{
+	uint64_t n, v;
+	size_t i;
+
+	if (get_varint(&p, end, &n) || n > MAX_PACK)
+		return -1;
+
+	rec->npack_payload = n;
+
+	for (i = 0; i < n; i++) {
+		if (get_varint(&p, end, &v))
+			return -1;
+
+		rec->packet_offset[i] = v;
+	}
+
+	if (end - p > MAX_PAYLOAD)
+		return -1;
+
+	memcpy(rec->payload, p, end - p);
+
+	return 0;
+}
+
+int mgmon_flowrec_decode(const uint8_t *buf, size_t size, IPFlow *rec)
+{
+	const uint8_t *p = buf, *end, *sec;
+	uint64_t len, v = 0, duration = 0, prev = 0;
+	uint32_t v32 = 0;
+	unsigned int id, type, i;
+	uint8_t mask;
+
+	if (get_varint(&p, buf + size, &len) || len > (uint64_t)(buf + size - p))
+		return -1;
+
+	end = p + len;
+	memset(rec, 0, sizeof(IPFlow));
+
+	while (p < end) {
+		id = *p >> 2;
+		type = *p & 3;
+		p++;
+		sec = NULL;
+		v = 0;
+		v32 = 0;
+
+		switch (type) {
+			case WIRE_VARINT:
+				if (get_varint(&p, end, &v))
+					return -1;
+
+				break;
+
+			case WIRE_F64:
+				if (end - p < 8)
+					return -1;
+
+				memcpy(&v, p, 8);
+				v = le64toh(v);
+				p += 8;
+				break;
+
+			case WIRE_BYTES:
+				if (get_varint(&p, end, &len) || len > (uint64_t)(end - p))
+					return -1;
+
+				sec = p;
+				p += len;
+				break;
+
+			case WIRE_F32:
+				if (end - p < 4)
+					return -1;
+
+				memcpy(&v32, p, 4);
+				p += 4;
+				break;
+		}
+
+		switch (id) {
+			case FR_SRC_IP:
+				rec->source_ip = v32;
+				break;
+
+			case FR_DST_IP:
+				rec->destination_ip = v32;
+				break;
+
+			case FR_SRC_PORT:
+				rec->source_port = v;
+				break;
+
+			case FR_DST_PORT:
+				rec->destination_port = v;
+				break;
+
+			case FR_PROTO:
+				rec->transport_protocol = v;
+				break;
+
+			case FR_NPACK:
+				rec->npack = v;
+				break;
+
+			case FR_NBYTES:
+				rec->nbytes = v;
+				break;
+
+			case FR_NBYTES_SQR:
+				rec->nbytes_sqr = v;
+				break;
+
+			case FR_MIN_SIZE:
+				rec->min_pack_size = v;
+				break;
+
+			case FR_MAX_SIZE:
+				rec->max_pack_size = v;
+				break;
+
+			case FR_FIRST_TS:
+				rec->firstpacket_timestamp = v;
+				break;
+
+			case FR_DURATION:
+				duration = v;
+				break;
+
+			case FR_PREV_TS:
+				prev = v;
+				break;
+
+			case FR_MIN_IAT:
+				rec->min_int_time = get_double(type, v);
+				break;
+
+			case FR_MAX_IAT:
+				rec->max_int_time = get_double(type, v);
+				break;
+
+			case FR_SUM_IAT:
+				rec->sum_int_time = get_double(type, v);
+				break;
+
+			case FR_SUM_IAT_SQR:
+				rec->sum_int_time_sqr = get_double(type, v);
+				break;
+
+			case FR_RTT_SYN:
+				rec->rtt_syn = v;
+				break;
+
+			case FR_STATE:
+				rec->rtt_syn_done = (v & FR_ST_RTT_DONE) != 0;
+				rec->flag_FIN = (v & FR_ST_FIN) != 0;
+				rec->flag_ACK_nulo = (v & FR_ST_ACK_NULO) != 0;
+				rec->frag_flag = (v & FR_ST_FRAG) != 0;
+				rec->expired_by_flags = (v & FR_ST_BY_FLAGS) != 0;
+				break;
+
+			case FR_TCP_FLAGS:
+				rec->flags = v;
+				break;
+
+			case FR_NUM_FLAGS:
+				if (sec == NULL || sec == p)
+					return -1;
+
+				mask = *sec++;
+
+				for (i = 0; i < 8; i++) {
+					if ((mask & (1 << i)) && get_varint(&sec, p, &len) == 0)
+						rec->num_flags[i] = len;
+				}
+
+				break;
+
+			case FR_NWINDOW_ZERO:
+				rec->nwindow_zero = v;
+				break;
+
+			case FR_CUR_SEQ:
+				rec->current_seq_number = v;
+				break;
+
+			case FR_PREV_SEQ:
+				rec->previous_seq_number = v;
+				break;
+
+			case FR_DATA_LEN:
+				rec->dataLen = v;
+				break;
+
+			case FR_OFFSET:
+				rec->offset = v;
+				break;
+
+			case FR_IP_ID:
+				rec->ip_id = v;
+				break;
+
+			case FR_SRC_MAC:
+				rec->source_mac = v;
+				break;
+
+			case FR_DST_MAC:
+				rec->destination_mac = v;
+				break;
+
+			case FR_SAMPLES:
+				if (sec == NULL || flowrec_get_samples(rec, sec, p))
+					return -1;
+
+				break;
+
+			case FR_PAYLOAD:
+				if (sec == NULL || flowrec_get_payload(rec, sec, p))
+					return -1;
+
+				break;
+
+			default:
+				// Field of a newer version
+				break;
+		}
+	}
+
+	rec->lastpacket_timestamp = rec->firstpacket_timestamp + duration;
+	rec->previous_timestamp = rec->lastpacket_timestamp - prev;
+	rec->duration = duration;
+	rec->payload_ptr = rec->payload;
+	mgmon_flow_record_stats(rec);
+
+	return end - buf;
+}
+
+void mgmon_flowrec_writer_init(struct mgmon_flowrec_writer *w, int sections)
+{
+	w->len = MGMON_FLOWREC_HEADER;
+	w->count = 0;
+	w->seq = 0;
+	w->sections = sections;
+}
+
+int mgmon_flowrec_writer_add(struct mgmon_flowrec_writer *w, const IPFlow *rec)
+{
+	size_t len;
+
+	if (w->count == UINT16_MAX)
+		return -1;
+
+	len = mgmon_flowrec_encode(rec, w->sections, w->buf + w->len, MGMON_FLOWREC_DATAGRAM - w->len);
+
+	if (len == 0)
+		return -1;
+
+	w->len += len;
+	w->count++;
+
+	return 0;
+}
+
+size_t mgmon_flowrec_writer_finish(struct mgmon_flowrec_writer *w)
+{
+	size_t len = w->len;
+
+	if (w->count == 0)
+		return 0;
+
+	w->buf[0] = MGMON_FLOWREC_MAGIC >> 8;
+	w->buf[1] = MGMON_FLOWREC_MAGIC & 0xFF;
+	w->buf[2] = MGMON_FLOWREC_VERSION;
+	w->buf[3] = 0;
+	w->buf[4] = w->count >> 8;
+	w->buf[5] = w->count;
+	w->buf[6] = w->seq >> 24;
+	w->buf[7] = w->seq >> 16;
+	w->buf[8] = w->seq >> 8;
+	w->buf[9] = w->seq;
+
+	w->seq++;
+	w->count = 0;
+	w->len = MGMON_FLOWREC_HEADER;
+
+	return len;
+}
+
+int mgmon_flowrec_parse(const uint8_t *buf, size_t size, uint32_t *seq, flow_handler callback, void *arg)
+{
+	IPFlow rec;
+	size_t off = MGMON_FLOWREC_HEADER;
+	unsigned int count, i;
+	int len;
+
+	if (size < MGMON_FLOWREC_HEADER || ((buf[0] << 8) | buf[1]) != MGMON_FLOWREC_MAGIC)
+		return -1;
+
+	if (buf[2] != MGMON_FLOWREC_VERSION) {
+		printf("[MgMON] Unsupported flow record version %d\n", buf[2]);
+		return -1;
+	}
+
+	count = (buf[4] << 8) | buf[5];
+
+	if (seq)
+		*seq = ((uint32_t) buf[6] << 24) | (buf[7] << 16) | (buf[8] << 8) | buf[9];
+
+	for (i = 0; i < count; i++) {
+		len = mgmon_flowrec_decode(buf + off, size - off, &rec);
+
+		if (len < 0)
+			return -1;
+
+		off += len;
+
+		if (callback)
+			callback(&rec, arg);
+	}
+
+	return count;
+}
@@ -0,0 +1,1105 @@
+/**
+ * @brief Flow meter: builds IPFlow records from captured frames.
+ *
+ * Flows are indexed by an open addressing table with linear probing. Each slot
+ * keeps the hash of the 5-tuple and the index of the flow, so probing only
+ * touches the slot array (8 slots per cache line) and the flow itself.
+ * Removals use backward shift deletion, so there are no tombstones and the
+ * probe sequences stay short.
+ *
+ * IPFlow records are too big to be updated for every frame (the counters span
+ * four or five cache lines), so each flow is split in a compact state with
+ * the fields updated for every frame, and an IPFlow that only receives the
+ * samples of the first frames. The state is copied into the IPFlow when the
+ * flow is exported.
+ */
+
+#include <math.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <hpcap.h>
+
+#include "libmgmon.h"
+
+#define ETH_HLEN_ 14
+#define ETHTYPE_IPV4 0x0800
+#define ETHTYPE_VLAN 0x8100
+#define ETHTYPE_QINQ 0x88a8
+
+#define IPPROTO_TCP_ 6
+#define IPPROTO_UDP_ 17
+
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+#define TCP_ACK 0x10
+
+#define FIN_TIMEOUT (1000000000ULL) /**< Time a flow is kept after a FIN, waiting for the last ACK */
+#define EVICT_SCAN 8		/**< Flows compared to choose the one to evict when the table is full */
+#define TICK_SHIFT 20		/**< Resolution of the expiration wheel: 2^20 ns, about 1 ms */
+#define LOOP_BATCH (4 * MGMON_FLOW_BURST)	/**< Frames read from HPCAP for every call to the meter */
+#define EXPORT_LATENCY (10000000ULL)	/**< Maximum time (ns) exported records wait to complete a batch */
+
+#define FLOW_FIN 0x01
+#define FLOW_ACK_NULO 0x02
+#define FLOW_FRAG 0x04
+#define FLOW_RTT_DONE 0x08
+#define FLOW_BY_FLAGS 0x10
+
+struct flow_slot {
+	uint32_t hash;
+	uint32_t rec;	/**< Record index + 1, 0 if the slot is empty */
+};
+
+/**
+ * Per flow fields updated with every frame. The ones read by the expiration
+ * scan are in the first cache line.
+ */
+struct flow_state {
+	uint32_t src_ip;
+	uint32_t dst_ip;
+	uint16_t src_port;
+	uint16_t dst_port;
+	uint8_t proto;
+	uint8_t tcp_flags;	/**< OR of the flags of all the segments */
+	uint8_t state;		/**< FLOW_* bits */
+	uint32_t hash;
+	uint32_t npack;		/**< 0 if the entry is free */
+	uint64_t last_ts;
+	uint64_t first_ts;
+	uint64_t nbytes;
+	uint64_t nbytes_sqr;
+	uint64_t rtt_syn;
+
+	double min_iat;
+	double max_iat;
+	double sum_iat;
+	double sum_iat_sqr;
+	uint32_t num_flags[8];
+
+	uint32_t nwindow_zero;
+	uint32_t cur_seq;
+	uint32_t prev_seq;
+	uint16_t max_size;
+	uint16_t min_size;
+	uint16_t ip_id;
+	uint16_t data_len;
+	uint16_t payload_off;
+	uint16_t payload_used;	/**< Bytes of sampled payload in the IPFlow */
+} __attribute__((aligned(64)));
+
+/**
+ * Information extracted once from each frame.
+ */
+struct flow_pkt_info {
+	uint32_t src_ip;
+	uint32_t dst_ip;
+	uint16_t src_port;
+	uint16_t dst_port;
+	uint8_t proto;
+	uint8_t tcp_flags;
+	uint8_t frag;
+	uint16_t ip_id;
+	uint16_t window;
+	uint32_t seq;
+	uint16_t payload_off;
+	uint16_t payload_len;
+	uint32_t hash;
+};
+
+struct mgmon_flow_meter {
+	struct flow_slot *slots;
+	size_t mask;
+
+	struct flow_state *flows;
+	IPFlow *recs;	/**< Samples of the first frames and export buffer of every flow */
+	size_t max_flows;
+	uint32_t *free_flows;
+	size_t nfree;
+
+	size_t hand;	/**< Next flow to check for eviction */
+
+	struct mgmon_wheel *wheel;	/**< Expiration timers, with the flow index as id */
+	uint64_t now;
+	uint64_t tick;
+
+	uint64_t idle_timeout;
+	uint64_t active_timeout;
+
+	flow_handler callback;
+	void *arg;
+
+	struct mgmon_flow_meter_stats stats;
+};
+
+/* Position in num_flags of every bit of the TCP flags byte (see IPFlow) */
+static const uint8_t tcp_flag_index[8] = { 0, 1, 2, 3, 4, 5, 7, 6 };
+
+static inline uint16_t rd16(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t rd32(const uint8_t *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static inline uint64_t rd_mac(const uint8_t *p)
+{
+	return ((uint64_t) rd16(p) << 32) | rd32(p + 2);
+}
+
+static inline uint32_t flow_hash(uint32_t src_ip, uint32_t dst_ip, uint16_t src_port, uint16_t dst_port, uint8_t proto)
+{
+	uint64_t a = ((uint64_t) src_ip << 32) | dst_ip;
+	uint64_t b = ((uint64_t) src_port << 32) | ((uint64_t) dst_port << 16) | proto;
+	uint64_t h = a * 0x9E3779B97F4A7C15ULL ^ b * 0xC2B2AE3D27D4EB4FULL;
+
+	h ^= h >> 31;
+	h *= 0xBF58476D1CE4E5B9ULL;
+	h ^= h >> 32;
+
+	return (uint32_t) h;
+}
+
+/**
+ * Parses the headers of the frame.
+ * @return 0 if it is an IPv4 frame, -1 if not.
+ */
+static inline int flow_parse(const uint8_t *data, uint16_t caplen, struct flow_pkt_info *info)
+{
+	const uint8_t *ip, *l4;
+	uint16_t ethtype, ip_len, ihl, frag, l4_hlen = 0;
+	size_t off = ETH_HLEN_;
+	int tags;
+
+	if (unlikely(caplen < ETH_HLEN_ + 20))
+		return -1;
+
+	ethtype = rd16(data + 12);
+
+	for (tags = 0; tags < 2 && (ethtype == ETHTYPE_VLAN || ethtype == ETHTYPE_QINQ); tags++) {
+		if (caplen < off + 4 + 20)
+			return -1;
+
+		ethtype = rd16(data + off + 2);
+		off += 4;
+	}
+
+	if (unlikely(ethtype != ETHTYPE_IPV4))
+		return -1;
+
+	ip = data + off;
+	ihl = (ip[0] & 0x0F) * 4;
+
+	if (unlikely((ip[0] >> 4) != 4 || ihl < 20 || off + ihl > caplen))
+		return -1;
+
+	ip_len = rd16(ip + 2);
+	frag = rd16(ip + 6);
+
+	memcpy(&info->src_ip, ip + 12, 4);
+	memcpy(&info->dst_ip, ip + 16, 4);
+	info->proto = ip[9];
+	info->ip_id = rd16(ip + 4);
+	info->frag = (frag & 0x3FFF) != 0;
+	info->src_port = info->dst_port = 0;
+	info->tcp_flags = 0;
+	info->window = 0;
+	info->seq = 0;
+
+	l4 = ip + ihl;
+	off += ihl;
+
+	/* Only the first fragment carries the transport header */
+	if ((frag & 0x1FFF) == 0) {
+		if (info->proto == IPPROTO_TCP_ && off + 20 <= caplen) {
+			info->src_port = rd16(l4);
+			info->dst_port = rd16(l4 + 2);
+			info->seq = rd32(l4 + 4);
+			info->tcp_flags = l4[13];
+			info->window = rd16(l4 + 14);
+			l4_hlen = (l4[12] >> 4) * 4;
+		} else if (info->proto == IPPROTO_UDP_ && off + 8 <= caplen) {
+			info->src_port = rd16(l4);
+			info->dst_port = rd16(l4 + 2);
+			l4_hlen = 8;
+		}
+	}
+
+	info->payload_off = off + l4_hlen;
+	info->payload_len = ip_len > ihl + l4_hlen ? ip_len - ihl - l4_hlen : 0;
+	info->hash = flow_hash(info->src_ip, info->dst_ip, info->src_port, info->dst_port, info->proto);
+
+	return 0;
+}
+
+static inline short flow_key_equal(const struct flow_state *flow, const struct flow_pkt_info *info)
+{
+	return flow->src_ip == info->src_ip && flow->dst_ip == info->dst_ip
+		   && flow->src_port == info->src_port && flow->dst_port == info->dst_port
+		   && flow->proto == info->proto;
+}
+
+/**
+ * Removes the flow from the index, moving back the slots of its probe
+ * sequence so lookups do not need tombstones.
+ */
+static void flow_unlink(struct mgmon_flow_meter *fm, uint32_t idx)
+{
+	size_t i = fm->flows[idx].hash & fm->mask, j, home;
+
+	while (fm->slots[i].rec != idx + 1)
+		i = (i + 1) & fm->mask;
+
+	j = i;
+
+	while (1) {
+		j = (j + 1) & fm->mask;
+
+		if (fm->slots[j].rec == 0)
+			break;
+
+		home = fm->slots[j].hash & fm->mask;
+
+		// Move the slot back if its home is not in the circular range (i, j]
+		if ((i < j && (home <= i || home > j)) || (i > j && home <= i && home > j)) {
+			fm->slots[i] = fm->slots[j];
+			i = j;
+		}
+	}
+
+	fm->slots[i].rec = 0;
+	fm->slots[i].hash = 0;
+}
+
+void mgmon_flow_record_stats(IPFlow *rec)
+{
+	double var;
+
+	rec->avg_pack_size = rec->std_pack_size = rec->avg_int_time = rec->std_int_time = 0;
+
+	if (rec->npack == 0)
+		return;
+
+	rec->avg_pack_size = (double) rec->nbytes / rec->npack;
+	var = (double) rec->nbytes_sqr / rec->npack - rec->avg_pack_size * rec->avg_pack_size;
+	rec->std_pack_size = var > 0 ? sqrt(var) : 0;
+
+	if (rec->npack > 1) {
+		rec->avg_int_time = rec->sum_int_time / (rec->npack - 1);
+		var = rec->sum_int_time_sqr / (rec->npack - 1) - rec->avg_int_time * rec->avg_int_time;
+		rec->std_int_time = var > 0 ? sqrt(var) : 0;
+	}
+}
+
+/**
+ * Fills the IPFlow of the flow with its state and the derived statistics.
+ */
+static void flow_build_record(const struct flow_state *flow, IPFlow *rec)
+{
+	int i;
+
+	rec->source_ip = flow->src_ip;
+	rec->destination_ip = flow->dst_ip;
+	rec->source_port = flow->src_port;
+	rec->destination_port = flow->dst_port;
+	rec->transport_protocol = flow->proto;
+
+	rec->nbytes = flow->nbytes;
+	rec->npack = flow->npack;
+	rec->max_pack_size = flow->max_size;
+	rec->min_pack_size = flow->min_size;
+	rec->nbytes_sqr = flow->nbytes_sqr;
+
+	rec->previous_timestamp = flow->last_ts;
+	rec->lastpacket_timestamp = flow->last_ts;
+	rec->firstpacket_timestamp = flow->first_ts;
+	rec->duration = flow->last_ts - flow->first_ts;
+
+	rec->rtt_syn_done = (flow->state & FLOW_RTT_DONE) != 0;
+	rec->rtt_syn = rec->rtt_syn_done ? flow->rtt_syn : 0;
+
+	rec->min_int_time = flow->npack > 1 ? flow->min_iat : 0;
+	rec->max_int_time = flow->max_iat;
+	rec->sum_int_time = flow->sum_iat;
+	rec->sum_int_time_sqr = flow->sum_iat_sqr;
+
+	for (i = 0; i < 8; i++)
+		rec->num_flags[i] = flow->num_flags[i];
+
+	rec->nwindow_zero = flow->nwindow_zero;
+	rec->current_seq_number = flow->cur_seq;
+	rec->previous_seq_number = flow->prev_seq;
+	rec->dataLen = flow->data_len;
+	rec->offset = flow->payload_off;
+	rec->flags = flow->tcp_flags;
+	rec->flag_FIN = (flow->state & FLOW_FIN) != 0;
+	rec->flag_ACK_nulo = (flow->state & FLOW_ACK_NULO) != 0;
+	rec->frag_flag = (flow->state & FLOW_FRAG) != 0;
+	rec->ip_id = flow->ip_id;
+	rec->expired_by_flags = (flow->state & FLOW_BY_FLAGS) != 0;
+
+	rec->payload_ptr = rec->payload;
+
+	mgmon_flow_record_stats(rec);
+}
+
+static void flow_export(struct mgmon_flow_meter *fm, uint32_t idx)
+{
+	flow_build_record(&fm->flows[idx], &fm->recs[idx]);
+
+	if (fm->callback)
+		fm->callback(&fm->recs[idx], fm->arg);
+
+	fm->stats.flows_exported++;
+}
+
+static void flow_release(struct mgmon_flow_meter *fm, uint32_t idx)
+{
+	mgmon_wheel_cancel(fm->wheel, idx);
+	flow_unlink(fm, idx);
+	memset(&fm->flows[idx], 0, sizeof(struct flow_state));
+	memset(&fm->recs[idx], 0, sizeof(IPFlow));
+	fm->free_flows[fm->nfree++] = idx;
+}
+
+/**
+ * Clears the counters of a flow, keeping its key and addresses.
+ */
+static void flow_restart(struct mgmon_flow_meter *fm, uint32_t idx)
+{
+	struct flow_state *flow = &fm->flows[idx];
+	IPFlow *rec = &fm->recs[idx];
+	uint64_t src_mac = rec->source_mac, dst_mac = rec->destination_mac;
+	uint32_t hash = flow->hash;
+
+	memset(&flow->tcp_flags, 0, sizeof(struct flow_state) - offsetof(struct flow_state, tcp_flags));
+	flow->hash = hash;
+
+	memset(rec, 0, sizeof(IPFlow));
+	rec->source_mac = src_mac;
+	rec->destination_mac = dst_mac;
+}
+
+/**
+ * @return Time at which the flow expires if it does not receive more frames.
+ */
+static inline uint64_t flow_deadline(struct mgmon_flow_meter *fm, const struct flow_state *flow)
+{
+	uint64_t idle = fm->idle_timeout;
+
+	if ((flow->state & FLOW_FIN) && FIN_TIMEOUT < idle)
+		idle = FIN_TIMEOUT;
+
+	return minimo(flow->last_ts + idle, flow->first_ts + fm->active_timeout);
+}
+
+/**
+ * Expiration timer of a flow. Timers are not moved when frames arrive, so the
+ * flow is checked again and only exported if its deadline has really passed.
+ */
+static void flow_timer(uint32_t idx, void *arg)
+{
+	struct mgmon_flow_meter *fm = arg;
+	struct flow_state *flow = &fm->flows[idx];
+	uint64_t deadline = flow_deadline(fm, flow);
+
+	if (deadline > fm->now) {
+		mgmon_wheel_schedule(fm->wheel, idx, deadline);
+		return;
+	}
+
+	if (fm->now - flow->first_ts >= fm->active_timeout)
+		fm->stats.expired_active++;
+	else if (flow->state & FLOW_FIN)
+		fm->stats.expired_flags++;
+	else
+		fm->stats.expired_idle++;
+
+	flow_export(fm, idx);
+	flow_release(fm, idx);
+}
+
+static inline void flow_advance(struct mgmon_flow_meter *fm, uint64_t now)
+{
+	if (likely((now >> TICK_SHIFT) <= fm->tick))
+		return;
+
+	fm->tick = now >> TICK_SHIFT;
+	fm->now = now;
+	mgmon_wheel_advance(fm->wheel, now);
+}
+
+/**
+ * Frees an entry when the table is full, exporting the flow that has been
+ * idle for longer among the next few ones of the eviction hand.
+ */
+static void flow_evict(struct mgmon_flow_meter *fm)
+{
+	size_t i, idx, victim = fm->hand;
+
+	for (i = 0; i < EVICT_SCAN; i++) {
+		idx = (fm->hand + 1 + i) % fm->max_flows;
+
+		if (fm->flows[idx].last_ts < fm->flows[victim].last_ts)
+			victim = idx;
+	}
+
+	fm->hand = victim;
+	fm->stats.evicted++;
+	flow_export(fm, victim);
+	flow_release(fm, victim);
+}
+
+/**
+ * Returns the index of the flow of the frame, creating it if needed.
+ */
+static inline uint32_t flow_lookup(struct mgmon_flow_meter *fm, const struct flow_pkt_info *info)
+{
+	size_t i;
+	struct flow_slot *slot;
+	struct flow_state *flow;
+	uint32_t idx;
+
+	while (1) {
+		for (i = info->hash & fm->mask;; i = (i + 1) & fm->mask) {
+			slot = &fm->slots[i];
+
+			if (slot->rec == 0)
+				break;
+
+			if (slot->hash == info->hash && flow_key_equal(&fm->flows[slot->rec - 1], info))
+				return slot->rec - 1;
+		}
+
+		if (likely(fm->nfree > 0))
+			break;
+
+		// Evicting moves slots, look for the free one again.
+		flow_evict(fm);
+	}
+
+	idx = fm->free_flows[--fm->nfree];
+	slot->hash = info->hash;
+	slot->rec = idx + 1;
+
+	flow = &fm->flows[idx];
+	flow->hash = info->hash;
+	flow->src_ip = info->src_ip;
+	flow->dst_ip = info->dst_ip;
+	flow->src_port = info->src_port;
+	flow->dst_port = info->dst_port;
+	flow->proto = info->proto;
+
+	fm->stats.flows_created++;
+
+	return idx;
+}
+
+/**
+ * Keeps the timestamp, size and the start of the payload of one of the first
+ * frames of the flow.
+ */
+static void flow_sample(struct flow_state *flow, IPFlow *rec, const struct flow_pkt_info *info,
+						const uint8_t *data, uint16_t caplen, uint16_t len, uint64_t ts, size_t n)
+{
+	uint16_t stored;
+
+	if (n == 0) {
+		rec->source_mac = rd_mac(data + 6);
+		rec->destination_mac = rd_mac(data);
+	}
+
+	rec->timestamp[n] = ts;
+	rec->size[n] = len;
+
+	if (info->payload_len > 0 && info->payload_off < caplen && flow->payload_used < MAX_PAYLOAD) {
+		stored = minimo(minimo(info->payload_len, caplen - info->payload_off), MAX_PAYLOAD - flow->payload_used);
+		rec->packet_offset[rec->npack_payload++] = flow->payload_used;
+		memcpy(rec->payload + flow->payload_used, data + info->payload_off, stored);
+		flow->payload_used += stored;
+	}
+}
+
+static inline void flow_update(struct mgmon_flow_meter *fm, uint32_t idx, const struct flow_pkt_info *info,
+							   const uint8_t *data, uint16_t caplen, uint16_t len, uint64_t ts)
+{
+	struct flow_state *flow = &fm->flows[idx];
+	double iat;
+	uint8_t flags = info->tcp_flags;
+	unsigned int b;
+	size_t n;
+
+	if (unlikely(flow->npack > 0 && ts > flow->first_ts && ts - flow->first_ts >= fm->active_timeout)) {
+		fm->stats.expired_active++;
+		flow_export(fm, idx);
+		flow_restart(fm, idx);
+	}
+
+	if (flow->npack == 0) {
+		flow->first_ts = ts;
+		flow->min_size = len;
+	} else {
+		iat = ts > flow->last_ts ? (double)(ts - flow->last_ts) : 0;
+
+		if (flow->npack == 1 || iat < flow->min_iat)
+			flow->min_iat = iat;
+
+		if (iat > flow->max_iat)
+			flow->max_iat = iat;
+
+		flow->sum_iat += iat;
+		flow->sum_iat_sqr += iat * iat;
+	}
+
+	n = flow->npack++;
+	flow->nbytes += len;
+	flow->nbytes_sqr += (uint64_t) len * len;
+
+	if (len > flow->max_size)
+		flow->max_size = len;
+
+	if (len < flow->min_size)
+		flow->min_size = len;
+
+	flow->last_ts = ts;
+	flow->state |= info->frag ? FLOW_FRAG : 0;
+	flow->ip_id = info->ip_id;
+	flow->payload_off = info->payload_off;
+	flow->data_len = info->payload_len;
+
+	if (info->proto == IPPROTO_TCP_) {
+		for (b = flags; b; b &= b - 1)
+			flow->num_flags[tcp_flag_index[__builtin_ctz(b)]]++;
+
+		flow->tcp_flags |= flags;
+
+		if (info->window == 0 && !(flags & TCP_RST))
+			flow->nwindow_zero++;
+
+		if ((flags & TCP_ACK) && info->payload_len == 0)
+			flow->state |= FLOW_ACK_NULO;
+
+		flow->prev_seq = flow->cur_seq;
+		flow->cur_seq = info->seq;
+
+		// RTT: time between the SYN and the ACK that completes the handshake.
+		if (unlikely(!(flow->state & FLOW_RTT_DONE))) {
+			if ((flags & (TCP_SYN | TCP_ACK)) == TCP_SYN) {
+				if (flow->rtt_syn == 0)
+					flow->rtt_syn = ts;
+			} else if ((flags & (TCP_SYN | TCP_ACK)) == TCP_ACK && flow->rtt_syn != 0) {
+				flow->rtt_syn = ts - flow->rtt_syn;
+				flow->state |= FLOW_RTT_DONE;
+			}
+		}
+
+		if (unlikely((flags & TCP_FIN) && !(flow->state & FLOW_FIN))) {
+			flow->state |= FLOW_FIN | FLOW_BY_FLAGS;
+
+			// Bring the timer forward to the FIN timeout
+			if (n > 0)
+				mgmon_wheel_schedule(fm->wheel, idx, flow_deadline(fm, flow));
+		}
+	}
+
+	if (unlikely(n == 0))
+		mgmon_wheel_schedule(fm->wheel, idx, flow_deadline(fm, flow));
+
+	if (unlikely(n < MAX_PACK))
+		flow_sample(flow, &fm->recs[idx], info, data, caplen, len, ts, n);
+
+	if (unlikely(flags & TCP_RST)) {
+		flow->state |= FLOW_BY_FLAGS;
+		fm->stats.expired_flags++;
+		flow_export(fm, idx);
+		flow_release(fm, idx);
+	}
+}
+
+static inline void flow_account(struct mgmon_flow_meter *fm, const struct flow_pkt_info *info,
+								const uint8_t *data, uint16_t caplen, uint16_t len, uint64_t ts)
+{
+	// Flows that expire before this frame are exported before it is accounted
+	flow_advance(fm, ts);
+	flow_update(fm, flow_lookup(fm, info), info, data, caplen, len, ts);
+}
+
+/**
+ * Allocates zeroed memory for the big arrays of the meter, backed by
+ * transparent huge pages when possible: the lookups are random and would
+ * otherwise miss the TLB in almost every frame.
+ */
+static void *flow_table_alloc(size_t size)
+{
+	void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (mem == MAP_FAILED)
+		return NULL;
+
+	madvise(mem, size, MADV_HUGEPAGE);
+
+	return mem;
+}
+
+static void flow_table_free(void *mem, size_t size)
+{
+	if (mem)
+		munmap(mem, size);
+}
+
+struct mgmon_flow_meter *mgmon_flow_meter_create(size_t max_flows, uint64_t idle_timeout, uint64_t active_timeout, flow_handler callback, void *arg)
+{
+	struct mgmon_flow_meter *fm;
+	size_t slots = 1, i;
+
+	if (max_flows == 0 || max_flows >= UINT32_MAX / 2)
+		return NULL;
+
+	// Keep the load factor at most at 0.5
+	while (slots < 2 * max_flows)
+		slots <<= 1;
+
+	fm = calloc(1, sizeof(struct mgmon_flow_meter));
+
+	if (fm == NULL)
+		return NULL;
+
+	fm->mask = slots - 1;
+	fm->max_flows = max_flows;
+	fm->slots = flow_table_alloc(slots * sizeof(struct flow_slot));
+	fm->flows = flow_table_alloc(max_flows * sizeof(struct flow_state));
+	fm->recs = flow_table_alloc(max_flows * sizeof(IPFlow));
+	fm->free_flows = calloc(max_flows, sizeof(uint32_t));
+	fm->wheel = mgmon_wheel_create(max_flows, TICK_SHIFT, flow_timer, fm);
+
+	if (!fm->slots || !fm->flows || !fm->recs || !fm->free_flows || !fm->wheel) {
+		printf("[MgMON] Cannot allocate a flow table of %zu flows\n", max_flows);
+		mgmon_flow_meter_destroy(fm);
+		return NULL;
+	}
+
+	// Hand out the lower records first
+	for (i = 0; i < max_flows; i++)
+		fm->free_flows[i] = max_flows - 1 - i;
+
+	fm->nfree = max_flows;
+	fm->idle_timeout = idle_timeout;
+	fm->active_timeout = active_timeout;
+	fm->callback = callback;
+	fm->arg = arg;
+
+	return fm;
+}
+
+void mgmon_flow_meter_destroy(struct mgmon_flow_meter *fm)
+{
+	if (fm == NULL)
+		return;
+
+	if (fm->slots && fm->flows && fm->recs && fm->free_flows && fm->wheel)
+		mgmon_flow_meter_flush(fm);
+
+	mgmon_wheel_destroy(fm->wheel);
+
+	flow_table_free(fm->slots, (fm->mask + 1) * sizeof(struct flow_slot));
+	flow_table_free(fm->flows, fm->max_flows * sizeof(struct flow_state));
+	flow_table_free(fm->recs, fm->max_flows * sizeof(IPFlow));
+	free(fm->free_flows);
+	free(fm);
+}
+
+int mgmon_flow_meter_packet(struct mgmon_flow_meter *fm, const uint8_t *data, uint16_t caplen, uint16_t len, uint64_t ts)
+{
+	struct flow_pkt_info info;
+
+	fm->stats.packets++;
+	fm->stats.bytes += len;
+
+	if (unlikely(flow_parse(data, caplen, &info) != 0)) {
+		fm->stats.non_ip++;
+		return -1;
+	}
+
+	flow_account(fm, &info, data, caplen, len, ts);
+
+	return 0;
+}
+
+static inline void flow_prefetch_state(const struct flow_state *flow)
+{
+	size_t off;
+
+	for (off = 0; off < sizeof(struct flow_state); off += 64)
+		__builtin_prefetch((const uint8_t *) flow + off, 1);
+}
+
+/**
+ * Frames of a burst that have gone through the first stage of the pipeline.
+ */
+struct flow_burst {
+	const struct mgmon_flow_pkt *pkts;
+	size_t count;
+	struct flow_pkt_info info[MGMON_FLOW_BURST];
+	int8_t valid[MGMON_FLOW_BURST];
+};
+
+/**
+ * Stage 1: parses the frames and starts loading their slots.
+ */
+static void flow_burst_parse(struct mgmon_flow_meter *fm, struct flow_burst *b, const struct mgmon_flow_pkt *pkts, size_t count)
+{
+	size_t i;
+
+	b->pkts = pkts;
+	b->count = count;
+
+	for (i = 0; i < count; i++) {
+		b->valid[i] = flow_parse(pkts[i].data, pkts[i].caplen, &b->info[i]) == 0;
+
+		if (b->valid[i])
+			__builtin_prefetch(&fm->slots[b->info[i].hash & fm->mask]);
+
+		fm->stats.bytes += pkts[i].len;
+	}
+}
+
+/**
+ * Stage 2: finds the probable flow of every frame and starts loading it.
+ */
+static void flow_burst_probe(struct mgmon_flow_meter *fm, struct flow_burst *b)
+{
+	struct flow_slot *slot;
+	size_t i, j;
+
+	for (i = 0; i < b->count; i++) {
+		if (!b->valid[i])
+			continue;
+
+		for (j = b->info[i].hash & fm->mask;; j = (j + 1) & fm->mask) {
+			slot = &fm->slots[j];
+
+			if (slot->rec == 0)
+				break;
+
+			if (slot->hash == b->info[i].hash) {
+				flow_prefetch_state(&fm->flows[slot->rec - 1]);
+				break;
+			}
+		}
+	}
+}
+
+/**
+ * Stage 3: updates the flows.
+ */
+static void flow_burst_update(struct mgmon_flow_meter *fm, struct flow_burst *b)
+{
+	size_t i;
+
+	for (i = 0; i < b->count; i++) {
+		fm->stats.packets++;
+
+		if (b->valid[i])
+			flow_account(fm, &b->info[i], b->pkts[i].data, b->pkts[i].caplen, b->pkts[i].len, b->pkts[i].ts);
+		else
+			fm->stats.non_ip++;
+	}
+}
+
+void mgmon_flow_meter_burst(struct mgmon_flow_meter *fm, const struct mgmon_flow_pkt *pkts, size_t count)
+{
+	struct flow_burst b[2];
+	size_t done = 0, n, cur = 0;
+
+	if (count == 0)
+		return;
+
+	n = minimo(count, MGMON_FLOW_BURST);
+	flow_burst_parse(fm, &b[cur], pkts, n);
+	done = n;
+
+	// Parse the next group while the flows of the current one are loaded
+	while (1) {
+		flow_burst_probe(fm, &b[cur]);
+
+		if (done < count) {
+			n = minimo(count - done, MGMON_FLOW_BURST);
+			flow_burst_parse(fm, &b[!cur], pkts + done, n);
+			done += n;
+		} else
+			b[!cur].count = 0;
+
+		flow_burst_update(fm, &b[cur]);
+
+		if (b[!cur].count == 0)
+			break;
+
+		cur = !cur;
+	}
+}
+
+void mgmon_flow_meter_expire(struct mgmon_flow_meter *fm, uint64_t now)
+{
+	flow_advance(fm, now);
+}
+
+void mgmon_flow_meter_flush(struct mgmon_flow_meter *fm)
+{
+	size_t i;
+
+	for (i = 0; i < fm->max_flows; i++) {
+		if (fm->flows[i].npack > 0) {
+			flow_export(fm, i);
+			flow_release(fm, i);
+		}
+	}
+}
+
+size_t mgmon_flow_meter_active(struct mgmon_flow_meter *fm)
+{
+	return fm->max_flows - fm->nfree;
+}
+
+void mgmon_flow_meter_get_stats(struct mgmon_flow_meter *fm, struct mgmon_flow_meter_stats *stats)
+{
+	*stats = fm->stats;
+}
+
+/**
+ * Sends the records through the MCAST_FLOW group of the queue or, with the
+ * shared memory transport, publishes them in its ring.
+ */
+struct flow_mcast_exporter {
+	int sd;
+	struct sockaddr_in addr;
+	struct mgmon_flowrec_writer writer;
+	struct mgmon_tx_batch *tx;
+	struct mgmon_shm *shm;
+};
+
+static int flow_mcast_open(struct flow_mcast_exporter *exp, int ifindex, int qindex)
+{
+	memset(exp, 0, sizeof(struct flow_mcast_exporter));
+	mgmon_flowrec_writer_init(&exp->writer, MGMON_FLOWREC_SAMPLES | MGMON_FLOWREC_PAYLOAD);
+
+	if (mgmon_get_transport() == MGMON_TRANSPORT_SHM) {
+		exp->shm = mgmon_shm_open(MCAST_FLOW, ifindex, qindex, 0);
+		return exp->shm ? 0 : -1;
+	}
+
+	exp->sd = open_multicast_tx_socket(MCAST_FLOW, ifindex, qindex, &exp->addr);
+
+	if (exp->sd == 0)
+		return -1;
+
+	exp->tx = mgmon_tx_batch_create(exp->sd, &exp->addr, MGMON_DEFAULT_BATCH, MGMON_FLOWREC_DATAGRAM);
+
+	if (exp->tx == NULL) {
+		close(exp->sd);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Queues the datagram of records being built for sending. Published
+ * immediately in shared memory, where there are no system calls to save.
+ */
+static void flow_mcast_close(struct flow_mcast_exporter *exp)
+{
+	size_t len = mgmon_flowrec_writer_finish(&exp->writer);
+
+	if (len == 0)
+		return;
+
+	if (exp->shm)
+		mgmon_shm_publish(exp->shm, exp->writer.buf, len);
+	else
+		mgmon_tx_batch_send(exp->tx, exp->writer.buf, len);
+}
+
+/**
+ * Sends all the records of the exporter.
+ */
+static void flow_mcast_flush(struct flow_mcast_exporter *exp)
+{
+	flow_mcast_close(exp);
+
+	if (exp->tx)
+		mgmon_tx_batch_flush(exp->tx);
+}
+
+static void flow_mcast_destroy(struct flow_mcast_exporter *exp)
+{
+	flow_mcast_close(exp);
+
+	if (exp->shm) {
+		mgmon_shm_close(exp->shm);
+		return;
+	}
+
+	mgmon_tx_batch_destroy(exp->tx);
+	close(exp->sd);
+}
+
+static void flow_mcast_export(IPFlow *record, void *arg)
+{
+	struct flow_mcast_exporter *exp = arg;
+
+	if (mgmon_flowrec_writer_add(&exp->writer, record) == 0)
+		return;
+
+	flow_mcast_close(exp);
+	mgmon_flowrec_writer_add(&exp->writer, record);
+}
+
+static void flow_read_header(void *header, u32 secs, u32 nsecs, u16 len, u16 caplen)
+{
+	struct mgmon_flow_pkt *pkt = header;
+
+	pkt->ts = ((uint64_t) secs) * 1000000000ULL + nsecs;
+	pkt->len = len;
+	pkt->caplen = caplen;
+}
+
+int mgmon_flow_meter_loop(int cpu, int ifindex, int qindex, size_t max_flows)
+{
+	struct hpcap_handle hp;
+	struct mgmon_flow_meter *fm;
+	struct flow_mcast_exporter exp;
+	struct mgmon_stats *stats;
+	struct mgmon_flow_pkt pkts[LOOP_BATCH];
+	static u_char auxbuf[LOOP_BATCH][MAX_PACKET_SIZE];
+	struct timespec now;
+	uint64_t timeout = 1000000000ULL, last_flush = 0;
+	u_char *bp;
+	size_t count;
+	pthread_t tid, sigtid;
+	cpu_set_t mask;
+	mgmon_signal ms;
+	int ret;
+
+	tid = pthread_self();
+
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	ret = pthread_setaffinity_np(tid, sizeof(cpu_set_t), &mask);
+
+	if (ret < 0) {
+		printf("[MgMON] Error when attaching thread to CPU %d\n", cpu);
+		return -1;
+	}
+
+	if (flow_mcast_open(&exp, ifindex, qindex) < 0)
+		return -1;
+
+	fm = mgmon_flow_meter_create(max_flows ? max_flows : MGMON_FLOW_DEFAULT_MAX_FLOWS,
+								 MGMON_FLOW_DEFAULT_IDLE_TIMEOUT, MGMON_FLOW_DEFAULT_ACTIVE_TIMEOUT, flow_mcast_export, &exp);
+
+	if (fm == NULL) {
+		flow_mcast_destroy(&exp);
+		return -1;
+	}
+
+	// Traffic statistics, with the number of flows, through the MCAST_MRTG channel
+	stats = mgmon_stats_create(MGMON_STATS_1S, NULL, NULL);
+
+	if (stats == NULL || mgmon_stats_export(stats, ifindex, qindex) < 0) {
+		mgmon_stats_destroy(stats);
+		mgmon_flow_meter_destroy(fm);
+		flow_mcast_destroy(&exp);
+		return -1;
+	}
+
+	ret = hpcap_open(&hp, ifindex, qindex);
+
+	if (ret != HPCAP_OK) {
+		printf("[MgMON] Error when opening interface hpcap%dq%d\n", ifindex, qindex);
+		mgmon_stats_destroy(stats);
+		mgmon_flow_meter_destroy(fm);
+		flow_mcast_destroy(&exp);
+		return -1;
+	}
+
+	ret = hpcap_map(&hp);
+
+	if (ret != HPCAP_OK) {
+		printf("[MgMON] Error when mapping interface hpcap%dq%d\n", ifindex, qindex);
+		hpcap_close(&hp);
+		mgmon_stats_destroy(stats);
+		mgmon_flow_meter_destroy(fm);
+		flow_mcast_destroy(&exp);
+		return -1;
+	}
+
+	ms.stop = 0;
+	sigemptyset(&ms.signal_mask);
+	sigaddset(&ms.signal_mask, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &ms.signal_mask, NULL);
+	ret = pthread_create(&sigtid, NULL, mgmon_signal_thread, &ms);
+
+	if (ret != 0) {
+		printf("[MgMON] Error when creating signal watchdog thread\n");
+		return -1;
+	}
+
+	pthread_setaffinity_np(sigtid, sizeof(cpu_set_t), &mask);
+
+	while (!ms.stop) {
+		hpcap_ack_wait_timeout(&hp, 1, timeout);
+
+		if (hp.acks >= hp.avail) {
+			// No traffic: expire the flows with the system clock.
+			clock_gettime(CLOCK_REALTIME, &now);
+			mgmon_flow_meter_expire(fm, now.tv_sec * 1000000000ULL + now.tv_nsec);
+			mgmon_stats_set_flows(stats, mgmon_flow_meter_active(fm));
+			mgmon_stats_advance(stats, now.tv_sec * 1000000000ULL + now.tv_nsec);
+			flow_mcast_flush(&exp);
+			continue;
+		}
+
+		while (hp.acks < hp.avail) {
+			for (count = 0; count < LOOP_BATCH && hp.acks < hp.avail;) {
+				hpcap_read_packet(&hp, &bp, auxbuf[count], &pkts[count], flow_read_header);
+
+				if (bp) {
+					pkts[count].data = bp;
+					count++;
+				}
+			}
+
+			mgmon_flow_meter_burst(fm, pkts, count);
+			mgmon_stats_burst(stats, pkts, count);
+		}
+
+		mgmon_stats_set_flows(stats, mgmon_flow_meter_active(fm));
+
+		/* Datagrams are sent when a batch is complete, but records are not
+		 * held for longer than EXPORT_LATENCY. */
+		flow_mcast_close(&exp);
+		clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+
+		if (now.tv_sec * 1000000000ULL + now.tv_nsec - last_flush >= EXPORT_LATENCY) {
+			flow_mcast_flush(&exp);
+			last_flush = now.tv_sec * 1000000000ULL + now.tv_nsec;
+		}
+	}
+
+	printf("[MgMON] stopping flow meter for hpcap%dq%d\n", ifindex, qindex);
+	pthread_join(sigtid, NULL);
+	hpcap_ack(&hp);
+
+	mgmon_flow_meter_destroy(fm);
+	flow_mcast_destroy(&exp);
+	mgmon_stats_destroy(stats);
+
+	hpcap_unmap(&hp);
+	hpcap_close(&hp);
+
+	return 0;
+}
@@ -0,0 +1,464 @@
+/**
+ * @brief Shared memory channels: single producer, multiple consumer rings.
+ *
+ * Each channel (MCAST_FLOW or MCAST_MRTG of a queue) is a file named
+ * mgmon_<channel>_<ifindex>q<qindex>, in the hugetlbfs mount at
+ * MGMON_SHM_HUGETLB_PATH if there is one, or in /dev/shm otherwise (with
+ * transparent hugepages, if the system allows them in shared memory). It holds
+ * a header page and a ring of messages, each one the same datagram that would
+ * be sent through the multicast group, so consumers parse both in the same
+ * way.
+ *
+ * Every consumer takes a slot of the header with its own cursor, so all of
+ * them see all the messages, as with multicast. The producer never waits:
+ * when the slowest consumer has not released the space a message needs, the
+ * message is dropped and counted, as a full socket buffer would do. Slots of
+ * consumers whose process is gone are released by the producer.
+ *
+ * Consumers spin for a while when the ring is empty and then sleep on a
+ * futex, which the producer only wakes when some consumer is sleeping.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/syscall.h>
+
+#include <hpcap.h>
+
+#include "libmgmon.h"
+
+#define SHM_MAGIC 0x4D53484DU	/**< "MSHM" */
+#define SHM_VERSION 1
+#define SHM_HEADER_SIZE 4096
+#define SHM_PAD UINT32_MAX		/**< Length of the marker that skips to the start of the ring */
+#define SHM_MSG_HLEN 8
+#define SHM_SPIN 2000			/**< Polls of an empty ring before sleeping */
+#define SHM_CACHELINE 64
+#define HUGETLBFS_MAGIC 0x958458f6
+
+#define SHM_ALIGN(len) (((len) + 7) & ~((uint64_t) 7))
+
+struct shm_consumer {
+	volatile uint64_t cursor;	/**< Bytes of the ring released by the consumer */
+	volatile int32_t pid;		/**< 0 if the slot is free */
+	uint8_t pad[SHM_CACHELINE - 12];
+};
+
+struct shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;				/**< Bytes of the ring, a power of two */
+	uint8_t pad0[SHM_CACHELINE - 16];
+
+	// Written by the producer
+	volatile uint64_t head;		/**< Bytes published */
+	uint64_t published;
+	uint64_t dropped;
+	uint8_t pad1[SHM_CACHELINE - 24];
+
+	volatile uint32_t futex;
+	volatile uint32_t waiters;
+	uint8_t pad2[SHM_CACHELINE - 8];
+
+	struct shm_consumer consumers[MGMON_SHM_MAX_CONSUMERS];
+};
+
+struct mgmon_shm {
+	struct shm_header *hdr;
+	uint8_t *ring;
+	size_t map_len;
+	uint64_t mask;
+
+	uint64_t min_cursor;	/**< Producer: cursor of the slowest consumer, last time it was checked */
+
+	int slot;				/**< Consumer: slot in the header, -1 if not attached */
+	uint64_t cursor;		/**< Consumer: next byte to read */
+	uint64_t pending;		/**< Consumer: size of the message returned by the last call, not yet released */
+	uint64_t consumed;
+};
+
+static void shm_min_cursor(struct mgmon_shm *shm, uint64_t head);
+
+static inline long shm_futex(volatile uint32_t *addr, int op, uint32_t val, const struct timespec *timeout)
+{
+	return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+/**
+ * Opens the file of the channel, in hugetlbfs if possible.
+ * @return The descriptor, -1 on error. created is set if the file is new.
+ */
+static int shm_open_file(const char *name, short *created)
+{
+	char path[256];
+	int fd, i;
+	const char *dirs[] = { MGMON_SHM_HUGETLB_PATH, "/dev/shm" };
+	struct statfs fs;
+
+	for (i = 0; i < 2; i++) {
+		// The hugetlbfs path is only used if it is mounted
+		if (i == 0 && (statfs(dirs[i], &fs) < 0 || fs.f_type != HUGETLBFS_MAGIC))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", dirs[i], name);
+
+		fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0666);
+
+		if (fd >= 0) {
+			*created = 1;
+			return fd;
+		}
+
+		if (errno == EEXIST) {
+			*created = 0;
+			return open(path, O_RDWR);
+		}
+	}
+
+	printf("[MgMON] Cannot create the shared memory channel %s: %s\n", name, strerror(errno));
+
+	return -1;
+}
+
+static void shm_name(char *name, size_t len, int mode, int ifindex, int qindex)
+{
+	snprintf(name, len, "mgmon_%s_%dq%d", mode == MCAST_MRTG ? "mrtg" : mode == MCAST_FLOW ? "flow" : "chan",
+			 ifindex, qindex);
+}
+
+struct mgmon_shm *mgmon_shm_open(int mode, int ifindex, int qindex, size_t size)
+{
+	struct mgmon_shm *shm;
+	struct statfs fs;
+	struct stat st;
+	char name[64];
+	short created;
+	size_t ring = MGMON_SHM_DEFAULT_SIZE, page;
+	int fd, i;
+
+	if (size > 0) {
+		for (ring = 4096; ring < size; ring <<= 1)
+			;
+	}
+
+	shm_name(name, sizeof(name), mode, ifindex, qindex);
+	fd = shm_open_file(name, &created);
+
+	if (fd < 0)
+		return NULL;
+
+	shm = calloc(1, sizeof(struct mgmon_shm));
+
+	if (shm == NULL) {
+		close(fd);
+		return NULL;
+	}
+
+	shm->slot = -1;
+
+	if (created) {
+		// hugetlbfs files must be a multiple of the page size
+		page = fstatfs(fd, &fs) == 0 && fs.f_bsize > 4096 ? (size_t) fs.f_bsize : 4096;
+		shm->map_len = (SHM_HEADER_SIZE + ring + page - 1) / page * page;
+
+		if (ftruncate(fd, shm->map_len) < 0) {
+			printf("[MgMON] Cannot size the shared memory channel %s: %s\n", name, strerror(errno));
+			goto error;
+		}
+	} else {
+		// Wait for the creator to size the file
+		for (i = 0; i < 1000 && fstat(fd, &st) == 0 && st.st_size == 0; i++)
+			usleep(1000);
+
+		if (fstat(fd, &st) < 0 || (size_t) st.st_size <= SHM_HEADER_SIZE)
+			goto error;
+
+		shm->map_len = st.st_size;
+	}
+
+	shm->hdr = mmap(NULL, shm->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+
+	if (shm->hdr == MAP_FAILED) {
+		printf("[MgMON] Cannot map the shared memory channel %s: %s\n", name, strerror(errno));
+		goto error;
+	}
+
+	close(fd);
+	fd = -1;
+	madvise(shm->hdr, shm->map_len, MADV_HUGEPAGE);
+
+	if (created) {
+		shm->hdr->version = SHM_VERSION;
+		shm->hdr->size = ring;
+		__atomic_store_n(&shm->hdr->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+	} else {
+		for (i = 0; i < 1000 && __atomic_load_n(&shm->hdr->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC; i++)
+			usleep(1000);
+
+		if (shm->hdr->magic != SHM_MAGIC || shm->hdr->version != SHM_VERSION ||
+				SHM_HEADER_SIZE + shm->hdr->size > shm->map_len) {
+			printf("[MgMON] The shared memory channel %s is not valid\n", name);
+			goto error;
+		}
+	}
+
+	shm->ring = (uint8_t *) shm->hdr + SHM_HEADER_SIZE;
+	shm->mask = shm->hdr->size - 1;
+	// A producer that restarts must not overwrite what the consumers did not read
+	shm_min_cursor(shm, shm->hdr->head);
+
+	return shm;
+
+error:
+	if (fd >= 0)
+		close(fd);
+
+	if (shm->hdr != NULL && shm->hdr != MAP_FAILED)
+		munmap(shm->hdr, shm->map_len);
+
+	free(shm);
+
+	return NULL;
+}
+
+void mgmon_shm_close(struct mgmon_shm *shm)
+{
+	if (shm == NULL)
+		return;
+
+	if (shm->slot >= 0)
+		__atomic_store_n(&shm->hdr->consumers[shm->slot].pid, 0, __ATOMIC_RELEASE);
+
+	munmap(shm->hdr, shm->map_len);
+	free(shm);
+}
+
+int mgmon_shm_unlink(int mode, int ifindex, int qindex)
+{
+	char name[64], path[256];
+	int ret = -1;
+
+	shm_name(name, sizeof(name), mode, ifindex, qindex);
+
+	snprintf(path, sizeof(path), "%s/%s", MGMON_SHM_HUGETLB_PATH, name);
+	ret &= unlink(path);
+	snprintf(path, sizeof(path), "/dev/shm/%s", name);
+	ret &= unlink(path);
+
+	return ret;
+}
+
+/**
+ * Recomputes the cursor of the slowest consumer, releasing the slots of the
+ * consumers that no longer exist.
+ */
+static void shm_min_cursor(struct mgmon_shm *shm, uint64_t head)
+{
+	struct shm_consumer *c;
+	uint64_t min = head, cursor;
+	int32_t pid;
+	int i;
+
+	for (i = 0; i < MGMON_SHM_MAX_CONSUMERS; i++) {
+		c = &shm->hdr->consumers[i];
+		pid = __atomic_load_n(&c->pid, __ATOMIC_ACQUIRE);
+
+		if (pid == 0)
+			continue;
+
+		cursor = __atomic_load_n(&c->cursor, __ATOMIC_ACQUIRE);
+
+		// Only a consumer that holds the ring back is checked
+		if (head - cursor + SHM_MSG_HLEN > shm->hdr->size / 2 && kill(pid, 0) < 0 && errno == ESRCH) {
+			__atomic_compare_exchange_n(&c->pid, &pid, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		if (cursor < min)
+			min = cursor;
+	}
+
+	shm->min_cursor = min;
+}
+
+int mgmon_shm_publish(struct mgmon_shm *shm, const void *data, size_t len)
+{
+	struct shm_header *hdr = shm->hdr;
+	uint64_t head = hdr->head, need = SHM_MSG_HLEN + SHM_ALIGN(len), pos = head & shm->mask, skip;
+	uint32_t msg_len = len;
+
+	skip = hdr->size - pos < need ? hdr->size - pos : 0;
+
+	if (need + skip > hdr->size)
+		return -1;
+
+	if (head + skip + need - shm->min_cursor > hdr->size) {
+		shm_min_cursor(shm, head);
+
+		if (head + skip + need - shm->min_cursor > hdr->size) {
+			hdr->dropped++;
+			return -1;
+		}
+	}
+
+	if (skip) {
+		*(uint32_t *)(shm->ring + pos) = SHM_PAD;
+		head += skip;
+		pos = 0;
+	}
+
+	memcpy(shm->ring + pos, &msg_len, sizeof(msg_len));
+	memcpy(shm->ring + pos + SHM_MSG_HLEN, data, len);
+
+	hdr->published++;
+	__atomic_store_n(&hdr->head, head + need, __ATOMIC_RELEASE);
+
+	// Pairs with the increment of waiters by a consumer going to sleep
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (unlikely(__atomic_load_n(&hdr->waiters, __ATOMIC_RELAXED) > 0)) {
+		__atomic_add_fetch(&hdr->futex, 1, __ATOMIC_RELEASE);
+		shm_futex(&hdr->futex, FUTEX_WAKE, INT32_MAX, NULL);
+	}
+
+	return 0;
+}
+
+int mgmon_shm_attach(struct mgmon_shm *shm)
+{
+	struct shm_consumer *c;
+	int32_t free_pid;
+	int i;
+
+	if (shm->slot >= 0)
+		return shm->slot;
+
+	for (i = 0; i < MGMON_SHM_MAX_CONSUMERS; i++) {
+		c = &shm->hdr->consumers[i];
+		free_pid = 0;
+
+		if (__atomic_compare_exchange_n(&c->pid, &free_pid, getpid(), 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			/* Start from the current head, as a new member of a multicast
+			 * group. Until the cursor is set, the producer sees the one of the
+			 * previous owner, which can only make it drop messages. */
+			shm->cursor = __atomic_load_n(&shm->hdr->head, __ATOMIC_ACQUIRE);
+			__atomic_store_n(&c->cursor, shm->cursor, __ATOMIC_RELEASE);
+			shm->slot = i;
+			shm->pending = 0;
+			return i;
+		}
+	}
+
+	printf("[MgMON] No free consumer slots in the shared memory channel\n");
+
+	return -1;
+}
+
+/**
+ * Waits for the head of the ring to move past the cursor.
+ * @return 0 if it moved, -1 on timeout.
+ */
+static int shm_wait(struct mgmon_shm *shm, uint64_t timeout_ns)
+{
+	struct shm_header *hdr = shm->hdr;
+	struct timespec ts;
+	uint32_t seen;
+	int i;
+
+	if (timeout_ns == 0)
+		return -1;
+
+	for (i = 0; i < SHM_SPIN; i++) {
+		if (__atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE) != shm->cursor)
+			return 0;
+
+		__builtin_ia32_pause();
+	}
+
+	ts.tv_sec = timeout_ns / 1000000000ULL;
+	ts.tv_nsec = timeout_ns % 1000000000ULL;
+
+	__atomic_add_fetch(&hdr->waiters, 1, __ATOMIC_SEQ_CST);
+	seen = __atomic_load_n(&hdr->futex, __ATOMIC_ACQUIRE);
+
+	if (__atomic_load_n(&hdr->head, __ATOMIC_SEQ_CST) == shm->cursor)
+		shm_futex(&hdr->futex, FUTEX_WAIT, seen, &ts);
+
+	__atomic_sub_fetch(&hdr->waiters, 1, __ATOMIC_RELEASE);
+
+	return __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE) != shm->cursor ? 0 : -1;
+}
+
+const uint8_t *mgmon_shm_next(struct mgmon_shm *shm, uint64_t timeout_ns, size_t *len)
+{
+	struct shm_header *hdr = shm->hdr;
+	uint64_t head, pos;
+	uint32_t msg_len;
+
+	if (shm->slot < 0 && mgmon_shm_attach(shm) < 0)
+		return NULL;
+
+	// Release the previous message
+	if (shm->pending) {
+		shm->cursor += shm->pending;
+		shm->pending = 0;
+		__atomic_store_n(&hdr->consumers[shm->slot].cursor, shm->cursor, __ATOMIC_RELEASE);
+	}
+
+	while (1) {
+		head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+
+		if (head == shm->cursor) {
+			if (shm_wait(shm, timeout_ns) < 0)
+				return NULL;
+
+			continue;
+		}
+
+		// The producer restarted the ring, or this slot was taken as dead
+		if (unlikely(head < shm->cursor || head - shm->cursor > hdr->size ||
+					 __atomic_load_n(&hdr->consumers[shm->slot].pid, __ATOMIC_ACQUIRE) != getpid())) {
+			shm->slot = -1;
+
+			if (mgmon_shm_attach(shm) < 0)
+				return NULL;
+
+			continue;
+		}
+
+		pos = shm->cursor & shm->mask;
+		memcpy(&msg_len, shm->ring + pos, sizeof(msg_len));
+
+		if (msg_len == SHM_PAD) {
+			shm->cursor += hdr->size - pos;
+			__atomic_store_n(&hdr->consumers[shm->slot].cursor, shm->cursor, __ATOMIC_RELEASE);
+			continue;
+		}
+
+		shm->pending = SHM_MSG_HLEN + SHM_ALIGN(msg_len);
+		shm->consumed++;
+		*len = msg_len;
+
+		return shm->ring + pos + SHM_MSG_HLEN;
+	}
+}
+
+void mgmon_shm_get_stats(struct mgmon_shm *shm, struct mgmon_shm_stats *stats)
+{
+	int i;
+
+	stats->published = shm->hdr->published;
+	stats->dropped = shm->hdr->dropped;
+	stats->consumed = shm->consumed;
+	stats->consumers = 0;
+
+	for (i = 0; i < MGMON_SHM_MAX_CONSUMERS; i++)
+		stats->consumers += shm->hdr->consumers[i].pid != 0;
+}
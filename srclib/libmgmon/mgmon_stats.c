@@ -0,0 +1,446 @@
+/**
+ * @brief Traffic statistics with multi-resolution rollups.
+ *
+ * The frames are only accounted in the current 1 ms interval: an add to the
+ * bytes and frames and an increment of a size class. When a frame falls out
+ * of the interval, it is closed: copied to the history ring of its resolution
+ * and merged into the current interval of the next one, which is closed in
+ * the same way when the interval below reaches its end. So the cost of the
+ * rollups is paid once per millisecond, not per frame.
+ *
+ * Every history ring has a single writer, the thread that accounts the
+ * frames, which writes a closed interval in its slot and then advances the
+ * head of the ring. Readers copy the slots they want and check the head again
+ * afterwards: the slots that may have been overwritten while they were copied
+ * are discarded, so they never block the writer nor see torn intervals.
+ *
+ * Idle intervals are closed with no traffic, so the history has no holes.
+ * After a gap of more than an interval of the lowest resolution (1 min) in the
+ * timestamps, the intervals are started again at the new time instead.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <hpcap.h>
+
+#include "libmgmon.h"
+
+#define STATS_BATCH 128		/**< Frames read from HPCAP for every call to mgmon_stats_burst */
+#define STATS_TIMEOUT (1000000000ULL)	/**< Time the loop waits for frames before closing intervals with the system clock */
+
+static const uint64_t stats_period[MGMON_STATS_LEVELS] = { 1000000ULL, 1000000000ULL, 60000000000ULL };
+static const size_t stats_history[MGMON_STATS_LEVELS] = {
+	MGMON_STATS_1MS_HISTORY, MGMON_STATS_1S_HISTORY, MGMON_STATS_1MIN_HISTORY
+};
+
+struct stats_level {
+	struct mgmon_stats_bin cur;		/**< Interval being accumulated */
+	volatile uint64_t head;			/**< Intervals closed */
+	uint64_t mask;
+	struct mgmon_stats_bin *ring;
+};
+
+struct mgmon_stats {
+	uint64_t start;		/**< Start of the current 1 ms interval */
+	short started;
+	uint64_t flows;		/**< Last number of flows reported */
+
+	struct stats_level levels[MGMON_STATS_LEVELS];
+
+	int level;			/**< Resolution that is published */
+	mrtg_handler callback;
+	void *arg;
+
+	// Channel of the published intervals
+	int sd;
+	struct sockaddr_in addr;
+	struct mgmon_shm *shm;
+};
+
+/**
+ * Size class of a frame: log2 of its length in units of 64 bytes, rounded up.
+ */
+static inline unsigned int stats_size_class(uint16_t len)
+{
+	uint64_t units = ((uint32_t) len - 1) >> 6;
+	unsigned int c = 63 - __builtin_clzll((units << 1) | 1);
+
+	return minimo(c, MGMON_STATS_SIZE_CLASSES - 1);
+}
+
+static inline void stats_start(struct stats_level *lv, uint64_t timestamp, uint64_t flows)
+{
+	memset(&lv->cur, 0, sizeof(struct mgmon_stats_bin));
+	lv->cur.timestamp = timestamp;
+	lv->cur.flows = flows;
+}
+
+static void stats_merge(struct mgmon_stats_bin *dst, const struct mgmon_stats_bin *src)
+{
+	int i;
+
+	dst->bytes += src->bytes;
+	dst->packets += src->packets;
+	dst->flows = maximo(dst->flows, src->flows);
+
+	for (i = 0; i < MGMON_STATS_SIZE_CLASSES; i++)
+		dst->sizes[i] += src->sizes[i];
+}
+
+static void stats_publish(struct mgmon_stats *s, const struct mgmon_stats_bin *bin)
+{
+	mrtg m;
+
+	m.bytes = bin->bytes;
+	m.packets = bin->packets;
+	m.concurrent_flows = bin->flows;
+	m.timestamp = bin->timestamp;
+
+	if (s->callback)
+		s->callback(&m, s->arg);
+
+	if (s->shm)
+		mgmon_shm_publish(s->shm, &m, sizeof(mrtg));
+	else if (s->sd)
+		sendto(s->sd, &m, sizeof(mrtg), 0, (struct sockaddr *) &s->addr, sizeof(s->addr));
+}
+
+/**
+ * Stores the current interval of a resolution in its history, merges it into
+ * the next resolution and starts the next interval.
+ */
+static void stats_close(struct mgmon_stats *s, int l)
+{
+	struct stats_level *lv = &s->levels[l];
+	uint64_t head = lv->head;
+
+	lv->ring[head & lv->mask] = lv->cur;
+	__atomic_store_n(&lv->head, head + 1, __ATOMIC_RELEASE);
+
+	if (l == s->level)
+		stats_publish(s, &lv->cur);
+
+	if (l + 1 < MGMON_STATS_LEVELS)
+		stats_merge(&s->levels[l + 1].cur, &lv->cur);
+
+	stats_start(lv, lv->cur.timestamp + stats_period[l], s->flows);
+}
+
+/**
+ * Closes the current intervals, if any, and starts new ones at ts.
+ */
+static void stats_restart(struct mgmon_stats *s, uint64_t ts)
+{
+	int l;
+
+	for (l = 0; s->started && l < MGMON_STATS_LEVELS; l++)
+		stats_close(s, l);
+
+	for (l = 0; l < MGMON_STATS_LEVELS; l++)
+		stats_start(&s->levels[l], ts - ts % stats_period[l], s->flows);
+
+	s->start = s->levels[0].cur.timestamp;
+	s->started = 1;
+}
+
+/**
+ * Called when ts is not in the current 1 ms interval.
+ */
+static void stats_roll(struct mgmon_stats *s, uint64_t ts)
+{
+	const uint64_t top = stats_period[MGMON_STATS_LEVELS - 1];
+	int l;
+
+	if (!s->started || (ts > s->start && ts - s->start >= top) || (ts < s->start && s->start - ts >= top)) {
+		stats_restart(s, ts);
+		return;
+	}
+
+	// Late frames, within the limit, go to the current interval
+	if (ts < s->start)
+		return;
+
+	while (ts - s->levels[0].cur.timestamp >= stats_period[0]) {
+		stats_close(s, 0);
+
+		for (l = 1; l < MGMON_STATS_LEVELS; l++) {
+			if (s->levels[l - 1].cur.timestamp - s->levels[l].cur.timestamp < stats_period[l])
+				break;
+
+			stats_close(s, l);
+		}
+	}
+
+	s->start = s->levels[0].cur.timestamp;
+}
+
+struct mgmon_stats *mgmon_stats_create(int level, mrtg_handler callback, void *arg)
+{
+	struct mgmon_stats *s;
+	int l;
+
+	if (level < 0 || level >= MGMON_STATS_LEVELS)
+		return NULL;
+
+	s = calloc(1, sizeof(struct mgmon_stats));
+
+	if (s == NULL)
+		return NULL;
+
+	for (l = 0; l < MGMON_STATS_LEVELS; l++) {
+		s->levels[l].ring = calloc(stats_history[l], sizeof(struct mgmon_stats_bin));
+		s->levels[l].mask = stats_history[l] - 1;
+
+		if (s->levels[l].ring == NULL) {
+			printf("[MgMON] Cannot allocate the statistics history\n");
+			mgmon_stats_destroy(s);
+			return NULL;
+		}
+	}
+
+	s->level = level;
+	s->callback = callback;
+	s->arg = arg;
+
+	return s;
+}
+
+void mgmon_stats_destroy(struct mgmon_stats *s)
+{
+	int l;
+
+	if (s == NULL)
+		return;
+
+	for (l = 0; l < MGMON_STATS_LEVELS; l++)
+		free(s->levels[l].ring);
+
+	if (s->shm)
+		mgmon_shm_close(s->shm);
+	else if (s->sd)
+		close(s->sd);
+
+	free(s);
+}
+
+int mgmon_stats_export(struct mgmon_stats *s, int ifindex, int qindex)
+{
+	if (mgmon_get_transport() == MGMON_TRANSPORT_SHM) {
+		s->shm = mgmon_shm_open(MCAST_MRTG, ifindex, qindex, 0);
+		return s->shm ? 0 : -1;
+	}
+
+	s->sd = open_multicast_tx_socket(MCAST_MRTG, ifindex, qindex, &s->addr);
+
+	return s->sd ? 0 : -1;
+}
+
+void mgmon_stats_packet(struct mgmon_stats *s, uint64_t ts, uint16_t len)
+{
+	struct mgmon_stats_bin *cur = &s->levels[0].cur;
+
+	if (unlikely(ts - s->start >= stats_period[0]))
+		stats_roll(s, ts);
+
+	cur->bytes += len;
+	cur->packets++;
+	cur->sizes[stats_size_class(len)]++;
+}
+
+void mgmon_stats_burst(struct mgmon_stats *s, const struct mgmon_flow_pkt *pkts, size_t count)
+{
+	struct mgmon_stats_bin *cur = &s->levels[0].cur;
+	uint64_t bytes = 0, start = 0;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (unlikely(pkts[i].ts - s->start >= stats_period[0])) {
+			cur->bytes += bytes;
+			cur->packets += i - start;
+			bytes = 0;
+			start = i;
+			stats_roll(s, pkts[i].ts);
+		}
+
+		bytes += pkts[i].len;
+		cur->sizes[stats_size_class(pkts[i].len)]++;
+	}
+
+	cur->bytes += bytes;
+	cur->packets += count - start;
+}
+
+void mgmon_stats_advance(struct mgmon_stats *s, uint64_t now)
+{
+	if (s->started && now > s->start && now - s->start >= stats_period[0])
+		stats_roll(s, now);
+}
+
+void mgmon_stats_set_flows(struct mgmon_stats *s, uint64_t flows)
+{
+	struct mgmon_stats_bin *cur = &s->levels[0].cur;
+
+	s->flows = flows;
+	cur->flows = maximo(cur->flows, flows);
+}
+
+size_t mgmon_stats_query(struct mgmon_stats *s, int level, uint64_t from, uint64_t to, struct mgmon_stats_bin *bins, size_t max)
+{
+	struct stats_level *lv;
+	uint64_t head, first, idx, valid;
+	size_t n = 0, i;
+	struct mgmon_stats_bin tmp;
+
+	if (level < 0 || level >= MGMON_STATS_LEVELS || max == 0)
+		return 0;
+
+	lv = &s->levels[level];
+	head = __atomic_load_n(&lv->head, __ATOMIC_ACQUIRE);
+	first = head > lv->mask ? head - lv->mask : 0;
+
+	// From the newest to the oldest, so the latest ones are kept if they do not fit
+	for (idx = head; idx > first && n < max; idx--) {
+		bins[n] = lv->ring[(idx - 1) & lv->mask];
+
+		if (bins[n].timestamp >= to)
+			continue;
+
+		if (bins[n].timestamp < from)
+			break;
+
+		if (n == 0)
+			head = idx;
+
+		n++;
+	}
+
+	/* The writer may have overwritten the oldest slots while they were being
+	 * copied: slot of interval i is rewritten with interval i + size, and the
+	 * one being written now is the slot of the head. */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	valid = __atomic_load_n(&lv->head, __ATOMIC_ACQUIRE);
+	valid = valid > lv->mask ? valid - lv->mask : 0;
+
+	// bins[i] is interval head - 1 - i
+	while (n > 0 && head - n < valid)
+		n--;
+
+	for (i = 0; i < n / 2; i++) {
+		tmp = bins[i];
+		bins[i] = bins[n - 1 - i];
+		bins[n - 1 - i] = tmp;
+	}
+
+	return n;
+}
+
+static void stats_read_header(void *header, u32 secs, u32 nsecs, u16 len, u16 caplen)
+{
+	struct mgmon_flow_pkt *pkt = header;
+
+	pkt->ts = ((uint64_t) secs) * 1000000000ULL + nsecs;
+	pkt->len = len;
+	pkt->caplen = caplen;
+}
+
+int mgmon_stats_loop(int cpu, int ifindex, int qindex)
+{
+	struct hpcap_handle hp;
+	struct mgmon_stats *s;
+	struct mgmon_flow_pkt pkts[STATS_BATCH];
+	static u_char auxbuf[MAX_PACKET_SIZE];
+	struct timespec now;
+	u_char *bp;
+	size_t count;
+	pthread_t tid, sigtid;
+	cpu_set_t mask;
+	mgmon_signal ms;
+	int ret;
+
+	tid = pthread_self();
+
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	ret = pthread_setaffinity_np(tid, sizeof(cpu_set_t), &mask);
+
+	if (ret < 0) {
+		printf("[MgMON] Error when attaching thread to CPU %d\n", cpu);
+		return -1;
+	}
+
+	s = mgmon_stats_create(MGMON_STATS_1S, NULL, NULL);
+
+	if (s == NULL)
+		return -1;
+
+	if (mgmon_stats_export(s, ifindex, qindex) < 0) {
+		mgmon_stats_destroy(s);
+		return -1;
+	}
+
+	ret = hpcap_open(&hp, ifindex, qindex);
+
+	if (ret != HPCAP_OK) {
+		printf("[MgMON] Error when opening interface hpcap%dq%d\n", ifindex, qindex);
+		mgmon_stats_destroy(s);
+		return -1;
+	}
+
+	ret = hpcap_map(&hp);
+
+	if (ret != HPCAP_OK) {
+		printf("[MgMON] Error when mapping interface hpcap%dq%d\n", ifindex, qindex);
+		hpcap_close(&hp);
+		mgmon_stats_destroy(s);
+		return -1;
+	}
+
+	ms.stop = 0;
+	sigemptyset(&ms.signal_mask);
+	sigaddset(&ms.signal_mask, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &ms.signal_mask, NULL);
+	ret = pthread_create(&sigtid, NULL, mgmon_signal_thread, &ms);
+
+	if (ret != 0) {
+		printf("[MgMON] Error when creating signal watchdog thread\n");
+		return -1;
+	}
+
+	pthread_setaffinity_np(sigtid, sizeof(cpu_set_t), &mask);
+
+	while (!ms.stop) {
+		hpcap_ack_wait_timeout(&hp, 1, STATS_TIMEOUT);
+
+		if (hp.acks >= hp.avail) {
+			// No traffic: close the intervals with the system clock.
+			clock_gettime(CLOCK_REALTIME, &now);
+			mgmon_stats_advance(s, now.tv_sec * 1000000000ULL + now.tv_nsec);
+			continue;
+		}
+
+		while (hp.acks < hp.avail) {
+			// Only the headers are used, so every frame can share the auxiliary buffer
+			for (count = 0; count < STATS_BATCH && hp.acks < hp.avail;) {
+				hpcap_read_packet(&hp, &bp, auxbuf, &pkts[count], stats_read_header);
+
+				if (bp)
+					count++;
+			}
+
+			mgmon_stats_burst(s, pkts, count);
+		}
+	}
+
+	printf("[MgMON] stopping statistics for hpcap%dq%d\n", ifindex, qindex);
+	pthread_join(sigtid, NULL);
+	hpcap_ack(&hp);
+
+	mgmon_stats_destroy(s);
+
+	hpcap_unmap(&hp);
+	hpcap_close(&hp);
+
+	return 0;
+}
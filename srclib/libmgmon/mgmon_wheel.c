@@ -0,0 +1,327 @@
+/**
+ * @brief Hierarchical timing wheel.
+ *
+ * MGMON_WHEEL_LEVELS levels. A slot of level l spans 2^(MGMON_WHEEL_BITS * l)
+ * ticks, and a turn of level l (2^MGMON_WHEEL_BITS slots) spans one slot of
+ * level l + 1. Every level keeps the slots of its current turn and of the next
+ * one, and a timer is stored in the lowest level whose current or next turn
+ * contains its expiration tick. Timers only fire from level 0.
+ *
+ * Upper levels move their timers to the lower ones before their slot starts.
+ * Instead of moving the whole slot when the lower level completes a turn,
+ * which makes the wheel stall for as long as it takes to move all the timers
+ * that expire in the next turn, the next slot of every level is drained a bit
+ * in every tick of the current turn of the level below. Every tick does a
+ * bounded amount of work and every timer is moved at most
+ * MGMON_WHEEL_LEVELS - 1 times before it fires.
+ *
+ * Timers are identified by an index in [0, max_timers) and linked in their
+ * slots by index, so the wheel does not allocate memory after its creation.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include <hpcap.h>
+
+#include "libmgmon.h"
+
+#define WHEEL_TURN (1 << MGMON_WHEEL_BITS)	/**< Slots in a turn */
+#define WHEEL_ARRAY (2 * WHEEL_TURN)		/**< Slots kept per level: current and next turn */
+#define WHEEL_MASK (WHEEL_ARRAY - 1)
+#define WHEEL_WORDS (WHEEL_ARRAY / 64)
+#define WHEEL_SHIFT(level) (MGMON_WHEEL_BITS * (level))
+
+#define WHEEL_NONE UINT32_MAX
+#define WHEEL_IDLE UINT16_MAX	/**< Slot of a timer that is not scheduled */
+#define WHEEL_FIRING (MGMON_WHEEL_LEVELS * WHEEL_ARRAY)	/**< Slot of the timers being fired */
+
+struct wheel_node {
+	uint32_t next;
+	uint32_t prev;
+	uint64_t expires;	/**< Expiration tick */
+	uint16_t slot;		/**< level * WHEEL_ARRAY + index, WHEEL_IDLE if not scheduled */
+};
+
+struct mgmon_wheel {
+	struct wheel_node *nodes;
+	size_t max_timers;
+	size_t count;
+
+	uint64_t tick;	/**< Next tick to process. All the previous ones have fired. */
+	unsigned int tick_shift;
+
+	uint32_t heads[MGMON_WHEEL_LEVELS * WHEEL_ARRAY + 1];
+	uint32_t counts[MGMON_WHEEL_LEVELS * WHEEL_ARRAY];
+	uint64_t used[WHEEL_WORDS];	/**< Non empty slots of level 0 */
+
+	wheel_handler callback;
+	void *arg;
+};
+
+/**
+ * @return Lowest level whose current or next turn contains the expiration.
+ * Expirations beyond the last level are brought forward to its limit.
+ */
+static inline unsigned int wheel_level(struct mgmon_wheel *w, uint64_t *expires)
+{
+	unsigned int level;
+
+	for (level = 0; level < MGMON_WHEEL_LEVELS; level++) {
+		if ((*expires >> WHEEL_SHIFT(level + 1)) <= (w->tick >> WHEEL_SHIFT(level + 1)) + 1)
+			return level;
+	}
+
+	*expires = (((w->tick >> WHEEL_SHIFT(MGMON_WHEEL_LEVELS)) + 2) << WHEEL_SHIFT(MGMON_WHEEL_LEVELS)) - 1;
+
+	return MGMON_WHEEL_LEVELS - 1;
+}
+
+static inline void wheel_link(struct mgmon_wheel *w, uint32_t id, uint64_t expires)
+{
+	struct wheel_node *node = &w->nodes[id];
+	unsigned int level, idx, slot;
+
+	if (expires < w->tick)
+		expires = w->tick;
+
+	level = wheel_level(w, &expires);
+	idx = (expires >> WHEEL_SHIFT(level)) & WHEEL_MASK;
+	slot = level * WHEEL_ARRAY + idx;
+
+	node->expires = expires;
+	node->slot = slot;
+	node->prev = WHEEL_NONE;
+	node->next = w->heads[slot];
+
+	if (node->next != WHEEL_NONE)
+		w->nodes[node->next].prev = id;
+
+	w->heads[slot] = id;
+	w->counts[slot]++;
+
+	if (level == 0)
+		w->used[idx / 64] |= 1ULL << (idx % 64);
+}
+
+static inline void wheel_unlink(struct mgmon_wheel *w, uint32_t id)
+{
+	struct wheel_node *node = &w->nodes[id];
+	unsigned int slot = node->slot;
+
+	if (node->prev != WHEEL_NONE)
+		w->nodes[node->prev].next = node->next;
+	else
+		w->heads[slot] = node->next;
+
+	if (node->next != WHEEL_NONE)
+		w->nodes[node->next].prev = node->prev;
+
+	node->slot = WHEEL_IDLE;
+
+	if (slot == WHEEL_FIRING)
+		return;
+
+	w->counts[slot]--;
+
+	if (slot < WHEEL_ARRAY && w->heads[slot] == WHEEL_NONE)
+		w->used[slot / 64] &= ~(1ULL << (slot % 64));
+}
+
+/**
+ * Moves up to count timers of a slot of an upper level to the lower ones.
+ */
+static void wheel_drain(struct mgmon_wheel *w, unsigned int slot, size_t count)
+{
+	uint32_t id;
+
+	for (; count > 0 && (id = w->heads[slot]) != WHEEL_NONE; count--) {
+		wheel_unlink(w, id);
+		wheel_link(w, id, w->nodes[id].expires);
+	}
+}
+
+/**
+ * Drains the upper levels for the current tick.
+ * @return 1 if some upper level still has timers to move in this turn.
+ */
+static short wheel_cascade(struct mgmon_wheel *w)
+{
+	unsigned int level, cur, next;
+	uint64_t span, left;
+	short pending = 0;
+
+	for (level = MGMON_WHEEL_LEVELS - 1; level > 0; level--) {
+		span = 1ULL << WHEEL_SHIFT(level);
+		cur = level * WHEEL_ARRAY + ((w->tick >> WHEEL_SHIFT(level)) & WHEEL_MASK);
+		next = level * WHEEL_ARRAY + (((w->tick >> WHEEL_SHIFT(level)) + 1) & WHEEL_MASK);
+
+		// Only when the wheel jumped over ticks: the slot should be empty by now
+		if (unlikely(w->counts[cur] > 0))
+			wheel_drain(w, cur, w->counts[cur]);
+
+		if (w->counts[next] > 0) {
+			// Spread the slot over the ticks left before it starts
+			left = span - (w->tick & (span - 1));
+			wheel_drain(w, next, (w->counts[next] + left - 1) / left);
+			pending |= w->counts[next] > 0;
+		}
+	}
+
+	return pending;
+}
+
+/**
+ * Index of the first non empty slot of level 0 in [idx, end), or end if
+ * there is none.
+ */
+static inline unsigned int wheel_next_used(struct mgmon_wheel *w, unsigned int idx, unsigned int end)
+{
+	unsigned int word = idx / 64;
+	uint64_t bits;
+
+	if (idx >= end)
+		return end;
+
+	bits = w->used[word] & (~0ULL << (idx % 64));
+
+	while (!bits) {
+		if (++word * 64 >= end)
+			return end;
+
+		bits = w->used[word];
+	}
+
+	return minimo(word * 64 + __builtin_ctzll(bits), end);
+}
+
+struct mgmon_wheel *mgmon_wheel_create(size_t max_timers, unsigned int tick_shift, wheel_handler callback, void *arg)
+{
+	struct mgmon_wheel *w;
+	size_t i;
+
+	if (max_timers == 0 || max_timers >= WHEEL_NONE || tick_shift >= 64)
+		return NULL;
+
+	w = calloc(1, sizeof(struct mgmon_wheel));
+
+	if (w == NULL)
+		return NULL;
+
+	w->nodes = malloc(max_timers * sizeof(struct wheel_node));
+
+	if (w->nodes == NULL) {
+		printf("[MgMON] Cannot allocate a timing wheel of %zu timers\n", max_timers);
+		free(w);
+		return NULL;
+	}
+
+	for (i = 0; i < max_timers; i++)
+		w->nodes[i].slot = WHEEL_IDLE;
+
+	memset(w->heads, 0xFF, sizeof(w->heads));
+
+	w->max_timers = max_timers;
+	w->tick_shift = tick_shift;
+	w->callback = callback;
+	w->arg = arg;
+
+	return w;
+}
+
+void mgmon_wheel_destroy(struct mgmon_wheel *w)
+{
+	if (w == NULL)
+		return;
+
+	free(w->nodes);
+	free(w);
+}
+
+void mgmon_wheel_schedule(struct mgmon_wheel *w, uint32_t id, uint64_t expires)
+{
+	if (w->nodes[id].slot != WHEEL_IDLE)
+		wheel_unlink(w, id);
+	else
+		w->count++;
+
+	// Without a previous mgmon_wheel_advance, the first timer sets the clock
+	if (unlikely(w->tick == 0))
+		w->tick = expires >> w->tick_shift;
+
+	wheel_link(w, id, expires >> w->tick_shift);
+}
+
+void mgmon_wheel_cancel(struct mgmon_wheel *w, uint32_t id)
+{
+	if (w->nodes[id].slot == WHEEL_IDLE)
+		return;
+
+	wheel_unlink(w, id);
+	w->count--;
+}
+
+short mgmon_wheel_pending(struct mgmon_wheel *w, uint32_t id)
+{
+	return w->nodes[id].slot != WHEEL_IDLE;
+}
+
+size_t mgmon_wheel_advance(struct mgmon_wheel *w, uint64_t now)
+{
+	uint64_t target = now >> w->tick_shift;
+	unsigned int idx, end;
+	uint32_t id;
+	size_t fired = 0;
+	short pending;
+
+	while (w->tick <= target) {
+		if (w->count == 0) {
+			w->tick = target + 1;
+			break;
+		}
+
+		pending = wheel_cascade(w);
+		idx = w->tick & WHEEL_MASK;
+
+		if (w->heads[idx] == WHEEL_NONE) {
+			if (pending) {
+				w->tick++;
+				continue;
+			}
+
+			// Nothing to move: jump to the next timer of this turn, or to the next turn
+			end = (idx | (WHEEL_TURN - 1)) + 1;
+			w->tick = minimo(w->tick + (wheel_next_used(w, idx + 1, end) - idx), target + 1);
+			continue;
+		}
+
+		/* The callbacks can schedule and cancel timers, even the ones of this
+		 * slot, so they are kept in a separate list while they fire. */
+		w->heads[WHEEL_FIRING] = w->heads[idx];
+		w->heads[idx] = WHEEL_NONE;
+		w->counts[idx] = 0;
+		w->used[idx / 64] &= ~(1ULL << (idx % 64));
+
+		for (id = w->heads[WHEEL_FIRING]; id != WHEEL_NONE; id = w->nodes[id].next)
+			w->nodes[id].slot = WHEEL_FIRING;
+
+		// Timers scheduled from the callbacks for this tick go to the next one
+		w->tick++;
+
+		while ((id = w->heads[WHEEL_FIRING]) != WHEEL_NONE) {
+			wheel_unlink(w, id);
+			w->count--;
+			fired++;
+
+			if (w->callback)
+				w->callback(id, w->arg);
+		}
+	}
+
+	return fired;
+}
+
+size_t mgmon_wheel_count(struct mgmon_wheel *w)
+{
+	return w->count;
+}